@@ -0,0 +1,206 @@
+#include "AllocTracker.h"
+
+#ifdef SHAPE_ALLOC_TRACKING
+
+#include <opencv2/opencv.hpp>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <unwind.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "Log.h"
+
+using namespace cv;
+
+// Plain data, so touching them from operator new needs no initialization
+static thread_local uint64_t threadAllocations;
+static thread_local uint64_t threadBytes;
+static thread_local const char* threadStrictZone;
+static thread_local bool reporting;
+
+const char* AllocTracker::zoneName(Zone zone){
+   static const char* names[Zones] = { "ingest", "heights", "segment", "classify", "output" };
+   return zone >= 0 && zone < Zones ? names[zone] : "?";
+}
+
+// Mat buffers come from OpenCV's own allocator, with malloc, past operator
+// new; this one counts them and leaves the work to the standard allocator,
+// which also frees them
+class CountingMatAllocator : public MatAllocator {
+public:
+   UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                      UMatUsageFlags usageFlags) const{
+      UMatData* u = Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+      if(u && !data) AllocTracker::count(u->size);
+      return u;
+   }
+   bool allocate(UMatData* u, int accessFlags, UMatUsageFlags usageFlags) const{
+      return Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+   }
+   void deallocate(UMatData* u) const{
+      Mat::getStdAllocator()->deallocate(u);
+   }
+};
+
+AllocTracker::AllocTracker(){
+   reset();
+   static CountingMatAllocator matAllocator;
+   Mat::setDefaultAllocator(&matAllocator);
+}
+
+AllocTracker& AllocTracker::shared(){
+   static AllocTracker tracker;
+   return tracker;
+}
+
+struct Backtrace {
+   void* frames[24];
+   int count = 0;
+};
+
+static _Unwind_Reason_Code unwindFrame(_Unwind_Context* context, void* arg){
+   Backtrace* trace = (Backtrace*)arg;
+   void* pc = (void*)_Unwind_GetIP(context);
+   if(pc) trace->frames[trace->count++] = pc;
+   return trace->count < 24 ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+// The stack of an allocation in a strict zone, then abort
+static void reportAllocation(size_t bytes){
+   reporting = true;
+   LOGE("Allocation of %zu bytes in the steady %s zone", bytes, threadStrictZone);
+   Backtrace trace;
+   _Unwind_Backtrace(unwindFrame, &trace);
+   for(int i = 0; i < trace.count; i++){
+      Dl_info info;
+      if(!dladdr(trace.frames[i], &info) || !info.dli_fname){
+         LOGE("  #%02d %p", i, trace.frames[i]);
+         continue;
+      }
+      int status = -1;
+      char* name = info.dli_sname ? abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status) : NULL;
+      const char* symbol = status == 0 ? name : info.dli_sname ? info.dli_sname : "?";
+      void* base = info.dli_sname ? info.dli_saddr : info.dli_fbase;
+      LOGE("  #%02d %s+%#lx (%s)", i, symbol, (unsigned long)((char*)trace.frames[i] - (char*)base), info.dli_fname);
+      free(name);
+   }
+   abort();
+}
+
+void AllocTracker::count(size_t bytes){
+   threadAllocations++;
+   threadBytes += bytes;
+   if(threadStrictZone && !reporting) reportAllocation(bytes);
+}
+
+AllocTracker::Counts AllocTracker::threadCounts(){
+   Counts counts;
+   counts.allocations = threadAllocations;
+   counts.bytes = threadBytes;
+   return counts;
+}
+
+void AllocTracker::addThreadCounts(const Counts& counts){
+   threadAllocations += counts.allocations;
+   threadBytes += counts.bytes;
+}
+
+const char* AllocTracker::currentZone(){
+   return threadStrictZone;
+}
+
+const char* AllocTracker::enterZone(const char* strictZone){
+   const char* outer = threadStrictZone;
+   threadStrictZone = strictZone;
+   return outer;
+}
+
+void AllocTracker::add(Zone zone, const Counts& begin, const Counts& end){
+   uint64_t n = end.allocations - begin.allocations;
+   samples[zone]++;
+   allocations[zone] += n;
+   bytes[zone] += end.bytes - begin.bytes;
+   uint64_t most = peak[zone].load();
+   while(n > most && !peak[zone].compare_exchange_weak(most, n)) {}
+}
+
+void AllocTracker::countJavaArray(size_t size){
+   javaArrays++;
+   javaBytes += size;
+}
+
+void AllocTracker::countLocalRefs(int delta){
+   int64_t live = localRefs += delta;
+   int64_t most = peakLocalRefs.load();
+   while(live > most && !peakLocalRefs.compare_exchange_weak(most, live)) {}
+}
+
+string AllocTracker::report() const{
+   string text;
+   char line[128];
+   for(int z = 0; z < Zones; z++){
+      uint64_t n = samples[z].load();
+      if(n == 0) continue;
+      snprintf(line, sizeof(line), "%-10s %8llu x %8.1f allocations %10.0f bytes, most %llu\n", zoneName((Zone)z),
+               (unsigned long long)n, (double)allocations[z].load() / n, (double)bytes[z].load() / n,
+               (unsigned long long)peak[z].load());
+      text += line;
+   }
+   uint64_t frames = max<uint64_t>(samples[Output].load(), 1);
+   snprintf(line, sizeof(line), "java: %.2f arrays %.0f bytes per frame, %lld local refs held, most %lld\n",
+            (double)javaArrays.load() / frames, (double)javaBytes.load() / frames, (long long)localRefs.load(),
+            (long long)peakLocalRefs.load());
+   return text + line;
+}
+
+void AllocTracker::reset(){
+   for(int z = 0; z < Zones; z++){
+      samples[z] = 0;
+      allocations[z] = 0;
+      bytes[z] = 0;
+      peak[z] = 0;
+   }
+   javaArrays = 0;
+   javaBytes = 0;
+   peakLocalRefs = localRefs.load();
+}
+
+// Every C++ allocation of the process goes through these
+void* operator new(size_t size){
+   AllocTracker::count(size);
+   void* p = malloc(size ? size : 1);
+   if(!p) throw bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size){
+   return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept{
+   AllocTracker::count(size);
+   return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept{
+   return operator new(size, nothrow);
+}
+
+void operator delete(void* p) noexcept{
+   free(p);
+}
+
+void operator delete[](void* p) noexcept{
+   free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept{
+   free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept{
+   free(p);
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "BitMask.h"
+#include "ContourTracer.h"
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BITMASK_SIMD 1
+#define BITMASK_NEON 1
+typedef uint64x2_t word2;
+static inline word2 load2(const uint64_t* p){ return vld1q_u64(p); }
+static inline void store2(uint64_t* p, word2 v){ vst1q_u64(p, v); }
+static inline word2 and2(word2 a, word2 b){ return vandq_u64(a, b); }
+static inline word2 or2(word2 a, word2 b){ return vorrq_u64(a, b); }
+static inline word2 shl1(word2 a){ return vshlq_n_u64(a, 1); }
+static inline word2 shr1(word2 a){ return vshrq_n_u64(a, 1); }
+static inline word2 shl63(word2 a){ return vshlq_n_u64(a, 63); }
+static inline word2 shr63(word2 a){ return vshrq_n_u64(a, 63); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BITMASK_SIMD 1
+typedef __m128i word2;
+static inline word2 load2(const uint64_t* p){ return _mm_loadu_si128((const __m128i*)p); }
+static inline void store2(uint64_t* p, word2 v){ _mm_storeu_si128((__m128i*)p, v); }
+static inline word2 and2(word2 a, word2 b){ return _mm_and_si128(a, b); }
+static inline word2 or2(word2 a, word2 b){ return _mm_or_si128(a, b); }
+static inline word2 shl1(word2 a){ return _mm_slli_epi64(a, 1); }
+static inline word2 shr1(word2 a){ return _mm_srli_epi64(a, 1); }
+static inline word2 shl63(word2 a){ return _mm_slli_epi64(a, 63); }
+static inline word2 shr63(word2 a){ return _mm_srli_epi64(a, 63); }
+#endif
+
+BitMask::BitMask(int rows, int cols){
+   create(rows, cols);
+}
+
+void BitMask::create(int rows, int cols){
+   if(!words.empty() && this->rows == rows && this->cols == cols){
+      return;
+   }
+   this->rows = rows;
+   this->cols = cols;
+   wordsPerRow = (cols + 63) / 64;
+   stride = wordsPerRow + 2;
+   words.assign((size_t)(rows + 2) * stride, 0);
+}
+
+void BitMask::clear(){
+   fill(words.begin(), words.end(), 0);
+}
+
+uint64_t BitMask::lastWordMask() const{
+   int used = cols - (wordsPerRow - 1) * 64;
+   return used == 64 ? ~(uint64_t)0 : (((uint64_t)1 << used) - 1);
+}
+
+int BitMask::nextSet(int y, int from) const{
+   if(from >= cols) return cols;
+   const uint64_t* r = row(y);
+   int wi = from >> 6;
+   uint64_t w = r[wi] & (~(uint64_t)0 << (from & 63));
+   while(w == 0){
+      if(++wi >= wordsPerRow) return cols;
+      w = r[wi];
+   }
+   return wi * 64 + __builtin_ctzll(w);
+}
+
+int BitMask::nextClear(int y, int from) const{
+   if(from >= cols) return cols;
+   const uint64_t* r = row(y);
+   int wi = from >> 6;
+   uint64_t w = ~r[wi] & (~(uint64_t)0 << (from & 63));
+   while(w == 0){
+      if(++wi >= wordsPerRow) return cols;
+      w = ~r[wi];
+   }
+   // padding bits are zero, so a run ending at the last column stops there
+   return min(cols, wi * 64 + __builtin_ctzll(w));
+}
+
+size_t BitMask::count() const{
+   size_t n = 0;
+   for(int y = 0; y < rows; y++){
+      const uint64_t* r = row(y);
+      for(int i = 0; i < wordsPerRow; i++){
+         n += __builtin_popcountll(r[i]);
+      }
+   }
+   return n;
+}
+
+#ifdef BITMASK_NEON
+// Bits of eight int16 pixels above level, pixel i in bit i
+static inline uint64_t threshold8(const int16_t* p, int16x8_t level){
+   static const uint16_t weights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+   uint16x8_t bits = vandq_u16(vcgtq_s16(vld1q_s16(p), level), vld1q_u16(weights));
+   uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(bits));
+   return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+}
+#endif
+
+// Bits of pixels [0, n) of p above level, pixel i in bit i, n <= 64
+static inline uint64_t thresholdWord(const float* p, int n, float level){
+   uint64_t w = 0;
+   for(int b = 0; b < n; b++){
+      w |= (uint64_t)(p[b] > level) << b;
+   }
+   return w;
+}
+
+static inline uint64_t thresholdWord(const int16_t* p, int n, int16_t level){
+   uint64_t w = 0;
+   int b = 0;
+#ifdef BITMASK_NEON
+   int16x8_t lv = vdupq_n_s16(level);
+   for(; b + 8 <= n; b += 8){
+      w |= threshold8(p + b, lv) << b;
+   }
+#endif
+   for(; b < n; b++){
+      w |= (uint64_t)(p[b] > level) << b;
+   }
+   return w;
+}
+
+// Ors in the bits of roi's pixels; words outside roi are not touched
+template<typename T>
+static void thresholdRows(const Mat& src, T level, Rect roi, BitMask& mask){
+   int x1 = roi.x + roi.width;
+   for(int y = roi.y; y < roi.y + roi.height; y++){
+      const T* p = src.ptr<T>(y);
+      uint64_t* r = mask.row(y);
+      for(int wi = roi.x >> 6; wi << 6 < x1; wi++){
+         int base = wi * 64;
+         int lo = max(base, roi.x), hi = min(base + 64, x1);
+         r[wi] |= thresholdWord(p + lo, hi - lo, level) << (lo - base);
+      }
+   }
+}
+
+void BitMask::threshold(const Mat& src, float level){
+   create(src.rows, src.cols);
+   clear();
+   threshold(src, level, Rect(0, 0, cols, rows));
+}
+
+void BitMask::threshold(const Mat& src, float level, Rect roi){
+   CV_Assert(src.type() == CV_32FC1 || src.type() == CV_16SC1);
+   CV_Assert(src.rows == rows && src.cols == cols);
+   roi &= Rect(0, 0, cols, rows);
+   if(roi.empty()) return;
+   if(src.type() == CV_16SC1){
+      // integers are above level exactly when above its floor
+      thresholdRows<int16_t>(src, saturate_cast<int16_t>(cvFloor(level)), roi, *this);
+   }
+   else{
+      thresholdRows<float>(src, level, roi, *this);
+   }
+}
+
+void BitMask::toMat(Mat& dst) const{
+   dst.create(rows, cols, CV_8UC1);
+   for(int y = 0; y < rows; y++){
+      uchar* p = dst.ptr<uchar>(y);
+      for(int x = 0; x < cols; x++){
+         p[x] = get(y, x) ? 255 : 0;
+      }
+   }
+}
+
+// One 3x3 step: a horizontal pass into scratch, then a vertical pass into
+// dst. scratch holds the whole source first, so dst may be this mask.
+void BitMask::morph(BitMask& dst, bool dilation) const{
+   scratch.resize(words.size());
+   // the guard rows above and below are the background outside the image;
+   // the horizontal pass never writes them, and a mask of another shape may
+   // have left pixels there
+   fill(scratch.begin(), scratch.begin() + stride, 0);
+   fill(scratch.end() - stride, scratch.end(), 0);
+   uint64_t last = lastWordMask();
+   int n = wordsPerRow;
+
+   for(int y = 0; y < rows; y++){
+      const uint64_t* s = row(y);
+      uint64_t* h = &scratch[(size_t)(y + 1) * stride + 1];
+      int i = 0;
+#ifdef BITMASK_SIMD
+      for(; i + 1 < n; i += 2){
+         word2 cur = load2(s + i);
+         word2 left = or2(shl1(cur), shr63(load2(s + i - 1)));
+         word2 right = or2(shr1(cur), shl63(load2(s + i + 1)));
+         store2(h + i, dilation ? or2(cur, or2(left, right)) : and2(cur, and2(left, right)));
+      }
+#endif
+      for(; i < n; i++){
+         uint64_t cur = s[i];
+         uint64_t left = (cur << 1) | (s[i - 1] >> 63);
+         uint64_t right = (cur >> 1) | (s[i + 1] << 63);
+         h[i] = dilation ? (cur | left | right) : (cur & left & right);
+      }
+      h[n - 1] &= last;
+   }
+
+   if(&dst != this) dst.create(rows, cols);
+   for(int y = 0; y < rows; y++){
+      const uint64_t* a = &scratch[(size_t)y * stride + 1];
+      const uint64_t* b = a + stride;
+      const uint64_t* c = b + stride;
+      uint64_t* d = dst.row(y);
+      int i = 0;
+#ifdef BITMASK_SIMD
+      for(; i + 1 < n; i += 2){
+         word2 va = load2(a + i), vb = load2(b + i), vc = load2(c + i);
+         store2(d + i, dilation ? or2(va, or2(vb, vc)) : and2(va, and2(vb, vc)));
+      }
+#endif
+      for(; i < n; i++){
+         d[i] = dilation ? (a[i] | b[i] | c[i]) : (a[i] & b[i] & c[i]);
+      }
+   }
+}
+
+void BitMask::erode(BitMask& dst, int radius) const{
+   if(radius <= 0 && &dst != this) dst = *this;
+   const BitMask* src = this;
+   for(int i = 0; i < radius; i++){
+      src->morph(dst, false);
+      src = &dst;
+   }
+}
+
+void BitMask::dilate(BitMask& dst, int radius) const{
+   if(radius <= 0 && &dst != this) dst = *this;
+   const BitMask* src = this;
+   for(int i = 0; i < radius; i++){
+      src->morph(dst, true);
+      src = &dst;
+   }
+}
+
+void BitMask::open(BitMask& dst, int radius) const{
+   erode(dst, radius);
+   dst.dilate(dst, radius);
+}
+
+void BitMask::close(BitMask& dst, int radius) const{
+   dilate(dst, radius);
+   dst.erode(dst, radius);
+}
+
+void BitMask::traceContour(Point start, vector<Point>& contour) const{
+   traceOuterContour(*this, start, contour);
+}
@@ -0,0 +1,51 @@
+#include "Blob.h"
+#include <algorithm>
+
+// sum of k^2 for k = 0..n
+static inline double sumSquares(double n){
+   return n * (n + 1) * (2 * n + 1) / 6;
+}
+
+void Blob::addRun(int y, int x0, int x1){
+   double n = x1 - x0 + 1;
+   double sx = (x0 + x1) * n / 2;
+   double sxx = sumSquares(x1) - sumSquares(x0 - 1);
+   if(area == 0){
+      bbox = Rect(x0, y, x1 - x0 + 1, 1);
+   }
+   else{
+      int left = min(bbox.x, x0), right = max(bbox.x + bbox.width, x1 + 1);
+      int top = min(bbox.y, y), bottom = max(bbox.y + bbox.height, y + 1);
+      bbox = Rect(left, top, right - left, bottom - top);
+   }
+   area += (int)n;
+   m10 += sx;
+   m01 += n * y;
+   m20 += sxx;
+   m11 += sx * y;
+   m02 += n * y * y;
+}
+
+void Blob::merge(const Blob& other){
+   if(other.area == 0) return;
+   if(area == 0){
+      bbox = other.bbox;
+   }
+   else{
+      bbox |= other.bbox;
+   }
+   area += other.area;
+   m10 += other.m10;
+   m01 += other.m01;
+   m20 += other.m20;
+   m11 += other.m11;
+   m02 += other.m02;
+}
+
+Moments Blob::getMoments() const{
+   return Moments(area, m10, m01, m20, m11, m02, 0, 0, 0, 0);
+}
+
+Point2f Blob::getCenter() const{
+   return Point2f(m10 / area, m01 / area);
+}
@@ -0,0 +1,59 @@
+#include "CoarseDetector.h"
+#include "DepthPixel.h"
+
+// Regions closer than this are merged: the in-place 5x5 filter of one region
+// reads 2 pixels around it, which another region must not have filtered yet
+static const int halo = 2;
+
+static bool haloOverlaps(const Rect& a, const Rect& b){
+   Rect grown(a.x - halo, a.y - halo, a.width + 2 * halo, a.height + 2 * halo);
+   return (grown & b).area() > 0;
+}
+
+void CoarseDetector::reserve(Size size, int blobs){
+   runs.reserve(size);
+   labeler.reserve(runs.runs.capacity());
+   this->blobs.reserve(blobs);
+}
+
+void CoarseDetector::find(const Mat& coarse, int levels, float level, Size full, vector<Rect>& regions){
+   regions.clear();
+   objects = 0;
+   mask.threshold(coarse, planeLevel(coarse, level));
+   runs.encode(mask);
+   labeler.label(runs, blobs);
+
+   int scale = 1 << levels;
+   Rect image(0, 0, full.width, full.height);
+   for(size_t i = 0; i < blobs.size(); i++){
+      const Blob& b = blobs[i];
+      if(b.area * scale * scale < minArea) continue;
+      // coarse pixel c covers full pixels [c * scale, (c + 1) * scale)
+      Point2f center = b.getCenter() * (float)scale + Point2f((scale - 1) / 2.f, (scale - 1) / 2.f);
+      if(center.x < full.width * border || center.x > full.width * (1 - border) ||
+         center.y < full.height * border || center.y > full.height * (1 - border)){
+         continue;
+      }
+      objects++;
+      // one coarse pixel more on every side, where the edge averaged below level
+      int pad = scale + margin;
+      Rect r(b.bbox.x * scale - pad, b.bbox.y * scale - pad,
+             b.bbox.width * scale + 2 * pad, b.bbox.height * scale + 2 * pad);
+      regions.push_back(r & image);
+   }
+
+   // merge until no two halos overlap; a handful of regions per frame
+   for(bool merged = true; merged;){
+      merged = false;
+      for(size_t i = 0; i < regions.size() && !merged; i++){
+         for(size_t j = i + 1; j < regions.size(); j++){
+            if(haloOverlaps(regions[i], regions[j])){
+               regions[i] |= regions[j];
+               regions.erase(regions.begin() + j);
+               merged = true;
+               break;
+            }
+         }
+      }
+   }
+}
@@ -0,0 +1,201 @@
+#include "ConnectedComponents.h"
+#include "TilePool.h"
+#include <algorithm>
+#include <unordered_map>
+
+// Union-find over raster indices. Parents always point to a smaller index, so
+// the root of a component is its first pixel in raster order.
+static int findLocal(int* parent, int i){
+   while(parent[i] != i){
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+   }
+   return i;
+}
+
+static void uniteLocal(int* parent, int a, int b){
+   a = findLocal(parent, a);
+   b = findLocal(parent, b);
+   if(a < b) parent[b] = a;
+   else if(b < a) parent[a] = b;
+}
+
+static int findAtomic(int* parent, int i){
+   for(;;){
+      int p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED);
+      if(p == i) return i;
+      int gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+      if(gp != p){
+         // path halving; losing the race only leaves a longer path behind
+         __atomic_compare_exchange_n(&parent[i], &p, gp, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+      }
+      i = gp;
+   }
+}
+
+static void uniteAtomic(int* parent, int a, int b){
+   for(;;){
+      a = findAtomic(parent, a);
+      b = findAtomic(parent, b);
+      if(a == b) return;
+      if(a < b) swap(a, b);
+      int expected = a;
+      if(__atomic_compare_exchange_n(&parent[a], &expected, b, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+         return;
+      }
+   }
+}
+
+ParallelLabeler::ParallelLabeler(int numThreads) : numThreads(max(0, numThreads)){
+}
+
+int ParallelLabeler::getNumThreads() const{
+   return numThreads > 0 ? numThreads : TilePool::shared().getNumThreads();
+}
+
+// Row accessors so the same labeling code reads byte and bit-packed masks
+struct ByteRows {
+   const Mat& mask;
+   bool test(int y, int x) const { return mask.ptr<uchar>(y)[x] != 0; }
+   int nextSet(int y, int x) const{
+      const uchar* p = mask.ptr<uchar>(y);
+      while(x < mask.cols && !p[x]) x++;
+      return x;
+   }
+};
+
+struct BitRows {
+   const BitMask& mask;
+   bool test(int y, int x) const { return mask.get(y, x); }
+   int nextSet(int y, int x) const { return mask.nextSet(y, x); }
+};
+
+template<typename Rows>
+static void labelStrip(const Rows& mask, Mat& labels, int y0, int y1){
+   int* parent = labels.ptr<int>(0);
+   int cols = labels.cols;
+   for(int y = y0; y < y1; y++){
+      bool up = y > y0;
+      int* row = labels.ptr<int>(y);
+      fill(row, row + cols, -1);
+      for(int x = mask.nextSet(y, 0); x < cols; x = mask.nextSet(y, x + 1)){
+         int i = y * cols + x;
+         if(up && mask.test(y - 1, x)){
+            // N touches W, NW and NE, they are already in its component
+            row[x] = i - cols;
+            continue;
+         }
+         int cur = i;
+         if(x > 0 && row[x - 1] >= 0) cur = i - 1;
+         else if(up && x > 0 && mask.test(y - 1, x - 1)) cur = i - cols - 1;
+         if(up && x + 1 < cols && mask.test(y - 1, x + 1)){
+            if(cur != i) uniteLocal(parent, cur, i - cols + 1);
+            else cur = i - cols + 1;
+         }
+         row[x] = cur;
+      }
+   }
+}
+
+template<typename Rows>
+static void mergeBoundary(const Rows& mask, Mat& labels, int y){
+   int* parent = labels.ptr<int>(0);
+   int cols = labels.cols;
+   for(int x = mask.nextSet(y, 0); x < cols; x = mask.nextSet(y, x + 1)){
+      int i = y * cols + x;
+      if(mask.test(y - 1, x)){
+         uniteAtomic(parent, i, i - cols);
+         continue;
+      }
+      if(x > 0 && mask.test(y - 1, x - 1)) uniteAtomic(parent, i, i - cols - 1);
+      if(x + 1 < cols && mask.test(y - 1, x + 1)) uniteAtomic(parent, i, i - cols + 1);
+   }
+}
+
+void ParallelLabeler::collectStrip(int y0, int y1, vector<Blob>& out){
+   int* parent = labels.ptr<int>(0);
+   int cols = labels.cols;
+   unordered_map<int, int> index;
+   out.clear();
+   for(int y = y0; y < y1; y++){
+      int* row = labels.ptr<int>(y);
+      int x = 0;
+      while(x < cols){
+         // other strips may be halving paths through this row concurrently
+         if(__atomic_load_n(&row[x], __ATOMIC_RELAXED) < 0){
+            x++;
+            continue;
+         }
+         // a horizontal run is connected, so one find serves all its pixels
+         int root = findAtomic(parent, y * cols + x);
+         int x0 = x;
+         for(; x < cols && __atomic_load_n(&row[x], __ATOMIC_RELAXED) >= 0; x++){
+            __atomic_store_n(&row[x], root, __ATOMIC_RELAXED);
+         }
+         auto it = index.find(root);
+         if(it == index.end()){
+            it = index.insert(make_pair(root, (int)out.size())).first;
+            out.push_back(Blob());
+            out.back().label = root;
+         }
+         out[it->second].addRun(y, x0, x - 1);
+      }
+   }
+}
+
+void ParallelLabeler::label(const Mat& mask, vector<Blob>& blobs){
+   CV_Assert(mask.type() == CV_8UC1);
+   ByteRows rows = { mask };
+   labelRows(rows, mask.rows, mask.cols, blobs);
+}
+
+void ParallelLabeler::label(const BitMask& mask, vector<Blob>& blobs){
+   BitRows rows = { mask };
+   labelRows(rows, mask.rows, mask.cols, blobs);
+}
+
+template<typename Rows>
+void ParallelLabeler::labelRows(const Rows& mask, int rows, int cols, vector<Blob>& blobs){
+   labels.create(rows, cols, CV_32SC1);
+   CV_Assert(labels.isContinuous());
+
+   int strips = max(1, min(getNumThreads(), rows));
+   vector<int> bounds(strips + 1);
+   for(int s = 0; s <= strips; s++){
+      bounds[s] = rows * s / strips;
+   }
+   stripBlobs.resize(strips);
+
+   // the strips run on the shared pool, no threads are started per frame
+   TilePool& pool = TilePool::shared();
+   pool.run(strips, [&](int s){
+      labelStrip(mask, labels, bounds[s], bounds[s + 1]);
+   });
+   if(strips > 1){
+      pool.run(strips - 1, [&](int s){
+         mergeBoundary(mask, labels, bounds[s + 1]);
+      });
+   }
+   pool.run(strips, [&](int s){
+      collectStrip(bounds[s], bounds[s + 1], stripBlobs[s]);
+   });
+
+   // a blob spanning several strips shows up once per strip
+   blobs.clear();
+   for(auto& part : stripBlobs){
+      blobs.insert(blobs.end(), part.begin(), part.end());
+   }
+   sort(blobs.begin(), blobs.end(), [](const Blob& a, const Blob& b){
+      return a.label < b.label;
+   });
+   size_t n = 0;
+   for(size_t i = 0; i < blobs.size(); i++){
+      if(n > 0 && blobs[n - 1].label == blobs[i].label){
+         blobs[n - 1].merge(blobs[i]);
+      }
+      else{
+         blobs[n++] = blobs[i];
+      }
+   }
+   blobs.resize(n);
+}
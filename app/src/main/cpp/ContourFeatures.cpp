@@ -0,0 +1,195 @@
+#include "ContourFeatures.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FEATURES_NEON 1
+#endif
+
+Moments ContourFeatures::getMoments() const{
+   return Moments(m00, m10, m01, m20, m11, m02, 0, 0, 0, 0);
+}
+
+Point2f ContourFeatures::getCenter() const{
+   return Point2f(m10 / m00, m01 / m00);
+}
+
+// Running sums over the edges, coordinates relative to the first point. The
+// polygon terms use the Green's theorem form of cv::moments for contours.
+struct EdgeSums {
+   double a = 0, len = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+   float minX = 0, minY = 0, maxX = 0, maxY = 0;
+   float minTurn = 0, maxTurn = 0;
+
+   // edge p0 -> p1, turn at p1 towards p2
+   void add(double x0, double y0, double x1, double y1, double x2, double y2){
+      double c = x0 * y1 - x1 * y0;
+      a += c;
+      len += sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+      m10 += c * (x0 + x1);
+      m01 += c * (y0 + y1);
+      m20 += c * (x0 * x0 + x0 * x1 + x1 * x1);
+      m11 += c * (x0 * (2 * y0 + y1) + x1 * (y0 + 2 * y1));
+      m02 += c * (y0 * y0 + y0 * y1 + y1 * y1);
+      float turn = (float)((x1 - x0) * (y2 - y1) - (y1 - y0) * (x2 - x1));
+      minTurn = min(minTurn, turn);
+      maxTurn = max(maxTurn, turn);
+      minX = min(minX, (float)x1);
+      maxX = max(maxX, (float)x1);
+      minY = min(minY, (float)y1);
+      maxY = max(maxY, (float)y1);
+   }
+};
+
+#ifdef FEATURES_NEON
+// Four consecutive points, relative to the origin, as x and y lanes
+static inline void load4(const Point* p, int32x2_t origin, float32x4_t& x, float32x4_t& y){
+   int32x4x2_t v = vld2q_s32((const int32_t*)p);
+   x = vcvtq_f32_s32(vsubq_s32(v.val[0], vdupq_lane_s32(origin, 0)));
+   y = vcvtq_f32_s32(vsubq_s32(v.val[1], vdupq_lane_s32(origin, 1)));
+}
+
+static inline void load4(const Point2f* p, float32x2_t origin, float32x4_t& x, float32x4_t& y){
+   float32x4x2_t v = vld2q_f32((const float*)p);
+   x = vsubq_f32(v.val[0], vdupq_lane_f32(origin, 0));
+   y = vsubq_f32(v.val[1], vdupq_lane_f32(origin, 1));
+}
+
+static inline int32x2_t originOf(const Point& p){
+   int32_t o[2] = { p.x, p.y };
+   return vld1_s32(o);
+}
+
+static inline float32x2_t originOf(const Point2f& p){
+   float o[2] = { p.x, p.y };
+   return vld1_f32(o);
+}
+
+static inline float32x4_t sqrt4(float32x4_t d2){
+#if defined(__aarch64__)
+   return vsqrtq_f32(d2);
+#else
+   // reciprocal square root estimate plus two Newton steps
+   float32x4_t r = vrsqrteq_f32(d2);
+   r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d2, r), r));
+   r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d2, r), r));
+   float32x4_t zero = vdupq_n_f32(0);
+   return vbslq_f32(vceqq_f32(d2, zero), zero, vmulq_f32(d2, r));
+#endif
+}
+
+static inline double sum4(float32x4_t v){
+   float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+   return (double)vget_lane_f32(s, 0) + vget_lane_f32(s, 1);
+}
+
+// Adds edges i -> i + 1 for i in [0, count), four at a time. Needs points up
+// to count + 1 for the turns. Returns the number of edges done.
+template<typename P, typename O>
+static int addEdgesNeon(const P* pts, int count, O origin, EdgeSums& s){
+   // float lanes are flushed to the double sums every so many blocks
+   const int flushBlocks = 64;
+   float32x4_t zero = vdupq_n_f32(0);
+   float32x4_t minX = vdupq_n_f32(s.minX), maxX = vdupq_n_f32(s.maxX);
+   float32x4_t minY = vdupq_n_f32(s.minY), maxY = vdupq_n_f32(s.maxY);
+   float32x4_t minTurn = zero, maxTurn = zero;
+   int i = 0;
+   while(i + 4 <= count){
+      float32x4_t a = zero, len = zero, m10 = zero, m01 = zero, m20 = zero, m11 = zero, m02 = zero;
+      for(int b = 0; b < flushBlocks && i + 4 <= count; b++, i += 4){
+         float32x4_t x0, y0, x1, y1, x2, y2;
+         load4(pts + i, origin, x0, y0);
+         load4(pts + i + 1, origin, x1, y1);
+         load4(pts + i + 2, origin, x2, y2);
+
+         float32x4_t c = vmlsq_f32(vmulq_f32(x0, y1), x1, y0);
+         float32x4_t dx = vsubq_f32(x1, x0), dy = vsubq_f32(y1, y0);
+         a = vaddq_f32(a, c);
+         len = vaddq_f32(len, sqrt4(vmlaq_f32(vmulq_f32(dx, dx), dy, dy)));
+         m10 = vmlaq_f32(m10, c, vaddq_f32(x0, x1));
+         m01 = vmlaq_f32(m01, c, vaddq_f32(y0, y1));
+         float32x4_t xx = vmlaq_f32(vmlaq_f32(vmulq_f32(x0, x0), x0, x1), x1, x1);
+         float32x4_t yy = vmlaq_f32(vmlaq_f32(vmulq_f32(y0, y0), y0, y1), y1, y1);
+         float32x4_t xy = vmlaq_f32(vmulq_f32(x0, vmlaq_n_f32(y1, y0, 2)), x1, vmlaq_n_f32(y0, y1, 2));
+         m20 = vmlaq_f32(m20, c, xx);
+         m11 = vmlaq_f32(m11, c, xy);
+         m02 = vmlaq_f32(m02, c, yy);
+
+         float32x4_t turn = vmlsq_f32(vmulq_f32(dx, vsubq_f32(y2, y1)), dy, vsubq_f32(x2, x1));
+         minTurn = vminq_f32(minTurn, turn);
+         maxTurn = vmaxq_f32(maxTurn, turn);
+         minX = vminq_f32(minX, x1);
+         maxX = vmaxq_f32(maxX, x1);
+         minY = vminq_f32(minY, y1);
+         maxY = vmaxq_f32(maxY, y1);
+      }
+      s.a += sum4(a);
+      s.len += sum4(len);
+      s.m10 += sum4(m10);
+      s.m01 += sum4(m01);
+      s.m20 += sum4(m20);
+      s.m11 += sum4(m11);
+      s.m02 += sum4(m02);
+   }
+   float lanes[4];
+   vst1q_f32(lanes, minX); s.minX = min(min(lanes[0], lanes[1]), min(lanes[2], lanes[3]));
+   vst1q_f32(lanes, maxX); s.maxX = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+   vst1q_f32(lanes, minY); s.minY = min(min(lanes[0], lanes[1]), min(lanes[2], lanes[3]));
+   vst1q_f32(lanes, maxY); s.maxY = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+   vst1q_f32(lanes, minTurn); s.minTurn = min(s.minTurn, min(min(lanes[0], lanes[1]), min(lanes[2], lanes[3])));
+   vst1q_f32(lanes, maxTurn); s.maxTurn = max(s.maxTurn, max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3])));
+   return i;
+}
+#endif
+
+template<typename P>
+static void computeFeaturesImpl(const vector<P>& contour, ContourFeatures& f){
+   f = ContourFeatures();
+   int n = (int)contour.size();
+   if(n == 0) return;
+
+   const P* pts = &contour[0];
+   double ox = pts[0].x, oy = pts[0].y;
+   EdgeSums s;
+   int done = 0;
+#ifdef FEATURES_NEON
+   // the vector loop stays clear of the wrap-around at the end
+   if(n > 6) done = addEdgesNeon(pts, n - 2, originOf(pts[0]), s);
+#endif
+   for(int i = done; i < n; i++){
+      const P& p0 = pts[i];
+      const P& p1 = pts[(i + 1) % n];
+      const P& p2 = pts[(i + 2) % n];
+      s.add(p0.x - ox, p0.y - oy, p1.x - ox, p1.y - oy, p2.x - ox, p2.y - oy);
+   }
+
+   // orientation independent, like cv::moments
+   double sign = s.a < 0 ? -1 : 1;
+   double m00 = sign * s.a / 2;
+   double m10 = sign * s.m10 / 6, m01 = sign * s.m01 / 6;
+   double m20 = sign * s.m20 / 12, m11 = sign * s.m11 / 24, m02 = sign * s.m02 / 12;
+   f.area = m00;
+   f.perimeter = s.len;
+   f.m00 = m00;
+   f.m10 = m10 + ox * m00;
+   f.m01 = m01 + oy * m00;
+   f.m20 = m20 + 2 * ox * m10 + ox * ox * m00;
+   f.m11 = m11 + ox * m01 + oy * m10 + ox * oy * m00;
+   f.m02 = m02 + 2 * oy * m01 + oy * oy * m00;
+
+   int x0 = (int)floor(s.minX + ox), y0 = (int)floor(s.minY + oy);
+   int x1 = (int)floor(s.maxX + ox), y1 = (int)floor(s.maxY + oy);
+   f.bbox = Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+   if(s.minTurn >= 0 && s.maxTurn > 0) f.convexity = 1;
+   else if(s.maxTurn <= 0 && s.minTurn < 0) f.convexity = -1;
+}
+
+void computeFeatures(const vector<Point>& contour, ContourFeatures& features){
+   computeFeaturesImpl(contour, features);
+}
+
+void computeFeatures(const vector<Point2f>& contour, ContourFeatures& features){
+   computeFeaturesImpl(contour, features);
+}
@@ -0,0 +1,88 @@
+#include "CpuTopology.h"
+#include <sched.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <tuple>
+
+// A kernel CPU list like "0-3,6,8-9"
+static vector<int> parseCpuList(const string& text){
+   vector<int> cpus;
+   size_t at = 0;
+   while(at < text.size()){
+      int first, last, used = 0;
+      if(sscanf(text.c_str() + at, "%d-%d%n", &first, &last, &used) == 2 && used > 0){
+         for(int c = first; c <= last; c++) cpus.push_back(c);
+      }
+      else if(sscanf(text.c_str() + at, "%d%n", &first, &used) == 1 && used > 0) cpus.push_back(first);
+      else break;
+      at += used;
+      if(at < text.size() && text[at] == ',') at++;
+      else break;
+   }
+   return cpus;
+}
+
+static string readLine(const string& path){
+   ifstream file(path.c_str());
+   string line;
+   getline(file, line);
+   return line;
+}
+
+static int readInt(const string& path, int fallback){
+   string line = readLine(path);
+   return line.empty() ? fallback : atoi(line.c_str());
+}
+
+vector<vector<int> > cpuGroups(int n){
+   vector<int> online = parseCpuList(readLine("/sys/devices/system/cpu/online"));
+   if(online.empty()){
+      for(int c = 0; c < max(1, (int)thread::hardware_concurrency()); c++) online.push_back(c);
+   }
+   // node, cluster and number of every CPU
+   vector<tuple<int, int, int> > keyed;
+   vector<int> node(online.back() + 1, 0);
+   for(int x = 0; x < 64; x++){
+      vector<int> cpus = parseCpuList(readLine("/sys/devices/system/node/node" + to_string(x) + "/cpulist"));
+      for(size_t i = 0; i < cpus.size(); i++) if(cpus[i] < (int)node.size()) node[cpus[i]] = x;
+   }
+   for(size_t i = 0; i < online.size(); i++){
+      string topology = "/sys/devices/system/cpu/cpu" + to_string(online[i]) + "/topology/";
+      // older ARM kernels report the cluster as the package
+      int cluster = readInt(topology + "cluster_id", readInt(topology + "physical_package_id", 0));
+      keyed.push_back(make_tuple(node[online[i]], cluster, online[i]));
+   }
+   sort(keyed.begin(), keyed.end());
+
+   n = max(1, min(n, (int)keyed.size()));
+   vector<vector<int> > groups(n);
+   for(int g = 0; g < n; g++){
+      size_t first = keyed.size() * g / n, last = keyed.size() * (g + 1) / n;
+      for(size_t i = first; i < last; i++) groups[g].push_back(get<2>(keyed[i]));
+   }
+   return groups;
+}
+
+bool pinThread(const vector<int>& cpus){
+   if(cpus.empty()) return true;
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   for(size_t i = 0; i < cpus.size(); i++) CPU_SET(cpus[i], &set);
+   return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void runPinned(const vector<int>& cpus, const function<void()>& body){
+   if(cpus.empty()){
+      body();
+      return;
+   }
+   thread pinned([&]{
+      pinThread(cpus);
+      body();
+   });
+   pinned.join();
+}
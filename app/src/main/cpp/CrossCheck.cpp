@@ -0,0 +1,289 @@
+#include "CrossCheck.h"
+#include <cmath>
+#include "DepthPixel.h"
+#include "Shape.h"
+
+const char* CrossCheck::stageName(Stage stage){
+   static const char* names[Stages] = { "none", "heights", "boxFilter", "threshold", "open", "contours",
+                                        "simplify", "shapes" };
+   return stage >= None && stage < Stages ? names[stage] : "?";
+}
+
+// CV_32FC1 meters of a height plane in either of the pipeline's types
+static void toMeters(const Mat& src, Mat& dst){
+   src.convertTo(dst, CV_32FC1, src.type() == CV_16SC1 ? 0.001 : 1.0);
+}
+
+// Pixel inside one of the regions, or anywhere without regions
+static bool inside(const vector<Rect>* regions, int x, int y){
+   if(!regions) return true;
+   for(size_t i = 0; i < regions->size(); i++){
+      if((*regions)[i].contains(Point(x, y))) return true;
+   }
+   return false;
+}
+
+void CrossCheck::comparePlanes(const Mat& reference, const Mat& optimized, const vector<Rect>* regions,
+                               Stage stage, Divergence& d) const{
+   Mat meters;
+   toMeters(optimized, meters);
+   int count = 0;
+   for(int y = 0; y < reference.rows; y++){
+      const float* r = reference.ptr<float>(y);
+      const float* o = meters.ptr<float>(y);
+      for(int x = 0; x < reference.cols; x++){
+         if(fabs(r[x] - o[x]) <= heightTolerance || !inside(regions, x, y)) continue;
+         if(count++ == 0){
+            d.pixel = Point(x, y);
+            d.reference = r[x];
+            d.optimized = o[x];
+         }
+      }
+   }
+   if(count > 0){
+      d.stage = stage;
+      d.count = count;
+   }
+}
+
+void CrossCheck::checkHeights(const Mat& depth, const Mat& background, double unitsPerMeter,
+                              const Mat& cameraMatrix, const Mat& distortion, const Mat& diff,
+                              Divergence& d) const{
+   if(d.found()) return;
+   // the listener's first path: the pixels the camera did not report take
+   // the background, then background - depth, undistorted
+   Mat z, b, heights;
+   depth.convertTo(z, CV_32FC1, 1.0 / unitsPerMeter);
+   background.convertTo(b, CV_32FC1, 1.0 / unitsPerMeter);
+   for(int y = 0; y < z.rows; y++){
+      float* zRow = z.ptr<float>(y);
+      const float* bRow = b.ptr<float>(y);
+      for(int x = 0; x < z.cols; x++){
+         if(zRow[x] == 0) zRow[x] = bRow[x];
+      }
+   }
+   subtract(b, z, heights);
+   if(!cameraMatrix.empty()){
+      Mat distorted = heights.clone();
+      undistort(distorted, heights, cameraMatrix, distortion);
+   }
+   comparePlanes(heights, diff, NULL, Heights, d);
+}
+
+void CrossCheck::checkBoxFilter(const Mat& heights, const Mat& filtered, const vector<Rect>* regions,
+                                Divergence& d) const{
+   if(d.found()) return;
+   Mat meters, reference;
+   toMeters(heights, meters);
+   cv::boxFilter(meters, reference, -1, Size(5, 5));
+   comparePlanes(reference, filtered, regions, BoxFilter, d);
+}
+
+void CrossCheck::checkThreshold(const Mat& filtered, float level, const vector<Rect>* regions,
+                                const BitMask& mask, Divergence& d) const{
+   if(d.found()) return;
+   // on the plane's own type and level, so integer heights are compared
+   // exactly
+   Mat reference;
+   cv::threshold(filtered, reference, planeLevel(filtered, level), 255, THRESH_BINARY);
+   Mat meters;
+   toMeters(filtered, meters);
+   reference.convertTo(reference, CV_8UC1);
+   int count = 0;
+   for(int y = 0; y < reference.rows; y++){
+      for(int x = 0; x < reference.cols; x++){
+         bool expected = reference.at<uchar>(y, x) != 0 && inside(regions, x, y);
+         if(expected == mask.get(y, x)) continue;
+         if(count++ == 0){
+            d.pixel = Point(x, y);
+            d.reference = expected;
+            d.optimized = mask.get(y, x);
+            d.detail = "height " + to_string(meters.at<float>(y, x));
+         }
+      }
+   }
+   if(count > 0){
+      d.stage = Threshold;
+      d.count = count;
+   }
+}
+
+// Pixels of two CV_8UC1 masks that differ, the first one in d
+static int compareMasks(const Mat& reference, const Mat& optimized, CrossCheck::Divergence& d){
+   int count = 0;
+   for(int y = 0; y < reference.rows; y++){
+      const uchar* r = reference.ptr<uchar>(y);
+      const uchar* o = optimized.ptr<uchar>(y);
+      for(int x = 0; x < reference.cols; x++){
+         if((r[x] != 0) == (o[x] != 0)) continue;
+         if(count++ == 0){
+            d.pixel = Point(x, y);
+            d.reference = r[x] != 0;
+            d.optimized = o[x] != 0;
+         }
+      }
+   }
+   return count;
+}
+
+void CrossCheck::checkOpen(const Mat& before, const BitMask& opened, Divergence& d) const{
+   if(d.found()) return;
+   // 3x3 square; BitMask takes the pixels outside the image as background,
+   // for erosion too
+   Mat eroded, reference, optimized;
+   erode(before, eroded, Mat(), Point(-1, -1), 1, BORDER_CONSTANT, Scalar::all(0));
+   dilate(eroded, reference, Mat(), Point(-1, -1), 1, BORDER_CONSTANT, Scalar::all(0));
+   opened.toMat(optimized);
+   int count = compareMasks(reference, optimized, d);
+   if(count > 0){
+      d.stage = Open;
+      d.count = count;
+   }
+}
+
+void CrossCheck::checkContours(const BitMask& mask, const vector<Blob>& blobs, vector<vector<Point> >& contours,
+                               Divergence& d) const{
+   contours.clear();
+   if(d.found()) return;
+   Mat binary;
+   mask.toMat(binary);
+   findContours(binary, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+   // every outer contour bounds a blob; a blob without one lies in the hole
+   // of another blob, which RETR_EXTERNAL drops
+   vector<bool> matched(blobs.size(), false);
+   int count = 0;
+   for(size_t i = 0; i < contours.size(); i++){
+      Rect box = boundingRect(contours[i]);
+      bool found = false;
+      for(size_t j = 0; j < blobs.size() && !found; j++){
+         if(!matched[j] && blobs[j].bbox == box) found = matched[j] = true;
+      }
+      if(!found && count++ == 0){
+         d.pixel = contours[i][0];
+         d.reference = box.area();
+         d.detail = "no blob with the contour's bounding box";
+      }
+   }
+   for(size_t j = 0; j < blobs.size(); j++){
+      if(matched[j]) continue;
+      bool nested = false;
+      for(size_t k = 0; k < blobs.size() && !nested; k++){
+         nested = k != j && (blobs[k].bbox & blobs[j].bbox) == blobs[j].bbox && blobs[k].bbox != blobs[j].bbox;
+      }
+      if(!nested && count++ == 0){
+         d.pixel = blobs[j].bbox.tl();
+         d.optimized = blobs[j].area;
+         d.detail = "no contour around the blob";
+      }
+   }
+   if(count > 0){
+      d.stage = Contours;
+      d.count = count;
+   }
+}
+
+void CrossCheck::checkSimplify(const vector<Point2f>& contour, double epsilon, int vertices, Point2f center,
+                               Divergence& d) const{
+   if(d.found()) return;
+   vector<Point2f> approx;
+   approxPolyDP(contour, approx, epsilon, true);
+   if((int)approx.size() == vertices) return;
+   d.stage = Simplify;
+   d.pixel = Point(cvRound(center.x), cvRound(center.y));
+   d.reference = (double)approx.size();
+   d.optimized = vertices;
+   d.count = 1;
+   d.detail = "vertices";
+}
+
+static string describe(const ShapeRecord& r){
+   return unpackType(r.type) + " at (" + to_string(r.x) + "," + to_string(r.y) + ") area " + to_string(r.area);
+}
+
+void CrossCheck::checkShapes(const vector<vector<Point> >& contours, const ShapeClassifier* classifier, Size size,
+                             const vector<ShapeRecord>& records, Divergence& d) const{
+   if(d.found()) return;
+   // the shapes as the listener first found them, on the traced mask. A
+   // traced outline runs through the centers of the border pixels, half a
+   // pixel inside the sub-pixel one, so its area is compared with half the
+   // perimeter added; a record may pair with a shape the reference found
+   // just too small.
+   SimplifyWorkspace workspace;
+   vector<ShapeRecord> reference;
+   vector<bool> valid;
+   vector<double> area;
+   for(size_t i = 0; i < contours.size(); i++){
+      Shape s(contours[i], &workspace, classifier);
+      Point2f center = s.getCenter();
+      if(center.x < size.width*0.1 || center.x > size.width*0.9 ||
+         center.y < size.height*0.1 || center.y > size.height*0.9){
+         s.isValidShape = false;
+      }
+      reference.push_back(s.getRecord());
+      valid.push_back(s.isValidShape);
+      area.push_back(s.getArea() + s.getPerimeter() / 2);
+   }
+   vector<bool> used(reference.size(), false);
+   int count = 0;
+   for(size_t j = 0; j < records.size(); j++){
+      const ShapeRecord& o = records[j];
+      int best = -1;
+      double bestDistance = centerTolerance;
+      for(size_t i = 0; i < reference.size(); i++){
+         double distance = hypot((double)(reference[i].x - o.x), (double)(reference[i].y - o.y));
+         if(!used[i] && distance <= bestDistance){
+            best = (int)i;
+            bestDistance = distance;
+         }
+      }
+      string difference;
+      if(best < 0) difference = "extra " + describe(o);
+      else{
+         used[best] = true;
+         const ShapeRecord& r = reference[best];
+         if(o.type != r.type || fabs(o.area - area[best]) > areaTolerance * area[best]){
+            difference = describe(r) + " is " + describe(o);
+         }
+      }
+      if(!difference.empty() && count++ == 0){
+         d.pixel = Point(o.x, o.y);
+         d.reference = best < 0 ? 0 : reference[best].area;
+         d.optimized = o.area;
+         d.detail = difference;
+      }
+   }
+   for(size_t i = 0; i < reference.size(); i++){
+      if(used[i] || !valid[i] || count++ > 0) continue;
+      d.pixel = Point(reference[i].x, reference[i].y);
+      d.reference = reference[i].area;
+      d.detail = "missing " + describe(reference[i]);
+   }
+   if(count > 0){
+      d.stage = Shapes;
+      d.count = count;
+   }
+}
+
+void CrossCheck::count(const Divergence& d){
+   frames++;
+   diverged[d.stage]++;
+}
+
+string CrossCheck::report() const{
+   uint64_t checked = frames.load();
+   string text = "cross-check: " + to_string(checked) + " frames, " + to_string(checked - diverged[None].load()) +
+                 " diverged";
+   const char* separator = ": ";
+   for(int i = None + 1; i < Stages; i++){
+      uint64_t n = diverged[i].load();
+      if(n == 0) continue;
+      text += separator + string(stageName((Stage)i)) + " " + to_string(n);
+      separator = ", ";
+   }
+   return text + "\n";
+}
+
+void CrossCheck::resetStats(){
+   frames = 0;
+   for(int i = 0; i < Stages; i++) diverged[i] = 0;
+}
@@ -0,0 +1,340 @@
+#include "DepthExchange.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+// The lens as the recording header keeps it
+static void storeLens(const Mat& cameraMatrix, const Mat& distortion, double* matrix, double* coefficients){
+   if(!cameraMatrix.empty()){
+      Mat m;
+      cameraMatrix.reshape(1, 1).convertTo(m, CV_64FC1);
+      for(int i = 0; i < 9; i++) matrix[i] = m.at<double>(0, i);
+   }
+   if(!distortion.empty()){
+      Mat d;
+      distortion.reshape(1, 1).convertTo(d, CV_64FC1);
+      for(int i = 0; i < min(5, d.cols); i++) coefficients[i] = d.at<double>(0, i);
+   }
+}
+
+static void loadLens(const double* matrix, const double* coefficients, Mat& cameraMatrix, Mat& distortion){
+   cameraMatrix.release();
+   distortion.release();
+   if(matrix[0] != 0){
+      cameraMatrix = Mat(3, 3, CV_64FC1, (void*)matrix).clone();
+      distortion = Mat(1, 5, CV_64FC1, (void*)coefficients).clone();
+   }
+}
+
+// The points of data from z [m] and confidence planes in the camera's order
+static void fillPoints(royale::DepthData& data, Size size, const float* z, const uint8_t* confidence,
+                       int64_t timestamp){
+   size_t n = (size_t)size.area();
+   data.width = (uint16_t)size.width;
+   data.height = (uint16_t)size.height;
+   data.timeStamp = chrono::microseconds(timestamp);
+   data.points.resize(n);
+   for(size_t i = 0; i < n; i++){
+      royale::DepthPoint& p = data.points[i];
+      memset(&p, 0, sizeof(p));
+      p.z = z[i];
+      p.depthConfidence = confidence[i];
+   }
+}
+
+static sockaddr_un socketAddress(const string& path){
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+   return address;
+}
+
+static bool sendAll(int fd, const char* data, size_t n){
+   while(n > 0){
+      ssize_t sent = send(fd, data, n, MSG_NOSIGNAL);
+      if(sent < 0 && errno == EINTR) continue;
+      if(sent <= 0) return false;
+      data += sent;
+      n -= sent;
+   }
+   return true;
+}
+
+// Until fd has something to read; false once interrupt, if any, is readable
+static bool waitReadable(int fd, int interrupt){
+   if(interrupt < 0) return true;
+   pollfd fds[2] = { { fd, POLLIN, 0 }, { interrupt, POLLIN, 0 } };
+   while(poll(fds, 2, -1) < 0){
+      if(errno != EINTR) return false;
+   }
+   return !(fds[1].revents & POLLIN);
+}
+
+static bool receiveAll(int fd, int interrupt, char* data, size_t n){
+   while(n > 0){
+      if(!waitReadable(fd, interrupt)) return false;
+      ssize_t received = recv(fd, data, n, 0);
+      if(received < 0 && errno == EINTR) continue;
+      if(received <= 0) return false;
+      data += received;
+      n -= received;
+   }
+   return true;
+}
+
+bool DepthStreamWriter::connect(const string& path, Size size, const Mat& cameraMatrix, const Mat& distortion){
+   close();
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(fd < 0) return false;
+   sockaddr_un address = socketAddress(path);
+   if(::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0){
+      close();
+      return false;
+   }
+   header = RecordingHeader();
+   header.width = size.width;
+   header.height = size.height;
+   storeLens(cameraMatrix, distortion, header.cameraMatrix, header.distortion);
+   if(!sendAll(fd, (const char*)&header, sizeof(header))){
+      close();
+      return false;
+   }
+   return true;
+}
+
+bool DepthStreamWriter::write(const royale::DepthData& data){
+   size_t n = (size_t)header.width * header.height;
+   if(fd < 0 || data.points.size() != n) return false;
+   RecordingFrame frame;
+   frame.bytes = (uint32_t)(n * (sizeof(float) + 1));
+   frame.timestamp = data.timeStamp.count();
+   // one send per frame
+   buffer.resize(sizeof(frame) + frame.bytes);
+   memcpy(&buffer[0], &frame, sizeof(frame));
+   float* z = (float*)&buffer[sizeof(frame)];
+   uint8_t* confidence = (uint8_t*)(z + n);
+   for(size_t i = 0; i < n; i++){
+      z[i] = data.points[i].z;
+      confidence[i] = data.points[i].depthConfidence;
+   }
+   return sendAll(fd, &buffer[0], buffer.size());
+}
+
+void DepthStreamWriter::close(){
+   if(fd >= 0) ::close(fd);
+   fd = -1;
+}
+
+bool DepthStreamReader::listen(const string& path){
+   close();
+   listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(listener < 0) return false;
+   unlink(path.c_str());
+   sockaddr_un address = socketAddress(path);
+   if(bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, 1) != 0){
+      close();
+      return false;
+   }
+   this->path = path;
+   return true;
+}
+
+bool DepthStreamReader::accept(){
+   if(fd >= 0) ::close(fd);
+   fd = -1;
+   if(listener < 0 || !waitReadable(listener, interrupt)) return false;
+   fd = ::accept(listener, NULL, NULL);
+   if(fd < 0) return false;
+   RecordingHeader expected;
+   if(!receiveAll(fd, interrupt, (char*)&header, sizeof(header)) || memcmp(header.magic, expected.magic, 4) != 0 ||
+      header.version != expected.version || header.width == 0 || header.height == 0 ||
+      header.width > RecordingReader::maxSide || header.height > RecordingReader::maxSide){
+      ::close(fd);
+      fd = -1;
+      return false;
+   }
+   loadLens(header.cameraMatrix, header.distortion, cameraMatrix, distortion);
+   return true;
+}
+
+bool DepthStreamReader::read(royale::DepthData& data){
+   RecordingFrame frame;
+   size_t n = (size_t)header.width * header.height;
+   // at most the labels and objects of a recording with ground truth
+   size_t most = n * (sizeof(float) + 2) + RecordingReader::maxObjects * sizeof(SceneObject);
+   if(fd < 0 || !receiveAll(fd, interrupt, (char*)&frame, sizeof(frame)) || frame.bytes < n * (sizeof(float) + 1) ||
+      frame.bytes > most){
+      return false;
+   }
+   // ground truth a recording may carry is read past
+   buffer.resize(frame.bytes);
+   if(!receiveAll(fd, interrupt, &buffer[0], frame.bytes)) return false;
+   const float* z = (const float*)&buffer[0];
+   fillPoints(data, getSize(), z, (const uint8_t*)(z + n), frame.timestamp);
+   return true;
+}
+
+void DepthStreamReader::close(){
+   if(fd >= 0) ::close(fd);
+   if(listener >= 0){
+      ::close(listener);
+      unlink(path.c_str());
+   }
+   fd = listener = -1;
+}
+
+// Header and slots start on cache lines
+static size_t headerBytes(){
+   return (sizeof(DepthShmHeader) + 63) & ~(size_t)63;
+}
+
+static size_t slotBytes(Size size){
+   size_t bytes = sizeof(DepthShmSlot) + size.area() * (sizeof(float) + 1);
+   return (bytes + 63) & ~(size_t)63;
+}
+
+bool DepthShmWriter::create(const string& name, Size size, const Mat& cameraMatrix, const Mat& distortion, int slots){
+   close();
+   shm_unlink(name.c_str());
+   int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+   if(fd < 0) return false;
+   bytes = headerBytes() + slots * slotBytes(size);
+   if(ftruncate(fd, bytes) != 0){
+      ::close(fd);
+      shm_unlink(name.c_str());
+      return false;
+   }
+   memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(memory == MAP_FAILED){
+      memory = NULL;
+      shm_unlink(name.c_str());
+      return false;
+   }
+   this->name = name;
+   // the fresh segment is zero, every slot free
+   header = new(memory) DepthShmHeader();
+   header->width = size.width;
+   header->height = size.height;
+   header->slots = slots;
+   header->slotBytes = (uint32_t)slotBytes(size);
+   storeLens(cameraMatrix, distortion, header->cameraMatrix, header->distortion);
+   return true;
+}
+
+void DepthShmWriter::write(const royale::DepthData& data){
+   if(!header) return;
+   size_t n = (size_t)header->width * header->height;
+   if(data.points.size() != n) return;
+   uint64_t written = header->written.load(memory_order_relaxed);
+   char* base = (char*)memory + headerBytes() + (written % header->slots) * header->slotBytes;
+   DepthShmSlot* slot = (DepthShmSlot*)base;
+   slot->frame.store(0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   slot->timestamp = data.timeStamp.count();
+   float* z = (float*)(base + sizeof(DepthShmSlot));
+   uint8_t* confidence = (uint8_t*)(z + n);
+   for(size_t i = 0; i < n; i++){
+      z[i] = data.points[i].z;
+      confidence[i] = data.points[i].depthConfidence;
+   }
+   slot->frame.store(written + 1, memory_order_release);
+   header->written.store(written + 1, memory_order_release);
+}
+
+void DepthShmWriter::close(){
+   if(memory){
+      munmap(memory, bytes);
+      shm_unlink(name.c_str());
+   }
+   memory = NULL;
+   header = NULL;
+}
+
+bool DepthShmReader::open(const string& name){
+   close();
+   int fd = shm_open(name.c_str(), O_RDONLY, 0);
+   if(fd < 0) return false;
+   struct stat info;
+   if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(DepthShmHeader)){
+      ::close(fd);
+      return false;
+   }
+   this->name = name;
+   device = info.st_dev;
+   inode = info.st_ino;
+   bytes = info.st_size;
+   memory = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(memory == MAP_FAILED){
+      memory = NULL;
+      return false;
+   }
+   header = (const DepthShmHeader*)memory;
+   DepthShmHeader expected;
+   if(memcmp(header->magic, expected.magic, 4) != 0 || header->version != expected.version ||
+      header->slotBytes != slotBytes(getSize()) || bytes < headerBytes() + header->slots * header->slotBytes){
+      close();
+      return false;
+   }
+   loadLens(header->cameraMatrix, header->distortion, cameraMatrix, distortion);
+   next = header->written.load(memory_order_acquire);
+   skipped = 0;
+   return true;
+}
+
+void DepthShmReader::close(){
+   if(memory) munmap(memory, bytes);
+   memory = NULL;
+   header = NULL;
+}
+
+bool DepthShmReader::stale() const{
+   if(!memory) return true;
+   int fd = shm_open(name.c_str(), O_RDONLY, 0);
+   if(fd < 0) return true;
+   struct stat info;
+   bool same = fstat(fd, &info) == 0 && (uint64_t)info.st_dev == device && (uint64_t)info.st_ino == inode;
+   ::close(fd);
+   return !same;
+}
+
+bool DepthShmReader::read(royale::DepthData& data){
+   size_t n = (size_t)header->width * header->height;
+   z.resize(n);
+   confidence.resize(n);
+   while(true){
+      uint64_t written = header->written.load(memory_order_acquire);
+      if(written <= next) return false;
+      // the newest frame; the ones before it are late already
+      uint64_t frame = written - 1;
+      skipped += frame - next;
+      const char* base = (const char*)memory + headerBytes() + (frame % header->slots) * header->slotBytes;
+      const DepthShmSlot* slot = (const DepthShmSlot*)base;
+      if(slot->frame.load(memory_order_acquire) != frame + 1){
+         next = frame;
+         continue;
+      }
+      int64_t timestamp = slot->timestamp;
+      memcpy(&z[0], base + sizeof(DepthShmSlot), n * sizeof(float));
+      memcpy(&confidence[0], base + sizeof(DepthShmSlot) + n * sizeof(float), n);
+      atomic_thread_fence(memory_order_acquire);
+      next = frame + 1;
+      // torn by the producer coming round again
+      if(slot->frame.load(memory_order_relaxed) != frame + 1){
+         skipped++;
+         continue;
+      }
+      fillPoints(data, getSize(), &z[0], &confidence[0], timestamp);
+      return true;
+   }
+}
@@ -0,0 +1,402 @@
+#include "DepthPipeline.h"
+#include "TilePool.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIPELINE_NEON 1
+#endif
+
+// vqrdmulh by this is a rounded division by 25: (2 * 1311 * s + 2^15) >> 16
+static const int16_t boxScale = 1311;
+
+static inline int16_t addSat(int16_t a, int16_t b){
+   return saturate_cast<int16_t>((int)a + b);
+}
+
+static inline int16_t scaleBox(int16_t s){
+   return saturate_cast<int16_t>((2 * (int)s * boxScale + (1 << 15)) >> 16);
+}
+
+// Border index of cv::BORDER_REFLECT_101
+static inline int reflect101(int i, int n){
+   if(i < 0) return -i;
+   if(i >= n) return 2 * n - 2 - i;
+   return i;
+}
+
+// 2x2 means of src into the tile of dst, which is half src's size
+static void halveTile(const Mat& src, Mat& dst, const Rect& tile){
+   int x1 = tile.x + tile.width;
+   for(int y = tile.y; y < tile.y + tile.height; y++){
+      int x = tile.x;
+      if(src.type() == CV_16SC1){
+         const int16_t* a = src.ptr<int16_t>(2 * y);
+         const int16_t* b = src.ptr<int16_t>(2 * y + 1);
+         int16_t* d = dst.ptr<int16_t>(y);
+#ifdef PIPELINE_NEON
+         // rounding halving adds cannot overflow
+         for(; x + 8 <= x1; x += 8){
+            int16x8x2_t ra = vld2q_s16(a + 2 * x), rb = vld2q_s16(b + 2 * x);
+            int16x8_t va = vrhaddq_s16(ra.val[0], ra.val[1]);
+            int16x8_t vb = vrhaddq_s16(rb.val[0], rb.val[1]);
+            vst1q_s16(d + x, vrhaddq_s16(va, vb));
+         }
+#endif
+         for(; x < x1; x++){
+            int va = (a[2 * x] + a[2 * x + 1] + 1) >> 1;
+            int vb = (b[2 * x] + b[2 * x + 1] + 1) >> 1;
+            d[x] = (int16_t)((va + vb + 1) >> 1);
+         }
+      }
+      else{
+         const float* a = src.ptr<float>(2 * y);
+         const float* b = src.ptr<float>(2 * y + 1);
+         float* d = dst.ptr<float>(y);
+#ifdef PIPELINE_NEON
+         for(; x + 4 <= x1; x += 4){
+            float32x4x2_t ra = vld2q_f32(a + 2 * x), rb = vld2q_f32(b + 2 * x);
+            float32x4_t sum = vaddq_f32(vaddq_f32(ra.val[0], ra.val[1]), vaddq_f32(rb.val[0], rb.val[1]));
+            vst1q_f32(d + x, vmulq_n_f32(sum, 0.25f));
+         }
+#endif
+         for(; x < x1; x++){
+            d[x] = ((a[2 * x] + a[2 * x + 1]) + (b[2 * x] + b[2 * x + 1])) * 0.25f;
+         }
+      }
+   }
+}
+
+// 2x2 means of src into dst, half its size rounded down
+static void halve(const Mat& src, Mat& dst){
+   dst.create(src.rows / 2, src.cols / 2, src.type());
+   // two source rows and one destination row per row of dst
+   parallel_for_tiles(dst.size(), 5 * (int)src.elemSize(), [&](const Rect& tile){
+      halveTile(src, dst, tile);
+   });
+}
+
+template<typename T>
+void DepthPipeline<T>::create(Size size){
+   depth.create(size, Pixel::depthType);
+   background.create(size, Pixel::depthType);
+   diff.create(size, Pixel::heightType);
+   background = Scalar::all(0);
+   resetBackground();
+}
+
+template<typename T>
+void DepthPipeline<T>::clearDepth(){
+   depth = Scalar::all(0);
+}
+
+template<typename T>
+void DepthPipeline<T>::fillWithBackground(){
+   background.copyTo(depth);
+}
+
+template<typename T>
+void DepthPipeline<T>::resetBackground(){
+   accum.create(depth.size(), Pixel::depthType == CV_32FC1 ? CV_32FC1 : CV_32SC1);
+   accum = Scalar::all(0);
+   frames = 0;
+}
+
+template<typename T>
+void DepthPipeline<T>::setDiff(const Mat& heights){
+   CV_Assert(heights.type() == CV_32FC1);
+   diff.create(heights.size(), Pixel::heightType);
+   parallel_for_tiles(diff.size(), 4 + sizeof(Height), [&](const Rect& tile){
+      Mat part = diff(tile);
+      heights(tile).convertTo(part, Pixel::heightType, Pixel::unitsPerMeter());
+   });
+}
+
+template<typename T>
+void DepthPipeline<T>::remapDiff(const Mat& mapX, const Mat& mapY){
+   // same interpolation and border as cv::undistort; every tile reads all of
+   // diff, so the result goes to temp
+   temp.create(mapX.size(), diff.type());
+   parallel_for_tiles(temp.size(), 2 * sizeof(Height) + 8, [&](const Rect& tile){
+      Mat part = temp(tile);
+      remap(diff, part, mapX(tile), mapY(tile), INTER_LINEAR, BORDER_CONSTANT);
+   });
+   cv::swap(diff, temp);
+}
+
+template<typename T>
+void DepthPipeline<T>::threshold(float level, BitMask& mask) const{
+   mask.create(diff.rows, diff.cols);
+   mask.clear();
+   // tiles never share a word of the mask
+   parallel_for_tiles(diff.size(), sizeof(Height), [&](const Rect& tile){
+      mask.threshold(diff, planeLevel(diff, level), tile);
+   });
+}
+
+template<typename T>
+void DepthPipeline<T>::threshold(float level, const vector<Rect>& regions, BitMask& mask) const{
+   mask.create(diff.rows, diff.cols);
+   mask.clear();
+   for(size_t i = 0; i < regions.size(); i++){
+      mask.threshold(diff, planeLevel(diff, level), regions[i]);
+   }
+}
+
+template<typename T>
+void DepthPipeline<T>::downsample(int levels, Mat& coarse){
+   CV_Assert(levels >= 1);
+   const Mat* src = &diff;
+   for(int i = 0; i < levels; i++){
+      Mat& dst = i == levels - 1 ? coarse : pyramid[i % 2];
+      halve(*src, dst);
+      src = &dst;
+   }
+}
+
+template<typename T>
+void DepthPipeline<T>::fillInvalid(){
+   parallel_for_tiles(depth.size(), 2 * sizeof(Depth), [&](const Rect& tile){
+      for(int y = tile.y; y < tile.y + tile.height; y++){
+         Depth* z = depth.ptr<Depth>(y);
+         const Depth* b = background.ptr<Depth>(y);
+         for(int x = tile.x; x < tile.x + tile.width; x++){
+            if(z[x] == 0) z[x] = b[x];
+         }
+      }
+   });
+}
+
+// Float pipeline: the planes as they always were, with OpenCV's kernels
+
+template<>
+void DepthPipeline<float>::addBackground(){
+   parallel_for_tiles(depth.size(), 8, [&](const Rect& tile){
+      Mat part = accum(tile);
+      part += depth(tile);
+   });
+   frames++;
+}
+
+template<>
+void DepthPipeline<float>::endBackground(){
+   if(frames == 0) return;
+   accum.convertTo(background, CV_32FC1, 1.0 / frames);
+}
+
+template<>
+void DepthPipeline<float>::difference(){
+   parallel_for_tiles(depth.size(), 12, [&](const Rect& tile){
+      Mat part = diff(tile);
+      subtract(background(tile), depth(tile), part);
+   });
+}
+
+// Horizontal 5-sums of src into tmp, for rows [y0, y1) and columns [x0, x1);
+// OpenCV's boxFilter would build a filter engine, on the heap, per call
+static void boxRowsFloat(const Mat& src, Mat& tmp, int y0, int y1, int x0, int x1){
+   int cols = src.cols;
+   for(int y = y0; y < y1; y++){
+      const float* s = src.ptr<float>(y);
+      float* t = tmp.ptr<float>(y);
+      int x = x0;
+      for(; x < min(2, x1); x++){
+         float sum = 0;
+         for(int k = -2; k <= 2; k++) sum += s[reflect101(x + k, cols)];
+         t[x] = sum;
+      }
+      for(; x < min(x1, cols - 2); x++){
+         t[x] = s[x - 2] + s[x - 1] + s[x] + s[x + 1] + s[x + 2];
+      }
+      for(; x < x1; x++){
+         float sum = 0;
+         for(int k = -2; k <= 2; k++) sum += s[reflect101(x + k, cols)];
+         t[x] = sum;
+      }
+   }
+}
+
+// Vertical 5-sums of tmp, scaled to means into dst, for the pixels of roi
+static void boxColsFloat(const Mat& tmp, Mat& dst, const Rect& roi){
+   const float scale = 1.0f / 25;
+   int x0 = roi.x, x1 = roi.x + roi.width;
+   for(int y = roi.y; y < roi.y + roi.height; y++){
+      const float* r[5];
+      for(int k = 0; k < 5; k++) r[k] = tmp.ptr<float>(reflect101(y + k - 2, tmp.rows));
+      float* d = dst.ptr<float>(y);
+      for(int x = x0; x < x1; x++){
+         d[x] = (r[0][x] + r[1][x] + r[2][x] + r[3][x] + r[4][x]) * scale;
+      }
+   }
+}
+
+template<>
+void DepthPipeline<float>::boxFilter(){
+   CV_Assert(diff.rows >= 3 && diff.cols >= 3);
+   temp.create(diff.size(), CV_32FC1);
+   // every row sum is in temp before any tile writes diff
+   parallel_for_tiles(diff.size(), 8, [&](const Rect& tile){
+      boxRowsFloat(diff, temp, tile.y, tile.y + tile.height, tile.x, tile.x + tile.width);
+   });
+   parallel_for_tiles(diff.size(), 24, [&](const Rect& tile){
+      boxColsFloat(temp, diff, tile);
+   });
+}
+
+template<>
+void DepthPipeline<float>::boxFilter(const Rect& area){
+   int rows = diff.rows, cols = diff.cols;
+   CV_Assert(rows >= 3 && cols >= 3);
+   Rect roi = area & Rect(0, 0, cols, rows);
+   if(roi.empty()) return;
+   temp.create(rows, cols, CV_32FC1);
+   // row sums for the rows the vertical pass reads
+   boxRowsFloat(diff, temp, max(roi.y - 2, 0), min(roi.y + roi.height + 2, rows), roi.x, roi.x + roi.width);
+   boxColsFloat(temp, diff, roi);
+}
+
+// Integer pipeline: uint16 depth and int16 heights in millimeters. Sums that
+// may leave 16 bits saturate instead of wrapping, so a 5x5 mean is exact up
+// to +-1.3 m and clamps beyond.
+
+template<>
+void DepthPipeline<int16_t>::addBackground(){
+   // widened to 32 bits: twenty frames of 4 m already overflow 16
+   parallel_for_tiles(depth.size(), 6, [&](const Rect& tile){
+      int x1 = tile.x + tile.width;
+      for(int y = tile.y; y < tile.y + tile.height; y++){
+         const uint16_t* z = depth.ptr<uint16_t>(y);
+         uint32_t* a = accum.ptr<uint32_t>(y);
+         int x = tile.x;
+#ifdef PIPELINE_NEON
+         for(; x + 8 <= x1; x += 8){
+            uint16x8_t v = vld1q_u16(z + x);
+            vst1q_u32(a + x, vaddw_u16(vld1q_u32(a + x), vget_low_u16(v)));
+            vst1q_u32(a + x + 4, vaddw_u16(vld1q_u32(a + x + 4), vget_high_u16(v)));
+         }
+#endif
+         for(; x < x1; x++){
+            a[x] += z[x];
+         }
+      }
+   });
+   frames++;
+}
+
+template<>
+void DepthPipeline<int16_t>::endBackground(){
+   if(frames == 0) return;
+   uint32_t half = frames / 2;
+   for(int y = 0; y < depth.rows; y++){
+      const uint32_t* a = accum.ptr<uint32_t>(y);
+      uint16_t* b = background.ptr<uint16_t>(y);
+      for(int x = 0; x < depth.cols; x++){
+         b[x] = (uint16_t)((a[x] + half) / frames);
+      }
+   }
+}
+
+template<>
+void DepthPipeline<int16_t>::difference(){
+   parallel_for_tiles(depth.size(), 6, [&](const Rect& tile){
+      int x1 = tile.x + tile.width;
+      for(int y = tile.y; y < tile.y + tile.height; y++){
+         const uint16_t* b = background.ptr<uint16_t>(y);
+         const uint16_t* z = depth.ptr<uint16_t>(y);
+         int16_t* d = diff.ptr<int16_t>(y);
+         int x = tile.x;
+#ifdef PIPELINE_NEON
+         // depths past 32.767 m clamp, then the signed difference saturates
+         uint16x8_t top = vdupq_n_u16(32767);
+         for(; x + 8 <= x1; x += 8){
+            int16x8_t vb = vreinterpretq_s16_u16(vminq_u16(vld1q_u16(b + x), top));
+            int16x8_t vz = vreinterpretq_s16_u16(vminq_u16(vld1q_u16(z + x), top));
+            vst1q_s16(d + x, vqsubq_s16(vb, vz));
+         }
+#endif
+         for(; x < x1; x++){
+            d[x] = (int16_t)(min((int)b[x], 32767) - min((int)z[x], 32767));
+         }
+      }
+   });
+}
+
+// Horizontal 5-sums of src into tmp, for rows [y0, y1) and columns [x0, x1)
+static void boxRows(const Mat& src, Mat& tmp, int y0, int y1, int x0, int x1){
+   int cols = src.cols;
+   for(int y = y0; y < y1; y++){
+      const int16_t* s = src.ptr<int16_t>(y);
+      int16_t* t = tmp.ptr<int16_t>(y);
+      int x = x0;
+      for(; x < min(2, x1); x++){
+         int16_t sum = 0;
+         for(int k = -2; k <= 2; k++) sum = addSat(sum, s[reflect101(x + k, cols)]);
+         t[x] = sum;
+      }
+#ifdef PIPELINE_NEON
+      for(; x + 8 <= min(x1, cols - 2); x += 8){
+         int16x8_t sum = vqaddq_s16(vld1q_s16(s + x - 2), vld1q_s16(s + x - 1));
+         sum = vqaddq_s16(sum, vld1q_s16(s + x));
+         sum = vqaddq_s16(sum, vld1q_s16(s + x + 1));
+         vst1q_s16(t + x, vqaddq_s16(sum, vld1q_s16(s + x + 2)));
+      }
+#endif
+      for(; x < x1; x++){
+         int16_t sum = 0;
+         for(int k = -2; k <= 2; k++) sum = addSat(sum, s[reflect101(x + k, cols)]);
+         t[x] = sum;
+      }
+   }
+}
+
+// Vertical 5-sums of tmp, scaled back into dst, for the pixels of roi
+static void boxCols(const Mat& tmp, Mat& dst, const Rect& roi){
+   int x0 = roi.x, x1 = roi.x + roi.width;
+   for(int y = roi.y; y < roi.y + roi.height; y++){
+      const int16_t* r[5];
+      for(int k = 0; k < 5; k++) r[k] = tmp.ptr<int16_t>(reflect101(y + k - 2, tmp.rows));
+      int16_t* d = dst.ptr<int16_t>(y);
+      int x = x0;
+#ifdef PIPELINE_NEON
+      for(; x + 8 <= x1; x += 8){
+         int16x8_t sum = vqaddq_s16(vld1q_s16(r[0] + x), vld1q_s16(r[1] + x));
+         sum = vqaddq_s16(sum, vld1q_s16(r[2] + x));
+         sum = vqaddq_s16(sum, vld1q_s16(r[3] + x));
+         sum = vqaddq_s16(sum, vld1q_s16(r[4] + x));
+         vst1q_s16(d + x, vqrdmulhq_n_s16(sum, boxScale));
+      }
+#endif
+      for(; x < x1; x++){
+         int16_t sum = 0;
+         for(int k = 0; k < 5; k++) sum = addSat(sum, r[k][x]);
+         d[x] = scaleBox(sum);
+      }
+   }
+}
+
+template<>
+void DepthPipeline<int16_t>::boxFilter(){
+   CV_Assert(diff.rows >= 3 && diff.cols >= 3);
+   temp.create(diff.size(), CV_16SC1);
+   // every row sum is in temp before any tile writes diff
+   parallel_for_tiles(diff.size(), 4, [&](const Rect& tile){
+      boxRows(diff, temp, tile.y, tile.y + tile.height, tile.x, tile.x + tile.width);
+   });
+   parallel_for_tiles(diff.size(), 12, [&](const Rect& tile){
+      boxCols(temp, diff, tile);
+   });
+}
+
+template<>
+void DepthPipeline<int16_t>::boxFilter(const Rect& area){
+   int rows = diff.rows, cols = diff.cols;
+   CV_Assert(rows >= 3 && cols >= 3);
+   Rect roi = area & Rect(0, 0, cols, rows);
+   if(roi.empty()) return;
+   temp.create(rows, cols, CV_16SC1);
+   // row sums for the rows the vertical pass reads
+   boxRows(diff, temp, max(roi.y - 2, 0), min(roi.y + roi.height + 2, rows), roi.x, roi.x + roi.width);
+   boxCols(temp, diff, roi);
+}
+
+template class DepthPipeline<float>;
+template class DepthPipeline<int16_t>;
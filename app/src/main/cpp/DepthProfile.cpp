@@ -0,0 +1,140 @@
+#include "DepthProfile.h"
+#include <algorithm>
+#include <cmath>
+
+static const float heightBin = 0.005f;
+static const float slopeBase = 0.0005f;
+
+// Below this a blob is a card or sheet lying on the table
+static const float flatHeight = 0.015f;
+// a tilted card fits a plane closer than this
+static const float flatResidual = 0.002f;
+
+static inline int slopeBin(float slope){
+   int b = 0;
+   for(float edge = slopeBase; b < DepthProfile::slopeBins - 1 && slope >= edge; edge *= 2){
+      b++;
+   }
+   return b;
+}
+
+void DepthProfile::addRun(const Mat& heights, int y, int x0, int x1){
+   CV_Assert(heights.type() == CV_32FC1 || heights.type() == CV_16SC1);
+   if(heights.type() == CV_16SC1) addRunOf<int16_t>(heights, y, x0, x1);
+   else addRunOf<float>(heights, y, x0, x1);
+}
+
+template<typename T>
+void DepthProfile::addRunOf(const Mat& heights, int y, int x0, int x1){
+   const T* row = heights.ptr<T>(y);
+   const T* up = heights.ptr<T>(max(y - 1, 0));
+   const T* down = heights.ptr<T>(min(y + 1, heights.rows - 1));
+   int last = heights.cols - 1;
+   double rowSum = 0, rowX = 0, rowXX = 0, rowH = 0, rowXH = 0, rowHH = 0;
+   for(int x = x0; x <= x1; x++){
+      float h = heightMeters(row[x]);
+      maxHeight = max(maxHeight, h);
+      int bin = (int)(h / heightBin);
+      heightHist[min(max(bin, 0), heightBins - 1)]++;
+
+      float gx = (heightMeters(row[min(x + 1, last)]) - heightMeters(row[max(x - 1, 0)])) / 2;
+      float gy = (heightMeters(down[x]) - heightMeters(up[x])) / 2;
+      slopeHist[slopeBin(sqrt(gx * gx + gy * gy))]++;
+
+      rowSum++;
+      rowX += x;
+      rowXX += (double)x * x;
+      rowH += h;
+      rowXH += x * h;
+      rowHH += h * h;
+   }
+   count += x1 - x0 + 1;
+   sumHeight += rowH;
+   sx += rowX;
+   sy += rowSum * y;
+   sxx += rowXX;
+   sxy += rowX * y;
+   syy += rowSum * y * y;
+   sxh += rowXH;
+   syh += rowH * y;
+   shh += rowHH;
+}
+
+void DepthProfile::merge(const DepthProfile& other){
+   count += other.count;
+   maxHeight = max(maxHeight, other.maxHeight);
+   sumHeight += other.sumHeight;
+   sx += other.sx;
+   sy += other.sy;
+   sxx += other.sxx;
+   sxy += other.sxy;
+   syy += other.syy;
+   sxh += other.sxh;
+   syh += other.syh;
+   shh += other.shh;
+   for(int i = 0; i < heightBins; i++) heightHist[i] += other.heightHist[i];
+   for(int i = 0; i < slopeBins; i++) slopeHist[i] += other.slopeHist[i];
+}
+
+float DepthProfile::getMeanHeight() const{
+   return count ? (float)(sumHeight / count) : 0;
+}
+
+float DepthProfile::getPlaneResidual() const{
+   if(count < 3) return 0;
+   // normal equations of the fit, solved around the centroid
+   double n = count;
+   double mx = sx / n, my = sy / n, mh = sumHeight / n;
+   double cxx = sxx / n - mx * mx, cxy = sxy / n - mx * my, cyy = syy / n - my * my;
+   double cxh = sxh / n - mx * mh, cyh = syh / n - my * mh, chh = shh / n - mh * mh;
+   double det = cxx * cyy - cxy * cxy;
+   double explained = 0;
+   if(fabs(det) > 1e-9){
+      double a = (cyy * cxh - cxy * cyh) / det;
+      double b = (cxx * cyh - cxy * cxh) / det;
+      explained = a * cxh + b * cyh;
+   }
+   return (float)sqrt(max(chh - explained, 0.0));
+}
+
+float DepthProfile::getPlateau(float fraction) const{
+   if(count == 0) return 0;
+   int first = min((int)(fraction * maxHeight / heightBin), heightBins - 1);
+   int n = 0;
+   for(int i = first; i < heightBins; i++) n += heightHist[i];
+   return (float)n / count;
+}
+
+string classifyDepthProfile(const DepthProfile& p, const string& type2d){
+   if(p.count == 0) return "OTR";
+   if(p.maxHeight < flatHeight || p.getPlaneResidual() < flatResidual) return "FLAT";
+
+   // mean over max height is the volume over that of the bounding prism:
+   // 1 for a box, 1/3 for a pyramid or cone, 2/3 for a dome, pi/4 for a
+   // cylinder lying on its side. The 5x5 filter rounds all of them off.
+   float fill = p.getMeanHeight() / p.maxHeight;
+   float plateau = p.getPlateau(0.9f);
+   float level = (float)p.slopeHist[0] / p.count;
+   // planar faces put most slopes into one or two neighbouring bins
+   float faces = 0;
+   for(int i = 1; i + 1 < DepthProfile::slopeBins; i++){
+      faces = max(faces, (float)(p.slopeHist[i] + p.slopeHist[i + 1]) / p.count);
+   }
+   bool round = type2d == "CIR" || type2d == "ELL";
+   bool elongated = type2d == "RECT" || type2d == "ELL";
+
+   if(level > 0.3f){
+      // a level top with steep sides; a standing cylinder looks like a box
+      return type2d == "CIR" ? "CYL" : "BOX";
+   }
+   if(faces > 0.65f && fill < 0.47f && plateau < 0.2f){
+      // sloped faces meeting at an apex
+      return "PYR";
+   }
+   if(fill < 0.85f){
+      // a lying cylinder keeps a level ridge along its length
+      if(elongated && level > 0.08f) return "CYL";
+      if(round) return "SPH";
+   }
+   return "OTR";
+}
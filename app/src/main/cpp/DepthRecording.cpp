@@ -0,0 +1,167 @@
+#include "DepthRecording.h"
+#include <chrono>
+#include <cstring>
+
+const uint32_t RecordingReader::maxSide;
+const uint32_t RecordingReader::maxObjects;
+
+bool RecordingWriter::open(const string& path, Size size, const Mat& cameraMatrix, const Mat& distortion,
+                           bool groundTruth){
+   close();
+   file.open(path.c_str(), ios::binary | ios::trunc);
+   if(!file.is_open()) return false;
+   header = RecordingHeader();
+   header.width = size.width;
+   header.height = size.height;
+   header.groundTruth = groundTruth;
+   if(!cameraMatrix.empty()){
+      Mat m;
+      cameraMatrix.reshape(1, 1).convertTo(m, CV_64FC1);
+      for(int i = 0; i < 9; i++) header.cameraMatrix[i] = m.at<double>(0, i);
+   }
+   if(!distortion.empty()){
+      Mat d;
+      distortion.reshape(1, 1).convertTo(d, CV_64FC1);
+      for(int i = 0; i < min(5, d.cols); i++) header.distortion[i] = d.at<double>(0, i);
+   }
+   frames = 0;
+   file.write((const char*)&header, sizeof(header));
+   return file.good();
+}
+
+bool RecordingWriter::write(const royale::DepthData& data, const Mat* labels, const vector<SceneObject>* objects){
+   size_t n = (size_t)header.width * header.height;
+   if(!file.is_open() || data.points.size() != n) return false;
+   bool truth = header.groundTruth != 0;
+   if(truth) CV_Assert(labels && labels->type() == CV_8UC1 && labels->size() == Size(header.width, header.height));
+
+   z.resize(n);
+   confidence.resize(n);
+   for(size_t i = 0; i < n; i++){
+      z[i] = data.points[i].z;
+      confidence[i] = data.points[i].depthConfidence;
+   }
+   RecordingFrame frame;
+   frame.objects = truth && objects ? (uint32_t)objects->size() : 0;
+   frame.bytes = (uint32_t)(n * (sizeof(float) + 1) + (truth ? n + frame.objects * sizeof(SceneObject) : 0));
+   frame.timestamp = data.timeStamp.count();
+
+   file.write((const char*)&frame, sizeof(frame));
+   file.write((const char*)&z[0], n * sizeof(float));
+   file.write((const char*)&confidence[0], n);
+   if(truth){
+      for(int y = 0; y < labels->rows; y++){
+         file.write((const char*)labels->ptr<uchar>(y), labels->cols);
+      }
+      if(frame.objects > 0){
+         file.write((const char*)&(*objects)[0], frame.objects * sizeof(SceneObject));
+      }
+   }
+   frames++;
+   return file.good();
+}
+
+void RecordingWriter::close(){
+   if(file.is_open()) file.close();
+}
+
+bool RecordingReader::open(const string& path){
+   file.close();
+   file.clear();
+   file.open(path.c_str(), ios::binary);
+   if(!file.is_open()) return false;
+   file.seekg(0, ios::end);
+   fileBytes = (int64_t)file.tellg();
+   file.seekg(0, ios::beg);
+   RecordingHeader expected;
+   file.read((char*)&header, sizeof(header));
+   if(!file.good() || memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version ||
+      header.width == 0 || header.height == 0 || header.width > maxSide || header.height > maxSide){
+      file.close();
+      return false;
+   }
+   cameraMatrix.release();
+   distortion.release();
+   if(header.cameraMatrix[0] != 0){
+      cameraMatrix = Mat(3, 3, CV_64FC1, header.cameraMatrix).clone();
+      distortion = Mat(1, 5, CV_64FC1, header.distortion).clone();
+   }
+   return true;
+}
+
+bool RecordingReader::readFrame(RecordingFrame& frame){
+   if(!file.read((char*)&frame, sizeof(frame))) return false;
+   // the size the writer gives a frame of this recording
+   uint64_t n = (uint64_t)header.width * header.height;
+   uint64_t bytes = n * (sizeof(float) + 1);
+   if(header.groundTruth) bytes += n + (uint64_t)frame.objects * sizeof(SceneObject);
+   int64_t position = (int64_t)file.tellg();
+   if(frame.objects > maxObjects || (!header.groundTruth && frame.objects != 0) || frame.bytes != bytes ||
+      position < 0 || position + (int64_t)bytes > fileBytes){
+      file.setstate(ios::failbit);
+      return false;
+   }
+   return true;
+}
+
+bool RecordingReader::read(royale::DepthData& data, Mat* labels, vector<SceneObject>* objects){
+   RecordingFrame frame;
+   if(!readFrame(frame)) return false;
+   size_t n = (size_t)header.width * header.height;
+   z.resize(n);
+   confidence.resize(n);
+   file.read((char*)&z[0], n * sizeof(float));
+   file.read((char*)&confidence[0], n);
+   if(!file) return false;
+
+   data.width = (uint16_t)header.width;
+   data.height = (uint16_t)header.height;
+   data.timeStamp = chrono::microseconds(frame.timestamp);
+   data.points.resize(n);
+   for(size_t i = 0; i < n; i++){
+      royale::DepthPoint& p = data.points[i];
+      memset(&p, 0, sizeof(p));
+      p.z = z[i];
+      p.depthConfidence = confidence[i];
+   }
+
+   if(header.groundTruth){
+      if(labels){
+         labels->create(header.height, header.width, CV_8UC1);
+         for(int y = 0; y < labels->rows; y++){
+            file.read((char*)labels->ptr<uchar>(y), labels->cols);
+         }
+      }
+      else{
+         file.seekg(n, ios::cur);
+      }
+      vector<SceneObject> own;
+      vector<SceneObject>& out = objects ? *objects : own;
+      out.resize(frame.objects);
+      if(frame.objects > 0) file.read((char*)&out[0], frame.objects * sizeof(SceneObject));
+   }
+   else if(labels){
+      labels->release();
+   }
+   return (bool)file;
+}
+
+bool RecordingReader::skip(){
+   RecordingFrame frame;
+   if(!readFrame(frame)) return false;
+   file.seekg(frame.bytes, ios::cur);
+   return (bool)file;
+}
+
+void RecordingReader::rewind(){
+   file.clear();
+   file.seekg(sizeof(RecordingHeader), ios::beg);
+}
+
+int RecordingReader::countFrames(){
+   rewind();
+   int n = 0;
+   while(skip()) n++;
+   rewind();
+   return n;
+}
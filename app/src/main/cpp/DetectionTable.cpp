@@ -0,0 +1,197 @@
+#include "DetectionTable.h"
+#include <algorithm>
+#include <cstring>
+
+// ShapeRecord's fields, in their order
+static const char* const shapeColumns[shapeRecordInts] = {
+   "type", "type3D", "x", "y", "left", "top", "width", "height", "cx", "cy", "cz",
+   "sizeMajor", "sizeMinor", "footprint", "volume", "area", "vertices"
+};
+
+// a group bigger than this is taken for a damaged count
+static const uint32_t maxGroup = 1 << 24;
+
+static DetectionColumn column(const char* name, uint32_t bytes){
+   DetectionColumn c;
+   strncpy(c.name, name, sizeof(c.name) - 1);
+   c.bytes = bytes;
+   return c;
+}
+
+static vector<DetectionColumn> frameColumns(){
+   vector<DetectionColumn> columns;
+   columns.push_back(column("recording", 4));
+   columns.push_back(column("frame", 4));
+   columns.push_back(column("timestamp", 8));
+   columns.push_back(column("detecting", 4));
+   columns.push_back(column("shapes", 4));
+   return columns;
+}
+
+static vector<DetectionColumn> rowColumns(){
+   vector<DetectionColumn> columns;
+   columns.push_back(column("recording", 4));
+   columns.push_back(column("frame", 4));
+   columns.push_back(column("timestamp", 8));
+   for(int i = 0; i < shapeRecordInts; i++) columns.push_back(column(shapeColumns[i], 4));
+   return columns;
+}
+
+bool DetectionTableWriter::open(const string& path, const vector<string>& recordings){
+   close();
+   file.open(path.c_str(), ios::binary | ios::trunc);
+   if(!file.is_open()) return false;
+   vector<DetectionColumn> perFrame = frameColumns();
+   vector<DetectionColumn> columns = rowColumns();
+
+   DetectionTableHeader header;
+   header.recordings = (uint32_t)recordings.size();
+   header.frameColumns = (uint32_t)perFrame.size();
+   header.columns = (uint32_t)columns.size();
+   file.write((const char*)&header, sizeof(header));
+   for(size_t i = 0; i < recordings.size(); i++){
+      uint32_t length = (uint32_t)recordings[i].size();
+      file.write((const char*)&length, sizeof(length));
+      file.write(recordings[i].data(), length);
+   }
+   file.write((const char*)&perFrame[0], perFrame.size() * sizeof(DetectionColumn));
+   file.write((const char*)&columns[0], columns.size() * sizeof(DetectionColumn));
+   frames = rows = 0;
+   return file.good();
+}
+
+bool DetectionTableWriter::write(const vector<DetectionFrame>& frameGroup, const vector<DetectionRow>& group){
+   if(!file.is_open()) return false;
+   if(frameGroup.empty()) return true;
+   size_t f = frameGroup.size();
+   uint32_t count = (uint32_t)f;
+   file.write((const char*)&count, sizeof(count));
+   column32.resize(max(f, group.size()));
+   column64.resize(max(f, group.size()));
+   for(size_t i = 0; i < f; i++) column32[i] = frameGroup[i].recording;
+   file.write((const char*)&column32[0], f * sizeof(int32_t));
+   for(size_t i = 0; i < f; i++) column32[i] = frameGroup[i].frame;
+   file.write((const char*)&column32[0], f * sizeof(int32_t));
+   for(size_t i = 0; i < f; i++) column64[i] = frameGroup[i].timestamp;
+   file.write((const char*)&column64[0], f * sizeof(int64_t));
+   for(size_t i = 0; i < f; i++) column32[i] = frameGroup[i].detecting;
+   file.write((const char*)&column32[0], f * sizeof(int32_t));
+   for(size_t i = 0; i < f; i++) column32[i] = frameGroup[i].shapes;
+   file.write((const char*)&column32[0], f * sizeof(int32_t));
+   frames += f;
+
+   size_t n = group.size();
+   count = (uint32_t)n;
+   file.write((const char*)&count, sizeof(count));
+   if(n == 0) return file.good();
+   for(size_t i = 0; i < n; i++) column32[i] = group[i].recording;
+   file.write((const char*)&column32[0], n * sizeof(int32_t));
+   for(size_t i = 0; i < n; i++) column32[i] = group[i].frame;
+   file.write((const char*)&column32[0], n * sizeof(int32_t));
+   for(size_t i = 0; i < n; i++) column64[i] = group[i].timestamp;
+   file.write((const char*)&column64[0], n * sizeof(int64_t));
+   // the record is nothing but int32 fields
+   for(int c = 0; c < shapeRecordInts; c++){
+      for(size_t i = 0; i < n; i++) column32[i] = ((const int32_t*)&group[i].shape)[c];
+      file.write((const char*)&column32[0], n * sizeof(int32_t));
+   }
+   rows += n;
+   return file.good();
+}
+
+void DetectionTableWriter::close(){
+   if(file.is_open()) file.close();
+}
+
+// The columns in the file must be the ones the writer writes
+static bool sameColumns(ifstream& file, const vector<DetectionColumn>& expected){
+   vector<DetectionColumn> columns(expected.size());
+   if(!file.read((char*)&columns[0], columns.size() * sizeof(DetectionColumn))) return false;
+   for(size_t i = 0; i < columns.size(); i++){
+      if(strncmp(columns[i].name, expected[i].name, sizeof(columns[i].name)) != 0 ||
+         columns[i].bytes != expected[i].bytes){
+         return false;
+      }
+   }
+   return true;
+}
+
+bool DetectionTableReader::open(const string& path){
+   if(file.is_open()) file.close();
+   file.clear();
+   damaged = false;
+   recordings.clear();
+   file.open(path.c_str(), ios::binary);
+   DetectionTableHeader header, expected;
+   if(!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, expected.magic, 4) != 0 ||
+      header.version != expected.version || header.frameColumns != frameColumns().size() ||
+      header.columns != rowColumns().size() || header.recordings > maxGroup){
+      return false;
+   }
+   for(uint32_t i = 0; i < header.recordings; i++){
+      uint32_t length = 0;
+      if(!file.read((char*)&length, sizeof(length)) || length > 4096) return false;
+      string recording(length, '\0');
+      if(length > 0 && !file.read(&recording[0], length)) return false;
+      recordings.push_back(recording);
+   }
+   return sameColumns(file, frameColumns()) && sameColumns(file, rowColumns());
+}
+
+bool DetectionTableReader::readColumn32(size_t n){
+   column32.resize(n);
+   return n == 0 || file.read((char*)&column32[0], n * sizeof(int32_t));
+}
+
+bool DetectionTableReader::readColumn64(size_t n){
+   column64.resize(n);
+   return n == 0 || file.read((char*)&column64[0], n * sizeof(int64_t));
+}
+
+bool DetectionTableReader::read(vector<DetectionFrame>& frames, vector<DetectionRow>& rows){
+   frames.clear();
+   rows.clear();
+   if(!file.is_open() || damaged) return false;
+   uint32_t count = 0;
+   file.read((char*)&count, sizeof(count));
+   // a clean end falls between groups
+   if(file.gcount() == 0 && file.eof()) return false;
+   damaged = true;
+   if(!file || count == 0 || count > maxGroup) return false;
+
+   size_t f = count;
+   frames.resize(f);
+   if(!readColumn32(f)) return false;
+   for(size_t i = 0; i < f; i++) frames[i].recording = column32[i];
+   if(!readColumn32(f)) return false;
+   for(size_t i = 0; i < f; i++) frames[i].frame = column32[i];
+   if(!readColumn64(f)) return false;
+   for(size_t i = 0; i < f; i++) frames[i].timestamp = column64[i];
+   if(!readColumn32(f)) return false;
+   for(size_t i = 0; i < f; i++) frames[i].detecting = column32[i];
+   if(!readColumn32(f)) return false;
+   uint64_t shapes = 0;
+   for(size_t i = 0; i < f; i++){
+      frames[i].shapes = column32[i];
+      if(column32[i] < 0 || frames[i].recording < 0 || frames[i].recording >= (int32_t)recordings.size()){
+         return false;
+      }
+      shapes += column32[i];
+   }
+
+   if(!file.read((char*)&count, sizeof(count)) || count != shapes) return false;
+   size_t n = count;
+   rows.resize(n);
+   if(!readColumn32(n)) return false;
+   for(size_t i = 0; i < n; i++) rows[i].recording = column32[i];
+   if(!readColumn32(n)) return false;
+   for(size_t i = 0; i < n; i++) rows[i].frame = column32[i];
+   if(!readColumn64(n)) return false;
+   for(size_t i = 0; i < n; i++) rows[i].timestamp = column64[i];
+   for(int c = 0; c < shapeRecordInts; c++){
+      if(!readColumn32(n)) return false;
+      for(size_t i = 0; i < n; i++) ((int32_t*)&rows[i].shape)[c] = column32[i];
+   }
+   damaged = false;
+   return true;
+}
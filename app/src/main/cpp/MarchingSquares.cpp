@@ -0,0 +1,150 @@
+#include "MarchingSquares.h"
+
+// Cell edges
+enum { T, R, B, L };
+
+// Oriented segments (from edge, to edge) per cell case, bits tl=8 tr=4 br=2
+// bl=1 set for corners above the level. Every segment keeps the inside on
+// the same side, so segments chain into closed loops. Saddles (5, 10) are
+// listed for a centre below the level; see saddleAbove for the other case.
+static const int segments[16][5] = {
+   { 0 },
+   { 1, B, L },
+   { 1, R, B },
+   { 1, R, L },
+   { 1, T, R },
+   { 2, T, R, B, L },
+   { 1, T, B },
+   { 1, T, L },
+   { 1, L, T },
+   { 1, B, T },
+   { 2, L, T, R, B },
+   { 1, R, T },
+   { 1, L, R },
+   { 1, B, R },
+   { 1, L, B },
+   { 0 },
+};
+
+// Saddles with the centre above the level join the two inside corners,
+// like the 8-connected mask does
+static const int saddleAbove5[5] = { 2, T, L, B, R };
+static const int saddleAbove10[5] = { 2, R, T, L, B };
+
+Point2f MarchingSquares::vertex(int edge, float level) const{
+   int gw = grid.cols;
+   int nH = grid.rows * (gw - 1);
+   if(edge < nH){
+      int y = edge / (gw - 1), x = edge % (gw - 1);
+      float a = grid.at<float>(y, x), b = grid.at<float>(y, x + 1);
+      return Point2f(x + (level - a) / (b - a), (float)y);
+   }
+   edge -= nH;
+   int y = edge / gw, x = edge % gw;
+   float a = grid.at<float>(y, x), b = grid.at<float>(y + 1, x);
+   return Point2f((float)x, y + (level - a) / (b - a));
+}
+
+void MarchingSquares::findContours(const Mat& src, float level, Rect roi, float background,
+                                   vector<vector<Point2f> >& contours){
+   int n = trace(src, level, roi, background);
+   contours.resize(n);
+   for(int i = 0; i < n; i++){
+      contours[i].assign(points.begin() + loopStart[i], points.begin() + loopStart[i + 1]);
+   }
+}
+
+void MarchingSquares::reserve(Size size){
+   size_t cells = (size_t)(size.width + 2) * (size.height + 2);
+   if(gridBuffer.size() < cells) gridBuffer.resize(cells);
+   // every edge is on one loop at most, and a loop takes four edges or more
+   next.reserve(2 * cells);
+   points.reserve(2 * cells);
+   loopStart.reserve(cells / 2 + 1);
+}
+
+// The loops go one after the other into points, which keeps its capacity
+// from frame to frame, as does the grid buffer: a steady frame allocates
+// nothing here. Returns the number of loops.
+int MarchingSquares::trace(const Mat& src, float level, Rect roi, float background){
+   CV_Assert(src.type() == CV_32FC1 || src.type() == CV_16SC1);
+   points.clear();
+   loopStart.assign(1, 0);
+   roi &= Rect(0, 0, src.cols, src.rows);
+   if(roi.empty()) return 0;
+
+   int gw = roi.width + 2, gh = roi.height + 2;
+   if(gridBuffer.size() < (size_t)gw * gh) gridBuffer.resize((size_t)gw * gh);
+   grid = Mat(gh, gw, CV_32FC1, &gridBuffer[0]);
+   grid = Scalar::all(background);
+   // the grid is in meters whatever the type of src
+   Mat inside = grid(Rect(1, 1, roi.width, roi.height));
+   src(roi).convertTo(inside, CV_32FC1, src.type() == CV_16SC1 ? 0.001 : 1);
+
+   int nH = gh * (gw - 1);
+   int nV = (gh - 1) * gw;
+   next.assign(nH + nV, -1);
+   for(int y = 0; y + 1 < gh; y++){
+      const float* top = grid.ptr<float>(y);
+      const float* bottom = grid.ptr<float>(y + 1);
+      for(int x = 0; x + 1 < gw; x++){
+         int c = (top[x] > level ? 8 : 0) | (top[x + 1] > level ? 4 : 0) |
+                 (bottom[x + 1] > level ? 2 : 0) | (bottom[x] > level ? 1 : 0);
+         if(c == 0 || c == 15) continue;
+         const int* seg = segments[c];
+         if(c == 5 || c == 10){
+            float centre = (top[x] + top[x + 1] + bottom[x] + bottom[x + 1]) / 4;
+            if(centre > level) seg = c == 5 ? saddleAbove5 : saddleAbove10;
+         }
+         int edge[4];
+         edge[T] = y * (gw - 1) + x;
+         edge[B] = (y + 1) * (gw - 1) + x;
+         edge[L] = nH + y * gw + x;
+         edge[R] = nH + y * gw + x + 1;
+         for(int i = 0; i < seg[0]; i++){
+            next[edge[seg[1 + 2 * i]]] = edge[seg[2 + 2 * i]];
+         }
+      }
+   }
+
+   // the background border closes every loop
+   Point2f offset((float)roi.x - 1, (float)roi.y - 1);
+   for(int start = 0; start < nH + nV; start++){
+      if(next[start] < 0) continue;
+      int e = start;
+      do{
+         points.push_back(vertex(e, level) + offset);
+         int n = next[e];
+         next[e] = -1;
+         e = n;
+      } while(e != start && e >= 0);
+      loopStart.push_back((int)points.size());
+   }
+   return (int)loopStart.size() - 1;
+}
+
+// Shoelace area of points [begin, end), as contourArea gives it
+static double loopArea(const Point2f* begin, const Point2f* end){
+   double a = 0;
+   for(const Point2f* p = begin, * q = end - 1; p != end; q = p++){
+      a += (double)q->x * p->y - (double)p->x * q->y;
+   }
+   return fabs(a) / 2;
+}
+
+bool MarchingSquares::findLargestContour(const Mat& src, float level, Rect roi, float background,
+                                         vector<Point2f>& contour){
+   int n = trace(src, level, roi, background);
+   double best = 0;
+   int bestIdx = -1;
+   for(int i = 0; i < n; i++){
+      double a = loopArea(&points[loopStart[i]], &points[0] + loopStart[i + 1]);
+      if(bestIdx < 0 || a > best){
+         best = a;
+         bestIdx = i;
+      }
+   }
+   if(bestIdx < 0) return false;
+   contour.assign(points.begin() + loopStart[bestIdx], points.begin() + loopStart[bestIdx + 1]);
+   return true;
+}
@@ -0,0 +1,211 @@
+#include "Measure3D.h"
+#include "DepthPixel.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MEASURE_NEON 1
+#endif
+
+void BackProjection::create(const Mat& cameraMatrix, Size size){
+   CV_Assert(cameraMatrix.rows == 3 && cameraMatrix.cols == 3);
+   Mat k;
+   cameraMatrix.convertTo(k, CV_64F);
+   fx = (float)k.at<double>(0, 0);
+   fy = (float)k.at<double>(1, 1);
+   double cx = k.at<double>(0, 2), cy = k.at<double>(1, 2);
+   rayX.resize(size.width);
+   rayY.resize(size.height);
+   for(int u = 0; u < size.width; u++) rayX[u] = (float)((u - cx) / fx);
+   for(int v = 0; v < size.height; v++) rayY[v] = (float)((v - cy) / fy);
+}
+
+// Sums over one run that do not depend on the row
+struct RunSums {
+   float zb = 0, zb2 = 0, hzb2 = 0, z = 0, xz = 0, xzb = 0, xzb2 = 0, xxzb2 = 0;
+};
+
+#ifdef MEASURE_NEON
+static inline float sum4(float32x4_t v){
+   float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+   return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+static inline float min4(float32x4_t v){
+   float32x2_t m = vmin_f32(vget_low_f32(v), vget_high_f32(v));
+   return vget_lane_f32(vpmin_f32(m, m), 0);
+}
+
+static inline float max4(float32x4_t v){
+   float32x2_t m = vmax_f32(vget_low_f32(v), vget_high_f32(v));
+   return vget_lane_f32(vpmax_f32(m, m), 0);
+}
+#endif
+
+#ifdef MEASURE_NEON
+static inline float32x4_t loadHeights(const float* h){
+   return vld1q_f32(h);
+}
+
+static inline float32x4_t loadHeights(const int16_t* h){
+   int16x4_t v = vld1_s16(h);
+   return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v)), 0.001f);
+}
+#endif
+
+template<typename T>
+static void sumRun(const T* h, const float* zb, const float* rx, int n, RunSums& s){
+   int i = 0;
+#ifdef MEASURE_NEON
+   float32x4_t zero = vdupq_n_f32(0);
+   float32x4_t azb = zero, azb2 = zero, ahzb2 = zero, az = zero;
+   float32x4_t axz = zero, axzb = zero, axzb2 = zero, axxzb2 = zero;
+   for(; i + 4 <= n; i += 4){
+      float32x4_t vh = loadHeights(h + i), vzb = vld1q_f32(zb + i), vx = vld1q_f32(rx + i);
+      float32x4_t zb2 = vmulq_f32(vzb, vzb);
+      float32x4_t z = vsubq_f32(vzb, vh);
+      float32x4_t xzb2 = vmulq_f32(vx, zb2);
+      azb = vaddq_f32(azb, vzb);
+      azb2 = vaddq_f32(azb2, zb2);
+      ahzb2 = vmlaq_f32(ahzb2, vh, zb2);
+      az = vaddq_f32(az, z);
+      axz = vmlaq_f32(axz, vx, z);
+      axzb = vmlaq_f32(axzb, vx, vzb);
+      axzb2 = vaddq_f32(axzb2, xzb2);
+      axxzb2 = vmlaq_f32(axxzb2, vx, xzb2);
+   }
+   s.zb = sum4(azb);
+   s.zb2 = sum4(azb2);
+   s.hzb2 = sum4(ahzb2);
+   s.z = sum4(az);
+   s.xz = sum4(axz);
+   s.xzb = sum4(axzb);
+   s.xzb2 = sum4(axzb2);
+   s.xxzb2 = sum4(axxzb2);
+#endif
+   for(; i < n; i++){
+      float hi = heightMeters(h[i]);
+      float zb2 = zb[i] * zb[i];
+      float z = zb[i] - hi;
+      s.zb += zb[i];
+      s.zb2 += zb2;
+      s.hzb2 += hi * zb2;
+      s.z += z;
+      s.xz += rx[i] * z;
+      s.xzb += rx[i] * zb[i];
+      s.xzb2 += rx[i] * zb2;
+      s.xxzb2 += rx[i] * rx[i] * zb2;
+   }
+}
+
+// Extents of the footprint points of one run projected on the axes (c, s)
+// and (-s, c); ry is the row's ray
+static void extentRun(const float* zb, const float* rx, float ry, int n, float c, float s, Vec4f& e){
+   int i = 0;
+#ifdef MEASURE_NEON
+   if(n >= 4){
+      float32x4_t minU = vdupq_n_f32(FLT_MAX), maxU = vdupq_n_f32(-FLT_MAX);
+      float32x4_t minV = minU, maxV = maxU;
+      float32x4_t ryS = vdupq_n_f32(ry * s), ryC = vdupq_n_f32(ry * c);
+      for(; i + 4 <= n; i += 4){
+         float32x4_t vzb = vld1q_f32(zb + i), vx = vld1q_f32(rx + i);
+         float32x4_t u = vmulq_f32(vzb, vmlaq_n_f32(ryS, vx, c));
+         float32x4_t v = vmulq_f32(vzb, vmlsq_n_f32(ryC, vx, s));
+         minU = vminq_f32(minU, u);
+         maxU = vmaxq_f32(maxU, u);
+         minV = vminq_f32(minV, v);
+         maxV = vmaxq_f32(maxV, v);
+      }
+      e[0] = min(e[0], min4(minU));
+      e[1] = max(e[1], max4(maxU));
+      e[2] = min(e[2], min4(minV));
+      e[3] = max(e[3], max4(maxV));
+   }
+#endif
+   for(; i < n; i++){
+      float u = zb[i] * (rx[i] * c + ry * s);
+      float v = zb[i] * (ry * c - rx[i] * s);
+      e[0] = min(e[0], u);
+      e[1] = max(e[1], u);
+      e[2] = min(e[2], v);
+      e[3] = max(e[3], v);
+   }
+}
+
+void BackProjection::reserve(int blobs){
+   sums.reserve(blobs);
+   extents.reserve(blobs);
+   axes.reserve(blobs);
+}
+
+void BackProjection::measure(const RunLengthMask& mask, const vector<int>& runLabels, int numBlobs,
+                             const Mat& heights, const Mat& background, vector<ShapeMetrics>& metrics){
+   CV_Assert(!empty() && background.type() == CV_32FC1);
+   CV_Assert(heights.type() == CV_32FC1 || heights.type() == CV_16SC1);
+   CV_Assert(heights.cols == (int)rayX.size() && heights.rows == (int)rayY.size());
+   CV_Assert(background.size() == heights.size() && runLabels.size() == mask.runs.size());
+
+   Sums zeroSums = {};
+   sums.assign(numBlobs, zeroSums);
+   bool fixedPoint = heights.type() == CV_16SC1;
+   for(size_t i = 0; i < mask.runs.size(); i++){
+      const Run& r = mask.runs[i];
+      int n = r.x1 - r.x0 + 1;
+      RunSums rs;
+      const float* zb = background.ptr<float>(r.y) + r.x0;
+      if(fixedPoint) sumRun(heights.ptr<int16_t>(r.y) + r.x0, zb, &rayX[r.x0], n, rs);
+      else sumRun(heights.ptr<float>(r.y) + r.x0, zb, &rayX[r.x0], n, rs);
+      double ry = rayY[r.y];
+      Sums& s = sums[runLabels[i]];
+      s.n += n;
+      s.zb += rs.zb;
+      s.zb2 += rs.zb2;
+      s.hzb2 += rs.hzb2;
+      s.z += rs.z;
+      s.xz += rs.xz;
+      s.yz += ry * rs.z;
+      s.px += rs.xzb;
+      s.py += ry * rs.zb;
+      s.pxx += rs.xxzb2;
+      s.pxy += ry * rs.xzb2;
+      s.pyy += ry * ry * rs.zb2;
+   }
+
+   // major axis of the footprint from its second moments
+   metrics.assign(numBlobs, ShapeMetrics());
+   axes.resize(numBlobs);
+   extents.assign(numBlobs, Vec4f(FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX));
+   for(int b = 0; b < numBlobs; b++){
+      const Sums& s = sums[b];
+      if(s.n == 0) continue;
+      double mx = s.px / s.n, my = s.py / s.n;
+      double cxx = s.pxx / s.n - mx * mx, cxy = s.pxy / s.n - mx * my, cyy = s.pyy / s.n - my * my;
+      double theta = 0.5 * atan2(2 * cxy, cxx - cyy);
+      axes[b] = Vec2f((float)cos(theta), (float)sin(theta));
+   }
+
+   for(size_t i = 0; i < mask.runs.size(); i++){
+      const Run& r = mask.runs[i];
+      int b = runLabels[i];
+      extentRun(background.ptr<float>(r.y) + r.x0, &rayX[r.x0], rayY[r.y], r.x1 - r.x0 + 1,
+                axes[b][0], axes[b][1], extents[b]);
+   }
+
+   for(int b = 0; b < numBlobs; b++){
+      const Sums& s = sums[b];
+      if(s.n == 0) continue;
+      ShapeMetrics& m = metrics[b];
+      m.centroid = Point3f((float)(s.xz / s.n), (float)(s.yz / s.n), (float)(s.z / s.n));
+      // extents run between pixel centres, add one pixel
+      double pitch = s.zb / s.n * (1 / fx + 1 / fy) / 2;
+      double a = extents[b][1] - extents[b][0] + pitch;
+      double c = extents[b][3] - extents[b][2] + pitch;
+      m.width = (float)max(a, c);
+      m.height = (float)min(a, c);
+      // every pixel covers zb / fx by zb / fy on the table
+      m.footprint = (float)(s.zb2 / (fx * fy) * 1e4);
+      m.volume = (float)(s.hzb2 / (fx * fy) * 1e6);
+   }
+}
@@ -0,0 +1,138 @@
+#include "PerfCounters.h"
+
+#ifdef SHAPE_PERF_COUNTERS
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+const char* PerfCounters::zoneName(Zone zone){
+   static const char* names[Zones] = { "ingest", "diff", "filter", "segment", "classify", "output" };
+   return zone >= 0 && zone < Zones ? names[zone] : "?";
+}
+
+const char* PerfCounters::eventName(Event event){
+   static const char* names[Events] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+   return event >= 0 && event < Events ? names[event] : "?";
+}
+
+static uint64_t cacheReadMisses(uint64_t cache){
+   return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// The counter group of one thread, opened on its first read and closed when
+// the thread exits
+struct CounterGroup {
+   int fds[PerfCounters::Events];
+   int slot[PerfCounters::Events];   // position in the group's read, -1 if not counted
+   int leader = -1;
+   int members = 0;
+   bool opened = false;
+
+   CounterGroup(){
+      for(int i = 0; i < PerfCounters::Events; i++){
+         fds[i] = -1;
+         slot[i] = -1;
+      }
+   }
+
+   ~CounterGroup(){
+      for(int i = 0; i < PerfCounters::Events; i++){
+         if(fds[i] >= 0) close(fds[i]);
+      }
+   }
+
+   void open(){
+      opened = true;
+      static const uint32_t types[PerfCounters::Events] = {
+         PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+      static const uint64_t configs[PerfCounters::Events] = {
+         PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, cacheReadMisses(PERF_COUNT_HW_CACHE_L1D),
+         cacheReadMisses(PERF_COUNT_HW_CACHE_LL), PERF_COUNT_HW_BRANCH_MISSES };
+      // the first event that opens leads the group, so they run together
+      for(int i = 0; i < PerfCounters::Events; i++){
+         perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size = sizeof(attr);
+         attr.type = types[i];
+         attr.config = configs[i];
+         attr.disabled = leader < 0;
+         attr.exclude_kernel = 1;
+         attr.exclude_hv = 1;
+         attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+         int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+         if(fd < 0) continue;
+         fds[i] = fd;
+         slot[i] = members++;
+         if(leader < 0) leader = fd;
+      }
+      if(leader >= 0) ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+   }
+};
+
+bool PerfCounters::read(uint64_t values[Events]){
+   static thread_local CounterGroup group;
+   if(!group.opened) group.open();
+   if(group.leader < 0) return false;
+   // nr, time enabled, time running, then a value per member
+   uint64_t buffer[3 + Events];
+   ssize_t size = ::read(group.leader, buffer, sizeof(buffer));
+   if(size < (ssize_t)((3 + group.members) * sizeof(uint64_t))) return false;
+   double scale = buffer[2] > 0 && buffer[2] < buffer[1] ? (double)buffer[1] / buffer[2] : 1.0;
+   for(int i = 0; i < Events; i++){
+      values[i] = group.slot[i] < 0 ? 0 : (uint64_t)(buffer[3 + group.slot[i]] * scale);
+   }
+   return true;
+}
+
+void PerfCounters::add(Zone zone, const uint64_t begin[Events], const uint64_t end[Events]){
+   samples[zone]++;
+   for(int i = 0; i < Events; i++){
+      if(end[i] > begin[i]) totals[zone][i] += end[i] - begin[i];
+   }
+}
+
+void PerfCounters::reset(){
+   for(int z = 0; z < Zones; z++){
+      samples[z] = 0;
+      for(int i = 0; i < Events; i++) totals[z][i] = 0;
+   }
+}
+
+string PerfCounters::report() const{
+   string text;
+   char line[160];
+   for(int z = 0; z < Zones; z++){
+      uint64_t n = samples[z].load();
+      if(n == 0) continue;
+      double instructions = (double)totals[z][Instructions].load();
+      double perK = instructions > 0 ? 1000 / instructions : 0;
+      snprintf(line, sizeof(line), "%-10s %8llu x %9.0f cycles, IPC %5.2f, per 1000 instr: L1 %6.2f LLC %6.2f br %6.2f\n",
+               zoneName((Zone)z), (unsigned long long)n, (double)totals[z][Cycles].load() / n,
+               totals[z][Cycles].load() > 0 ? instructions / totals[z][Cycles].load() : 0.0,
+               totals[z][L1Misses].load() * perK, totals[z][LLCMisses].load() * perK,
+               totals[z][BranchMisses].load() * perK);
+      text += line;
+   }
+   return text.empty() ? "no hardware counters\n" : text;
+}
+
+bool PerfCounters::writeCsv(const string& path) const{
+   ofstream file(path.c_str());
+   if(!file.is_open()) return false;
+   file << "zone,samples,tile_threads";
+   for(int i = 0; i < Events; i++) file << "," << eventName((Event)i);
+   file << "\n";
+   for(int z = 0; z < Zones; z++){
+      file << zoneName((Zone)z) << "," << samples[z].load() << "," << tileThreads.load();
+      for(int i = 0; i < Events; i++) file << "," << totals[z][i].load();
+      file << "\n";
+   }
+   return file.good();
+}
+
+#endif
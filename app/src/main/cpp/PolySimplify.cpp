@@ -0,0 +1,210 @@
+#include "PolySimplify.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+template<typename P>
+static int farthestFrom(const vector<P>& c, int from){
+   double best = -1;
+   int idx = from;
+   for(size_t i = 0; i < c.size(); i++){
+      double dx = (double)c[i].x - c[from].x, dy = (double)c[i].y - c[from].y;
+      double d = dx * dx + dy * dy;
+      if(d > best){
+         best = d;
+         idx = (int)i;
+      }
+   }
+   return idx;
+}
+
+template<typename P>
+static void douglasPeucker(const vector<P>& c, double epsilon, bool closed,
+                           SimplifyWorkspace& ws, vector<int>& indices){
+   int n = (int)c.size();
+   indices.clear();
+   if(n <= 2){
+      for(int i = 0; i < n; i++) indices.push_back(i);
+      return;
+   }
+   ws.keep.assign(n, 0);
+   ws.stack.clear();
+
+   // ranges are [start, end] in unwrapped indices, a closed chain may run
+   // past n - 1 back to its start
+   if(closed){
+      int a = farthestFrom(c, 0);
+      int b = farthestFrom(c, a);
+      if(a > b) swap(a, b);
+      ws.keep[a] = ws.keep[b] = 1;
+      ws.stack.push_back(a); ws.stack.push_back(b);
+      ws.stack.push_back(b); ws.stack.push_back(a + n);
+   }
+   else{
+      ws.keep[0] = ws.keep[n - 1] = 1;
+      ws.stack.push_back(0); ws.stack.push_back(n - 1);
+   }
+
+   double eps2 = epsilon * epsilon;
+   while(!ws.stack.empty()){
+      int end = ws.stack.back(); ws.stack.pop_back();
+      int start = ws.stack.back(); ws.stack.pop_back();
+      if(end - start < 2) continue;
+
+      const P& ps = c[start % n];
+      const P& pe = c[end % n];
+      double dx = (double)pe.x - ps.x, dy = (double)pe.y - ps.y;
+      double len2 = dx * dx + dy * dy;
+      // distance to the line through ps and pe, compared squared and scaled
+      // by len2 to avoid the division and square root per point
+      double limit = len2 > 0 ? eps2 * len2 : eps2;
+      double best = -1;
+      int split = -1;
+      for(int k = start + 1; k < end; k++){
+         const P& p = c[k % n];
+         double px = (double)p.x - ps.x, py = (double)p.y - ps.y;
+         double d;
+         if(len2 > 0){
+            double cross = px * dy - py * dx;
+            d = cross * cross;
+         }
+         else{
+            d = px * px + py * py;
+         }
+         if(d > best){
+            best = d;
+            split = k;
+         }
+      }
+      if(best > limit){
+         ws.keep[split % n] = 1;
+         ws.stack.push_back(start); ws.stack.push_back(split);
+         ws.stack.push_back(split); ws.stack.push_back(end);
+      }
+   }
+
+   for(int i = 0; i < n; i++){
+      if(ws.keep[i]) indices.push_back(i);
+   }
+}
+
+// Min-heap of vertex indices keyed by ws.area, ws.heapPos tracks positions
+static void heapSwap(SimplifyWorkspace& ws, int a, int b){
+   swap(ws.heap[a], ws.heap[b]);
+   ws.heapPos[ws.heap[a]] = a;
+   ws.heapPos[ws.heap[b]] = b;
+}
+
+static void siftUp(SimplifyWorkspace& ws, int pos){
+   while(pos > 0){
+      int parent = (pos - 1) / 2;
+      if(ws.area[ws.heap[parent]] <= ws.area[ws.heap[pos]]) break;
+      heapSwap(ws, parent, pos);
+      pos = parent;
+   }
+}
+
+static void siftDown(SimplifyWorkspace& ws, int pos){
+   int size = (int)ws.heap.size();
+   for(;;){
+      int l = 2 * pos + 1, r = l + 1, m = pos;
+      if(l < size && ws.area[ws.heap[l]] < ws.area[ws.heap[m]]) m = l;
+      if(r < size && ws.area[ws.heap[r]] < ws.area[ws.heap[m]]) m = r;
+      if(m == pos) break;
+      heapSwap(ws, m, pos);
+      pos = m;
+   }
+}
+
+template<typename P>
+static float triangleArea(const vector<P>& c, int a, int b, int d){
+   double abx = (double)c[b].x - c[a].x, aby = (double)c[b].y - c[a].y;
+   double adx = (double)c[d].x - c[a].x, ady = (double)c[d].y - c[a].y;
+   return (float)(fabs(abx * ady - aby * adx) / 2);
+}
+
+template<typename P>
+static void visvalingam(const vector<P>& c, double minArea, bool closed,
+                        SimplifyWorkspace& ws, vector<int>& indices){
+   int n = (int)c.size();
+   indices.clear();
+   int minCount = closed ? 3 : 2;
+   if(n <= minCount){
+      for(int i = 0; i < n; i++) indices.push_back(i);
+      return;
+   }
+   ws.prev.resize(n);
+   ws.next.resize(n);
+   ws.area.resize(n);
+   ws.heapPos.resize(n);
+   ws.keep.assign(n, 1);
+   ws.heap.clear();
+   for(int i = 0; i < n; i++){
+      ws.prev[i] = i > 0 ? i - 1 : (closed ? n - 1 : -1);
+      ws.next[i] = i < n - 1 ? i + 1 : (closed ? 0 : -1);
+      if(ws.prev[i] < 0 || ws.next[i] < 0){
+         ws.area[i] = FLT_MAX;   // open ends always stay
+         ws.heapPos[i] = -1;
+         continue;
+      }
+      ws.area[i] = triangleArea(c, ws.prev[i], i, ws.next[i]);
+      ws.heapPos[i] = (int)ws.heap.size();
+      ws.heap.push_back(i);
+   }
+   for(int i = (int)ws.heap.size() / 2 - 1; i >= 0; i--){
+      siftDown(ws, i);
+   }
+
+   int count = n;
+   while(!ws.heap.empty() && count > minCount){
+      int i = ws.heap[0];
+      float removed = ws.area[i];
+      if(removed >= minArea) break;
+      heapSwap(ws, 0, (int)ws.heap.size() - 1);
+      ws.heap.pop_back();
+      ws.heapPos[i] = -1;
+      if(!ws.heap.empty()) siftDown(ws, 0);
+
+      int p = ws.prev[i], q = ws.next[i];
+      ws.next[p] = q;
+      ws.prev[q] = p;
+      ws.keep[i] = 0;
+      count--;
+
+      // neighbours never drop below the area just removed, which keeps the
+      // elimination order monotonic
+      int neighbours[2] = { p, q };
+      for(int j : neighbours){
+         if(ws.heapPos[j] < 0) continue;
+         float a = max(removed, triangleArea(c, ws.prev[j], j, ws.next[j]));
+         float old = ws.area[j];
+         ws.area[j] = a;
+         if(a < old) siftUp(ws, ws.heapPos[j]);
+         else siftDown(ws, ws.heapPos[j]);
+      }
+   }
+
+   for(int i = 0; i < n; i++){
+      if(ws.keep[i]) indices.push_back(i);
+   }
+}
+
+void simplifyDouglasPeucker(const vector<Point>& contour, double epsilon, bool closed,
+                            SimplifyWorkspace& ws, vector<int>& indices){
+   douglasPeucker(contour, epsilon, closed, ws, indices);
+}
+
+void simplifyDouglasPeucker(const vector<Point2f>& contour, double epsilon, bool closed,
+                            SimplifyWorkspace& ws, vector<int>& indices){
+   douglasPeucker(contour, epsilon, closed, ws, indices);
+}
+
+void simplifyVisvalingam(const vector<Point>& contour, double minArea, bool closed,
+                         SimplifyWorkspace& ws, vector<int>& indices){
+   visvalingam(contour, minArea, closed, ws, indices);
+}
+
+void simplifyVisvalingam(const vector<Point2f>& contour, double minArea, bool closed,
+                         SimplifyWorkspace& ws, vector<int>& indices){
+   visvalingam(contour, minArea, closed, ws, indices);
+}
@@ -0,0 +1,185 @@
+#include "ResultRing.h"
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+// Process-shared: readers of other processes sleep on the same word
+static long futex(const atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout){
+   return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+static size_t headerBytes(){
+   return (sizeof(ResultRingHeader) + 63) & ~(size_t)63;
+}
+
+static size_t slotBytes(uint32_t maxRecords, uint32_t maskWords){
+   size_t bytes = sizeof(ResultRingSlot) + maxRecords * sizeof(ShapeRecord) + maskWords * sizeof(uint64_t);
+   return (bytes + 63) & ~(size_t)63;
+}
+
+bool ResultRingWriter::create(const string& path, Size maskSize, bool withMask, int slots, int maxRecords){
+   close();
+   unlink(path.c_str());
+   int fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+   if(fd < 0) return false;
+   // a reader may still be on the slot before the one being written
+   slots = max(slots, 2);
+   uint32_t maskWords = withMask ? (uint32_t)(maskSize.height * ((maskSize.width + 63) / 64)) : 0;
+   bytes = headerBytes() + slots * slotBytes(maxRecords, maskWords);
+   if(ftruncate(fd, bytes) != 0){
+      ::close(fd);
+      unlink(path.c_str());
+      return false;
+   }
+   memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(memory == MAP_FAILED){
+      memory = NULL;
+      unlink(path.c_str());
+      return false;
+   }
+   this->path = path;
+   // the fresh file is zero, every slot free
+   header = new(memory) ResultRingHeader();
+   header->slots = slots;
+   header->maxRecords = maxRecords;
+   header->maskWords = maskWords;
+   header->slotBytes = (uint32_t)slotBytes(maxRecords, maskWords);
+   return true;
+}
+
+void ResultRingWriter::close(){
+   if(memory){
+      munmap(memory, bytes);
+      unlink(path.c_str());
+   }
+   memory = NULL;
+   header = NULL;
+}
+
+void ResultRingWriter::publish(uint64_t index, int64_t timestamp, bool detecting, const vector<ShapeRecord>& records,
+                               const BitMask* mask){
+   if(!header) return;
+   uint64_t sequence = header->published.load(memory_order_relaxed) + 1;
+   char* base = (char*)memory + headerBytes() + (sequence % header->slots) * header->slotBytes;
+   ResultRingSlot* slot = (ResultRingSlot*)base;
+   slot->sequence.store(0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   slot->index = index;
+   slot->timestamp = timestamp;
+   slot->published = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+   slot->detecting = detecting;
+   slot->count = detecting ? (uint32_t)min(records.size(), (size_t)header->maxRecords) : 0;
+   if(slot->count > 0) memcpy(base + sizeof(ResultRingSlot), &records[0], slot->count * sizeof(ShapeRecord));
+   slot->maskRows = slot->maskCols = slot->maskWordsPerRow = 0;
+   if(detecting && mask && (size_t)mask->rows * mask->wordsPerRow <= header->maskWords){
+      uint64_t* words = (uint64_t*)(base + sizeof(ResultRingSlot) + header->maxRecords * sizeof(ShapeRecord));
+      for(int y = 0; y < mask->rows; y++){
+         memcpy(words + (size_t)y * mask->wordsPerRow, mask->row(y), mask->wordsPerRow * sizeof(uint64_t));
+      }
+      slot->maskRows = mask->rows;
+      slot->maskCols = mask->cols;
+      slot->maskWordsPerRow = mask->wordsPerRow;
+   }
+
+   slot->sequence.store(sequence, memory_order_release);
+   header->published.store(sequence, memory_order_release);
+   // a reader that checks published after its waiters increment either sees
+   // this frame or gets woken
+   header->wake.fetch_add(1, memory_order_seq_cst);
+   if(header->waiters.load(memory_order_seq_cst) > 0) futex(&header->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool ResultRingReader::open(const string& path){
+   close();
+   // read-write, as sleeping readers count themselves in the header
+   int fd = ::open(path.c_str(), O_RDWR);
+   if(fd < 0) return false;
+   struct stat info;
+   if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ResultRingHeader)){
+      ::close(fd);
+      return false;
+   }
+   bytes = info.st_size;
+   memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(memory == MAP_FAILED){
+      memory = NULL;
+      return false;
+   }
+   header = (const ResultRingHeader*)memory;
+   ResultRingHeader expected;
+   if(memcmp(header->magic, expected.magic, 4) != 0 || header->version != expected.version ||
+      header->recordBytes != expected.recordBytes || header->slots < 2 ||
+      header->slotBytes != slotBytes(header->maxRecords, header->maskWords) ||
+      bytes < headerBytes() + header->slots * header->slotBytes){
+      close();
+      return false;
+   }
+   handed = header->published.load(memory_order_acquire);
+   lapped = 0;
+   return true;
+}
+
+void ResultRingReader::close(){
+   if(memory) munmap(memory, bytes);
+   memory = NULL;
+   header = NULL;
+}
+
+const ResultRingSlot* ResultRingReader::slotOf(uint64_t sequence) const{
+   return (const ResultRingSlot*)((const char*)memory + headerBytes() + (sequence % header->slots) * header->slotBytes);
+}
+
+bool ResultRingReader::wait(uint64_t sequence, int timeoutMs){
+   ResultRingHeader* shared = (ResultRingHeader*)header;
+   timespec timeout;
+   timeout.tv_sec = timeoutMs / 1000;
+   timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+   shared->waiters.fetch_add(1, memory_order_seq_cst);
+   uint32_t wake = shared->wake.load(memory_order_seq_cst);
+   bool published = shared->published.load(memory_order_seq_cst) > sequence;
+   // returns at once when a frame came since wake was read
+   if(!published) futex(&shared->wake, FUTEX_WAIT, wake, &timeout);
+   shared->waiters.fetch_sub(1, memory_order_seq_cst);
+   return getPublished() > sequence;
+}
+
+bool ResultRingReader::next(uint64_t sequence, ResultRingView& view){
+   while(true){
+      uint64_t published = getPublished();
+      if(published <= sequence) return false;
+      uint64_t wanted = sequence + 1;
+      // the writer may be filling the slot after published, so a slot short
+      // of a whole ring is the oldest one safe to read
+      uint64_t oldest = published >= header->slots ? published - header->slots + 2 : 1;
+      if(wanted < oldest){
+         sequence = oldest - 1;
+         wanted = oldest;
+      }
+      const ResultRingSlot* slot = slotOf(wanted);
+      // overwritten since published was read; skip ahead with the new one
+      if(slot->sequence.load(memory_order_acquire) != wanted) continue;
+      const char* base = (const char*)slot;
+      // a retry after a torn view asks for the same frames again
+      if(wanted > handed + 1) lapped += wanted - handed - 1;
+      handed = max(handed, wanted);
+      view.sequence = wanted;
+      view.slot = slot;
+      view.records = (const ShapeRecord*)(base + sizeof(ResultRingSlot));
+      view.mask = slot->maskRows > 0 ? (const uint64_t*)(base + sizeof(ResultRingSlot) + header->maxRecords *
+                                                          sizeof(ShapeRecord)) : NULL;
+      return true;
+   }
+}
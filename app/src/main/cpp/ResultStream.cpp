@@ -0,0 +1,108 @@
+#include "ResultStream.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+static sockaddr_un resultAddress(const string& path){
+   sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+   return address;
+}
+
+bool ResultServer::open(const string& path){
+   close();
+   listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+   if(listener < 0) return false;
+   unlink(path.c_str());
+   sockaddr_un address = resultAddress(path);
+   if(bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0){
+      close();
+      return false;
+   }
+   this->path = path;
+   missed = 0;
+   return true;
+}
+
+void ResultServer::close(){
+   for(size_t i = 0; i < clients.size(); i++) ::close(clients[i]);
+   clients.clear();
+   if(listener >= 0){
+      ::close(listener);
+      unlink(path.c_str());
+   }
+   listener = -1;
+}
+
+int ResultServer::publish(ResultHeader& header, const vector<ShapeRecord>& records){
+   if(listener < 0) return 0;
+   int client;
+   while((client = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) clients.push_back(client);
+
+   header.count = (uint32_t)min(records.size(), maxResultShapes);
+   header.published = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+   iovec parts[2];
+   parts[0].iov_base = &header;
+   parts[0].iov_len = sizeof(header);
+   parts[1].iov_base = (void*)(header.count > 0 ? &records[0] : NULL);
+   parts[1].iov_len = header.count * sizeof(ShapeRecord);
+   msghdr message;
+   memset(&message, 0, sizeof(message));
+   message.msg_iov = parts;
+   message.msg_iovlen = header.count > 0 ? 2 : 1;
+
+   int reached = 0;
+   for(size_t i = 0; i < clients.size();){
+      if(sendmsg(clients[i], &message, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) reached++;
+      else if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) missed++;
+      else{
+         ::close(clients[i]);
+         clients.erase(clients.begin() + i);
+         continue;
+      }
+      i++;
+   }
+   return reached;
+}
+
+bool ResultClient::connect(const string& path){
+   close();
+   fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+   if(fd < 0) return false;
+   sockaddr_un address = resultAddress(path);
+   if(::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0){
+      close();
+      return false;
+   }
+   buffer.resize(sizeof(ResultHeader) + maxResultShapes * sizeof(ShapeRecord));
+   return true;
+}
+
+bool ResultClient::read(ResultHeader& header, vector<ShapeRecord>& records){
+   ssize_t size;
+   do size = recv(fd, &buffer[0], buffer.size(), 0);
+   while(size < 0 && errno == EINTR);
+   ResultHeader expected;
+   if(size < (ssize_t)sizeof(header)) return false;
+   memcpy(&header, &buffer[0], sizeof(header));
+   if(memcmp(header.magic, expected.magic, 4) != 0 || header.recordBytes != sizeof(ShapeRecord) ||
+      size != (ssize_t)(sizeof(header) + header.count * sizeof(ShapeRecord))){
+      return false;
+   }
+   records.resize(header.count);
+   if(header.count > 0) memcpy(&records[0], &buffer[sizeof(header)], header.count * sizeof(ShapeRecord));
+   return true;
+}
+
+void ResultClient::close(){
+   if(fd >= 0) ::close(fd);
+   fd = -1;
+}
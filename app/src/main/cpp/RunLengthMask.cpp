@@ -0,0 +1,142 @@
+#include "RunLengthMask.h"
+#include <algorithm>
+#include "ContourTracer.h"
+
+void RunLengthMask::beginRows(int rows, int cols){
+   this->rows = rows;
+   this->cols = cols;
+   runs.clear();
+   rowStart.resize(rows + 1);
+}
+
+void RunLengthMask::reserve(Size size){
+   runs.reserve((size_t)size.height * ((size.width + 1) / 2));
+   rowStart.reserve(size.height + 1);
+}
+
+void RunLengthMask::threshold(const Mat& src, float level){
+   CV_Assert(src.type() == CV_32FC1);
+   beginRows(src.rows, src.cols);
+   for(int y = 0; y < rows; y++){
+      rowStart[y] = (int)runs.size();
+      const float* p = src.ptr<float>(y);
+      int x = 0;
+      while(x < cols){
+         while(x < cols && !(p[x] > level)) x++;
+         if(x == cols) break;
+         int x0 = x;
+         while(x < cols && p[x] > level) x++;
+         Run r = { y, x0, x - 1 };
+         runs.push_back(r);
+      }
+   }
+   rowStart[rows] = (int)runs.size();
+}
+
+void RunLengthMask::encode(const BitMask& mask){
+   beginRows(mask.rows, mask.cols);
+   for(int y = 0; y < rows; y++){
+      rowStart[y] = (int)runs.size();
+      for(int x = mask.nextSet(y, 0); x < cols; ){
+         int end = mask.nextClear(y, x);
+         Run r = { y, x, end - 1 };
+         runs.push_back(r);
+         x = mask.nextSet(y, end);
+      }
+   }
+   rowStart[rows] = (int)runs.size();
+}
+
+bool RunLengthMask::get(int y, int x) const{
+   if(y < 0 || y >= rows || x < 0 || x >= cols) return false;
+   auto first = runs.begin() + rowStart[y];
+   auto last = runs.begin() + rowStart[y + 1];
+   // last run starting at or before x
+   auto it = upper_bound(first, last, x, [](int v, const Run& r){ return v < r.x0; });
+   return it != first && (it - 1)->x1 >= x;
+}
+
+size_t RunLengthMask::area() const{
+   size_t n = 0;
+   for(const Run& r : runs){
+      n += r.x1 - r.x0 + 1;
+   }
+   return n;
+}
+
+void RunLengthMask::traceContour(Point start, vector<Point>& contour) const{
+   traceOuterContour(*this, start, contour);
+}
+
+// Parents always point to an earlier run, so the root of a component is its
+// first run in raster order.
+static int findRun(vector<int>& parent, int i){
+   while(parent[i] != i){
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+   }
+   return i;
+}
+
+void RunLabeler::reserve(size_t runs){
+   parent.reserve(runs);
+   runLabels.reserve(runs);
+}
+
+void RunLabeler::label(const RunLengthMask& mask, vector<Blob>& blobs){
+   labelRuns(mask, blobs, NULL, NULL);
+}
+
+void RunLabeler::label(const RunLengthMask& mask, vector<Blob>& blobs,
+                       const Mat& heights, vector<DepthProfile>& profiles){
+   CV_Assert((heights.type() == CV_32FC1 || heights.type() == CV_16SC1) &&
+             heights.rows == mask.rows && heights.cols == mask.cols);
+   labelRuns(mask, blobs, &heights, &profiles);
+}
+
+void RunLabeler::labelRuns(const RunLengthMask& mask, vector<Blob>& blobs,
+                           const Mat* heights, vector<DepthProfile>* profiles){
+   const vector<Run>& runs = mask.runs;
+   int n = (int)runs.size();
+   parent.resize(n);
+   for(int i = 0; i < n; i++){
+      parent[i] = i;
+   }
+
+   for(int y = 1; y < mask.rows; y++){
+      // two-pointer sweep over the runs of rows y - 1 and y
+      int a = mask.rowStart[y - 1], aEnd = mask.rowStart[y];
+      int b = mask.rowStart[y], bEnd = mask.rowStart[y + 1];
+      while(a < aEnd && b < bEnd){
+         const Run& up = runs[a];
+         const Run& cur = runs[b];
+         if(up.x0 <= cur.x1 + 1 && cur.x0 <= up.x1 + 1){
+            int ra = findRun(parent, a), rb = findRun(parent, b);
+            if(ra < rb) parent[rb] = ra;
+            else if(rb < ra) parent[ra] = rb;
+         }
+         // advance whichever run ends first
+         if(up.x1 < cur.x1) a++;
+         else b++;
+      }
+   }
+
+   blobs.clear();
+   if(profiles) profiles->clear();
+   runLabels.resize(n);
+   for(int i = 0; i < n; i++){
+      int root = findRun(parent, i);
+      if(root == i){
+         runLabels[i] = (int)blobs.size();
+         blobs.push_back(Blob());
+         blobs.back().label = runs[i].y * mask.cols + runs[i].x0;
+         if(profiles) profiles->push_back(DepthProfile());
+      }
+      else{
+         runLabels[i] = runLabels[root];
+      }
+      const Run& r = runs[i];
+      blobs[runLabels[i]].addRun(r.y, r.x0, r.x1);
+      if(profiles) (*profiles)[runLabels[i]].addRun(*heights, r.y, r.x0, r.x1);
+   }
+}
@@ -0,0 +1,375 @@
+#include "SceneGenerator.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// bases stretched less than this still count as regular
+static const float regularAspect = 1.15f;
+// objects keep this gap between their bounding circles [m]
+static const float gap = 0.02f;
+// discs stay under the 3D classifier's flat height
+static const float minDiscHeight = 0.007f, maxDiscHeight = 0.012f;
+
+const char* SceneObject::expectedType() const{
+   bool stretched = aspect > regularAspect;
+   if(kind == Cylinder || kind == Disc) return stretched ? "ELL" : "CIR";
+   switch(sides){
+      case 3: return "TRI";
+      case 4: return stretched ? "RECT" : "SQR";
+      case 5: return "PENT";
+      default: return "HEX";
+   }
+}
+
+const char* SceneObject::expectedType3D() const{
+   switch(kind){
+      case Pyramid: return "PYR";
+      case Cylinder: return "CYL";
+      case Disc: return "FLAT";
+      default: return "BOX";
+   }
+}
+
+// Per-pixel noise, cheaper than cv::RNG::gaussian by a wide margin: an
+// xorshift64* generator, and the sum of four of its 16-bit parts for an
+// approximately normal value (tails cut at 3.5 sigma, far enough for sensor
+// noise)
+struct PixelNoise {
+   uint64_t state;
+
+   explicit PixelNoise(uint64_t seed) : state(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+
+   uint64_t next(){
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return state * 0x2545f4914f6cdd1dull;
+   }
+   // [0, 1)
+   float uniform(){
+      return (next() >> 40) * (1.f / (1 << 24));
+   }
+   float gaussian(float sigma){
+      uint64_t r = next();
+      int sum = (int)(r & 0xffff) + (int)((r >> 16) & 0xffff) + (int)((r >> 32) & 0xffff) + (int)(r >> 48);
+      // the sum of four uniforms on [0, 65536) has mean 131070 and
+      // standard deviation 65536 / sqrt(3)
+      return (sum - 131070) * (sigma * 1.7320508f / 65536);
+   }
+};
+
+// Half-space n . p <= c in an object's frame
+struct HalfSpace {
+   Point3f n;
+   float c;
+};
+
+// An object's frame on the table: origin at the base center, z up, x along
+// the stretch, which is divided out so the base is regular
+struct ObjectFrame {
+   Point2f center;
+   float cosA, sinA, invAspect;
+   int kind;
+   float radius, height;
+   vector<HalfSpace> faces;   // prisms and pyramids
+   Rect pixels;               // projected bounding box
+
+   Point3f toLocal(const Point3f& p, bool direction) const{
+      float x = direction ? p.x : p.x - center.x;
+      float y = direction ? p.y : p.y - center.y;
+      return Point3f((cosA * x + sinA * y) * invAspect, -sinA * x + cosA * y, p.z);
+   }
+
+   // Nearest ray parameter t > 0 where o + t d enters the solid, FLT_MAX if
+   // it misses
+   float intersect(const Point3f& o, const Point3f& d) const{
+      float t0 = 0, t1 = FLT_MAX;
+      if(kind == SceneObject::Cylinder || kind == SceneObject::Disc){
+         // side: x^2 + y^2 <= r^2
+         float a = d.x * d.x + d.y * d.y;
+         float b = 2 * (o.x * d.x + o.y * d.y);
+         float c = o.x * o.x + o.y * o.y - radius * radius;
+         if(a < 1e-12f){
+            if(c > 0) return FLT_MAX;
+         }
+         else{
+            float disc = b * b - 4 * a * c;
+            if(disc < 0) return FLT_MAX;
+            float s = sqrt(disc);
+            t0 = max(t0, (-b - s) / (2 * a));
+            t1 = min(t1, (-b + s) / (2 * a));
+         }
+         // caps: 0 <= z <= height
+         if(fabs(d.z) < 1e-12f){
+            if(o.z < 0 || o.z > height) return FLT_MAX;
+         }
+         else{
+            float za = -o.z / d.z, zb = (height - o.z) / d.z;
+            t0 = max(t0, min(za, zb));
+            t1 = min(t1, max(za, zb));
+         }
+      }
+      else{
+         // clip the ray against every face
+         for(size_t i = 0; i < faces.size(); i++){
+            const HalfSpace& f = faces[i];
+            float denom = f.n.dot(d);
+            float num = f.c - f.n.dot(o);
+            if(fabs(denom) < 1e-12f){
+               if(num < 0) return FLT_MAX;
+               continue;
+            }
+            float t = num / denom;
+            if(denom < 0) t0 = max(t0, t);
+            else t1 = min(t1, t);
+            if(t0 > t1) return FLT_MAX;
+         }
+      }
+      return t0 <= t1 && t0 > 0 ? t0 : FLT_MAX;
+   }
+};
+
+SceneGenerator::SceneGenerator(const SceneParams& params) : params(params){
+   if(params.cameraMatrix.empty()){
+      cameraMatrix = (Mat1d(3, 3) << 210, 0, params.size.width / 2.0, 0, 210, params.size.height / 2.0, 0, 0, 1);
+   }
+   else{
+      params.cameraMatrix.convertTo(cameraMatrix, CV_64FC1);
+   }
+   distortion = Mat::zeros(1, 5, CV_64FC1);
+   if(!params.distortion.empty()){
+      params.distortion.reshape(1, 1).convertTo(distortion, CV_64FC1);
+   }
+
+   // invert the distortion per pixel like cv::undistortPoints does
+   double fx = cameraMatrix.at<double>(0, 0), fy = cameraMatrix.at<double>(1, 1);
+   double cx = cameraMatrix.at<double>(0, 2), cy = cameraMatrix.at<double>(1, 2);
+   const double* k = distortion.ptr<double>(0);
+   rays.resize(params.size.area());
+   for(int v = 0; v < params.size.height; v++){
+      for(int u = 0; u < params.size.width; u++){
+         double xd = (u - cx) / fx, yd = (v - cy) / fy;
+         double x = xd, y = yd;
+         for(int i = 0; i < 10; i++){
+            double r2 = x * x + y * y;
+            double radial = 1 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2;
+            double dx = 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+            double dy = k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+            x = (xd - dx) / radial;
+            y = (yd - dy) / radial;
+         }
+         rays[v * params.size.width + u] = Point2f((float)x, (float)y);
+      }
+   }
+}
+
+void SceneGenerator::lensMatrices(const royale::LensParameters& lens, Mat& cameraMatrix, Mat& distortion){
+   cameraMatrix = (Mat1d(3, 3) << lens.focalLength.first, 0, lens.principalPoint.first,
+                   0, lens.focalLength.second, lens.principalPoint.second,
+                   0, 0, 1);
+   distortion = (Mat1d(1, 5) << lens.distortionRadial[0], lens.distortionRadial[1],
+                 lens.distortionTangential.first, lens.distortionTangential.second,
+                 lens.distortionRadial[2]);
+}
+
+bool SceneGenerator::project(const Point3f& p, Point2f& pixel) const{
+   if(p.z <= 0) return false;
+   const double* k = distortion.ptr<double>(0);
+   double x = p.x / p.z, y = p.y / p.z;
+   double r2 = x * x + y * y;
+   double radial = 1 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2;
+   double xd = x * radial + 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+   double yd = y * radial + k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+   pixel.x = (float)(cameraMatrix.at<double>(0, 0) * xd + cameraMatrix.at<double>(0, 2));
+   pixel.y = (float)(cameraMatrix.at<double>(1, 1) * yd + cameraMatrix.at<double>(1, 2));
+   return true;
+}
+
+static float uniformf(RNG& rng, float a, float b){
+   return a + (b - a) * (float)rng.uniform(0, 1 << 24) / (1 << 24);
+}
+
+void SceneGenerator::randomScene(RNG& rng, Scene& scene) const{
+   const SceneParams& p = params;
+   scene.tableDistance = uniformf(rng, p.minDistance, p.maxDistance);
+   scene.tiltX = uniformf(rng, -p.maxTilt, p.maxTilt);
+   scene.tiltY = uniformf(rng, -p.maxTilt, p.maxTilt);
+   randomObjects(rng, scene);
+}
+
+void SceneGenerator::randomObjects(RNG& rng, Scene& scene) const{
+   const SceneParams& p = params;
+   scene.objects.clear();
+
+   // the table area seen inside the border, ignoring tilt and distortion
+   float halfW = scene.tableDistance * p.size.width / (2 * (float)cameraMatrix.at<double>(0, 0)) * (1 - 2 * p.border);
+   float halfH = scene.tableDistance * p.size.height / (2 * (float)cameraMatrix.at<double>(1, 1)) * (1 - 2 * p.border);
+   int n = rng.uniform(p.minObjects, p.maxObjects + 1);
+   for(int i = 0; i < n; i++){
+      for(int attempt = 0; attempt < 20; attempt++){
+         SceneObject o;
+         o.kind = rng.uniform(0, 4);
+         o.sides = rng.uniform(3, 7);
+         o.radius = uniformf(rng, p.minRadius, p.maxRadius);
+         bool stretch = (o.kind == SceneObject::Cylinder || o.sides == 4) && rng.uniform(0, 2) == 0;
+         o.aspect = stretch ? uniformf(rng, 1.3f, max(1.3f, p.maxAspect)) : 1;
+         o.height = o.kind == SceneObject::Disc ? uniformf(rng, minDiscHeight, maxDiscHeight)
+                                                : uniformf(rng, max(p.minHeight, 0.02f), p.maxHeight);
+         o.angle = uniformf(rng, 0, (float)CV_PI);
+         float extent = o.radius * o.aspect;
+         if(extent >= halfW || extent >= halfH) continue;
+         o.x = uniformf(rng, -halfW + extent, halfW - extent);
+         o.y = uniformf(rng, -halfH + extent, halfH - extent);
+         bool free = true;
+         for(size_t j = 0; j < scene.objects.size() && free; j++){
+            const SceneObject& q = scene.objects[j];
+            free = hypot(o.x - q.x, o.y - q.y) > extent + q.radius * q.aspect + gap;
+         }
+         if(free){
+            scene.objects.push_back(o);
+            break;
+         }
+      }
+   }
+}
+
+// Axes and origin of the table frame in camera coordinates
+struct TableFrame {
+   Point3f ex, ey, ez, origin;
+
+   explicit TableFrame(const Scene& scene){
+      // untilted: x right, y towards the top of the image, z towards the camera
+      float cx = cos(scene.tiltX), sx = sin(scene.tiltX);
+      float cy = cos(scene.tiltY), sy = sin(scene.tiltY);
+      ex = rotate(Point3f(1, 0, 0), cx, sx, cy, sy);
+      ey = rotate(Point3f(0, -1, 0), cx, sx, cy, sy);
+      ez = rotate(Point3f(0, 0, -1), cx, sx, cy, sy);
+      origin = Point3f(0, 0, scene.tableDistance);
+   }
+
+   // about the camera y axis, then x
+   static Point3f rotate(const Point3f& p, float cx, float sx, float cy, float sy){
+      Point3f q(cy * p.x + sy * p.z, p.y, -sy * p.x + cy * p.z);
+      return Point3f(q.x, cx * q.y - sx * q.z, sx * q.y + cx * q.z);
+   }
+
+   Point3f toCamera(const Point3f& p) const{
+      return origin + ex * p.x + ey * p.y + ez * p.z;
+   }
+   Point3f toTable(const Point3f& p, bool direction) const{
+      Point3f q = direction ? p : p - origin;
+      return Point3f(ex.dot(q), ey.dot(q), ez.dot(q));
+   }
+};
+
+void SceneGenerator::render(const Scene& scene, uint64_t seed, royale::DepthData& data, Mat* labels) const{
+   const SceneParams& p = params;
+   int w = p.size.width, h = p.size.height;
+   TableFrame table(scene);
+   Point3f eye = table.toTable(Point3f(0, 0, 0), false);
+
+   vector<ObjectFrame> frames(scene.objects.size());
+   vector<Point3f> eyes(frames.size());
+   for(size_t i = 0; i < frames.size(); i++){
+      const SceneObject& o = scene.objects[i];
+      ObjectFrame& f = frames[i];
+      f.center = Point2f(o.x, o.y);
+      f.cosA = cos(o.angle);
+      f.sinA = sin(o.angle);
+      f.invAspect = 1 / o.aspect;
+      f.kind = o.kind;
+      f.radius = o.radius;
+      f.height = o.height;
+      if(o.kind == SceneObject::Prism || o.kind == SceneObject::Pyramid){
+         float inner = o.radius * (float)cos(CV_PI / o.sides);
+         // a pyramid's sides lean in to the apex
+         float lean = o.kind == SceneObject::Pyramid ? inner / o.height : 0;
+         for(int s = 0; s < o.sides; s++){
+            float a = (float)(2 * CV_PI * s / o.sides);
+            f.faces.push_back(HalfSpace { Point3f(cos(a), sin(a), lean), inner });
+         }
+         f.faces.push_back(HalfSpace { Point3f(0, 0, -1), 0 });
+         if(o.kind == SceneObject::Prism) f.faces.push_back(HalfSpace { Point3f(0, 0, 1), o.height });
+      }
+      eyes[i] = f.toLocal(eye, false);
+
+      // bounding box of the projected corners of the bounding prism
+      float ex = o.radius * o.aspect, ey = o.radius;
+      float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+      for(int c = 0; c < 8; c++){
+         float lx = c & 1 ? ex : -ex, ly = c & 2 ? ey : -ey, lz = c & 4 ? o.height : 0;
+         Point3f t(o.x + f.cosA * lx - f.sinA * ly, o.y + f.sinA * lx + f.cosA * ly, lz);
+         Point2f px;
+         if(!project(table.toCamera(t), px)) continue;
+         x0 = min(x0, px.x);
+         y0 = min(y0, px.y);
+         x1 = max(x1, px.x);
+         y1 = max(y1, px.y);
+      }
+      f.pixels = x0 <= x1 ? Rect(Point(cvFloor(x0) - 2, cvFloor(y0) - 2), Point(cvCeil(x1) + 3, cvCeil(y1) + 3))
+                          & Rect(0, 0, w, h) : Rect();
+   }
+
+   Mat own;
+   Mat& label = labels ? *labels : own;
+   label.create(h, w, CV_8UC1);
+   data.width = (uint16_t)w;
+   data.height = (uint16_t)h;
+   data.points.resize(w * h);
+   PixelNoise rng(seed);
+   int last = w * h - 1;
+   for(int v = 0; v < h; v++){
+      uchar* l = label.ptr<uchar>(v);
+      for(int u = 0; u < w; u++){
+         const Point2f& r2 = rays[v * w + u];
+         Point3f ray(r2.x, r2.y, 1);
+         Point3f dir = table.toTable(ray, true);
+         // the camera looks down on the table, dir.z < 0 where it sees it
+         float t = dir.z < 0 ? -eye.z / dir.z : 0;
+         int hit = 0;
+         for(size_t i = 0; i < frames.size(); i++){
+            const ObjectFrame& f = frames[i];
+            if(!f.pixels.contains(Point(u, v))) continue;
+            float ti = f.intersect(eyes[i], f.toLocal(dir, true));
+            if(ti < FLT_MAX && (t == 0 || ti < t)){
+               t = ti;
+               hit = (int)i + 1;
+            }
+         }
+         l[u] = (uchar)hit;
+
+         // the listener reads the points back to front; the image is the
+         // sensor turned half a turn, so x and y flip sign
+         royale::DepthPoint& point = data.points[last - (v * w + u)];
+         float z = t;
+         float sigma = p.noise * z * z;
+         if(z > 0) z += rng.gaussian(sigma);
+         bool valid = z > 0 && rng.uniform() >= p.dropout;
+         point.x = -r2.x * z;
+         point.y = -r2.y * z;
+         point.z = valid ? z : 0;
+         point.noise = sigma;
+         point.grayValue = valid ? (uint16_t)min(4095.f, 400 / (z * z)) : 0;
+         point.depthConfidence = valid ? 255 : 0;
+      }
+   }
+
+   // mixed pixels on the silhouettes, where the label changes
+   if(p.edgeDropout > 0){
+      for(int v = 0; v < h; v++){
+         const uchar* l = label.ptr<uchar>(v);
+         const uchar* up = label.ptr<uchar>(max(v - 1, 0));
+         const uchar* down = label.ptr<uchar>(min(v + 1, h - 1));
+         for(int u = 0; u < w; u++){
+            bool edge = l[u] != up[u] || l[u] != down[u] ||
+                        (u > 0 && l[u] != l[u - 1]) || (u + 1 < w && l[u] != l[u + 1]);
+            if(edge && rng.uniform() < p.edgeDropout){
+               royale::DepthPoint& point = data.points[last - (v * w + u)];
+               point.z = 0;
+               point.grayValue = 0;
+               point.depthConfidence = 0;
+            }
+         }
+      }
+   }
+}
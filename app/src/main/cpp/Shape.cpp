@@ -1,87 +1,231 @@
 #include "Shape.h"
 
-Shape::Shape(const vector<Point> & contour) {
-   this->contour = contour;
+template<typename T>
+Shape_<T>::Shape_(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace,
+                  const ShapeClassifier * classifier) {
+   reset(contour, workspace, classifier);
+}
+
+template<typename T>
+Shape_<T>::Shape_(const vector<Point_<T> > & contour, const Blob & blob, SimplifyWorkspace * workspace,
+                  const ShapeClassifier * classifier) {
+   start(contour, workspace, classifier);
+   area = blob.area;
+   center = blob.getCenter();
+   boundingRect = blob.bbox;
+   validate();
+}
+
+template<typename T>
+void Shape_<T>::reset(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace,
+                      const ShapeClassifier * classifier) {
+   start(contour, workspace, classifier);
+   validate();
+}
+
+template<typename T>
+void Shape_<T>::reserve(size_t points) {
+   contour.reserve(points);
+   approx.reserve(points);
+   pixels.reserve(points);
+}
+
+// Every cache back to unset; assign keeps the capacity of the vectors
+template<typename T>
+void Shape_<T>::start(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace,
+                      const ShapeClassifier * classifier) {
+   this->contour.assign(contour.begin(), contour.end());
+   this->workspace = workspace;
+   this->classifier = classifier ? classifier : &ShapeClassifier::getDefault();
+   isValidShape = true;
+   area = -1;
+   perimeter = -1;
+   center = Point2f(FLT_MAX, FLT_MAX);
+   boundingRect = Rect();
+   approx.clear();
+   type = "NULL";
+   type3D = "NULL";
+   hasDepth = false;
+   metrics = ShapeMetrics();
+   hasFeatures = false;
+   hasDescriptor = false;
+}
 
+template<typename T>
+void Shape_<T>::validate() {
    // eliminate small blobs
    if(getArea() < 100) {
         isValidShape = false;
         return;
    }
-   // eliminate concave blobs
-   if(!isContourConvex(getApprox())){
+   // eliminate concave blobs unless they match a concave template (stars,
+   // L-shapes); the approximation of a convex contour is convex
+   if(!getDescriptor().convex && getType() == "OTR"){
          isValidShape = false;
          return;
    }
 }
 
-double Shape::getArea(){
+// Fills every cache that is still unset from a single walk of the contour
+template<typename T>
+void Shape_<T>::extractFeatures(){
+   computeFeatures(contour, features);
+   hasFeatures = true;
    if(area == -1){
-      area = contourArea(contour);
+      area = features.area;
+   }
+   if(perimeter == -1){
+      perimeter = features.perimeter;
+   }
+   if(center.x == FLT_MAX){
+      center = features.getCenter();
+   }
+   if(boundingRect.empty()){
+      boundingRect = features.bbox;
+   }
+}
+
+template<typename T>
+const ContourFeatures & Shape_<T>::getFeatures(){
+   if(!hasFeatures){
+      extractFeatures();
+   }
+   return features;
+}
+
+template<typename T>
+const ShapeDescriptor & Shape_<T>::getDescriptor(){
+   if(!hasDescriptor){
+      ContourFeatures approxFeatures;
+      computeFeatures(getApprox(), approxFeatures);
+      describeShape(getFeatures(), approxFeatures, (int)approx.size(), descriptor);
+      hasDescriptor = true;
+   }
+   return descriptor;
+}
+
+template<typename T>
+double Shape_<T>::getArea(){
+   if(area == -1){
+      extractFeatures();
    }
    return area;
 }
 
-double Shape::getPerimeter(){
+template<typename T>
+double Shape_<T>::getPerimeter(){
    if(perimeter == -1){
-      perimeter = arcLength(contour,true);
+      extractFeatures();
    }
    return perimeter;
 }
 
-Point2f Shape::getCenter(){
+template<typename T>
+Point2f Shape_<T>::getCenter(){
    if(center.x == FLT_MAX){
-      Moments mu = moments( contour, false);
-      center = Point2f( mu.m10/mu.m00 , mu.m01/mu.m00 );
+      extractFeatures();
    }
    return center;
 }
 
-Rect Shape::getBoundingRect(){
+template<typename T>
+Rect Shape_<T>::getBoundingRect(){
    if(boundingRect.empty()){
-      boundingRect = cv::boundingRect(contour);
+      extractFeatures();
    }
    return boundingRect;
 }
 
-vector<Point> Shape::getApprox(){
+template<typename T>
+const vector<Point_<T> > & Shape_<T>::getApprox(){
    if(approx.empty()){
-      double epsilon = 0.02*getPerimeter();
-      approx = approximatePolyDP(epsilon);
+      approximatePolyDP(0.02*getPerimeter());
    }
    return approx;
 }
 
-string Shape::getType(){
+template<typename T>
+string Shape_<T>::getType(){
    if(type == "NULL"){
-      if (getApprox().size() == 3){
-         type = "TRI";
-      }
-      else if (getApprox().size() == 4){
-         type = "RECT";
-      }
-      else{
-         int radius = getBoundingRect().width / 2;
-         if (abs(1 - ((double)boundingRect.width / boundingRect.height)) <= 0.2 &&
-            abs(1 - (area / (CV_PI * pow(radius, 2)))) <= 0.2){
-               type = "CIR";
-         }
-         else{
-            type = "OTR";
-         }
-      }
+      type = classifier->classify(getDescriptor());
    }
    return type;
 }
 
-vector<Point> Shape::approximatePolyDP(double epsilon){
-   approxPolyDP(contour, approx, epsilon, true);
+template<typename T>
+string Shape_<T>::getType3D(){
+   if(type3D == "NULL" && hasDepth){
+      type3D = classifyDepthProfile(depth, getType());
+   }
+   return type3D;
+}
+
+template<typename T>
+void Shape_<T>::setDepthProfile(const DepthProfile & profile){
+   depth = profile;
+   hasDepth = true;
+   type3D = "NULL";
+}
+
+template<typename T>
+void Shape_<T>::setMetrics(const ShapeMetrics & metrics){
+   this->metrics = metrics;
+}
+
+template<typename T>
+ShapeRecord Shape_<T>::getRecord(){
+   ShapeRecord r;
+   r.type = packType(getType());
+   r.type3D = hasDepth ? packType(getType3D()) : 0;
+   Point2f c = getCenter();
+   r.x = cvRound(c.x);
+   r.y = cvRound(c.y);
+   Rect box = getBoundingRect();
+   r.left = box.x;
+   r.top = box.y;
+   r.width = box.width;
+   r.height = box.height;
+   r.cx = cvRound(metrics.centroid.x * 1000);
+   r.cy = cvRound(metrics.centroid.y * 1000);
+   r.cz = cvRound(metrics.centroid.z * 1000);
+   r.sizeMajor = cvRound(metrics.width * 1000);
+   r.sizeMinor = cvRound(metrics.height * 1000);
+   r.footprint = cvRound(metrics.footprint * 100);
+   r.volume = cvRound(metrics.volume * 1000);
+   r.area = cvRound(getArea());
+   r.vertices = (int32_t)getApprox().size();
+   return r;
+}
+
+template<typename T>
+const vector<Point_<T> > & Shape_<T>::approximatePolyDP(double epsilon){
+   SimplifyWorkspace local;
+   SimplifyWorkspace & ws = workspace ? *workspace : local;
+   simplifyDouglasPeucker(contour, epsilon, true, ws, ws.indices);
+   approx.resize(ws.indices.size());
+   for( size_t i = 0; i < ws.indices.size(); i++ ){
+      approx[i] = contour[ws.indices[i]];
+   }
    return approx;
 }
 
-void Shape::draw(cv::Mat& image){
+// polylines only takes integer points
+static const vector<Point> & toPixels(const vector<Point> & pts, vector<Point> &) {
+   return pts;
+}
+
+static const vector<Point> & toPixels(const vector<Point2f> & pts, vector<Point> & buf) {
+   buf.resize(pts.size());
+   for( size_t i = 0; i < pts.size(); i++ ){
+      buf[i] = Point(cvRound(pts[i].x), cvRound(pts[i].y));
+   }
+   return buf;
+}
+
+template<typename T>
+void Shape_<T>::draw(cv::Mat& image){
    auto color = isValidShape ? Scalar(255,0,0): Scalar(0,0,255);
-   polylines(image, contour, true, color, 1);
+   polylines(image, toPixels(contour, pixels), true, color, 1);
 
    if(isValidShape){
       int fontface = cv::FONT_HERSHEY_SIMPLEX;
@@ -90,6 +234,9 @@ void Shape::draw(cv::Mat& image){
       int baseline = 0;
 
       string label = getType();
+      if(hasDepth){
+         label += " " + getType3D();
+      }
       cv::Size text = cv::getTextSize(label, fontface, scale, thickness, &baseline);
       cv::Rect r = getBoundingRect();
       cv::Point pt(r.x + ((r.width - text.width) / 2), r.y + ((r.height + text.height) / 2));
@@ -104,3 +251,6 @@ void Shape::draw(cv::Mat& image){
    }
 
 }
+
+template class Shape_<int>;
+template class Shape_<float>;
@@ -0,0 +1,267 @@
+#include "ShapeClassifier.h"
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+// Range of each continuous term mapped onto the table bins; values outside
+// are clamped. Nothing the detector keeps is much less circular than 0.3.
+static const float circularityMin = 0.3f, spreadMin = 0.3f;
+
+// Distance weights. The continuous terms are all in [0, 1]. Vertex counts of
+// the approximation are noisy (a start point next to a corner adds one), so
+// one vertex off costs about as much as a 0.02 difference in circularity.
+static const float elongationWeight = 4, circularityWeight = 30, spreadWeight = 10;
+static const float vertexWeight = 0.01f, convexWeight = 0.5f;
+// beyond this from every template a shape is "OTR"
+static const float maxDistance = 0.12f;
+
+// plain char data, classifiers may be constructed during static initialization
+static const char* const other = "OTR";
+
+void describeShape(const ContourFeatures& f, const ContourFeatures& approx, int vertices, ShapeDescriptor& d){
+   d = ShapeDescriptor();
+   d.vertices = vertices;
+   d.convex = approx.convexity != 0;
+   if(f.m00 <= 0 || approx.perimeter <= 0) return;
+
+   double cx = f.m10 / f.m00, cy = f.m01 / f.m00;
+   double s = f.m00 * f.m00;
+   double n20 = (f.m20 - cx * f.m10) / s;
+   double n02 = (f.m02 - cy * f.m01) / s;
+   double n11 = (f.m11 - cx * f.m01) / s;
+   double hu1 = n20 + n02;
+   double hu2 = (n20 - n02) * (n20 - n02) + 4 * n11 * n11;
+   // principal axes of the inertia ellipse
+   double l1 = (hu1 + sqrt(hu2)) / 2, l2 = (hu1 - sqrt(hu2)) / 2;
+   d.elongation = l1 > 0 ? (float)sqrt(max(l2, 0.0) / l1) : 0;
+   // on the approximation, the perimeter of the contour grows with noise
+   d.circularity = (float)(4 * CV_PI * approx.area / (approx.perimeter * approx.perimeter));
+   d.spread = hu1 > 0 ? (float)(1 / (2 * CV_PI * hu1)) : 0;
+}
+
+void describeOutline(const vector<Point2f>& outline, SimplifyWorkspace& ws, ShapeDescriptor& d){
+   ContourFeatures f, af;
+   computeFeatures(outline, f);
+   simplifyDouglasPeucker(outline, 0.02 * f.perimeter, true, ws, ws.indices);
+   vector<Point2f> approx(ws.indices.size());
+   for(size_t i = 0; i < approx.size(); i++){
+      approx[i] = outline[ws.indices[i]];
+   }
+   computeFeatures(approx, af);
+   describeShape(f, af, (int)approx.size(), d);
+}
+
+static int toBin(float v, float lo){
+   int b = (int)((v - lo) / (1 - lo) * ShapeClassifier::bins);
+   return min(max(b, 0), ShapeClassifier::bins - 1);
+}
+
+static float binCenter(int b, float lo){
+   return lo + (b + 0.5f) * (1 - lo) / ShapeClassifier::bins;
+}
+
+static int toVertexBin(int vertices){
+   return min(max(vertices - 3, 0), ShapeClassifier::vertexBins - 1);
+}
+
+int ShapeClassifier::cellOf(const ShapeDescriptor& d){
+   int cell = toBin(d.elongation, 0);
+   cell = cell * bins + toBin(d.circularity, circularityMin);
+   cell = cell * bins + toBin(d.spread, spreadMin);
+   cell = cell * vertexBins + toVertexBin(d.vertices);
+   return cell * 2 + (d.convex ? 1 : 0);
+}
+
+static float distance(const ShapeDescriptor& a, const ShapeDescriptor& b){
+   float de = a.elongation - b.elongation;
+   float dc = a.circularity - b.circularity;
+   float ds = a.spread - b.spread;
+   float dv = (float)(toVertexBin(a.vertices) - toVertexBin(b.vertices));
+   return elongationWeight * de * de + circularityWeight * dc * dc + spreadWeight * ds * ds +
+          vertexWeight * dv * dv + (a.convex != b.convex ? convexWeight : 0);
+}
+
+// Outline generators for the default templates, unit sized around the origin
+static vector<Point2f> polygonOutline(int n){
+   vector<Point2f> pts(n);
+   for(int i = 0; i < n; i++){
+      double t = 2 * CV_PI * i / n;
+      pts[i] = Point2f((float)cos(t), (float)sin(t));
+   }
+   return pts;
+}
+
+static vector<Point2f> starOutline(int n, float inner){
+   vector<Point2f> pts(2 * n);
+   for(int i = 0; i < 2 * n; i++){
+      double t = CV_PI * i / n;
+      float r = i % 2 ? inner : 1;
+      pts[i] = Point2f((float)(r * cos(t)), (float)(r * sin(t)));
+   }
+   return pts;
+}
+
+static vector<Point2f> ellipseOutline(float a, float b){
+   // dense enough that the approximation behaves like on a real contour
+   int n = 96;
+   vector<Point2f> pts(n);
+   for(int i = 0; i < n; i++){
+      double t = 2 * CV_PI * i / n;
+      pts[i] = Point2f((float)(a * cos(t)), (float)(b * sin(t)));
+   }
+   return pts;
+}
+
+static vector<Point2f> rectOutline(float w, float h){
+   vector<Point2f> pts;
+   pts.push_back(Point2f(0, 0));
+   pts.push_back(Point2f(w, 0));
+   pts.push_back(Point2f(w, h));
+   pts.push_back(Point2f(0, h));
+   return pts;
+}
+
+// L with legs w and h and thickness t
+static vector<Point2f> lOutline(float w, float h, float t){
+   vector<Point2f> pts;
+   pts.push_back(Point2f(0, 0));
+   pts.push_back(Point2f(t, 0));
+   pts.push_back(Point2f(t, h - t));
+   pts.push_back(Point2f(w, h - t));
+   pts.push_back(Point2f(w, h));
+   pts.push_back(Point2f(0, h));
+   return pts;
+}
+
+ShapeClassifier::ShapeClassifier(){
+   addDefaultTemplates();
+   build();
+}
+
+void ShapeClassifier::addDefaultTemplates(){
+   clear();
+   addTemplate("TRI", polygonOutline(3));
+   addTemplate("SQR", rectOutline(1, 1));
+   addTemplate("PENT", polygonOutline(5));
+   addTemplate("HEX", polygonOutline(6));
+   addTemplate("CIR", ellipseOutline(1, 1));
+   // the elongated classes are sampled along their aspect ratio, more
+   // templates only cost table build time
+   for(float aspect = 1.25f; aspect < 6; aspect *= 1.12f){
+      addTemplate("RECT", rectOutline(aspect, 1));
+      addTemplate("ELL", ellipseOutline(aspect, 1));
+   }
+   for(float inner = 0.3f; inner < 0.6f; inner += 0.05f){
+      addTemplate("STAR", starOutline(5, inner));
+      addTemplate("STAR", starOutline(6, inner));
+   }
+   for(float aspect = 1; aspect < 2.5f; aspect *= 1.2f){
+      for(float thickness = 0.2f; thickness < 0.6f; thickness += 0.08f){
+         addTemplate("L", lOutline(aspect, 1, thickness));
+      }
+   }
+}
+
+void ShapeClassifier::clear(){
+   names.assign(1, string(other));
+   templates.clear();
+}
+
+int ShapeClassifier::classId(const string& name){
+   for(size_t i = 0; i < names.size(); i++){
+      if(names[i] == name) return (int)i;
+   }
+   names.push_back(name);
+   return (int)names.size() - 1;
+}
+
+void ShapeClassifier::addTemplate(const string& name, const vector<Point2f>& outline){
+   // the approximation works in pixels, so scale to a typical blob size
+   ContourFeatures f;
+   computeFeatures(outline, f);
+   if(f.area <= 0) return;
+   float scale = (float)sqrt(2000 / f.area);
+   vector<Point2f> scaled(outline.size());
+   for(size_t i = 0; i < outline.size(); i++){
+      scaled[i] = outline[i] * scale;
+   }
+   Template t;
+   t.cls = classId(name);
+   describeOutline(scaled, workspace, t.d);
+   templates.push_back(t);
+}
+
+void ShapeClassifier::build(){
+   CV_Assert(names.size() <= 256);
+   table.assign(bins * bins * bins * vertexBins * 2, 0);
+   ShapeDescriptor d;
+   for(int e = 0; e < bins; e++){
+      d.elongation = binCenter(e, 0);
+      for(int c = 0; c < bins; c++){
+         d.circularity = binCenter(c, circularityMin);
+         for(int s = 0; s < bins; s++){
+            d.spread = binCenter(s, spreadMin);
+            for(int v = 0; v < vertexBins; v++){
+               d.vertices = v + 3;
+               for(int convex = 0; convex < 2; convex++){
+                  d.convex = convex != 0;
+                  float best = maxDistance;
+                  int cls = 0;
+                  for(size_t i = 0; i < templates.size(); i++){
+                     float dist = distance(d, templates[i].d);
+                     if(dist < best){
+                        best = dist;
+                        cls = templates[i].cls;
+                     }
+                  }
+                  table[cellOf(d)] = (unsigned char)cls;
+               }
+            }
+         }
+      }
+   }
+}
+
+bool ShapeClassifier::load(const string& path){
+   ifstream file(path.c_str());
+   if(!file) return false;
+
+   vector<string> oldNames;
+   vector<Template> oldTemplates;
+   names.swap(oldNames);
+   templates.swap(oldTemplates);
+   clear();
+
+   string line;
+   while(getline(file, line)){
+      size_t comment = line.find('#');
+      if(comment != string::npos) line.erase(comment);
+      istringstream in(line);
+      string name;
+      if(!(in >> name)) continue;
+      vector<Point2f> outline;
+      float x, y;
+      while(in >> x >> y){
+         outline.push_back(Point2f(x, y));
+      }
+      if(outline.size() >= 3) addTemplate(name, outline);
+   }
+
+   if(templates.empty()){
+      names.swap(oldNames);
+      templates.swap(oldTemplates);
+      return false;
+   }
+   build();
+   return true;
+}
+
+const string& ShapeClassifier::classify(const ShapeDescriptor& d) const{
+   return names[table[cellOf(d)]];
+}
+
+const ShapeClassifier& ShapeClassifier::getDefault(){
+   static const ShapeClassifier classifier;
+   return classifier;
+}
@@ -0,0 +1,128 @@
+#include "ShapeFusion.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static int64_t nowNs(){
+   return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ShapeFusion::setCameras(int n){
+   lock_guard<mutex> guard(lock);
+   cameras.resize(max(n, 0));
+   for(size_t i = 0; i < cameras.size(); i++){
+      cameras[i].pending = false;
+      cameras[i].seen = 0;
+      cameras[i].records.clear();
+   }
+   count = (int)cameras.size();
+}
+
+void ShapeFusion::setPose(int camera, const Mat& cameraToTable){
+   lock_guard<mutex> guard(lock);
+   if(camera < 0 || camera >= (int)cameras.size()) return;
+   CV_Assert(cameraToTable.type() == CV_64FC1 && cameraToTable.cols == 4 &&
+             (cameraToTable.rows == 3 || cameraToTable.rows == 4));
+   Camera& c = cameras[camera];
+   for(int i = 0; i < 3; i++){
+      for(int j = 0; j < 4; j++) c.pose[4 * i + j] = cameraToTable.at<double>(i, j);
+   }
+}
+
+void ShapeFusion::submit(int camera, bool detecting, const vector<ShapeRecord>& records){
+   unique_lock<mutex> guard(lock);
+   if(camera < 0 || camera >= (int)cameras.size()) return;
+   int64_t now = nowNs();
+   Camera& c = cameras[camera];
+   // a camera ahead of the others keeps only its latest frame
+   c.records.assign(records.begin(), records.end());
+   c.detecting = detecting;
+   c.pending = true;
+   c.seen = now;
+   int32_t members = 0;
+   for(size_t i = 0; i < cameras.size(); i++){
+      const Camera& other = cameras[i];
+      bool live = other.seen != 0 && now - other.seen < staleNs;
+      if(live && !other.pending) return;
+      if(other.pending) members |= 1 << i;
+   }
+   // rounds go out in order: the next one waits for this one's output
+   lock_guard<mutex> outputGuard(outputLock);
+   fuse(members);
+   for(size_t i = 0; i < cameras.size(); i++) cameras[i].pending = false;
+   guard.unlock();
+   if(output) output(fused);
+}
+
+// Greedy, largest records first: a record joins the nearest shape within
+// mergeDistance that no view of its camera is in yet, or starts its own
+void ShapeFusion::fuse(int32_t members){
+   views.clear();
+   for(size_t c = 0; c < cameras.size(); c++){
+      const Camera& camera = cameras[c];
+      if(!(members & (1 << c)) || !camera.detecting) continue;
+      for(size_t i = 0; i < camera.records.size(); i++){
+         const ShapeRecord& r = camera.records[i];
+         if(r.cz <= 0){
+            unplaced++;
+            continue;
+         }
+         View v;
+         v.camera = (int)c;
+         const double* p = camera.pose;
+         v.position = Point3d(p[0] * r.cx + p[1] * r.cy + p[2] * r.cz + p[3],
+                              p[4] * r.cx + p[5] * r.cy + p[6] * r.cz + p[7],
+                              p[8] * r.cx + p[9] * r.cy + p[10] * r.cz + p[11]);
+         v.record = &r;
+         views.push_back(v);
+      }
+   }
+   sort(views.begin(), views.end(), [](const View& a, const View& b) { return a.record->area > b.record->area; });
+
+   fused.index = rounds++;
+   fused.cameras = members;
+   fused.records.clear();
+   sums.clear();
+   weights.clear();
+   for(size_t i = 0; i < views.size(); i++){
+      const View& v = views[i];
+      int best = -1;
+      double bestDistance = mergeDistance;
+      for(size_t k = 0; k < fused.records.size(); k++){
+         if(fused.records[k].cameras & (1 << v.camera)) continue;
+         Point3d center = sums[k] * (1.0 / weights[k]);
+         double d = hypot(center.x - v.position.x, center.y - v.position.y);
+         if(d <= bestDistance){
+            best = (int)k;
+            bestDistance = d;
+         }
+      }
+      double weight = max(1, v.record->area);
+      if(best < 0){
+         const ShapeRecord& r = *v.record;
+         FusedRecord f;
+         f.type = r.type;
+         f.type3D = r.type3D;
+         f.sizeMajor = r.sizeMajor;
+         f.sizeMinor = r.sizeMinor;
+         f.footprint = r.footprint;
+         f.volume = r.volume;
+         fused.records.push_back(f);
+         sums.push_back(Point3d());
+         weights.push_back(0);
+         best = (int)fused.records.size() - 1;
+      }
+      FusedRecord& f = fused.records[best];
+      f.cameras |= 1 << v.camera;
+      f.views++;
+      sums[best] = sums[best] + v.position * weight;
+      weights[best] += weight;
+   }
+   for(size_t k = 0; k < fused.records.size(); k++){
+      Point3d center = sums[k] * (1.0 / weights[k]);
+      fused.records[k].x = (int32_t)lround(center.x);
+      fused.records[k].y = (int32_t)lround(center.y);
+      fused.records[k].z = (int32_t)lround(center.z);
+   }
+}
@@ -0,0 +1,475 @@
+#include "ShapePipeline.h"
+#include <thread>
+#include "Log.h"
+#include "CpuTopology.h"
+#include "TilePool.h"
+#include "TraceRecorder.h"
+
+const float ShapePipeline::detectionThreshold = 0.005f;
+const int ShapePipeline::backgroundFrames;
+const int ShapePipeline::steadyFrames;
+const int ShapePipeline::reservedBlobs;
+
+ShapePipeline::ShapePipeline(){
+   executor.addStage("heights", [this](int slot) { heightsStage(frames[slot]); });
+   executor.addStage("segment", [this](int slot) { segmentStage(frames[slot]); });
+   executor.addStage("classify", [this](int slot) { classifyStage(frames[slot]); });
+   executor.addStage("output", [this](int slot) { outputStage(frames[slot]); });
+   classifier = make_shared<ShapeClassifier>();
+   // integer planes round to whole millimeters in every stage
+   if(Planes::Pixel::unitsPerMeter() > 1) crossCheck.heightTolerance = 1.0f / Planes::Pixel::unitsPerMeter();
+}
+
+void ShapePipeline::setLens(const Mat& cameraMatrix, const Mat& distortion){
+   this->cameraMatrix = cameraMatrix;
+   distortionCoefficients = distortion;
+}
+
+void ShapePipeline::initialize(Size size, bool threaded){
+   executor.stop();
+   this->size = size;
+   // the per-pixel kernels run in tiles on the shared pool, which also
+   // turns off OpenCV's threads so the two do not compete for the cores,
+   // or on a pool of the pipeline's own cpus
+   TilePool& pool = TilePool::shared();
+   int poolThreads = (int)cpus.size();
+#ifdef SHAPE_PERF_COUNTERS
+   // the zones count their own thread only, see PerfCounters.h
+   poolThreads = 1;
+#endif
+   if(cpus.empty()) ownPool.reset();
+   else if(!ownPool || ownPoolCpus != cpus){
+      ownPool.reset(new TilePool(poolThreads, cpus));
+      ownPoolCpus = cpus;
+   }
+   int tileThreads = ownPool ? ownPool->getNumThreads() : pool.getNumThreads();
+   LOGI("Tile pool of %d threads.", tileThreads);
+#ifdef SHAPE_PERF_COUNTERS
+   perf.setTileThreads(tileThreads);
+#endif
+   // the stages are stopped, so their state can be reset from here; it is
+   // allocated on the cpus' node, next to the stages that use it
+   int slots = 5;
+   runPinned(cpus, [&]{
+      pipeline.create(size);
+      backProjection = BackProjection();
+      undistortMapX.release();
+      undistortMapY.release();
+      if(!cameraMatrix.empty()){
+         backProjection.create(cameraMatrix, size);
+         backProjection.reserve(reservedBlobs);
+         initUndistortRectifyMap(cameraMatrix, distortionCoefficients, Mat(), cameraMatrix,
+                                 size, CV_32FC1, undistortMapX, undistortMapY);
+      }
+      status = detecting ? DetectingBackground : ClickBackground;
+      drawing.create(size, CV_8UC3);
+      drawStatus(status);
+      // the run and outline buffers of segment and classify, so a steady
+      // frame never grows them
+      runs.reserve(size);
+      labeler.reserve(runs.runs.capacity());
+      coarseDetector.reserve(size, reservedBlobs);
+      regions.reserve(reservedBlobs);
+      isoContours.reserve(size);
+      size_t outline = MarchingSquares::outlinePoints(size);
+      contour.reserve(outline);
+      shape.reserve(outline);
+      simplifyWorkspace.reserve(outline);
+
+      // one frame per stage plus the one being ingested
+      frames.assign(slots, Frame());
+      for(int i = 0; i < slots; i++){
+         frames[i].depth.create(size, Planes::Pixel::depthType);
+         frames[i].diff.create(size, Planes::Pixel::heightType);
+         frames[i].drawing = Mat::zeros(size, CV_8UC3);
+         frames[i].blobs.reserve(reservedBlobs);
+         frames[i].profiles.reserve(reservedBlobs);
+         frames[i].metrics.reserve(reservedBlobs);
+         frames[i].records.reserve(reservedBlobs);
+      }
+   });
+   offered = ingested = 0;
+   finished = 0;
+   settledFrames = 0;
+   steady = false;
+   if(cpus.empty()) executor.setWorkerInit(function<void()>());
+   else executor.setWorkerInit([this]{
+      pinThread(cpus);
+      TilePool::bindThread(ownPool.get());
+   });
+   executor.start(slots, threaded && thread::hardware_concurrency() > 1);
+}
+
+void ShapePipeline::shutdown(){
+   executor.stop();
+}
+
+bool ShapePipeline::ingest(const royale::DepthData& data, bool wait){
+   uint64_t index = offered++;
+   TRACE_ZONE("ingest", (int64_t)index);
+   int slot = executor.acquire();
+   while(slot < 0 && wait){
+      this_thread::yield();
+      slot = executor.acquire();
+   }
+   if(slot < 0) return false;   // every frame is still in flight
+   // the caller's thread is not a stage worker: the copy, and the stages
+   // when submit runs them inline, go to the pipeline's own pool by hand
+   TilePoolBinding binding(ownPool.get());
+   Frame& frame = frames[slot];
+   frame.index = index;
+   frame.timestamp = data.timeStamp.count();
+   int last = frame.depth.rows * frame.depth.cols - 1;
+   {
+      // the copy only; without threads, submit runs the stages too
+      PERF_ZONE(perf, Ingest);
+      ALLOC_ZONE(Ingest, steady.load());
+      parallel_for_tiles(frame.depth.size(), sizeof(royale::DepthPoint) + sizeof(Planes::Depth), [&](const Rect& tile){
+         for(int y = tile.y; y < tile.y + tile.height; y++){
+            Planes::Depth* zRowPtr = frame.depth.ptr<Planes::Depth>(y);
+            int k = last - y * frame.depth.cols - tile.x;   // to reverse the screen
+            for(int x = tile.x; x < tile.x + tile.width; x++, k--){
+               const royale::DepthPoint& curPoint = data.points.at(k);
+               zRowPtr[x] = curPoint.depthConfidence > 0 ? Planes::Pixel::depthFromMeters(curPoint.z) : 0;
+            }
+         }
+      });
+   }
+   ingested++;
+   executor.submit(slot);
+   return true;
+}
+
+void ShapePipeline::flush(){
+   while(executor.isRunning() && finished.load() < ingested) this_thread::yield();
+}
+
+// Background capture, or the height above the table with the objects
+// segmented from it
+void ShapePipeline::heightsStage(Frame& frame){
+   TRACE_ZONE("heights", (int64_t)frame.index);
+   bool changed = applyCommands();
+   settledFrames = changed || detecting ? 0 : min(settledFrames + 1, steadyFrames);
+   frame.steady = settledFrames == steadyFrames;
+   steady = frame.steady;
+   ALLOC_ZONE(Heights, frame.steady);
+   frame.mode = mode;
+   frame.status = status;
+   frame.classifier = classifier;
+   frame.detecting = false;
+   frame.divergence = CrossCheck::Divergence();
+   // the pipeline works on the frame's planes; remapDiff may hand back
+   // another buffer, which the frame then keeps
+   pipeline.depth = frame.depth;
+   pipeline.diff = frame.diff;
+
+   //Background profile
+   if(detecting){
+      if(!capturing){
+         pipeline.resetBackground();
+         capturing = true;
+      }
+      pipeline.addBackground();
+      if(pipeline.getBackgroundFrames() == backgroundFrames){
+         pipeline.endBackground();
+         // metric measurements take the table depth in meters; a new
+         // buffer, as frames still in flight read the old one
+         Mat backgrMeters;
+         pipeline.background.convertTo(backgrMeters, CV_32FC1, 1.0 / Planes::Pixel::unitsPerMeter());
+         backgrUndist = Mat();
+         if(cameraMatrix.empty()) backgrUndist = backgrMeters;
+         else undistort(backgrMeters, backgrUndist, cameraMatrix, distortionCoefficients);
+         capturing = false;
+         detecting = false;
+         detected = true;
+         LOGI("Background detecting has ended.");
+      }
+   }
+
+   else if(planeMode){
+      PERF_ZONE(perf, Diff);
+      // nearest neighbour, so invalid pixels do not bleed into valid ones;
+      // millimeters are remapped aside, then converted to meters
+      zUndist.create(pipeline.depth.size(), CV_32FC1);
+      Mat& remapped = Planes::Pixel::depthType == CV_32FC1 ? zUndist : zRemapped;
+      remapped.create(pipeline.depth.size(), Planes::Pixel::depthType);
+      parallel_for_tiles(zUndist.size(), 16, [&](const Rect& tile){
+         Mat part = remapped(tile);
+         remap(pipeline.depth, part, undistortMapX(tile), undistortMapY(tile), INTER_NEAREST);
+         if(&remapped != &zUndist){
+            Mat meters = zUndist(tile);
+            part.convertTo(meters, CV_32FC1, 1.0 / Planes::Pixel::unitsPerMeter());
+         }
+      });
+      if(!planeFound || !planeFitter.update(zUndist, backProjection, plane)){
+         planeFound = planeFitter.fit(zUndist, backProjection, plane);
+         if(planeFound){
+            LOGI("Table plane n=(%f,%f,%f) d=%f", plane.nx, plane.ny, plane.nz, plane.d);
+         }
+      }
+      if(planeFound){
+         PlaneFitter::heightAbove(zUndist, backProjection, plane, planeHeights);
+         pipeline.setDiff(planeHeights);
+         // never into table, which may share the captured background
+         PlaneFitter::planeDepth(backProjection, plane, frame.planeTable);
+         frame.table = frame.planeTable;
+         frame.detecting = true;
+      }
+   }
+
+   else if(detected){
+      PERF_ZONE(perf, Diff);
+      if(crossChecking) pipeline.depth.copyTo(checkDepth);
+      pipeline.fillInvalid();
+      pipeline.difference();
+      if(!undistortMapX.empty()) pipeline.remapDiff(undistortMapX, undistortMapY);
+      frame.table = backgrUndist;
+      frame.detecting = true;
+      if(crossChecking){
+         crossCheck.checkHeights(checkDepth, pipeline.background, Planes::Pixel::unitsPerMeter(),
+                                 undistortMapX.empty() ? Mat() : cameraMatrix, distortionCoefficients,
+                                 pipeline.diff, frame.divergence);
+      }
+   }
+
+   frame.checking = crossChecking && frame.detecting;
+   if(frame.checking) pipeline.diff.copyTo(checkHeights);
+   if(frame.detecting) filterHeights(frame.mask);
+   if(frame.checking){
+      const vector<Rect>* area = pyramidLevels > 0 ? &regions : NULL;
+      crossCheck.checkBoxFilter(checkHeights, pipeline.diff, area, frame.divergence);
+      crossCheck.checkThreshold(pipeline.diff, detectionThreshold, area, frame.mask, frame.divergence);
+   }
+   frame.diff = pipeline.diff;
+}
+
+// Commands posted since the last frame, in the order they were posted;
+// true if there were any
+bool ShapePipeline::applyCommands(){
+   Command command;
+   bool applied = false;
+   while(commands.pop(command)){
+      applied = true;
+      switch(command.type){
+         case Command::SetMode:
+            mode = command.value;
+            break;
+         case Command::DetectBackground:
+            // the capture restarts with this frame
+            LOGI("Background detecting has started.");
+            detecting = true;
+            detected = false;
+            capturing = false;
+            status = DetectingBackground;
+            break;
+         case Command::SetPlaneMode:
+            LOGI("Table plane mode %s.", command.value ? "on" : "off");
+            planeMode = command.value != 0;
+            planeFound = false;
+            if(!planeMode && !detected) status = ClickBackground;
+            break;
+         case Command::SetPyramidLevels:
+            LOGI("Pyramid levels %d.", command.value);
+            pyramidLevels = max(0, min(command.value, 2));
+            break;
+         case Command::SetTemplates:
+            classifier = command.classifier;
+            break;
+         case Command::SetCrossCheck:
+            LOGI("Cross-check %s.", command.value ? "on" : "off");
+            crossChecking = command.value != 0;
+            break;
+      }
+   }
+   return applied;
+}
+
+// Smooths and thresholds the pipeline's diff, in the pyramid mode only
+// around the objects found on the coarse level
+void ShapePipeline::filterHeights(BitMask& mask){
+   PERF_ZONE(perf, Filter);
+   const Mat& diff = pipeline.diff;
+   if(pyramidLevels > 0){
+      pipeline.downsample(pyramidLevels, coarse);
+      coarseDetector.find(coarse, pyramidLevels, detectionThreshold, diff.size(), regions);
+      for(size_t i = 0; i < regions.size(); i++) pipeline.boxFilter(regions[i]);
+      pipeline.threshold(detectionThreshold, regions, mask);
+   }
+   else{
+      pipeline.boxFilter();
+      pipeline.threshold(detectionThreshold, mask);
+   }
+}
+
+// Blobs of the mask with their height profiles and metric sizes
+void ShapePipeline::segmentStage(Frame& frame){
+   TRACE_ZONE("segment", (int64_t)frame.index);
+   if(!frame.detecting) return;
+   ALLOC_ZONE(Segment, frame.steady);
+   PERF_ZONE(perf, Segment);
+   // remove speckle noise the box filter lets through
+   if(frame.checking) frame.mask.toMat(checkMask);
+   frame.mask.open(frame.mask, 1);
+   if(frame.checking) crossCheck.checkOpen(checkMask, frame.mask, frame.divergence);
+   // Find blobs on the runs, with their height profiles
+   runs.encode(frame.mask);
+   labeler.label(runs, frame.blobs, frame.diff, frame.profiles);
+   if(frame.checking) crossCheck.checkContours(frame.mask, frame.blobs, frame.checkContours, frame.divergence);
+   frame.metrics.clear();
+   if(!backProjection.empty()){
+      backProjection.measure(runs, labeler.getRunLabels(), (int)frame.blobs.size(), frame.diff,
+                             frame.table, frame.metrics);
+   }
+}
+
+// Outlines, types and records of the blobs
+void ShapePipeline::classifyStage(Frame& frame){
+   TRACE_ZONE("classify", (int64_t)frame.index);
+   if(!frame.detecting) return;
+   ALLOC_ZONE(Classify, frame.steady);
+   PERF_ZONE(perf, Classify);
+   const Mat& diff = frame.diff;
+   frame.records.clear();
+
+   if(frame.mode == 1) frame.drawing = Scalar::all(0);
+   for(unsigned int i = 0; i < frame.blobs.size(); i++){
+      // sub-pixel outline of the blob from the filtered heights
+      Rect roi = frame.blobs[i].bbox;
+      roi = Rect(roi.x - 1, roi.y - 1, roi.width + 2, roi.height + 2);
+      if(!isoContours.findLargestContour(diff, detectionThreshold, roi, 0, contour)) continue;
+      Shape2f& s = shape;
+      s.reset(contour, &simplifyWorkspace, frame.classifier.get());
+      s.setDepthProfile(frame.profiles[i]);
+      auto center = s.getCenter();
+      if(center.x < size.width*0.1 || center.x > size.width*0.9 ||
+         center.y < size.height*0.1 || center.y > size.height*0.9){
+         s.isValidShape = false;
+      }
+      if(!frame.metrics.empty()) s.setMetrics(frame.metrics[i]);
+      if(s.isValidShape) frame.records.push_back(s.getRecord());
+      if(frame.mode == 1) s.draw(frame.drawing);
+      if(frame.checking){
+         crossCheck.checkSimplify(contour, 0.02 * s.getPerimeter(), (int)s.getApprox().size(), center,
+                                  frame.divergence);
+      }
+   }
+   if(frame.checking){
+      crossCheck.checkShapes(frame.checkContours, frame.classifier.get(), size, frame.records, frame.divergence);
+   }
+}
+
+void ShapePipeline::outputStage(Frame& frame){
+   TRACE_ZONE("output", (int64_t)frame.index);
+   PERF_ZONE(perf, Output);
+   ALLOC_ZONE(Output, frame.steady);
+   Mat image;
+   if(frame.mode == 1){
+      if(!frame.detecting && frame.status != drawnStatus) drawStatus(frame.status);
+      image = frame.detecting ? frame.drawing : drawing;
+   }
+   if(frame.checking){
+      const CrossCheck::Divergence& d = frame.divergence;
+      crossCheck.count(d);
+      if(d.found()){
+         LOGE("Cross-check frame %llu: %s diverges at (%d,%d), reference %g, optimized %g, %d in the stage %s",
+              (unsigned long long)frame.index, CrossCheck::stageName(d.stage), d.pixel.x, d.pixel.y, d.reference,
+              d.optimized, d.count, d.detail.c_str());
+      }
+   }
+   if(output) output(frame, image);
+   finished++;
+}
+
+void ShapePipeline::drawStatus(Status s){
+   drawing = Scalar::all(0);
+   const char* text = s == DetectingBackground ? "Detecting background..." : "Click Backgr button";
+   putText(drawing, text, Point(30, 30), FONT_HERSHEY_PLAIN, 1, Scalar(0, 0, 255), 1);
+   drawnStatus = s;
+}
+
+string ShapePipeline::getStats() const{
+   string stats = executor.report();
+   if(crossCheck.getFrames() > 0) stats += crossCheck.report();
+#ifdef SHAPE_PERF_COUNTERS
+   stats += perf.report();
+#endif
+#ifdef SHAPE_ALLOC_TRACKING
+   stats += AllocTracker::shared().report();
+#endif
+   return stats;
+}
+
+bool ShapePipeline::writePerfCsv(const string& path) const{
+#ifdef SHAPE_PERF_COUNTERS
+   return perf.writeCsv(path);
+#else
+   (void)path;
+   return false;
+#endif
+}
+
+bool ShapePipeline::post(const Command& command){
+   if(!commands.push(command)){
+      LOGE("Control queue full, command %d dropped", (int)command.type);
+      return false;
+   }
+   return true;
+}
+
+void ShapePipeline::setMode(int mode){
+   Command command;
+   command.type = Command::SetMode;
+   command.value = mode;
+   post(command);
+}
+
+void ShapePipeline::setPlaneMode(bool on){
+   Command command;
+   command.type = Command::SetPlaneMode;
+   command.value = on;
+   post(command);
+}
+
+void ShapePipeline::setPyramidLevels(int levels){
+   Command command;
+   command.type = Command::SetPyramidLevels;
+   command.value = levels;
+   post(command);
+}
+
+void ShapePipeline::detectBackground(){
+   Command command;
+   command.type = Command::DetectBackground;
+   post(command);
+}
+
+void ShapePipeline::setCrossCheck(bool on){
+   Command command;
+   command.type = Command::SetCrossCheck;
+   command.value = on;
+   post(command);
+}
+
+bool ShapePipeline::setAllocationCheck(bool on){
+#ifdef SHAPE_ALLOC_TRACKING
+   LOGI("Allocation check %s.", on ? "on" : "off");
+   AllocTracker::shared().setStrict(on);
+   return true;
+#else
+   if(on) LOGE("Allocation check needs a build with SHAPE_ALLOC_TRACKING");
+   return !on;
+#endif
+}
+
+bool ShapePipeline::loadTemplates(const string& path){
+   shared_ptr<ShapeClassifier> loaded = make_shared<ShapeClassifier>();
+   if(!loaded->load(path)){
+      LOGE("Cannot load shape templates from %s", path.c_str());
+      return false;
+   }
+   LOGI("Loaded %zu shape templates in %zu classes", loaded->getNumTemplates(), loaded->getNumClasses());
+   Command command;
+   command.type = Command::SetTemplates;
+   command.classifier = loaded;
+   return post(command);
+}
@@ -0,0 +1,152 @@
+#include "StageExecutor.h"
+#include <chrono>
+#include <cstdio>
+#include "TraceRecorder.h"
+
+static int64_t nowNs(){
+   return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Spins briefly on an empty queue, then yields, then sleeps: a frame comes
+// every 20 ms or so, and an idle worker should not keep a core busy
+static void backoff(int idle){
+   if(idle < 64) return;
+   if(idle < 128) this_thread::yield();
+   else this_thread::sleep_for(chrono::microseconds(200));
+}
+
+void StageExecutor::addStage(const string& name, const Stage& run){
+   if(running.load()) return;
+   stages.push_back(unique_ptr<Worker>(new Worker(name, run, 1)));
+}
+
+void StageExecutor::start(int slots, bool threaded){
+   stop();
+   this->threaded = threaded;
+   // every queue can hold every slot, so a push never fails
+   freeSlots.reset(new SpscQueue<int>(slots));
+   for(int i = 0; i < slots; i++) freeSlots->push(i);
+   for(size_t i = 0; i < stages.size(); i++){
+      Worker& w = *stages[i];
+      stages[i].reset(new Worker(w.name, w.run, slots));
+   }
+   submitTime.assign(slots, 0);
+   resetStats();
+   running.store(true);
+   if(threaded){
+      for(size_t i = 0; i < stages.size(); i++){
+         stages[i]->worker = thread(&StageExecutor::workerLoop, this, i);
+      }
+   }
+}
+
+void StageExecutor::stop(){
+   if(!running.exchange(false)) return;
+   for(size_t i = 0; i < stages.size(); i++){
+      if(stages[i]->worker.joinable()) stages[i]->worker.join();
+   }
+}
+
+int StageExecutor::acquire(){
+   int slot;
+   if(!running.load() || !freeSlots->pop(slot)){
+      dropped++;
+      return -1;
+   }
+   return slot;
+}
+
+void StageExecutor::submit(int slot){
+   submitTime[slot] = nowNs();
+   if(threaded && !stages.empty()){
+      stages[0]->in.push(slot);
+      return;
+   }
+   for(size_t i = 0; i < stages.size(); i++) runStage(i, slot);
+   release(slot);
+}
+
+void StageExecutor::runStage(size_t i, int slot){
+   Worker& w = *stages[i];
+   int64_t start = nowNs();
+   w.run(slot);
+   w.busyNs += nowNs() - start;
+   w.frames++;
+}
+
+void StageExecutor::release(int slot){
+   latencyNs += nowNs() - submitTime[slot];
+   released++;
+   freeSlots->push(slot);
+}
+
+void StageExecutor::workerLoop(size_t i){
+   TraceRecorder::shared().nameThread(stages[i]->name);
+   if(workerInit) workerInit();
+   SpscQueue<int>* out = i + 1 < stages.size() ? &stages[i + 1]->in : NULL;
+   int idle = 0;
+   while(running.load(memory_order_acquire)){
+      int slot;
+      if(!stages[i]->in.pop(slot)){
+         backoff(idle++);
+         continue;
+      }
+      idle = 0;
+      runStage(i, slot);
+      if(out) out->push(slot);
+      else release(slot);
+   }
+}
+
+void StageExecutor::getStats(vector<StageStats>& stats) const{
+   double elapsed = (double)(nowNs() - statsStart.load());
+   stats.resize(stages.size());
+   for(size_t i = 0; i < stages.size(); i++){
+      const Worker& w = *stages[i];
+      StageStats& s = stats[i];
+      s.name = w.name;
+      s.frames = w.frames.load();
+      s.busyMs = w.busyNs.load() * 1e-6;
+      s.occupancy = elapsed > 0 ? w.busyNs.load() / elapsed : 0;
+      s.queued = w.in.size();
+   }
+}
+
+double StageExecutor::getMeanLatencyMs() const{
+   uint64_t n = released.load();
+   return n ? latencyNs.load() * 1e-6 / n : 0;
+}
+
+string StageExecutor::report() const{
+   vector<StageStats> stats;
+   getStats(stats);
+   size_t busiest = 0;
+   for(size_t i = 1; i < stats.size(); i++){
+      if(stats[i].occupancy > stats[busiest].occupancy) busiest = i;
+   }
+   string text;
+   char line[160];
+   for(size_t i = 0; i < stats.size(); i++){
+      const StageStats& s = stats[i];
+      snprintf(line, sizeof(line), "%-10s %6.1f%% busy %8llu frames %7.2f ms/frame %2zu queued%s\n",
+               s.name.c_str(), 100 * s.occupancy, (unsigned long long)s.frames,
+               s.frames ? s.busyMs / s.frames : 0.0, s.queued, i == busiest ? "  <- bottleneck" : "");
+      text += line;
+   }
+   snprintf(line, sizeof(line), "%s, latency %.2f ms, %llu dropped\n", threaded ? "pipelined" : "serial",
+            getMeanLatencyMs(), (unsigned long long)getDropped());
+   text += line;
+   return text;
+}
+
+void StageExecutor::resetStats(){
+   for(size_t i = 0; i < stages.size(); i++){
+      stages[i]->frames = 0;
+      stages[i]->busyNs = 0;
+   }
+   dropped = 0;
+   released = 0;
+   latencyNs = 0;
+   statsStart = nowNs();
+}
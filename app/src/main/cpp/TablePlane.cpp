@@ -0,0 +1,200 @@
+#include "TablePlane.h"
+#include "TilePool.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PLANE_NEON 1
+#endif
+
+// RANSAC budget and stopping: enough hypotheses for a 99% chance of an all
+// inlier sample at the best inlier share seen so far
+static const int maxIterations = 200;
+static const double confidence = 0.99;
+// share of the samples the plane must hold to count as the table
+static const float minSupport = 0.3f;
+// the table is seen from above, not edge on
+static const float minNormalZ = 0.2f;
+// weight of a new estimate when following drift
+static const float driftBlend = 0.25f;
+
+void PlaneFitter::sample(const Mat& depth, const BackProjection& rays){
+   CV_Assert(depth.type() == CV_32FC1 && !rays.empty());
+   CV_Assert(depth.cols == (int)rays.getRayX().size() && depth.rows == (int)rays.getRayY().size());
+   const vector<float>& rayX = rays.getRayX();
+   const vector<float>& rayY = rays.getRayY();
+   xs.clear();
+   ys.clear();
+   zs.clear();
+   int ox = phase % step, oy = (phase / step) % step;
+   for(int v = oy; v < depth.rows; v += step){
+      const float* z = depth.ptr<float>(v);
+      for(int u = ox; u < depth.cols; u += step){
+         if(z[u] <= 0) continue;
+         xs.push_back(rayX[u] * z[u]);
+         ys.push_back(rayY[v] * z[u]);
+         zs.push_back(z[u]);
+      }
+   }
+}
+
+// Points within tolerance of the plane. Gives up as soon as the count can no
+// longer exceed best.
+int PlaneFitter::countInliers(const Plane& p, int best) const{
+   int n = (int)xs.size();
+   int count = 0;
+   const int chunk = 128;
+   for(int start = 0; start < n; start += chunk){
+      if(count + (n - start) <= best) return count;
+      int end = min(start + chunk, n);
+      int i = start;
+#ifdef PLANE_NEON
+      uint32x4_t acc = vdupq_n_u32(0);
+      float32x4_t vd = vdupq_n_f32(p.d), tol = vdupq_n_f32(tolerance);
+      for(; i + 4 <= end; i += 4){
+         float32x4_t dist = vmlaq_n_f32(vd, vld1q_f32(&xs[i]), p.nx);
+         dist = vmlaq_n_f32(dist, vld1q_f32(&ys[i]), p.ny);
+         dist = vmlaq_n_f32(dist, vld1q_f32(&zs[i]), p.nz);
+         // all ones for an inlier, so subtracting counts it
+         acc = vsubq_u32(acc, vcaltq_f32(dist, tol));
+      }
+      uint32x2_t s = vadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+      count += (int)(vget_lane_u32(s, 0) + vget_lane_u32(s, 1));
+#endif
+      for(; i < end; i++){
+         if(fabs(p.distance(xs[i], ys[i], zs[i])) < tolerance) count++;
+      }
+   }
+   return count;
+}
+
+// Least squares z = a x + b y + c over the inliers of plane
+bool PlaneFitter::refine(Plane& plane) const{
+   double sxx = 0, sxy = 0, syy = 0, sx = 0, sy = 0, n = 0, sxz = 0, syz = 0, sz = 0;
+   for(size_t i = 0; i < xs.size(); i++){
+      if(fabs(plane.distance(xs[i], ys[i], zs[i])) >= tolerance) continue;
+      double x = xs[i], y = ys[i], z = zs[i];
+      sxx += x * x; sxy += x * y; syy += y * y;
+      sx += x; sy += y; n++;
+      sxz += x * z; syz += y * z; sz += z;
+   }
+   if(n < 3) return false;
+   // Cramer's rule on the 3x3 normal equations
+   double det = sxx * (syy * n - sy * sy) - sxy * (sxy * n - sy * sx) + sx * (sxy * sy - syy * sx);
+   if(fabs(det) < 1e-12) return false;
+   double a = (sxz * (syy * n - sy * sy) - sxy * (syz * n - sy * sz) + sx * (syz * sy - syy * sz)) / det;
+   double b = (sxx * (syz * n - sz * sy) - sxz * (sxy * n - sy * sx) + sx * (sxy * sz - syz * sx)) / det;
+   double c = (sxx * (syy * sz - sy * syz) - sxy * (sxy * sz - sx * syz) + sxz * (sxy * sy - syy * sx)) / det;
+   // a x + b y - z + c = 0, camera side positive
+   double norm = sqrt(a * a + b * b + 1);
+   double sign = c < 0 ? -1 : 1;
+   plane.nx = (float)(sign * a / norm);
+   plane.ny = (float)(sign * b / norm);
+   plane.nz = (float)(-sign / norm);
+   plane.d = (float)(sign * c / norm);
+   return true;
+}
+
+bool PlaneFitter::fit(const Mat& depth, const BackProjection& rays, Plane& plane){
+   sample(depth, rays);
+   int n = (int)xs.size();
+   if(n < 3) return false;
+
+   Plane best;
+   int bestCount = 0;
+   double needed = maxIterations;
+   for(int it = 0; it < maxIterations && it < needed; it++){
+      int i = rng.uniform(0, n), j = rng.uniform(0, n), k = rng.uniform(0, n);
+      float ux = xs[j] - xs[i], uy = ys[j] - ys[i], uz = zs[j] - zs[i];
+      float vx = xs[k] - xs[i], vy = ys[k] - ys[i], vz = zs[k] - zs[i];
+      Plane p;
+      p.nx = uy * vz - uz * vy;
+      p.ny = uz * vx - ux * vz;
+      p.nz = ux * vy - uy * vx;
+      float len = sqrt(p.nx * p.nx + p.ny * p.ny + p.nz * p.nz);
+      if(len < 1e-9f) continue;
+      p.nx /= len; p.ny /= len; p.nz /= len;
+      if(fabs(p.nz) < minNormalZ) continue;
+      p.d = -(p.nx * xs[i] + p.ny * ys[i] + p.nz * zs[i]);
+      if(p.d < 0){
+         p.nx = -p.nx; p.ny = -p.ny; p.nz = -p.nz; p.d = -p.d;
+      }
+
+      int count = countInliers(p, bestCount);
+      if(count > bestCount){
+         bestCount = count;
+         best = p;
+         double w = (double)count / n;
+         needed = w >= 1 ? 0 : log(1 - confidence) / log(1 - w * w * w);
+      }
+   }
+   if(bestCount < minSupport * n) return false;
+   // twice: the first refit can pull in points the hypothesis missed
+   if(!refine(best) || !refine(best)) return false;
+   plane = best;
+   return true;
+}
+
+bool PlaneFitter::update(const Mat& depth, const BackProjection& rays, Plane& plane){
+   phase = (phase + 1) % (step * step);
+   sample(depth, rays);
+   int n = (int)xs.size();
+   if(n < 3 || countInliers(plane, 0) < minSupport * n) return false;
+   Plane p = plane;
+   if(!refine(p)) return false;
+   float nx = plane.nx + driftBlend * (p.nx - plane.nx);
+   float ny = plane.ny + driftBlend * (p.ny - plane.ny);
+   float nz = plane.nz + driftBlend * (p.nz - plane.nz);
+   float len = sqrt(nx * nx + ny * ny + nz * nz);
+   plane.nx = nx / len;
+   plane.ny = ny / len;
+   plane.nz = nz / len;
+   plane.d = (plane.d + driftBlend * (p.d - plane.d)) / len;
+   return true;
+}
+
+void PlaneFitter::heightAbove(const Mat& depth, const BackProjection& rays, const Plane& p, Mat& height){
+   CV_Assert(depth.type() == CV_32FC1 && depth.cols == (int)rays.getRayX().size());
+   height.create(depth.size(), CV_32FC1);
+   const float* rayX = &rays.getRayX()[0];
+   parallel_for_tiles(depth.size(), 12, [&](const Rect& tile){
+      int u1 = tile.x + tile.width;
+      for(int v = tile.y; v < tile.y + tile.height; v++){
+         // height = z * (nx rx + ny ry + nz) + d along the ray of (u, v)
+         float base = p.ny * rays.getRayY()[v] + p.nz;
+         const float* z = depth.ptr<float>(v);
+         float* h = height.ptr<float>(v);
+         int u = tile.x;
+#ifdef PLANE_NEON
+         float32x4_t vbase = vdupq_n_f32(base), vd = vdupq_n_f32(p.d), zero = vdupq_n_f32(0);
+         for(; u + 4 <= u1; u += 4){
+            float32x4_t vz = vld1q_f32(z + u);
+            float32x4_t a = vmlaq_n_f32(vbase, vld1q_f32(rayX + u), p.nx);
+            float32x4_t r = vmlaq_f32(vd, vz, a);
+            vst1q_f32(h + u, vbslq_f32(vcgtq_f32(vz, zero), r, zero));
+         }
+#endif
+         for(; u < u1; u++){
+            h[u] = z[u] > 0 ? z[u] * (p.nx * rayX[u] + base) + p.d : 0;
+         }
+      }
+   });
+}
+
+void PlaneFitter::planeDepth(const BackProjection& rays, const Plane& p, Mat& depth){
+   const vector<float>& rayX = rays.getRayX();
+   const vector<float>& rayY = rays.getRayY();
+   depth.create((int)rayY.size(), (int)rayX.size(), CV_32FC1);
+   parallel_for_tiles(depth.size(), 8, [&](const Rect& tile){
+      for(int v = tile.y; v < tile.y + tile.height; v++){
+         float base = p.ny * rayY[v] + p.nz;
+         float* z = depth.ptr<float>(v);
+         for(int u = tile.x; u < tile.x + tile.width; u++){
+            // rays that never meet the plane get no depth
+            float a = p.nx * rayX[u] + base;
+            z[u] = a < 0 ? -p.d / a : 0;
+         }
+      }
+   });
+}
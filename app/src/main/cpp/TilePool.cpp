@@ -0,0 +1,179 @@
+#include "TilePool.h"
+#include "CpuTopology.h"
+
+const int TilePool::maxJobs;
+const int TilePool::l1Bytes;
+const int TilePool::minTileRows;
+
+TilePool::TilePool(int numThreads, const vector<int>& cpus) : cpus(cpus){
+   if(numThreads <= 0){
+      numThreads = max(1, (int)thread::hardware_concurrency());
+   }
+   for(int i = 0; i < maxJobs; i++){
+      jobs[i].blocks.reset(new Block[numThreads]);
+   }
+   // the caller is thread 0 of its own jobs
+   for(int i = 1; i < numThreads; i++){
+      workers.push_back(thread(&TilePool::workerLoop, this, i));
+   }
+}
+
+TilePool::~TilePool(){
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   for(auto& w : workers){
+      w.join();
+   }
+}
+
+static int sharedThreads = 0;
+
+static TilePool* createShared(){
+   setNumThreads(0);
+#ifdef SHAPE_PERF_COUNTERS
+   // hardware counters are per thread: the tiles run on the zone counting them
+   return new TilePool(1);
+#else
+   return new TilePool(sharedThreads);
+#endif
+}
+
+void TilePool::setSharedThreads(int numThreads){
+   sharedThreads = numThreads;
+}
+
+static thread_local TilePool* bound = NULL;
+
+TilePool& TilePool::shared(){
+   if(bound) return *bound;
+   // never destroyed: its workers may still be asleep when the process exits
+   static TilePool* pool = createShared();
+   return *pool;
+}
+
+TilePool* TilePool::bindThread(TilePool* pool){
+   TilePool* outer = bound;
+   bound = pool;
+   return outer;
+}
+
+void TilePool::work(Job& job, int index){
+   int blocks = getNumThreads();
+   for(int b = 0; b < blocks; b++){
+      Block& block = job.blocks[(index + b) % blocks];
+      for(int i = block.next.fetch_add(1, memory_order_relaxed); i < block.end;
+          i = block.next.fetch_add(1, memory_order_relaxed)){
+         job.call(job.context, i);
+         job.done.fetch_add(1, memory_order_release);
+      }
+   }
+}
+
+void TilePool::workerLoop(int index){
+   pinThread(cpus);
+   unique_lock<mutex> guard(lock);
+   while(true){
+      Job* job = NULL;
+      for(int i = 0; i < maxJobs && !job; i++){
+         if(jobs[i].open) job = &jobs[i];
+      }
+      if(!job){
+         if(stopping) return;
+         wake.wait(guard);
+         continue;
+      }
+      job->users++;
+      guard.unlock();
+#ifdef SHAPE_ALLOC_TRACKING
+      // as if the caller made them: counted into and checked by its zone
+      const char* outer = AllocTracker::enterZone(job->allocZone);
+      AllocTracker::Counts begin = AllocTracker::threadCounts();
+      work(*job, index);
+      AllocTracker::Counts end = AllocTracker::threadCounts();
+      AllocTracker::enterZone(outer);
+      job->allocations += end.allocations - begin.allocations;
+      job->allocBytes += end.bytes - begin.bytes;
+#else
+      work(*job, index);
+#endif
+      guard.lock();
+      // every task is claimed, if not finished yet
+      job->open = false;
+      if(--job->users == 0) finished.notify_all();
+   }
+}
+
+void TilePool::run(int n, Call call, void* context){
+   if(n <= 0) return;
+   Job* job = NULL;
+   if(n > 1 && !workers.empty()){
+      lock_guard<mutex> guard(lock);
+      for(int i = 0; i < maxJobs && !job; i++){
+         if(!jobs[i].busy) job = &jobs[i];
+      }
+      if(job){
+         int blocks = getNumThreads();
+         for(int b = 0; b < blocks; b++){
+            job->blocks[b].next.store(n * b / blocks, memory_order_relaxed);
+            job->blocks[b].end = n * (b + 1) / blocks;
+         }
+         job->call = call;
+         job->context = context;
+         job->n = n;
+         job->done.store(0, memory_order_relaxed);
+#ifdef SHAPE_ALLOC_TRACKING
+         job->allocZone = AllocTracker::currentZone();
+         job->allocations.store(0, memory_order_relaxed);
+         job->allocBytes.store(0, memory_order_relaxed);
+#endif
+         job->busy = true;
+         job->open = true;
+      }
+   }
+   if(!job){
+      for(int i = 0; i < n; i++) call(context, i);
+      return;
+   }
+   wake.notify_all();
+   work(*job, 0);
+
+   // the last tasks may still run on workers
+   unique_lock<mutex> guard(lock);
+   job->open = false;
+   finished.wait(guard, [job] {
+      return job->users == 0 && job->done.load(memory_order_acquire) == job->n;
+   });
+#ifdef SHAPE_ALLOC_TRACKING
+   AllocTracker::Counts workers;
+   workers.allocations = job->allocations.load();
+   workers.bytes = job->allocBytes.load();
+   AllocTracker::addThreadCounts(workers);
+#endif
+   job->busy = false;
+}
+
+TilePool::TileGrid::TileGrid(Size size, Size tile) : size(size){
+   if(size.area() <= 0) return;
+   step.width = max(1, min(tile.width, size.width));
+   step.height = max(1, min(tile.height, size.height));
+   nx = (size.width + step.width - 1) / step.width;
+   count = nx * ((size.height + step.height - 1) / step.height);
+}
+
+Rect TilePool::TileGrid::tile(int i) const{
+   return Rect((i % nx) * step.width, (i / nx) * step.height, step.width, step.height) &
+          Rect(0, 0, size.width, size.height);
+}
+
+Size TilePool::tileSize(Size size, int bytesPerPixel){
+   int budget = l1Bytes / 2;
+   int rowBytes = max(1, size.width * max(1, bytesPerPixel));
+   if(rowBytes * minTileRows <= budget){
+      return Size(size.width, max(minTileRows, budget / rowBytes));
+   }
+   int width = budget / (max(1, bytesPerPixel) * minTileRows) / 64 * 64;
+   return Size(max(64, width), minTileRows);
+}
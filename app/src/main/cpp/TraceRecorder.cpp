@@ -0,0 +1,162 @@
+#include "TraceRecorder.h"
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+const int TraceRecorder::ringEvents;
+
+TraceRecorder& TraceRecorder::shared(){
+   static TraceRecorder recorder;
+   return recorder;
+}
+
+int64_t TraceRecorder::now(){
+   return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The calling thread's ring, created with its first event and marked
+// finished when the thread exits; the recorder keeps it until the next
+// clear, so its events can still be written
+struct RingHolder {
+   shared_ptr<void> ring;
+   atomic<bool>* alive = NULL;
+   string name;   // given before the ring exists
+   ~RingHolder(){
+      if(alive) alive->store(false);
+   }
+};
+
+static thread_local RingHolder holder;
+
+TraceRecorder::Ring& TraceRecorder::threadRing(){
+   if(!holder.ring){
+      shared_ptr<Ring> ring = make_shared<Ring>();
+      ring->tid = (long)syscall(SYS_gettid);
+      if(holder.name.empty()){
+         char name[17] = {0};
+         prctl(PR_GET_NAME, name, 0, 0, 0);
+         ring->name = name;
+      }
+      else ring->name = holder.name;
+      {
+         lock_guard<mutex> guard(lock);
+         rings.push_back(ring);
+      }
+      holder.alive = &ring->alive;
+      holder.ring = ring;
+   }
+   return *static_cast<Ring*>(holder.ring.get());
+}
+
+void TraceRecorder::record(const char* name, int64_t beginNs, int64_t endNs, int64_t frame){
+   Ring& ring = threadRing();
+   uint64_t head = ring.head.load(memory_order_relaxed);
+   Event& e = ring.events[head % ringEvents];
+   // a reader that sees any of the overwrites below also sees head, as it
+   // was before them (seqlock writer; see writeJson)
+   atomic_thread_fence(memory_order_release);
+   e.name.store(name, memory_order_relaxed);
+   e.begin.store(beginNs, memory_order_relaxed);
+   e.end.store(endNs, memory_order_relaxed);
+   e.frame.store(frame, memory_order_relaxed);
+   ring.head.store(head + 1, memory_order_release);
+}
+
+const char* TraceRecorder::intern(const string& name){
+   lock_guard<mutex> guard(lock);
+   return names.insert(name).first->c_str();
+}
+
+void TraceRecorder::nameThread(const string& name){
+   if(!holder.ring){
+      holder.name = name;
+      return;
+   }
+   lock_guard<mutex> guard(lock);
+   static_cast<Ring*>(holder.ring.get())->name = name;
+}
+
+void TraceRecorder::clear(){
+   lock_guard<mutex> guard(lock);
+   vector<shared_ptr<Ring> > live;
+   for(size_t i = 0; i < rings.size(); i++){
+      if(!rings[i]->alive.load()) continue;
+      rings[i]->cleared.store(rings[i]->head.load(memory_order_acquire));
+      live.push_back(rings[i]);
+   }
+   rings.swap(live);
+}
+
+// name as a JSON string
+static string quote(const char* name){
+   string text = "\"";
+   for(const char* c = name; *c; c++){
+      if(*c == '"' || *c == '\\') text += '\\';
+      if((unsigned char)*c >= 0x20) text += *c;
+   }
+   return text + "\"";
+}
+
+bool TraceRecorder::writeJson(const string& path){
+   struct Copy {
+      const char* name;
+      int64_t begin, end, frame;
+   };
+   // copy the rings first, so the timestamps can start at the earliest event
+   vector<vector<Copy> > copies;
+   vector<pair<long, string> > threads;
+   {
+      lock_guard<mutex> guard(lock);
+      for(size_t r = 0; r < rings.size(); r++){
+         Ring& ring = *rings[r];
+         uint64_t head = ring.head.load(memory_order_acquire);
+         uint64_t from = max(ring.cleared.load(), head > (uint64_t)ringEvents ? head - ringEvents : 0);
+         vector<Copy> events;
+         for(uint64_t i = from; i < head; i++){
+            const Event& e = ring.events[i % ringEvents];
+            Copy c = { e.name.load(memory_order_relaxed), e.begin.load(memory_order_relaxed),
+                       e.end.load(memory_order_relaxed), e.frame.load(memory_order_relaxed) };
+            events.push_back(c);
+         }
+         // the thread may have overwritten the oldest ones meanwhile, and may
+         // be writing the one after; the fence keeps the copies above before
+         // the second load of head (seqlock reader)
+         atomic_thread_fence(memory_order_acquire);
+         uint64_t now = ring.head.load(memory_order_relaxed);
+         uint64_t valid = now >= (uint64_t)ringEvents ? now - ringEvents + 1 : 0;
+         if(valid > from) events.erase(events.begin(), events.begin() + min<uint64_t>(valid - from, events.size()));
+         copies.push_back(events);
+         threads.push_back(make_pair(ring.tid, ring.name));
+      }
+   }
+   int64_t start = INT64_MAX;
+   for(size_t r = 0; r < copies.size(); r++){
+      for(size_t i = 0; i < copies[r].size(); i++) start = min(start, copies[r][i].begin);
+   }
+
+   ofstream file(path.c_str());
+   if(!file.is_open()) return false;
+   int pid = (int)getpid();
+   char line[128];
+   file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+   const char* separator = "";
+   for(size_t r = 0; r < copies.size(); r++){
+      file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << threads[r].first
+           << ",\"args\":{\"name\":" << quote(threads[r].second.c_str()) << "}}";
+      separator = ",\n";
+      for(size_t i = 0; i < copies[r].size(); i++){
+         const Copy& c = copies[r][i];
+         snprintf(line, sizeof(line), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld",
+                  (c.begin - start) / 1000.0, (c.end - c.begin) / 1000.0, pid, threads[r].first);
+         file << separator << "{\"name\":" << quote(c.name) << line;
+         if(c.frame >= 0) file << ",\"args\":{\"frame\":" << c.frame << "}";
+         file << "}";
+      }
+   }
+   file << "\n]}\n";
+   return file.good();
+}
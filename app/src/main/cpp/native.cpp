@@ -2,137 +2,147 @@
 #include <royale/ICameraDevice.hpp>
 #include <iostream>
 #include <jni.h>
-#include <android/log.h>
+#include <pthread.h>
 #include <thread>
 #include <chrono>
-#include <mutex>
 #include "opencv2/opencv.hpp"
-#include <Shape.h>
+#include <AllocTracker.h>
+#include <CpuTopology.h>
+#include <Log.h>
+#include <ResultRing.h>
+#include <ShapeFusion.h>
+#include <ShapePipeline.h>
+#include <TilePool.h>
+#include <TraceRecorder.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#define LOGI(...) ((void)__android_log_print(ANDROID_LOG_INFO, "Native", __VA_ARGS__))
-#define LOGE(...) ((void)__android_log_print(ANDROID_LOG_ERROR, "Native", __VA_ARGS__))
-
 using namespace royale;
 using namespace std;
 using namespace cv;
 
 JavaVM *m_vm;
-jmethodID m_amplitudeCallbackID, m_shapeDetectedCallbackID;
+jmethodID m_amplitudeCallbackID, m_shapeDetectedCallbackID, m_fusedShapesCallbackID;
 jobject m_obj;
 
-uint16_t width, height;
-int mode = 1; // 1 camera, 2 test
+// Threads attached to the JavaVM here stay attached until they exit:
+// attaching creates a java.lang.Thread, too much for every frame
+static pthread_key_t attachedKey;
+static pthread_once_t attachedOnce = PTHREAD_ONCE_INIT;
+
+static void detachThread (void *env)
+{
+    m_vm->DetachCurrentThread();
+}
+
+static void createAttachedKey()
+{
+    pthread_key_create (&attachedKey, detachThread);
+}
+
+// The calling thread's JNI interface pointer, attaching it on its first call
+static JNIEnv *attachedEnv()
+{
+    JNIEnv *env = NULL;
+    // a Java thread, or one attached before
+    if (m_vm->GetEnv ((void **) &env, JNI_VERSION_1_6) == JNI_OK) return env;
+    pthread_once (&attachedOnce, createAttachedKey);
+    m_vm->AttachCurrentThread((JNIEnv **) &env, NULL);
+    pthread_setspecific (attachedKey, env);
+    return env;
+}
 
-// this represents the main camera device object
-static std::unique_ptr<ICameraDevice> cameraDevice;
+// merges the shapes of all cameras when there are several
+static ShapeFusion fusion;
 
+// Feeds a camera's frames to its own detection pipeline and hands what comes
+// out of it to Java; only the first camera's image and shapes go to the
+// screen, with several cameras every camera's shapes go to the fusion
 class MyListener : public IDepthDataListener
 {
+    int index;
+    uint16_t width = 0, height = 0;
     Mat cameraMatrix, distortionCoefficients;
-    Mat zImage, zImage8;
 
-    mutex flagMutex;
-    bool detecting = false;
-    bool detected = false;
-    int count = 0;
-    Mat backgrMat;
-    Mat diff, diffBin;
-    Mat drawing;
+    ShapePipeline shapes;
+
+    // output stage
+    vector<jint> argb;
+    // shared-memory copy of the output for other readers, opened with the
+    // camera
+    ResultRingWriter ring;
+    string ringPath;
+    bool ringMask = false;
 
     void onNewData (const DepthData *data)
     {
-        if(detecting){
-            zImage = Scalar::all (0);
-        }
-        else{
-            zImage = backgrMat.clone();
-        }
-        int k = zImage.rows * zImage.cols -1 ; // to reverse scrren
-        for (int y = 0; y < zImage.rows; y++)
-        {
-            float *zRowPtr = zImage.ptr<float> (y);
-            for (int x = 0; x < zImage.cols; x++, k--)
-            {
-                auto curPoint = data->points.at (k);
-                if (curPoint.depthConfidence > 0)
-                {
-                    zRowPtr[x] = curPoint.z;
-                }
-            }
-        }
-
-        //Background profile
-        if(detecting){
-            backgrMat += zImage;
-            count++;
-            if(count == 20){
-                backgrMat /= 20;
-                detecting = false;
-                detected = true;
-                LOGI("Background detecting has ended.");
-            }
-        }
+        shapes.ingest (*data);
+    }
 
-        else if (detected){
-            diff = backgrMat - zImage;
-            Mat temp = diff.clone();
-            undistort (temp, diff, cameraMatrix, distortionCoefficients);
-
-            boxFilter(diff, diff, -1, Size(5,5));
-            threshold(diff, diffBin, 0.005, 255, CV_THRESH_BINARY);
-            // Find contours
-            diffBin.convertTo(diffBin, CV_8UC1);
-            vector<vector<Point> > contours;
-            findContours(diffBin, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
-
-            if(mode == 1) drawing = Scalar::all (0);
-            for( unsigned int i = 0; i< contours.size(); i++ )
-            {
-                Shape s = Shape(contours[i]);
-                auto center = s.getCenter();
-                if(center.x < width*0.1 || center.x > width*0.9 ||
-                   center.y < height*0.1 || center.y > height*0.9){
-                    s.isValidShape = false;
-                }
-                if(mode == 1) s.draw(drawing);
-            }
-        }
+    void output (const ShapePipeline::Frame &frame, const Mat &image)
+    {
+        ring.publish (frame.index, frame.timestamp, frame.detecting, frame.records, &frame.mask);
+        if (fusion.getCameras() > 1) fusion.submit (index, frame.detecting, frame.records);
+        if (index != 0) return;
+        if(frame.detecting) sendShapes(frame.records);
 
-        if(mode == 1) {
+        if(frame.mode == 1) {
+            TRACE_ZONE ("amplitudeCallback", (int64_t) frame.index);
             // fill a temp structure to use to populate the java int array
             //  int color = (A & 0xff) << 24 | (R & 0xff) << 16 | (G & 0xff) << 8 | (B & 0xff);
-            jint fill[width * height];
-            k = 0;
-            for (int i = 0; i < drawing.rows; i++) {
-                Vec3b *ptr = drawing.ptr<Vec3b>(i);
-                for (int j = 0; j < drawing.cols; j++) {
-                    Vec3b p = ptr[j];
-                    int color = (255 & 0xff) << 24 | (p[2] & 0xff) << 16 | (p[1] & 0xff) << 8 |
-                                (p[0] & 0xff);
-                    fill[k] = color;
-                    k++;
+            argb.resize(width * height);
+            parallel_for_tiles(image.size(), 7, [&](const Rect &tile) {
+                for (int i = tile.y; i < tile.y + tile.height; i++) {
+                    const Vec3b *ptr = image.ptr<Vec3b>(i);
+                    int k = i * image.cols + tile.x;
+                    for (int j = tile.x; j < tile.x + tile.width; j++) {
+                        Vec3b p = ptr[j];
+                        int color = (255 & 0xff) << 24 | (p[2] & 0xff) << 16 | (p[1] & 0xff) << 8 |
+                                    (p[0] & 0xff);
+                        argb[k] = color;
+                        k++;
+                    }
                 }
-            }
+            });
             // attach to the JavaVM thread and get a JNI interface pointer
-            JNIEnv *env;
-            m_vm->AttachCurrentThread((JNIEnv **) &env, NULL);
+            JNIEnv *env = attachedEnv();
             jintArray intArray = env->NewIntArray(width * height);
-            env->SetIntArrayRegion(intArray, 0, width * height, fill);
+            ALLOC_JAVA_ARRAY (width * height * sizeof(jint));
+            ALLOC_LOCAL_REFS (1);
+            env->SetIntArrayRegion(intArray, 0, width * height, &argb[0]);
             env->CallVoidMethod(m_obj, m_amplitudeCallbackID, intArray);
-            m_vm->DetachCurrentThread();
+            env->DeleteLocalRef(intArray);
+            ALLOC_LOCAL_REFS (-1);
         }
-        else if(mode == 2){
+        else if(frame.mode == 2){
 
         }
+    }
 
+    // Every detected frame reports its valid shapes, shapeRecordInts ints each
+    void sendShapes(const vector<ShapeRecord> &records)
+    {
+        TRACE_ZONE ("shapeDetectedCallback", -1);
+        JNIEnv *env = attachedEnv();
+        jsize n = (jsize) (records.size() * shapeRecordInts);
+        jintArray intArray = env->NewIntArray(n);
+        ALLOC_JAVA_ARRAY (n * sizeof(jint));
+        ALLOC_LOCAL_REFS (1);
+        if (n > 0) env->SetIntArrayRegion(intArray, 0, n, (const jint *) &records[0]);
+        env->CallVoidMethod(m_obj, m_shapeDetectedCallbackID, intArray);
+        env->DeleteLocalRef(intArray);
+        ALLOC_LOCAL_REFS (-1);
     }
 
 public :
+    explicit MyListener (int index) : index (index)
+    {
+        shapes.setOutput ([this](const ShapePipeline::Frame &frame, const Mat &image) { output (frame, image); });
+    }
+
     void setLensParameters (LensParameters lensParameters)
     {
         // Construct the camera matrix
@@ -159,29 +169,152 @@ public :
              lensParameters.distortionRadial[2]);
     }
 
-    void initialize(){
-        zImage.create (Size (width,height), CV_32FC1);
-        backgrMat.create (Size (width,height), CV_32FC1);
-        backgrMat = Scalar::all (0);
-        drawing = Mat::zeros(height, width, CV_8UC3);
-        putText(drawing, "Click Backgr button",Point(30,30),FONT_HERSHEY_PLAIN ,1,Scalar(0,0,255),1);
+    // Runs the pipeline's threads on cpus; takes effect when the camera opens
+    void setCpus(const vector<int> &cpus){
+        shapes.setCpus (cpus);
     }
 
+    void initialize(uint16_t width, uint16_t height){
+        this->width = width;
+        this->height = height;
+        ring.close();
+        if (!ringPath.empty() && !ring.create (ringPath, Size (width, height), ringMask)) {
+            LOGE ("Cannot create the result ring %s", ringPath.c_str());
+        }
+        shapes.setLens (cameraMatrix, distortionCoefficients);
+        shapes.initialize (Size (width, height));
+    }
+
+    void shutdown(){
+        shapes.shutdown();
+        ring.close();
+    }
+
+    // Takes effect when the camera opens; an empty path turns it off
+    void setResultRing(const string &path, bool mask){
+        ringPath = path;
+        ringMask = mask;
+    }
+
+    string getStats(){
+        return shapes.getStats();
+    }
+
+    bool writePerfCsv(const string &path){
+        return shapes.writePerfCsv (path);
+    }
+
+    bool loadTemplates(const string &path){
+        return shapes.loadTemplates (path);
+    }
+
+    // The setters below only post commands, from any thread; they take effect
+    // with the next frame
+    void setMode(int m){
+        shapes.setMode (m);
+    }
+
+    void setPlaneMode(bool on){
+        shapes.setPlaneMode (on);
+    }
+
+    // 0 turns the pyramid mode off, 1 and 2 detect at half and quarter size
+    void setPyramidLevels(int levels){
+        shapes.setPyramidLevels (levels);
+    }
+
+    // The heights stage restarts the capture with its next frame
     void detectBackground(){
-        LOGI("Background detecting has started.");
-        detecting = true;
-        detected = false;
-        count = 0;
-        backgrMat = Scalar::all (0);
-        drawing = Scalar::all (0);
-        putText(drawing, "Detecting background...",Point(30,30),FONT_HERSHEY_PLAIN ,1,Scalar(0,0,255),1);
+        shapes.detectBackground();
     }
+
+    void setCrossCheck(bool on){
+        shapes.setCrossCheck (on);
+    }
+
+    bool setAllocationCheck(bool on){
+        return shapes.setAllocationCheck (on);
+    }
+};
+
+// One camera: its device and the listener running its pipeline. The device
+// goes first when the camera does, while the listener is still there.
+struct Camera
+{
+    int index;
+    MyListener listener;
+    std::unique_ptr<ICameraDevice> device;
+    royale::String id;
+
+    explicit Camera (int index) : index (index), listener (index) {}
 };
 
-MyListener listener;
+// The cameras by index, the first one from the start so that settings made
+// before opening it hold; a camera keeps its slot, and with it its pose and
+// cpus, when closed and opened again
+static vector<unique_ptr<Camera>> cameras = [] {
+    vector<unique_ptr<Camera>> first;
+    first.push_back (unique_ptr<Camera> (new Camera (0)));
+    return first;
+}();
 
+static Camera &addCamera()
+{
+    cameras.push_back (unique_ptr<Camera> (new Camera ((int) cameras.size())));
+    return *cameras.back();
+}
+
+// Every fused round sends its shapes, fusedRecordInts ints each
+static void sendFused (const ShapeFusion::Frame &frame)
+{
+    TRACE_ZONE ("fusedShapesCallback", (int64_t) frame.index);
+    JNIEnv *env = attachedEnv();
+    jsize n = (jsize) (frame.records.size() * fusedRecordInts);
+    jintArray intArray = env->NewIntArray(n);
+    ALLOC_JAVA_ARRAY (n * sizeof(jint));
+    ALLOC_LOCAL_REFS (1);
+    if (n > 0) env->SetIntArrayRegion(intArray, 0, n, (const jint *) &frame.records[0]);
+    env->CallVoidMethod(m_obj, m_fusedShapesCallbackID, intArray);
+    env->DeleteLocalRef(intArray);
+    ALLOC_LOCAL_REFS (-1);
+}
+
+// Before opening the cameras: gives each of count cameras its own group of
+// cpus and, with more than one, fuses their shapes
+void Java_com_esalman17_shapedetector_MainActivity_SetCameraCountNative (JNIEnv *env, jobject thiz, jint count)
+{
+    while ((int) cameras.size() < count) addCamera();
+    vector<vector<int>> groups = cpuGroups (count);
+    for (int i = 0; i < (int) cameras.size(); i++)
+    {
+        cameras[i]->listener.setCpus (count > 1 ? groups[i % groups.size()] : vector<int>());
+    }
+    fusion.setCameras (count);
+    LOGI ("%d camera(s), %zu cpu group(s)", (int) count, groups.size());
+}
+
+// The camera to table transform of a camera, 12 or 16 doubles row by row [mm]
+void Java_com_esalman17_shapedetector_MainActivity_SetCameraPoseNative (JNIEnv *env, jobject thiz, jint camera,
+                                                                      jdoubleArray pose)
+{
+    jsize n = env->GetArrayLength (pose);
+    if (n != 12 && n != 16)
+    {
+        LOGE ("A camera pose has 12 or 16 values, not %d", (int) n);
+        return;
+    }
+    Mat1d transform (n / 4, 4);
+    env->GetDoubleArrayRegion (pose, 0, n, (jdouble *) transform.ptr<double>());
+    fusion.setPose (camera, transform);
+}
+
+// Opens one more camera, or one opened before again; returns its width,
+// height and index
 jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv *env, jobject thiz, jint fd, jint vid, jint pid)
 {
+    std::unique_ptr<ICameraDevice> cameraDevice;
+    uint16_t width, height;
+
     // the camera manager will query for a connected camera
     {
         CameraManager manager;
@@ -196,10 +329,12 @@ jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv
     }
     // the camera device is now available and CameraManager can be deallocated here
 
+    // nothing to return without a camera; Java checks for null
+    jintArray intArray = NULL;
     if (cameraDevice == nullptr)
     {
         LOGI ("Cannot create the camera device");
-        jintArray intArray();
+        return intArray;
     }
 
     // IMPORTANT: call the initialize method before working with the camera device
@@ -207,6 +342,7 @@ jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv
     if (ret != CameraStatus::SUCCESS)
     {
         LOGI ("Cannot initialize the camera device, CODE %d", (int) ret);
+        return intArray;
     }
 
     royale::Vector<royale::String> opModes;
@@ -258,6 +394,26 @@ jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv
         LOGI ("    %s", opModes.at (i).c_str());
     }
 
+    // the slot this camera had before, or the first one no camera took yet
+    Camera *slot = nullptr;
+    for (size_t i = 0; i < cameras.size() && slot == nullptr; i++)
+    {
+        if (cameras[i]->id == cameraId) slot = cameras[i].get();
+    }
+    for (size_t i = 0; i < cameras.size() && slot == nullptr; i++)
+    {
+        if (cameras[i]->id.empty()) slot = cameras[i].get();
+    }
+    Camera &camera = slot != nullptr ? *slot : addCamera();
+    if (camera.device != nullptr)
+    {
+        camera.device->stopCapture();
+        camera.device.reset();
+        camera.listener.shutdown();
+    }
+    camera.id = cameraId;
+    MyListener &listener = camera.listener;
+
     LensParameters lensParams;
     ret = cameraDevice->getLensParameters (lensParams);
     if (ret != CameraStatus::SUCCESS)
@@ -266,7 +422,7 @@ jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv
     }else{
         listener.setLensParameters (lensParams);
     }
-    listener.initialize();
+    listener.initialize (width, height);
 
     // register a data listener
     ret = cameraDevice->registerDataListener (&listener);
@@ -301,14 +457,16 @@ jintArray Java_com_esalman17_shapedetector_MainActivity_OpenCameraNative (JNIEnv
     {
         LOGI ("Failed to start capture, CODE %d", (int) ret);
     }
+    camera.device = std::move (cameraDevice);
 
-    jint fill[2];
+    jint fill[3];
     fill[0] = width;
     fill[1] = height;
+    fill[2] = camera.index;
 
-    jintArray intArray = env->NewIntArray (2);
+    intArray = env->NewIntArray (3);
 
-    env->SetIntArrayRegion (intArray, 0, 2, fill);
+    env->SetIntArrayRegion (intArray, 0, 3, fill);
 
     return intArray;
 }
@@ -330,21 +488,129 @@ void Java_com_esalman17_shapedetector_MainActivity_RegisterCallback (JNIEnv *env
     // save method ID to call the method later in the listener
     m_amplitudeCallbackID = env->GetMethodID (g_class, "amplitudeCallback", "([I)V");
     m_shapeDetectedCallbackID = env->GetMethodID (g_class, "shapeDetectedCallback", "([I)V");
+    m_fusedShapesCallbackID = env->GetMethodID (g_class, "fusedShapesCallback", "([I)V");
+    fusion.setOutput (sendFused);
 }
 
 void Java_com_esalman17_shapedetector_MainActivity_DetectBackgroundNative (JNIEnv *env, jobject thiz)
 {
-    listener.detectBackground();
+    for (auto &camera : cameras) camera->listener.detectBackground();
 }
 
 void Java_com_esalman17_shapedetector_MainActivity_CloseCameraNative (JNIEnv *env, jobject thiz)
 {
-    cameraDevice->stopCapture();
+    for (auto &camera : cameras)
+    {
+        if (camera->device == nullptr) continue;
+        camera->device->stopCapture();
+        camera->device.reset();
+        camera->listener.shutdown();
+    }
+}
+
+jstring Java_com_esalman17_shapedetector_MainActivity_GetPipelineStatsNative (JNIEnv *env, jobject thiz)
+{
+    string stats;
+    for (auto &camera : cameras)
+    {
+        if (cameras.size() > 1) stats += "camera " + to_string (camera->index) + "\n";
+        stats += camera->listener.getStats();
+    }
+    if (fusion.getCameras() > 1)
+    {
+        stats += "fusion: " + to_string (fusion.getRounds()) + " rounds, " + to_string (fusion.getUnplaced()) +
+                 " shapes without a position\n";
+    }
+    LOGI ("%s", stats.c_str());
+    return env->NewStringUTF (stats.c_str());
+}
+
+void Java_com_esalman17_shapedetector_MainActivity_SetTracingNative (JNIEnv *env, jobject thiz, jboolean on)
+{
+    TraceRecorder::shared().setEnabled (on);
+}
+
+jboolean Java_com_esalman17_shapedetector_MainActivity_DumpTraceNative (JNIEnv *env, jobject thiz, jstring path)
+{
+    const char *chars = env->GetStringUTFChars (path, NULL);
+    bool ok = TraceRecorder::shared().writeJson (chars);
+    env->ReleaseStringUTFChars (path, chars);
+    return (jboolean) ok;
+}
+
+// A zone Java timed itself with System.nanoTime, on the calling thread
+void Java_com_esalman17_shapedetector_MainActivity_TraceEventNative (JNIEnv *env, jobject thiz, jstring name,
+                                                                    jlong beginNs, jlong endNs)
+{
+    TraceRecorder &recorder = TraceRecorder::shared();
+    if (!recorder.isEnabled()) return;
+    const char *chars = env->GetStringUTFChars (name, NULL);
+    recorder.record (recorder.intern (chars), beginNs, endNs);
+    env->ReleaseStringUTFChars (name, chars);
+}
+
+jboolean Java_com_esalman17_shapedetector_MainActivity_DumpPerfCountersNative (JNIEnv *env, jobject thiz, jstring path)
+{
+    // the first camera's to path, the others' to path.1, path.2, ...
+    const char *chars = env->GetStringUTFChars (path, NULL);
+    bool ok = true;
+    for (auto &camera : cameras)
+    {
+        string file = camera->index == 0 ? string (chars) : chars + ("." + to_string (camera->index));
+        ok = camera->listener.writePerfCsv (file) && ok;
+    }
+    env->ReleaseStringUTFChars (path, chars);
+    return (jboolean) ok;
+}
+
+void Java_com_esalman17_shapedetector_MainActivity_SetResultRingNative (JNIEnv *env, jobject thiz, jstring path,
+                                                                      jboolean mask)
+{
+    // a ring has one writer: the first camera, which is there from the
+    // start; the ring is created when the camera opens
+    if (cameras[0]->device != nullptr)
+    {
+        LOGI ("The result ring takes effect when the first camera opens again");
+    }
+    const char *chars = env->GetStringUTFChars (path, NULL);
+    cameras[0]->listener.setResultRing (chars, mask);
+    env->ReleaseStringUTFChars (path, chars);
+}
+
+void Java_com_esalman17_shapedetector_MainActivity_SetPlaneModeNative (JNIEnv *env, jobject thiz, jboolean on)
+{
+    for (auto &camera : cameras) camera->listener.setPlaneMode (on);
+}
+
+void Java_com_esalman17_shapedetector_MainActivity_SetPyramidLevelsNative (JNIEnv *env, jobject thiz, jint levels)
+{
+    for (auto &camera : cameras) camera->listener.setPyramidLevels (levels);
+}
+
+jboolean Java_com_esalman17_shapedetector_MainActivity_LoadShapeTemplatesNative (JNIEnv *env, jobject thiz, jstring path)
+{
+    const char *chars = env->GetStringUTFChars (path, NULL);
+    bool ok = true;
+    for (auto &camera : cameras) ok = camera->listener.loadTemplates (chars) && ok;
+    env->ReleaseStringUTFChars (path, chars);
+    return (jboolean) ok;
+}
+
+void Java_com_esalman17_shapedetector_MainActivity_SetCrossCheckNative (JNIEnv *env, jobject thiz, jboolean on)
+{
+    for (auto &camera : cameras) camera->listener.setCrossCheck (on);
+}
+
+jboolean Java_com_esalman17_shapedetector_MainActivity_SetAllocationCheckNative (JNIEnv *env, jobject thiz, jboolean on)
+{
+    bool ok = true;
+    for (auto &camera : cameras) ok = camera->listener.setAllocationCheck (on) && ok;
+    return (jboolean) ok;
 }
 
 void Java_com_esalman17_shapedetector_MainActivity_ChangeModeNative (JNIEnv *env, jobject thiz, jint m)
 {
-    mode = m;
+    for (auto &camera : cameras) camera->listener.setMode (m);
 }
 
 #ifdef __cplusplus
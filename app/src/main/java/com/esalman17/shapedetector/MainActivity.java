@@ -16,9 +16,18 @@ import android.view.View;
 import android.widget.Button;
 import android.widget.ImageView;
 import android.graphics.Bitmap;
+import android.graphics.Canvas;
+import android.graphics.Color;
+import android.graphics.Paint;
 import android.graphics.Point;
 import android.view.Display;
 
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.FileReader;
+import java.io.FileWriter;
+import java.io.IOException;
+import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.Iterator;
 
@@ -37,27 +46,63 @@ public class MainActivity extends Activity {
 
     private PendingIntent mUsbPi;
     private UsbManager manager;
-    private UsbDeviceConnection usbConnection;
+    private ArrayList<UsbDeviceConnection> usbConnections = new ArrayList<>();
 
     private Bitmap bmpCam = null;
     private Bitmap bmpTest = null;
+    private Canvas canvasTest = null;
+    private Paint paintTest = null;
     private ImageView mainImView;
 
     boolean m_opened;
+    boolean m_registered;
     Mode currentMode;
 
     private static final String LOG_TAG = "MainActivity";
     private static final String ACTION_USB_PERMISSION = "ACTION_ROYALE_USB_PERMISSION";
+    // camera to table transforms, as shape_multicam --poses reads them
+    private static final String CAMERA_POSES_FILE = "camera_poses.txt";
+    // what the pipelines measured, written when the cameras close
+    private static final String STATS_FILE = "pipeline_stats.txt";
+    private static final String PERF_COUNTERS_FILE = "perf_counters.csv";
+    private static final String TRACE_FILE = "trace.json";
+
+    // Debug switches, extras of the launching intent, e.g.
+    // adb shell am start -n com.esalman17.shapedetector/.MainActivity --ez crossCheck true
+    private static final String EXTRA_CROSS_CHECK = "crossCheck";
+    private static final String EXTRA_TRACING = "tracing";
+    private static final String EXTRA_ALLOCATION_CHECK = "allocationCheck";
+    // a file for the shared-memory result ring, e.g. --es resultRing /dev/shm/shape_results
+    private static final String EXTRA_RESULT_RING = "resultRing";
+    private static final String EXTRA_RESULT_RING_MASK = "resultRingMask";
+    private boolean crossCheck;
+    private boolean tracing;
+    private boolean allocationCheck;
+    private String resultRing;
+    private boolean resultRingMask;
 
     int scaleFactor;
     int[] resolution;
     Point displaySize, camRes;
 
     public native int[] OpenCameraNative(int fd, int vid, int pid);
+    public native void SetCameraCountNative(int count);
+    public native void SetCameraPoseNative(int camera, double[] cameraToTable);
     public native void CloseCameraNative();
     public native void RegisterCallback();
     public native void DetectBackgroundNative();
     public native void ChangeModeNative(int mode);
+    public native boolean LoadShapeTemplatesNative(String path);
+    public native void SetPlaneModeNative(boolean on);
+    public native void SetPyramidLevelsNative(int levels);
+    public native void SetCrossCheckNative(boolean on);
+    public native boolean SetAllocationCheckNative(boolean on);
+    public native String GetPipelineStatsNative();
+    public native boolean DumpPerfCountersNative(String path);
+    public native void SetResultRingNative(String path, boolean mask);
+    public native void SetTracingNative(boolean on);
+    public native boolean DumpTraceNative(String path);
+    public native void TraceEventNative(String name, long beginNs, long endNs);
 
     //broadcast receiver for user usb permission dialog
     private final BroadcastReceiver mUsbReceiver = new BroadcastReceiver() {
@@ -69,9 +114,7 @@ public class MainActivity extends Activity {
 
                 if (intent.getBooleanExtra(UsbManager.EXTRA_PERMISSION_GRANTED, false)) {
                     if (device != null) {
-                        RegisterCallback();
-                        performUsbPermissionCallback(device);
-                        createBitmap();
+                        openDevice(device);
                     }
                 } else {
                     System.out.println("permission denied for device" + device);
@@ -86,6 +129,7 @@ public class MainActivity extends Activity {
         setRequestedOrientation (ActivityInfo.SCREEN_ORIENTATION_LANDSCAPE);
         setContentView(R.layout.activity_main);
         Log.d(LOG_TAG, "onCreate()");
+        readDebugExtras(getIntent());
 
         // hide the navigation bar
         final int flags = View.SYSTEM_UI_FLAG_LAYOUT_STABLE
@@ -135,6 +179,7 @@ public class MainActivity extends Activity {
         findViewById(R.id.buttonTest).setOnClickListener(new View.OnClickListener() {
             @Override
             public void onClick(View view) {
+                initializeTestMode();
                 ChangeModeNative(2);
                 currentMode = Mode.TEST;
             }
@@ -144,6 +189,7 @@ public class MainActivity extends Activity {
     @Override
     protected void onPause() {
         if (m_opened) {
+            dumpDebugFiles();
             CloseCameraNative();
             m_opened = false;
         }
@@ -164,13 +210,69 @@ public class MainActivity extends Activity {
         Log.d(LOG_TAG, "onDestroy()");
         //unregisterReceiver(mUsbReceiver);
 
-        if(usbConnection != null) {
-            usbConnection.close();
+        for (UsbDeviceConnection connection : usbConnections) {
+            connection.close();
         }
+        usbConnections.clear();
 
         super.onDestroy();
     }
 
+    private void readDebugExtras(Intent intent) {
+        crossCheck = intent.getBooleanExtra(EXTRA_CROSS_CHECK, false);
+        tracing = intent.getBooleanExtra(EXTRA_TRACING, false);
+        allocationCheck = intent.getBooleanExtra(EXTRA_ALLOCATION_CHECK, false);
+        resultRing = intent.getStringExtra(EXTRA_RESULT_RING);
+        resultRingMask = intent.getBooleanExtra(EXTRA_RESULT_RING_MASK, false);
+    }
+
+    // Once SetCameraCountNative made the pipelines; the ring before the
+    // cameras open, as it is created with the first one
+    private void applyDebugSwitches() {
+        if (resultRing != null) {
+            SetResultRingNative(resultRing, resultRingMask);
+        }
+        SetCrossCheckNative(crossCheck);
+        SetTracingNative(tracing);
+        if (allocationCheck && !SetAllocationCheckNative(true)) {
+            Log.e(LOG_TAG, "No allocation check, built without SHAPE_ALLOC_TRACKING");
+        }
+    }
+
+    // What the pipelines measured while the cameras were open, into the app's
+    // external files, where adb pull finds them
+    private void dumpDebugFiles() {
+        File dir = getExternalFilesDir(null);
+        if (dir == null) {
+            return;
+        }
+        writeTextFile(new File(dir, STATS_FILE), GetPipelineStatsNative());
+        if (!DumpPerfCountersNative(new File(dir, PERF_COUNTERS_FILE).getPath())) {
+            Log.d(LOG_TAG, "No hardware counters, built without SHAPE_PERF_COUNTERS");
+        }
+        if (tracing && !DumpTraceNative(new File(dir, TRACE_FILE).getPath())) {
+            Log.e(LOG_TAG, "Cannot write the trace");
+        }
+    }
+
+    private static void writeTextFile(File file, String text) {
+        FileWriter writer = null;
+        try {
+            writer = new FileWriter(file);
+            writer.write(text);
+        } catch (IOException e) {
+            Log.e(LOG_TAG, "Cannot write " + file + ": " + e);
+        } finally {
+            if (writer != null) {
+                try {
+                    writer.close();
+                } catch (IOException e) {
+                    Log.w(LOG_TAG, "Cannot close " + file);
+                }
+            }
+        }
+    }
+
     public void openCamera() {
         Log.d(LOG_TAG, "openCamera");
 
@@ -185,44 +287,120 @@ public class MainActivity extends Activity {
 
         Log.d(LOG_TAG, "USB Devices : " + deviceList.size());
 
+        // every royale camera gets its own pipeline; with several their
+        // shapes are fused, see fusedShapesCallback
+        ArrayList<UsbDevice> cameras = new ArrayList<>();
         Iterator<UsbDevice> iterator = deviceList.values().iterator();
         UsbDevice device;
-        boolean found = false;
         while (iterator.hasNext()) {
             device = iterator.next();
             if (device.getVendorId() == 0x1C28 ||
                     device.getVendorId() == 0x058B ||
                     device.getVendorId() == 0x1f46) {
                 Log.d(LOG_TAG, "royale device found");
-                found = true;
-                if (!manager.hasPermission(device)) {
-                    Intent intent = new Intent(ACTION_USB_PERMISSION);
-                    intent.setAction(ACTION_USB_PERMISSION);
-                    mUsbPi = PendingIntent.getBroadcast(this, 0, intent, 0);
-                    manager.requestPermission(device, mUsbPi);
-                } else {
-                    RegisterCallback();
-                    performUsbPermissionCallback(device);
-                    createBitmap();
-                }
-                break;
+                cameras.add(device);
             }
         }
-        if (!found) {
+        if (cameras.isEmpty()) {
             Log.e(LOG_TAG, "No royale device found!!!");
+            return;
+        }
+        SetCameraCountNative(cameras.size());
+        applyDebugSwitches();
+        if (cameras.size() > 1) {
+            loadCameraPoses(cameras.size());
+        }
+        for (UsbDevice camera : cameras) {
+            if (!manager.hasPermission(camera)) {
+                Intent intent = new Intent(ACTION_USB_PERMISSION);
+                intent.setAction(ACTION_USB_PERMISSION);
+                mUsbPi = PendingIntent.getBroadcast(this, 0, intent, 0);
+                manager.requestPermission(camera, mUsbPi);
+            } else {
+                openDevice(camera);
+            }
+        }
+    }
+
+    // One line of 12 numbers per camera in the app's external files: its 3x4
+    // camera to table transform row by row [mm], # starts a comment. Cameras
+    // without a line stay at the identity pose
+    private void loadCameraPoses(int count) {
+        File file = new File(getExternalFilesDir(null), CAMERA_POSES_FILE);
+        if (!file.exists()) {
+            Log.w(LOG_TAG, "No " + file + ", the cameras are fused at the identity pose");
+            return;
+        }
+        int camera = 0;
+        BufferedReader reader = null;
+        try {
+            reader = new BufferedReader(new FileReader(file));
+            String line;
+            while (camera < count && (line = reader.readLine()) != null) {
+                int comment = line.indexOf('#');
+                if (comment >= 0) {
+                    line = line.substring(0, comment);
+                }
+                line = line.trim();
+                if (line.isEmpty()) {
+                    continue;
+                }
+                String[] values = line.split("\\s+");
+                if (values.length != 12) {
+                    Log.e(LOG_TAG, file + ": the pose of camera " + camera + " has " + values.length + " values, not 12");
+                    return;
+                }
+                double[] pose = new double[12];
+                for (int i = 0; i < 12; i++) {
+                    pose[i] = Double.parseDouble(values[i]);
+                }
+                SetCameraPoseNative(camera, pose);
+                camera++;
+            }
+        } catch (IOException | NumberFormatException e) {
+            Log.e(LOG_TAG, "Cannot read " + file + ": " + e);
+        } finally {
+            if (reader != null) {
+                try {
+                    reader.close();
+                } catch (IOException e) {
+                    Log.w(LOG_TAG, "Cannot close " + file);
+                }
+            }
+        }
+        Log.i(LOG_TAG, camera + " camera pose(s) from " + file);
+    }
+
+    private void openDevice(UsbDevice device) {
+        if (!m_registered) {
+            RegisterCallback();
+            m_registered = true;
+        }
+        performUsbPermissionCallback(device);
+        if (resolution != null) {
+            createBitmap();
         }
     }
 
     private void performUsbPermissionCallback(UsbDevice device) {
-        usbConnection = manager.openDevice(device);
+        UsbDeviceConnection usbConnection = manager.openDevice(device);
+        usbConnections.add(usbConnection);
         Log.i(LOG_TAG, "permission granted for: " + device.getDeviceName() + ", fileDesc: " + usbConnection.getFileDescriptor());
 
         int fd = usbConnection.getFileDescriptor();
 
-        resolution = OpenCameraNative(fd, device.getVendorId(), device.getProductId());
-        camRes = new Point(resolution[0], resolution[1]);
+        // width, height and index of the camera; the screen shows the first
+        int[] opened = OpenCameraNative(fd, device.getVendorId(), device.getProductId());
+        if (opened == null) {
+            Log.e(LOG_TAG, "Cannot open the camera");
+            return;
+        }
+        if (opened[2] == 0 || resolution == null) {
+            resolution = opened;
+            camRes = new Point(resolution[0], resolution[1]);
+        }
 
-        if (resolution[0] > 0) {
+        if (opened[0] > 0) {
             m_opened = true;
         }
     }
@@ -252,7 +430,9 @@ public class MainActivity extends Activity {
         runOnUiThread(new Runnable() {
             @Override
             public void run() {
+                long begin = System.nanoTime();
                 mainImView.setImageBitmap(bmpCam);
+                TraceEventNative("setImageBitmap", begin, System.nanoTime());
             }
         });
     }
@@ -263,16 +443,91 @@ public class MainActivity extends Activity {
             getWindowManager().getDefaultDisplay().getRealSize(displaySize);
             Log.i(LOG_TAG, "Window display size: x=" + displaySize.x + ", y=" + displaySize.y);
             bmpTest = Bitmap.createBitmap(displaySize.x, displaySize.y, Bitmap.Config.ARGB_8888);
+            canvasTest = new Canvas(bmpTest);
+            paintTest = new Paint(Paint.ANTI_ALIAS_FLAG);
+            paintTest.setColor(Color.WHITE);
+            paintTest.setStrokeWidth(4);
+            paintTest.setTextSize(32);
+        }
+    }
+
+    // The first four characters of a packed type name, see ShapeRecord.h
+    private static String unpackType(int packed){
+        StringBuilder name = new StringBuilder();
+        for (int i = 0; i < 4; i++) {
+            char c = (char) ((packed >>> (8 * i)) & 0xff);
+            if (c == 0) break;
+            name.append(c);
         }
+        return name.toString();
     }
 
+    // One record of SHAPE_RECORD_INTS ints per valid shape, see ShapeRecord.h:
+    // type, type3D (packed chars), center x, y, bounding box left, top, width,
+    // height [px], centroid x, y, z [mm], width, height [mm], footprint [mm^2],
+    // volume [mm^3], area [px^2], vertices
+    private static final int SHAPE_RECORD_INTS = 17;
+
+    // In the test mode the shapes are outlined on the projector image, each
+    // with its type, where the projector falls onto it
     public void shapeDetectedCallback(int[] descriptors){
         if (!m_opened)
         {
             Log.d(LOG_TAG, "Device in Java not initialized");
             return;
         }
+        if (currentMode != Mode.TEST || bmpTest == null) {
+            return;
+        }
+        long begin = System.nanoTime();
+        bmpTest.eraseColor(Color.BLACK);
+        paintTest.setStyle(Paint.Style.STROKE);
+        for (int i = 0; i + SHAPE_RECORD_INTS <= descriptors.length; i += SHAPE_RECORD_INTS) {
+            // camera distance in cm, as the projector calibration takes it
+            float z = descriptors[i + 10] / 10f;
+            float left = descriptors[i + 4], top = descriptors[i + 5];
+            Point from = convertCamPixel2ProPixel(left, top, z);
+            Point to = convertCamPixel2ProPixel(left + descriptors[i + 6], top + descriptors[i + 7], z);
+            if (from == null || to == null) {
+                continue;
+            }
+            canvasTest.drawRect(from.x, from.y, to.x, to.y, paintTest);
+            paintTest.setStyle(Paint.Style.FILL);
+            canvasTest.drawText(unpackType(descriptors[i]), from.x, from.y - 8, paintTest);
+            paintTest.setStyle(Paint.Style.STROKE);
+        }
+        TraceEventNative("drawShapes", begin, System.nanoTime());
+
+        runOnUiThread(new Runnable() {
+            @Override
+            public void run() {
+                mainImView.setImageBitmap(bmpTest);
+            }
+        });
+    }
+
+    // One record of FUSED_RECORD_INTS ints per shape on the table, merged from
+    // every camera that sees it, see ShapeFusion.h: type, type3D (packed
+    // chars), centroid x, y, z in the table frame [mm], width, height [mm],
+    // footprint [mm^2], volume [mm^3], a bit per camera that saw it, views
+    private static final int FUSED_RECORD_INTS = 11;
 
+    // Table positions have no projector calibration yet, so the fused shapes
+    // are logged rather than drawn
+    public void fusedShapesCallback(int[] descriptors){
+        if (!m_opened)
+        {
+            Log.d(LOG_TAG, "Device in Java not initialized");
+            return;
+        }
+        StringBuilder shapes = new StringBuilder();
+        for (int i = 0; i + FUSED_RECORD_INTS <= descriptors.length; i += FUSED_RECORD_INTS) {
+            shapes.append(' ').append(unpackType(descriptors[i]))
+                    .append(" (").append(descriptors[i + 2]).append(',').append(descriptors[i + 3])
+                    .append(',').append(descriptors[i + 4]).append(") mm, ")
+                    .append(descriptors[i + 10]).append(" views;");
+        }
+        Log.d(LOG_TAG, "fused " + descriptors.length / FUSED_RECORD_INTS + " shape(s):" + shapes);
     }
 
     // depends on camera position, not a generic function TODO make generic
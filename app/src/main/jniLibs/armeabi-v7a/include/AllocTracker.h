@@ -0,0 +1,120 @@
+#pragma once
+
+// Native heap allocations per pipeline zone: every operator new, and every
+// Mat buffer through a counting MatAllocator, counted on the thread that
+// makes them; tile pool workers hand theirs to the thread whose job they
+// ran, and are checked against its zone. The JNI layer adds the Java arrays
+// it creates and the local references it holds. With the strict check on,
+// an allocation inside a zone of a steady frame, one whose settings have
+// not changed for a while, aborts with the stack that made it, so the
+// steady state can be kept free of allocations.
+//
+// Only built with SHAPE_ALLOC_TRACKING, which replaces the global operator
+// new. Without it the ALLOC_ macros expand to nothing.
+#ifdef SHAPE_ALLOC_TRACKING
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+class AllocTracker {
+public:
+   enum Zone { Ingest, Heights, Segment, Classify, Output, Zones };
+   static const char* zoneName(Zone zone);
+
+   struct Counts {
+      uint64_t allocations = 0;
+      uint64_t bytes = 0;
+   };
+
+   // Installs the counting MatAllocator on first use
+   static AllocTracker& shared();
+
+   // An allocation of the calling thread; aborts inside a strict zone
+   static void count(size_t bytes);
+   // Allocations of the calling thread since it started
+   static Counts threadCounts();
+   // Adds allocations made on its behalf, e.g. by pool workers, to the
+   // calling thread's
+   static void addThreadCounts(const Counts& counts);
+   // The calling thread's zone; a strict one aborts on allocation. Returns
+   // the zone it replaces.
+   static const char* enterZone(const char* strictZone);
+   static const char* currentZone();
+
+   void add(Zone zone, const Counts& begin, const Counts& end);
+   void countJavaArray(size_t bytes);
+   void countLocalRefs(int delta);
+
+   void setStrict(bool on) { strict.store(on); }
+   bool isStrict() const { return strict.load(); }
+
+   // Per zone allocations and bytes per sample, the most in one sample, and
+   // the Java arrays and local references per frame
+   string report() const;
+   void reset();
+
+private:
+   atomic<bool> strict { false };
+   atomic<uint64_t> samples[Zones];
+   atomic<uint64_t> allocations[Zones];
+   atomic<uint64_t> bytes[Zones];
+   atomic<uint64_t> peak[Zones];
+   atomic<uint64_t> javaArrays { 0 };
+   atomic<uint64_t> javaBytes { 0 };
+   atomic<int64_t> localRefs { 0 };
+   atomic<int64_t> peakLocalRefs { 0 };
+
+   AllocTracker();
+};
+
+// Counts the enclosing scope into one zone; strict in a steady frame while
+// the strict check is on
+class AllocZone {
+public:
+   AllocZone(AllocTracker::Zone zone, bool steady) : zone(zone){
+      AllocTracker& tracker = AllocTracker::shared();
+      outer = AllocTracker::enterZone(steady && tracker.isStrict() ? AllocTracker::zoneName(zone) : NULL);
+      begin = AllocTracker::threadCounts();
+   }
+   ~AllocZone(){
+      AllocTracker::Counts end = AllocTracker::threadCounts();
+      AllocTracker::enterZone(outer);
+      AllocTracker::shared().add(zone, begin, end);
+   }
+
+private:
+   AllocTracker::Zone zone;
+   AllocTracker::Counts begin;
+   const char* outer;
+};
+
+// Allocations the strict check lets through in the enclosing scope, e.g. a
+// tool's own bookkeeping in the output callback
+class AllocUnchecked {
+public:
+   AllocUnchecked() : outer(AllocTracker::enterZone(NULL)) {}
+   ~AllocUnchecked() { AllocTracker::enterZone(outer); }
+
+private:
+   const char* outer;
+};
+
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_(a, b)
+#define ALLOC_ZONE(zone, steady) AllocZone ALLOC_CONCAT(allocZone, __LINE__)(AllocTracker::zone, steady)
+#define ALLOC_JAVA_ARRAY(bytes) AllocTracker::shared().countJavaArray(bytes)
+#define ALLOC_LOCAL_REFS(delta) AllocTracker::shared().countLocalRefs(delta)
+#define ALLOC_UNCHECKED() AllocUnchecked ALLOC_CONCAT(allocUnchecked, __LINE__)
+
+#else
+
+#define ALLOC_ZONE(zone, steady)
+#define ALLOC_JAVA_ARRAY(bytes)
+#define ALLOC_LOCAL_REFS(delta)
+#define ALLOC_UNCHECKED()
+
+#endif
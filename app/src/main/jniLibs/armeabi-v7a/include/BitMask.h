@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Binary mask packed at 1 bit per pixel, 64 pixels per word. Bit (x & 63) of
+// word (x >> 6) holds pixel x, so bit 0 is the leftmost pixel of a word.
+// Every row has a zero guard word on both sides and there is a zero guard
+// row above and below the image, so neighbourhood operations never need
+// bounds checks. Padding bits past cols are always kept zero.
+class BitMask {
+public:
+   int rows = 0, cols = 0;
+   int wordsPerRow = 0;   // words holding pixels, guards excluded
+
+   BitMask() {}
+   BitMask(int rows, int cols);
+   void create(int rows, int cols);
+   void clear();
+
+   uint64_t* row(int y) { return &words[(size_t)(y + 1) * stride + 1]; }
+   const uint64_t* row(int y) const { return &words[(size_t)(y + 1) * stride + 1]; }
+   bool get(int y, int x) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+   void set(int y, int x) { row(y)[x >> 6] |= (uint64_t)1 << (x & 63); }
+   // First foreground x >= from in row y, cols if there is none
+   int nextSet(int y, int from) const;
+   // First background x >= from in row y, cols if there is none
+   int nextClear(int y, int from) const;
+   size_t count() const;
+   size_t memoryBytes() const { return words.size() * sizeof(uint64_t); }
+
+   // Sets every pixel of src (CV_32FC1 or CV_16SC1) above level, like
+   // THRESH_BINARY
+   void threshold(const Mat& src, float level);
+   // Same inside roi only, on a mask of src's size; pixels outside roi keep
+   // their value and set ones inside stay set
+   void threshold(const Mat& src, float level, Rect roi);
+   // CV_8UC1 copy with 255 for foreground
+   void toMat(Mat& dst) const;
+
+   // Square structuring element of size 2 * radius + 1, pixels outside the
+   // image count as background
+   void erode(BitMask& dst, int radius = 1) const;
+   void dilate(BitMask& dst, int radius = 1) const;
+   void open(BitMask& dst, int radius = 1) const;
+   void close(BitMask& dst, int radius = 1) const;
+
+   // Outer 8-connected border of the component containing start, which must
+   // be the component's first pixel in raster order. Points are compressed
+   // like CV_CHAIN_APPROX_SIMPLE.
+   void traceContour(Point start, vector<Point>& contour) const;
+
+private:
+   int stride = 0;   // words per row including guards
+   vector<uint64_t> words;
+   mutable vector<uint64_t> scratch;
+
+   uint64_t lastWordMask() const;
+   void morph(BitMask& dst, bool dilation) const;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Per-blob statistics collected while labeling. Everything Shape would
+// otherwise walk the contour for (area, bbox, moments) is accumulated per run
+// of foreground pixels.
+struct Blob {
+   int label = -1;        // raster index of the blob's first (top-left) pixel
+   int area = 0;          // pixel count
+   Rect bbox;
+   double m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+
+   // Adds the horizontal run [x0, x1] of row y
+   void addRun(int y, int x0, int x1);
+   void merge(const Blob& other);
+   Moments getMoments() const;
+   Point2f getCenter() const;
+   // First pixel in raster order, where outer contour tracing starts
+   Point getStart(int cols) const { return Point(label % cols, label / cols); }
+};
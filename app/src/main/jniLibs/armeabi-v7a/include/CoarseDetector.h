@@ -0,0 +1,41 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "BitMask.h"
+#include "Blob.h"
+#include "RunLengthMask.h"
+
+using namespace std;
+using namespace cv;
+
+// First pass of the pyramid mode. Objects are found on the height plane
+// downsampled by 2^levels, and only the regions around the ones that pass
+// Shape's area filter and the border filter are processed at full
+// resolution, so noise never costs more than the coarse pass.
+class CoarseDetector {
+public:
+   int minArea = 100;     // full resolution pixels, like Shape::validate
+   float border = 0.1f;   // blobs centered closer to an edge are dropped
+   int margin = 3;        // full resolution pixels added around each blob,
+                          // besides one coarse pixel
+
+   // Full resolution regions, inside an image of size full, holding the
+   // blobs of coarse (CV_32FC1 or CV_16SC1) above level [m]. Regions whose
+   // 5x5 filter neighbourhoods would overlap are merged, so they can be
+   // filtered in place one by one.
+   void find(const Mat& coarse, int levels, float level, Size full, vector<Rect>& regions);
+
+   // Sizes the buffers for coarse planes up to size and up to blobs blobs
+   void reserve(Size size, int blobs);
+
+   // Blobs of the last coarse pass that passed the filters
+   int getNumObjects() const { return objects; }
+
+private:
+   BitMask mask;
+   RunLengthMask runs;
+   RunLabeler labeler;
+   vector<Blob> blobs;
+   int objects = 0;
+};
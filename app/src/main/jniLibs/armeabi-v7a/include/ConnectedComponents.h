@@ -0,0 +1,36 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BitMask.h"
+#include "Blob.h"
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// 8-connected component labeling of a binary mask. The mask is split into
+// horizontal strips, one per thread; each strip is labeled independently and
+// the labels are merged across strip boundaries with a lock-free union-find.
+class ParallelLabeler {
+public:
+   // Strips per mask, 0 for one per thread of the pool the calling thread
+   // runs its kernels on, looked up on every call
+   explicit ParallelLabeler(int numThreads = 0);
+
+   // mask: CV_8UC1, non-zero is foreground. Blobs are ordered by label.
+   void label(const Mat& mask, vector<Blob>& blobs);
+   void label(const BitMask& mask, vector<Blob>& blobs);
+
+   // CV_32SC1, label of the blob each pixel belongs to, -1 for background
+   const Mat& getLabels() const { return labels; }
+   int getNumThreads() const;
+
+private:
+   int numThreads;   // 0 for the pool's
+   Mat labels;
+   vector<vector<Blob> > stripBlobs;
+
+   template<typename Rows>
+   void labelRows(const Rows& mask, int rows, int cols, vector<Blob>& blobs);
+   void collectStrip(int y0, int y1, vector<Blob>& out);
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Geometric features of a closed contour gathered in a single pass over its
+// points: what contourArea, arcLength, moments, boundingRect and the sign
+// part of isContourConvex would each compute with their own walk.
+struct ContourFeatures {
+   double area = 0;        // unsigned polygon area, as contourArea
+   double perimeter = 0;   // closed length, as arcLength(contour, true)
+   // raw polygon moments up to second order, as moments(contour)
+   double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+   Rect bbox;              // as boundingRect
+   // +1 or -1 when every turn has that sign (or is straight), 0 otherwise
+   int convexity = 0;
+
+   Moments getMoments() const;
+   Point2f getCenter() const;
+};
+
+// Edges are processed four at a time in NEON registers where available.
+// Coordinates are taken relative to the first point so that float lanes keep
+// full precision; moments are shifted back in double.
+void computeFeatures(const vector<Point>& contour, ContourFeatures& features);
+void computeFeatures(const vector<Point2f>& contour, ContourFeatures& features);
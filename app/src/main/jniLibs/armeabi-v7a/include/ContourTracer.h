@@ -0,0 +1,54 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Moore neighbourhood, clockwise on screen starting east
+namespace moore {
+   static const int dx[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+   static const int dy[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+   static const int dirOf[3][3] = { { 5, 6, 7 }, { 4, -1, 0 }, { 3, 2, 1 } };
+}
+
+// Outer 8-connected border of the component containing start, which must be
+// the component's first pixel in raster order. Mask only needs
+// get(y, x), answering false for pixels outside the image. Points are
+// compressed like CV_CHAIN_APPROX_SIMPLE.
+template<typename Mask>
+void traceOuterContour(const Mask& mask, Point start, vector<Point>& contour){
+   contour.clear();
+   Point cur = start;
+   int back = 4;   // west of the first raster pixel is background
+   int firstDir = -1, lastDir = -1;
+   for(;;){
+      int d = -1;
+      for(int i = 1; i <= 8; i++){
+         int k = (back + i) & 7;
+         if(mask.get(cur.y + moore::dy[k], cur.x + moore::dx[k])){
+            d = k;
+            break;
+         }
+      }
+      if(d < 0){
+         contour.push_back(start);   // isolated pixel
+         return;
+      }
+      // Jacob's stopping criterion
+      if(cur == start && d == firstDir) break;
+      if(firstDir < 0) firstDir = d;
+      if(d != lastDir) contour.push_back(cur);
+      lastDir = d;
+
+      Point next(cur.x + moore::dx[d], cur.y + moore::dy[d]);
+      // the neighbour checked just before d is background and touches next
+      int pb = (d + 7) & 7;
+      back = moore::dirOf[cur.y + moore::dy[pb] - next.y + 1][cur.x + moore::dx[pb] - next.x + 1];
+      cur = next;
+   }
+   if(lastDir == firstDir && contour.size() > 1){
+      contour.erase(contour.begin());
+   }
+}
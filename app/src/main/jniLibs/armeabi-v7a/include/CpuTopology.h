@@ -0,0 +1,22 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+// Where threads run, for keeping the threads of one pipeline and the
+// memory they work on together when several pipelines share the machine.
+
+// The online CPUs in n groups of neighbours: sorted by NUMA node, then by
+// cluster (the big and little clusters of a phone, which have their own L2),
+// then by number, and cut into runs of nearly equal size. Fewer groups when
+// there are fewer CPUs than n.
+vector<vector<int> > cpuGroups(int n);
+
+// Pins the calling thread to cpus; empty leaves it as it is
+bool pinThread(const vector<int>& cpus);
+
+// Runs body on a thread pinned to cpus and waits for it, so that the pages
+// body touches first are allocated on the cpus' node
+void runPinned(const vector<int>& cpus, const function<void()>& body);
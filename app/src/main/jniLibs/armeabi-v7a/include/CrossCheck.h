@@ -0,0 +1,86 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BitMask.h"
+#include "Blob.h"
+#include "ShapeClassifier.h"
+#include "ShapeRecord.h"
+
+using namespace std;
+using namespace cv;
+
+// The OpenCV path the listener started from, run next to the optimized
+// stages on the same frame: cv::undistort, cv::boxFilter, cv::threshold,
+// cv::erode and cv::dilate, cv::findContours and cv::approxPolyDP, then
+// Shape on the traced contours. Every check starts from the optimized input
+// of its stage, so a divergence points at the stage that caused it instead
+// of at everything after it. Only the first divergence of a frame is kept;
+// the checks after it return at once.
+class CrossCheck {
+public:
+   enum Stage { None, Heights, BoxFilter, Threshold, Open, Contours, Simplify, Shapes, Stages };
+   static const char* stageName(Stage stage);
+
+   struct Divergence {
+      Stage stage = None;
+      // first divergent pixel in raster order, or the divergent shape's center
+      Point pixel = Point(-1, -1);
+      double reference = 0, optimized = 0;   // values there
+      int count = 0;                         // divergent pixels or shapes of the stage
+      string detail;
+      bool found() const { return stage != None; }
+   };
+
+   CrossCheck() { resetStats(); }
+
+   float heightTolerance = 1e-5f;   // [m]
+   float centerTolerance = 1.5f;    // [px]
+   float areaTolerance = 0.15f;     // share of the reference area
+
+   // Heights stage. depth before its invalid pixels were filled and the
+   // background, in the pipeline's depth type and units, against diff before
+   // smoothing. Without a camera matrix the reference is not undistorted.
+   void checkHeights(const Mat& depth, const Mat& background, double unitsPerMeter, const Mat& cameraMatrix,
+                     const Mat& distortion, const Mat& diff, Divergence& d) const;
+   // heights before and after smoothing; with regions (the pyramid mode's),
+   // inside them only, NULL for the whole frame
+   void checkBoxFilter(const Mat& heights, const Mat& filtered, const vector<Rect>* regions, Divergence& d) const;
+   // level [m]; with regions, the mask must be clear outside them
+   void checkThreshold(const Mat& filtered, float level, const vector<Rect>* regions, const BitMask& mask,
+                       Divergence& d) const;
+
+   // Segment stage. before: CV_8UC1 copy of the mask before opening it with
+   // radius 1. contours: the reference contours of the opened mask, for
+   // checkShapes.
+   void checkOpen(const Mat& before, const BitMask& opened, Divergence& d) const;
+   void checkContours(const BitMask& mask, const vector<Blob>& blobs, vector<vector<Point> >& contours,
+                      Divergence& d) const;
+
+   // Classify stage. vertices: of the optimized simplification of contour
+   // with epsilon
+   void checkSimplify(const vector<Point2f>& contour, double epsilon, int vertices, Point2f center,
+                      Divergence& d) const;
+   // Valid shapes of the reference contours against the frame's records
+   void checkShapes(const vector<vector<Point> >& contours, const ShapeClassifier* classifier, Size size,
+                    const vector<ShapeRecord>& records, Divergence& d) const;
+
+   // Output stage, once per checked frame
+   void count(const Divergence& d);
+   uint64_t getFrames() const { return frames.load(); }
+   uint64_t getDiverged(Stage stage) const { return diverged[stage].load(); }
+   // Checked and divergent frames, by stage
+   string report() const;
+   void resetStats();
+
+private:
+   atomic<uint64_t> frames;
+   atomic<uint64_t> diverged[Stages];
+
+   // reference in meters, optimized in meters or millimeters
+   void comparePlanes(const Mat& reference, const Mat& optimized, const vector<Rect>* regions, Stage stage,
+                      Divergence& d) const;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <royale/DepthData.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "DepthRecording.h"
+
+using namespace std;
+using namespace cv;
+
+// Depth frames from another process on the same machine, for the daemon
+// when the camera is driven by a separate producer, or by a stand-in that
+// replays recordings.
+//
+// Over a Unix stream socket the producer connects and writes a recording
+// without ground truth: a RecordingHeader, then per frame a RecordingFrame,
+// the z [m] (float) and the confidence (uint8) of every point.
+//
+// In shared memory the producer owns a ring of frame slots after a
+// DepthShmHeader, and overwrites the oldest. Every slot carries the number
+// of the frame in it, 0 while it is written, so a reader that copied a slot
+// the producer meanwhile reused sees it and drops the copy.
+
+class DepthStreamWriter {
+public:
+   ~DepthStreamWriter() { close(); }
+   // cameraMatrix and distortion may be empty
+   bool connect(const string& path, Size size, const Mat& cameraMatrix, const Mat& distortion);
+   bool write(const royale::DepthData& data);
+   void close();
+
+private:
+   int fd = -1;
+   RecordingHeader header;
+   vector<char> buffer;
+};
+
+class DepthStreamReader {
+public:
+   ~DepthStreamReader() { close(); }
+   // Listens on path, replacing a stale socket file
+   bool listen(const string& path);
+   // accept and read give up once fd is readable, e.g. the read end of a
+   // pipe the owner writes to when it stops; -1 for never
+   void setInterrupt(int fd) { interrupt = fd; }
+   // Blocks for a producer and reads its header; false on a bad header or
+   // once interrupted
+   bool accept();
+   // The next frame; false when the producer disconnects or once interrupted
+   bool read(royale::DepthData& data);
+   void close();
+
+   Size getSize() const { return Size(header.width, header.height); }
+   const Mat& getCameraMatrix() const { return cameraMatrix; }
+   const Mat& getDistortion() const { return distortion; }
+
+private:
+   int listener = -1;
+   int fd = -1;
+   int interrupt = -1;
+   string path;
+   RecordingHeader header;
+   Mat cameraMatrix, distortion;
+   vector<char> buffer;
+};
+
+struct DepthShmHeader {
+   char magic[4] = { 'S', 'D', 'S', 'M' };
+   uint32_t version = 1;
+   uint32_t width = 0, height = 0;
+   uint32_t slots = 0;
+   uint32_t slotBytes = 0;       // DepthShmSlot and its planes, padded
+   double cameraMatrix[9] = {};
+   double distortion[5] = {};    // k1 k2 p1 p2 k3
+   atomic<uint64_t> written { 0 };   // frames published
+};
+
+// Followed by width * height z [m] (float), then as many confidences (uint8)
+struct DepthShmSlot {
+   atomic<uint64_t> frame;   // written + 1 of the frame in the slot, 0 while written
+   int64_t timestamp;        // [us]
+};
+
+class DepthShmWriter {
+public:
+   ~DepthShmWriter() { close(); }
+   // Creates or replaces the segment /name
+   bool create(const string& name, Size size, const Mat& cameraMatrix, const Mat& distortion, int slots = 4);
+   void write(const royale::DepthData& data);
+   void close();
+
+private:
+   string name;
+   void* memory = NULL;
+   size_t bytes = 0;
+   DepthShmHeader* header = NULL;
+};
+
+class DepthShmReader {
+public:
+   ~DepthShmReader() { close(); }
+   bool open(const string& name);
+   void close();
+
+   // The newest frame after the last one read, false when there is none yet.
+   // Frames the reader was too slow for are skipped.
+   bool read(royale::DepthData& data);
+   // Frames skipped or torn so far
+   uint64_t getSkipped() const { return skipped; }
+   // True once name no longer refers to the mapped segment: the producer
+   // went away, or replaced it when it restarted. Two system calls, for when
+   // no frame came for a while.
+   bool stale() const;
+
+   Size getSize() const { return Size(header->width, header->height); }
+   const Mat& getCameraMatrix() const { return cameraMatrix; }
+   const Mat& getDistortion() const { return distortion; }
+
+private:
+   string name;
+   uint64_t device = 0, inode = 0;   // of the mapped segment
+   void* memory = NULL;
+   size_t bytes = 0;
+   const DepthShmHeader* header = NULL;
+   uint64_t next = 0;
+   uint64_t skipped = 0;
+   Mat cameraMatrix, distortion;
+   vector<float> z;
+   vector<uint8_t> confidence;
+};
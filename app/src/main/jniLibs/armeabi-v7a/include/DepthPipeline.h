@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "BitMask.h"
+#include "DepthPixel.h"
+
+using namespace std;
+using namespace cv;
+
+// Per-frame image stages in front of the blob detection: background capture,
+// the height above the background, the 5x5 smoothing and the threshold. T is
+// float for planes in meters or int16_t for planes in millimeters; the
+// integer pipeline moves half the bytes and fills twice the SIMD lanes, with
+// saturating arithmetic instead of overflow. The full-frame kernels run in
+// tiles on TilePool::shared().
+template<typename T>
+class DepthPipeline {
+public:
+   typedef DepthPixel<T> Pixel;
+   typedef typename Pixel::Depth Depth;
+   typedef typename Pixel::Height Height;
+
+   Mat depth;        // current frame, Pixel::depthType
+   Mat background;   // mean of the captured frames, Pixel::depthType
+   Mat diff;         // background - depth, Pixel::heightType
+
+   void create(Size size);
+
+   // Starts the next frame from zeros or from the background, so pixels the
+   // camera does not report are background
+   void clearDepth();
+   void fillWithBackground();
+   // Same after the fact: the pixels of depth left at 0 take the background
+   void fillInvalid();
+   Depth* depthRow(int y) { return depth.ptr<Depth>(y); }
+
+   // Background capture: reset, add frames, then average them
+   void resetBackground();
+   void addBackground();
+   void endBackground();
+   int getBackgroundFrames() const { return frames; }
+
+   // diff = background - depth
+   void difference();
+   // diff remapped in place, e.g. with the undistortion maps
+   void remapDiff(const Mat& mapX, const Mat& mapY);
+   // diff from a CV_32FC1 plane in meters
+   void setDiff(const Mat& heights);
+   // 5x5 mean of diff, borders reflected like cv::boxFilter. Like remapDiff
+   // it may leave diff in another buffer.
+   void boxFilter();
+   // Same for the pixels of roi only, reading the neighbours around it
+   void boxFilter(const Rect& roi);
+   // Pixels of diff above level [m], like THRESH_BINARY
+   void threshold(float level, BitMask& mask) const;
+   // Same inside the regions only, the rest of mask is cleared
+   void threshold(float level, const vector<Rect>& regions, BitMask& mask) const;
+
+   // diff reduced by 2^levels with 2x2 means, odd last rows and columns
+   // dropped
+   void downsample(int levels, Mat& coarse);
+
+private:
+   Mat accum;   // CV_32FC1 or CV_32SC1 sum of the background frames
+   Mat temp;
+   Mat pyramid[2];
+   int frames = 0;
+};
+
+typedef DepthPipeline<float> DepthPipelineF;
+typedef DepthPipeline<int16_t> DepthPipelineMM;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+
+using namespace cv;
+
+// Pixel types of the depth pipeline. The float pipeline keeps depth and
+// heights in meters; the integer one keeps depth as uint16_t and heights as
+// int16_t, both in millimeters. Height planes given to the measuring stages
+// (DepthProfile, BackProjection, MarchingSquares) may be either CV_32FC1
+// meters or CV_16SC1 millimeters.
+template<typename T> struct DepthPixel;
+
+template<> struct DepthPixel<float> {
+   typedef float Depth;    // depth from the camera, 0 where invalid
+   typedef float Height;   // background minus depth
+   static const int depthType = CV_32FC1;
+   static const int heightType = CV_32FC1;
+   static Depth depthFromMeters(float z) { return z; }
+   static Height heightFromMeters(float h) { return h; }
+   static int unitsPerMeter() { return 1; }
+};
+
+template<> struct DepthPixel<int16_t> {
+   typedef uint16_t Depth;
+   typedef int16_t Height;
+   static const int depthType = CV_16UC1;
+   static const int heightType = CV_16SC1;
+   static Depth depthFromMeters(float z) { return saturate_cast<uint16_t>(z * 1000); }
+   static Height heightFromMeters(float h) { return saturate_cast<int16_t>(h * 1000); }
+   static int unitsPerMeter() { return 1000; }
+};
+
+// Height plane value in meters, for the stages that take either type
+inline float heightMeters(float h) { return h; }
+inline float heightMeters(int16_t h) { return h * 0.001f; }
+
+// Threshold in the plane's own units equivalent to level [m]: integer
+// heights are above level exactly when above its whole millimeters
+inline float planeLevel(const Mat& plane, float level){
+   return plane.type() == CV_16SC1 ? (float)cvFloor(level * 1000) : level;
+}
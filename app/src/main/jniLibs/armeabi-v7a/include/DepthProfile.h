@@ -0,0 +1,46 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "DepthPixel.h"
+
+using namespace std;
+using namespace cv;
+
+// Statistics of the height above the background inside a blob, accumulated
+// per run while labeling, so only foreground pixels are read. Heights are in
+// meters, whichever type the height plane has.
+struct DepthProfile {
+   // height histogram: 5 mm bins, the last one takes everything above
+   static const int heightBins = 64;
+   // slope histogram over the height change per pixel, doubling bin edges
+   // from 0.5 mm: [0, 0.5), [0.5, 1), [1, 2), ... [32, inf)
+   static const int slopeBins = 8;
+
+   int count = 0;
+   float maxHeight = 0;
+   double sumHeight = 0;
+   // sums of the least squares plane fit h = a x + b y + c
+   double sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0, sxh = 0, syh = 0, shh = 0;
+   int heightHist[heightBins] = {};
+   int slopeHist[slopeBins] = {};
+
+   // Adds pixels [x0, x1] of row y of heights (CV_32FC1 meters or CV_16SC1
+   // millimeters)
+   void addRun(const Mat& heights, int y, int x0, int x1);
+   void merge(const DepthProfile& other);
+
+   float getMeanHeight() const;
+   // root mean square distance to the best fitting plane
+   float getPlaneResidual() const;
+   // share of pixels at least fraction * maxHeight high
+   float getPlateau(float fraction) const;
+
+private:
+   template<typename T> void addRunOf(const Mat& heights, int y, int x0, int x1);
+};
+
+// 3D class from the height profile, with the 2D outline type to tell the
+// solids with the same profile apart: "FLAT", "BOX", "PYR", "CYL", "SPH" or
+// "OTR"
+string classifyDepthProfile(const DepthProfile& profile, const string& type2d);
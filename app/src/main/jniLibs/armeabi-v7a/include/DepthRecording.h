@@ -0,0 +1,99 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <royale/DepthData.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "SceneGenerator.h"
+
+using namespace std;
+using namespace cv;
+
+// Depth frames on disk, from the camera or the SceneGenerator. The file
+// starts with a RecordingHeader; every frame is a RecordingFrame followed by
+// the z [m] (float) and the confidence (uint8) of every point in the
+// camera's order and, in recordings with ground truth, the CV_8UC1 label
+// plane in image order and the scene's objects. x, y, noise and gray values
+// are not kept. Everything is little-endian, as on every target this builds
+// for.
+struct RecordingHeader {
+   char magic[4] = { 'S', 'D', 'R', 'C' };
+   uint32_t version = 1;
+   uint32_t width = 0, height = 0;
+   uint32_t groundTruth = 0;
+   uint32_t reserved = 0;
+   double cameraMatrix[9] = {};
+   double distortion[5] = {};    // k1 k2 p1 p2 k3
+};
+
+struct RecordingFrame {
+   uint32_t bytes = 0;      // of the frame after this header
+   uint32_t objects = 0;    // ground truth objects
+   int64_t timestamp = 0;   // [us]
+};
+
+class RecordingWriter {
+public:
+   ~RecordingWriter() { close(); }
+
+   // cameraMatrix and distortion as the listener builds them, may be empty
+   bool open(const string& path, Size size, const Mat& cameraMatrix, const Mat& distortion,
+             bool groundTruth = false);
+   // labels and objects are written in recordings with ground truth only
+   bool write(const royale::DepthData& data, const Mat* labels = NULL,
+              const vector<SceneObject>* objects = NULL);
+   void close();
+   bool isOpen() const { return file.is_open(); }
+   int getFrames() const { return frames; }
+
+private:
+   ofstream file;
+   RecordingHeader header;
+   vector<float> z;
+   vector<uint8_t> confidence;
+   int frames = 0;
+};
+
+class RecordingReader {
+public:
+   // Larger frames or more objects are taken for a damaged file
+   static const uint32_t maxSide = 8192;
+   static const uint32_t maxObjects = 4096;
+
+   // False when the file is not a recording or its header is damaged
+   bool open(const string& path);
+   void close() { file.close(); }
+   bool isOpen() const { return file.is_open(); }
+
+   Size getSize() const { return Size(header.width, header.height); }
+   bool hasGroundTruth() const { return header.groundTruth != 0; }
+   // CV_64FC1 3x3 and 1x5, empty when the recording has no lens
+   const Mat& getCameraMatrix() const { return cameraMatrix; }
+   const Mat& getDistortion() const { return distortion; }
+
+   // The next frame; points get z and confidence, the rest stays 0. False
+   // at the end of the file, and at a frame whose header does not match
+   // the recording or that runs past the end of the file: a recording cut
+   // short ends with its last whole frame.
+   bool read(royale::DepthData& data, Mat* labels = NULL, vector<SceneObject>* objects = NULL);
+   // Steps over the next frame without reading it; false as read
+   bool skip();
+   // Back to the first frame
+   void rewind();
+   // Frames in the file, counted by stepping over them; rewinds
+   int countFrames();
+
+private:
+   ifstream file;
+   RecordingHeader header;
+   Mat cameraMatrix, distortion;
+   int64_t fileBytes = 0;
+   vector<float> z;
+   vector<uint8_t> confidence;
+
+   // The next frame's header, if its frame is whole; otherwise the file is
+   // left at its end
+   bool readFrame(RecordingFrame& frame);
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "ShapeRecord.h"
+
+using namespace std;
+
+// Shapes detected offline, one row per shape, stored by column so an
+// analysis reads only the columns it needs and maps each straight into an
+// array, with one row per frame next to them, so frames without shapes are
+// there as well. The file starts with a DetectionTableHeader, the recording
+// paths (uint32 length and the bytes of each), a DetectionColumn per frame
+// column and one per shape column. Then come row groups until the end of
+// the file: a uint32 frame count and, per frame column in that order, the
+// values of every frame of the group, then a uint32 row count and the
+// values of every shape column likewise. The frame columns are recording
+// (index into the paths), frame, timestamp [us] (int64), detecting and
+// shapes, the rows of the frame in the group. The shape columns are
+// recording, frame, timestamp and the int32 fields of ShapeRecord in their
+// order. Little-endian, like the recordings.
+struct DetectionTableHeader {
+   char magic[4] = { 'S', 'D', 'D', 'T' };
+   uint32_t version = 2;
+   uint32_t recordings = 0;
+   uint32_t frameColumns = 0;
+   uint32_t columns = 0;
+};
+
+struct DetectionColumn {
+   char name[12] = {};
+   uint32_t bytes = 0;   // per value, 4 or 8 (signed integers)
+};
+
+// A frame, whether or not it had shapes
+struct DetectionFrame {
+   int32_t recording = 0;
+   int32_t frame = 0;      // in the recording, from 0
+   int64_t timestamp = 0;  // camera time [us]
+   int32_t detecting = 0;  // 1 once the background or plane was there
+   int32_t shapes = 0;     // rows of the frame
+};
+
+// A shape and the frame it was found in
+struct DetectionRow {
+   int32_t recording = 0;
+   int32_t frame = 0;      // in the recording, from 0
+   int64_t timestamp = 0;  // camera time [us]
+   ShapeRecord shape;
+};
+
+class DetectionTableWriter {
+public:
+   ~DetectionTableWriter() { close(); }
+
+   bool open(const string& path, const vector<string>& recordings);
+   // One row group: frames and the rows of those frames, in the same order;
+   // a group without frames writes nothing
+   bool write(const vector<DetectionFrame>& frames, const vector<DetectionRow>& rows);
+   void close();
+   uint64_t getFrames() const { return frames; }
+   uint64_t getRows() const { return rows; }
+
+private:
+   ofstream file;
+   uint64_t frames = 0;
+   uint64_t rows = 0;
+   // one column of a group at a time
+   vector<int32_t> column32;
+   vector<int64_t> column64;
+};
+
+class DetectionTableReader {
+public:
+   // false when path is not a table with the columns the writer writes
+   bool open(const string& path);
+   // The next row group; false at the end of the file or at a truncated or
+   // inconsistent group
+   bool read(vector<DetectionFrame>& frames, vector<DetectionRow>& rows);
+   // The last read stopped at a damaged group rather than the end
+   bool isDamaged() const { return damaged; }
+   const vector<string>& getRecordings() const { return recordings; }
+
+private:
+   ifstream file;
+   bool damaged = false;
+   vector<string> recordings;
+   vector<int32_t> column32;
+   vector<int64_t> column64;
+
+   bool readColumn32(size_t n);
+   bool readColumn64(size_t n);
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// Log lines of the native code: logcat on Android, stderr in the host tools
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOGI(...) ((void)__android_log_print(ANDROID_LOG_INFO, "Native", __VA_ARGS__))
+#define LOGE(...) ((void)__android_log_print(ANDROID_LOG_ERROR, "Native", __VA_ARGS__))
+#else
+#include <cstdio>
+#define LOGI(...) ((void)(fprintf(stderr, __VA_ARGS__), fputc('\n', stderr)))
+#define LOGE(...) ((void)(fprintf(stderr, "error: "), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr)))
+#endif
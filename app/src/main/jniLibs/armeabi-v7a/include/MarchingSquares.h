@@ -0,0 +1,45 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Marching-squares iso-contour extraction on a float plane. Vertices are
+// linearly interpolated along the cell edges, so contours have sub-pixel
+// accuracy at the sensor's own resolution. Pixel centres are at integer
+// coordinates, matching contours traced on the mask.
+class MarchingSquares {
+public:
+   // Closed iso-contours of src at level [m] inside roi; src is CV_32FC1 in
+   // meters or CV_16SC1 in millimeters (see DepthPixel.h). Pixels outside
+   // roi are taken as background, so every contour closes inside the roi
+   // border. A pixel equal to level counts as below it, like THRESH_BINARY.
+   void findContours(const Mat& src, float level, Rect roi, float background,
+                     vector<vector<Point2f> >& contours);
+
+   // The contour enclosing the largest area in roi, false if there is none
+   bool findLargestContour(const Mat& src, float level, Rect roi, float background,
+                           vector<Point2f>& contour);
+
+   // Sizes the buffers for a roi of the whole plane, so no later roi grows
+   // them
+   void reserve(Size size);
+   // A convex outline across the whole plane crosses about 2 (w + h) cell
+   // edges; twice that leaves room for ragged ones
+   static size_t outlinePoints(Size size){ return 4 * (size_t)(size.width + size.height); }
+
+private:
+   // padded copy of the roi, one background pixel on every side, over
+   // gridBuffer
+   Mat grid;
+   vector<float> gridBuffer;
+   vector<int> next;
+   // the loops of the last trace, loop i is [loopStart[i], loopStart[i + 1])
+   vector<Point2f> points;
+   vector<int> loopStart;
+
+   int trace(const Mat& src, float level, Rect roi, float background);
+   Point2f vertex(int edge, float level) const;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "RunLengthMask.h"
+
+using namespace std;
+using namespace cv;
+
+// Metric size and position of a blob, in the camera frame of the displayed
+// (undistorted) image
+struct ShapeMetrics {
+   Point3f centroid;       // mean of the object's surface points [m]
+   float width = 0;        // footprint extents along its principal axes,
+   float height = 0;       // width >= height [m]
+   float footprint = 0;    // table area covered [cm^2]
+   float volume = 0;       // between the surface and the table [cm^3]
+};
+
+// Pinhole back-projection of the undistorted image: pixel (u, v) at depth z
+// is (rayX[u] * z, rayY[v] * z, z). Two small tables instead of full x and y
+// planes, since the rays of an undistorted image are separable.
+class BackProjection {
+public:
+   void create(const Mat& cameraMatrix, Size size);
+   bool empty() const { return rayX.empty(); }
+   const vector<float>& getRayX() const { return rayX; }
+   const vector<float>& getRayY() const { return rayY; }
+
+   // Metrics of every blob straight from its runs. heights is the height
+   // above the table (CV_32FC1 meters or CV_16SC1 millimeters) and background
+   // the table depth (CV_32FC1 meters). Only the pixels of the runs are read,
+   // in two vectorized passes.
+   void measure(const RunLengthMask& mask, const vector<int>& runLabels, int numBlobs,
+                const Mat& heights, const Mat& background, vector<ShapeMetrics>& metrics);
+   // Sizes the per blob buffers for up to blobs blobs
+   void reserve(int blobs);
+
+private:
+   float fx = 0, fy = 0;
+   vector<float> rayX, rayY;
+
+   // per blob sums of the first pass: table depth zb, surface depth z and
+   // the moments of the footprint points (rayX * zb, rayY * zb)
+   struct Sums {
+      double n, zb, zb2, hzb2, z, xz, yz, px, py, pxx, pxy, pyy;
+   };
+   vector<Sums> sums;
+   vector<Vec4f> extents;   // min u, max u, min v, max v along the axes
+   vector<Vec2f> axes;      // cos, sin of the major axis
+};
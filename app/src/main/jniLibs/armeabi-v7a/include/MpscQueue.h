@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+using namespace std;
+
+// Bounded lock-free queue from any number of producer threads to one
+// consumer. Every cell carries a sequence number: a producer claims a cell
+// by advancing tail with a compare-and-swap, fills it, then publishes it by
+// bumping its sequence; the consumer takes cells in order once published.
+// Neither side takes a lock, so the consumer can drain it on a hot path.
+template<typename T>
+class MpscQueue {
+public:
+   // capacity is rounded up to a power of two
+   explicit MpscQueue(size_t capacity = 64){
+      size_t n = 1;
+      while(n < capacity) n <<= 1;
+      cells.reset(new Cell[n]);
+      mask = n - 1;
+      for(size_t i = 0; i < n; i++) cells[i].sequence.store(i, memory_order_relaxed);
+      head.value.store(0, memory_order_relaxed);
+      tail.value.store(0, memory_order_relaxed);
+   }
+
+   // Any thread; false when full
+   bool push(const T& v){
+      size_t t = tail.value.load(memory_order_relaxed);
+      Cell* cell;
+      for(;;){
+         cell = &cells[t & mask];
+         ptrdiff_t lag = (ptrdiff_t)(cell->sequence.load(memory_order_acquire) - t);
+         if(lag == 0){
+            if(tail.value.compare_exchange_weak(t, t + 1, memory_order_relaxed)) break;
+         }
+         // the consumer has not freed the cell a lap ago yet
+         else if(lag < 0) return false;
+         else t = tail.value.load(memory_order_relaxed);
+      }
+      cell->value = v;
+      cell->sequence.store(t + 1, memory_order_release);
+      return true;
+   }
+
+   // Consumer only; false when empty, or while the next cell is claimed but
+   // not yet published
+   bool pop(T& v){
+      size_t h = head.value.load(memory_order_relaxed);
+      Cell& cell = cells[h & mask];
+      if(cell.sequence.load(memory_order_acquire) != h + 1) return false;
+      v = cell.value;
+      // release what the value held before the cell is handed back
+      cell.value = T();
+      cell.sequence.store(h + mask + 1, memory_order_release);
+      head.value.store(h + 1, memory_order_relaxed);
+      return true;
+   }
+
+   size_t capacity() const { return mask + 1; }
+
+private:
+   struct Cell {
+      atomic<size_t> sequence;
+      T value;
+   };
+
+   struct Index {
+      atomic<size_t> value;
+      char padding[64 - sizeof(atomic<size_t>)];
+   };
+
+   unique_ptr<Cell[]> cells;
+   size_t mask;
+   Index head;   // next cell to pop, consumer only
+   Index tail;   // next cell to claim
+};
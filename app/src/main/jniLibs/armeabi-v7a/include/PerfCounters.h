@@ -0,0 +1,78 @@
+#pragma once
+
+// Hardware counters around the zones of the pipeline, read with
+// perf_event_open: cycles, instructions, L1 data and last level cache read
+// misses, and branch misses. Every thread opens its own counter group the
+// first time it enters a zone, and a zone adds what its thread's counters
+// moved while inside it. So that this includes the tiles a zone hands to
+// the tile pool, builds with the counters run the shared pool and the
+// pipelines' own pools on one thread, the caller's (TilePool.cpp,
+// ShapePipeline::initialize); the CSV gives the pool's threads in every row
+// and the numbers are whole when it is 1. Counters the kernel or the CPU
+// does not offer stay 0.
+//
+// Only built with SHAPE_PERF_COUNTERS. Without it PERF_ZONE expands to
+// nothing and none of this exists.
+#ifdef SHAPE_PERF_COUNTERS
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+class PerfCounters {
+public:
+   enum Zone { Ingest, Diff, Filter, Segment, Classify, Output, Zones };
+   enum Event { Cycles, Instructions, L1Misses, LLCMisses, BranchMisses, Events };
+   static const char* zoneName(Zone zone);
+   static const char* eventName(Event event);
+
+   PerfCounters() { reset(); }
+   // Threads of the tile pool the zones' kernels run on, for the CSV
+   void setTileThreads(int n) { tileThreads = n; }
+
+   // Counts of the calling thread since its group was opened, scaled when
+   // the kernel multiplexed it; false when the thread has no counters
+   static bool read(uint64_t values[Events]);
+   void add(Zone zone, const uint64_t begin[Events], const uint64_t end[Events]);
+   void reset();
+
+   // Per zone: samples, mean cycles, IPC and misses per 1000 instructions
+   string report() const;
+   // Per zone totals, one row per zone after a header
+   bool writeCsv(const string& path) const;
+
+private:
+   atomic<int> tileThreads { 1 };
+   atomic<uint64_t> samples[Zones];
+   atomic<uint64_t> totals[Zones][Events];
+};
+
+// Counts the enclosing scope into one zone
+class PerfZone {
+public:
+   PerfZone(PerfCounters& counters, PerfCounters::Zone zone) : counters(counters), zone(zone){
+      valid = PerfCounters::read(begin);
+   }
+   ~PerfZone(){
+      uint64_t end[PerfCounters::Events];
+      if(valid && PerfCounters::read(end)) counters.add(zone, begin, end);
+   }
+
+private:
+   PerfCounters& counters;
+   PerfCounters::Zone zone;
+   uint64_t begin[PerfCounters::Events];
+   bool valid;
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_ZONE(counters, zone) PerfZone PERF_CONCAT(perfZone, __LINE__)(counters, PerfCounters::zone)
+
+#else
+
+#define PERF_ZONE(counters, zone)
+
+#endif
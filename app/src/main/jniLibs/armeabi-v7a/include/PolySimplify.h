@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Scratch buffers for polygon simplification. They only grow, so once a
+// workspace has seen the longest contour of a scene, simplifying does not
+// allocate any more.
+struct SimplifyWorkspace {
+   vector<int> stack;             // Douglas-Peucker ranges still to split
+   vector<unsigned char> keep;
+   vector<float> area;            // Visvalingam-Whyatt effective areas
+   vector<int> prev, next;
+   vector<int> heap, heapPos;
+   vector<int> indices;           // free for the caller's result
+
+   // Grows the buffers for contours of up to points vertices up front
+   void reserve(size_t points){
+      stack.reserve(4 * points); keep.reserve(points);
+      area.reserve(points); prev.reserve(points); next.reserve(points);
+      heap.reserve(points); heapPos.reserve(points);
+      indices.reserve(points);
+   }
+};
+
+// Iterative Douglas-Peucker. Returns the kept vertices as ascending indices
+// into contour, without copying points. For closed contours the split starts
+// from a pair of far apart points, as cv::approxPolyDP does.
+void simplifyDouglasPeucker(const vector<Point>& contour, double epsilon, bool closed,
+                            SimplifyWorkspace& ws, vector<int>& indices);
+void simplifyDouglasPeucker(const vector<Point2f>& contour, double epsilon, bool closed,
+                            SimplifyWorkspace& ws, vector<int>& indices);
+
+// Visvalingam-Whyatt: repeatedly drops the vertex whose triangle with its
+// neighbours has the smallest area, until every remaining one is >= minArea.
+// Tends to keep the overall shape better than Douglas-Peucker on noisy
+// outlines at the same vertex count.
+void simplifyVisvalingam(const vector<Point>& contour, double minArea, bool closed,
+                         SimplifyWorkspace& ws, vector<int>& indices);
+void simplifyVisvalingam(const vector<Point2f>& contour, double minArea, bool closed,
+                         SimplifyWorkspace& ws, vector<int>& indices);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "BitMask.h"
+#include "ShapeRecord.h"
+
+using namespace std;
+
+// The shapes of every frame, and optionally the detection mask, in a ring of
+// slots in a shared file mapping, for any number of readers beside the JNI
+// upcall: the UI, a logger, a projector renderer, in this process or
+// another. One writer publishes frame after frame with increasing sequence
+// numbers and overwrites the oldest slot; it never waits for a reader. A
+// reader maps the file, sleeps on a futex or polls until a sequence is
+// published, and reads the slot in place. Every slot carries the sequence of
+// the frame in it, 0 while it is written, so a reader that fell a whole ring
+// behind skips ahead, and one that was overtaken while reading sees it.
+//
+// The file is a ResultRingHeader padded to 64 bytes, then the slots, each a
+// ResultRingSlot, maxRecords ShapeRecords and maskWords mask words, padded
+// to 64 bytes. Put it in /dev/shm on Linux, in the app's files on Android.
+struct ResultRingHeader {
+   char magic[4] = { 'S', 'D', 'R', 'R' };
+   uint32_t version = 1;
+   uint32_t slots = 0;
+   uint32_t slotBytes = 0;
+   uint32_t maxRecords = 0;
+   uint32_t maskWords = 0;           // per slot, 0 without masks
+   uint32_t recordBytes = sizeof(ShapeRecord);
+   uint32_t reserved = 0;
+   atomic<uint64_t> published { 0 };   // sequence of the newest whole slot, 0 before the first
+   atomic<uint32_t> wake { 0 };        // futex word, bumped with every frame
+   atomic<uint32_t> waiters { 0 };     // readers asleep on wake
+};
+
+struct ResultRingSlot {
+   atomic<uint64_t> sequence;   // of the frame in the slot, 0 while written
+   uint64_t index;              // frames the pipeline was offered before this one
+   int64_t timestamp;           // camera time [us]
+   int64_t published;           // steady clock when the slot was written [ns]
+   uint32_t detecting;          // records and mask are valid only while detecting
+   uint32_t count;              // records in the slot
+   // mask rows of maskWordsPerRow words, laid out like a BitMask row
+   // without its guard words; 0 rows when the frame has no mask
+   uint32_t maskRows, maskCols, maskWordsPerRow;
+   uint32_t reserved;
+};
+
+class ResultRingWriter {
+public:
+   ~ResultRingWriter() { close(); }
+
+   // Creates or replaces the file; masks of up to maskSize pixels are kept
+   // when withMask
+   bool create(const string& path, Size maskSize, bool withMask, int slots = 8, int maxRecords = 64);
+   void close();
+   bool isOpen() const { return header != NULL; }
+
+   // Copies the frame into the oldest slot and wakes the sleeping readers.
+   // Records past maxRecords and masks larger than the ring's are left out.
+   void publish(uint64_t index, int64_t timestamp, bool detecting, const vector<ShapeRecord>& records,
+                const BitMask* mask);
+
+private:
+   string path;
+   void* memory = NULL;
+   size_t bytes = 0;
+   ResultRingHeader* header = NULL;
+};
+
+// A published frame, read in place in the mapping
+struct ResultRingView {
+   uint64_t sequence = 0;
+   const ResultRingSlot* slot = NULL;
+   const ShapeRecord* records = NULL;
+   const uint64_t* mask = NULL;
+};
+
+class ResultRingReader {
+public:
+   ~ResultRingReader() { close(); }
+   bool open(const string& path);
+   void close();
+
+   uint64_t getPublished() const { return header->published.load(memory_order_acquire); }
+   // Sleeps until a frame after sequence is published; false after
+   // timeoutMs without one or on a signal
+   bool wait(uint64_t sequence, int timeoutMs);
+   // The frame after sequence, or the oldest one the ring still has when
+   // the writer overwrote it; false when none is published yet
+   bool next(uint64_t sequence, ResultRingView& view);
+   // After reading a view: false when the writer reused its slot meanwhile,
+   // and what was read may be torn
+   bool intact(const ResultRingView& view) const {
+      atomic_thread_fence(memory_order_acquire);
+      return view.slot->sequence.load(memory_order_relaxed) == view.sequence;
+   }
+   // Frames published since open that next stepped over, as they were
+   // overwritten before this reader got to them
+   uint64_t getLapped() const { return lapped; }
+
+private:
+   void* memory = NULL;
+   size_t bytes = 0;
+   const ResultRingHeader* header = NULL;
+   uint64_t handed = 0;   // newest sequence next returned
+   uint64_t lapped = 0;
+
+   const ResultRingSlot* slotOf(uint64_t sequence) const;
+};
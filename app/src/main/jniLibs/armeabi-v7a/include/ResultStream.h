@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ShapeRecord.h"
+
+using namespace std;
+
+// The shapes of every frame over a Unix domain socket, from the daemon to
+// any number of local clients. The socket is SOCK_SEQPACKET: every frame is
+// one message, a ResultHeader followed by count ShapeRecords, and is
+// delivered whole or not at all. A client too slow to keep its socket
+// buffer drained misses frames instead of holding up the daemon.
+struct ResultHeader {
+   char magic[4] = { 'S', 'D', 'R', 'S' };
+   uint32_t count = 0;         // ShapeRecords after the header
+   uint64_t index = 0;         // frames the daemon was offered before this one
+   int64_t timestamp = 0;      // camera time [us]
+   int64_t ingested = 0;       // steady clock when the frame was ingested [ns]
+   int64_t published = 0;      // steady clock when the message was sent [ns]
+   uint32_t detecting = 0;     // records are valid only while detecting
+   uint32_t recordBytes = sizeof(ShapeRecord);
+};
+
+// Most records in one message
+static const size_t maxResultShapes = 256;
+
+class ResultServer {
+public:
+   ~ResultServer() { close(); }
+   // Listens on path, replacing a stale socket file
+   bool open(const string& path);
+   void close();
+
+   // Takes waiting clients, then sends to every client without blocking.
+   // Returns the clients reached; a full client misses the message, a gone
+   // one is dropped.
+   int publish(ResultHeader& header, const vector<ShapeRecord>& records);
+
+   int getClients() const { return (int)clients.size(); }
+   // Messages clients missed since the server opened
+   uint64_t getMissed() const { return missed; }
+
+private:
+   int listener = -1;
+   string path;
+   vector<int> clients;
+   uint64_t missed = 0;
+};
+
+class ResultClient {
+public:
+   ~ResultClient() { close(); }
+   bool connect(const string& path);
+   // Blocks for the next frame; false when the daemon goes away or sends
+   // something that is not a frame
+   bool read(ResultHeader& header, vector<ShapeRecord>& records);
+   void close();
+
+private:
+   int fd = -1;
+   vector<char> buffer;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "BitMask.h"
+#include "Blob.h"
+#include "DepthProfile.h"
+
+using namespace std;
+using namespace cv;
+
+// Horizontal run of foreground pixels [x0, x1] in row y
+struct Run {
+   int y, x0, x1;
+};
+
+// Run-length encoded binary mask. A table-top scene is a few blobs on an
+// empty table, so everything downstream of the encoding costs O(runs)
+// instead of O(width * height).
+class RunLengthMask {
+public:
+   int rows = 0, cols = 0;
+   vector<Run> runs;       // row-major order
+   vector<int> rowStart;   // runs of row y are [rowStart[y], rowStart[y + 1])
+
+   // Encodes the pixels of src (CV_32FC1) above level, like THRESH_BINARY
+   void threshold(const Mat& src, float level);
+   void encode(const BitMask& mask);
+   // Sizes the runs for the worst mask of size, one run per two columns of
+   // every row, so no later encoding grows them
+   void reserve(Size size);
+
+   // false outside the image
+   bool get(int y, int x) const;
+   size_t area() const;
+   // Outer contour of the blob starting at start, see traceOuterContour
+   void traceContour(Point start, vector<Point>& contour) const;
+
+private:
+   void beginRows(int rows, int cols);
+};
+
+// 8-connected components over runs: runs of adjacent rows are merged when
+// they overlap or touch diagonally, and blob statistics are summed per run.
+class RunLabeler {
+public:
+   // Blobs are ordered by label (raster order of their first pixel)
+   void label(const RunLengthMask& mask, vector<Blob>& blobs);
+   // Also gathers the height profile of every blob from heights (CV_32FC1 or
+   // CV_16SC1, see DepthPixel.h), reading only the pixels of the runs
+   void label(const RunLengthMask& mask, vector<Blob>& blobs,
+              const Mat& heights, vector<DepthProfile>& profiles);
+   // Index into blobs of every run, valid after label()
+   const vector<int>& getRunLabels() const { return runLabels; }
+   // Sizes the per run buffers for up to runs runs
+   void reserve(size_t runs);
+
+private:
+   vector<int> parent;
+   vector<int> runLabels;
+
+   void labelRuns(const RunLengthMask& mask, vector<Blob>& blobs,
+                  const Mat* heights, vector<DepthProfile>* profiles);
+};
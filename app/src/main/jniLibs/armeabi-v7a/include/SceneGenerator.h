@@ -0,0 +1,98 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <royale/DepthData.hpp>
+#include <royale/LensParameters.hpp>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// One solid on the table. The base is a regular polygon (or a circle)
+// stretched by aspect along its own x axis, then turned by angle.
+struct SceneObject {
+   enum Kind { Prism, Pyramid, Cylinder, Disc };
+
+   int32_t kind = Prism;
+   int32_t sides = 4;        // corners of prism and pyramid bases
+   float x = 0, y = 0;       // base center on the table [m]
+   float angle = 0;          // about the table normal [rad]
+   float radius = 0.04f;     // circumradius of the base before stretching [m]
+   float aspect = 1;         // x stretch of the base
+   float height = 0.05f;     // [m]
+
+   // Types the classifier should report: TRI, SQR, RECT, PENT, HEX, CIR or
+   // ELL, and BOX, PYR, CYL or FLAT
+   const char* expectedType() const;
+   const char* expectedType3D() const;
+};
+
+// A table plane and the objects on it. The table frame has its origin where
+// the optical axis meets the table, x and y along the table and z up towards
+// the camera.
+struct Scene {
+   float tableDistance = 0.6f;   // along the optical axis [m]
+   float tiltX = 0, tiltY = 0;   // table rotation about the camera x and y axes [rad]
+   vector<SceneObject> objects;
+};
+
+struct SceneParams {
+   Size size = Size(224, 171);
+   // CV_64FC1 3x3 and 1x5 (k1 k2 p1 p2 k3) like the listener builds them;
+   // empty for fx = fy = 210 at the image center and no distortion
+   Mat cameraMatrix, distortion;
+
+   float minDistance = 0.5f, maxDistance = 0.8f;   // table along the axis [m]
+   float maxTilt = 0.1f;                          // [rad]
+   int minObjects = 1, maxObjects = 4;
+   float minRadius = 0.02f, maxRadius = 0.05f;    // [m]
+   float minHeight = 0.01f, maxHeight = 0.08f;    // [m]
+   float maxAspect = 1.8f;
+   // objects stay this share of the view away from the image border
+   float border = 0.15f;
+
+   // depth noise sigma at 1 m [m]; it grows with the square of the distance
+   float noise = 0.002f;
+   // share of pixels reported with confidence 0, anywhere in the image
+   float dropout = 0.005f;
+   // share of pixels on object silhouettes reported with confidence 0, the
+   // mixed pixels a ToF camera drops at depth edges
+   float edgeDropout = 0.3f;
+};
+
+// Renders parametric table-top scenes as the camera would deliver them:
+// royale DepthData in the sensor's point order with lens distortion, noise
+// and dropouts, plus ground truth labels. A ray is cast for every pixel
+// through the distorted lens; only the pixels inside an object's projected
+// bounding box test that object. Rendering is const, so threads can share
+// one generator, and deterministic for a given seed.
+class SceneGenerator {
+public:
+   explicit SceneGenerator(const SceneParams& params = SceneParams());
+
+   const SceneParams& getParams() const { return params; }
+   const Mat& getCameraMatrix() const { return cameraMatrix; }
+   const Mat& getDistortion() const { return distortion; }
+
+   // Camera matrix and distortion coefficients of a royale lens
+   static void lensMatrices(const royale::LensParameters& lens, Mat& cameraMatrix, Mat& distortion);
+
+   // A random table pose and non-overlapping objects inside the view
+   void randomScene(RNG& rng, Scene& scene) const;
+   // New objects on the scene's table
+   void randomObjects(RNG& rng, Scene& scene) const;
+
+   // data: width * height points, the first one the last pixel of the
+   // image, as the listener reads them. labels: CV_8UC1 in image order, 0
+   // for the table, i + 1 for scene.objects[i]; may be NULL.
+   void render(const Scene& scene, uint64_t seed, royale::DepthData& data, Mat* labels = NULL) const;
+
+private:
+   SceneParams params;
+   Mat cameraMatrix, distortion;
+   // normalized ray (x, y, 1) of every pixel, distortion removed
+   vector<Point2f> rays;
+
+   bool project(const Point3f& p, Point2f& pixel) const;
+};
@@ -1,33 +1,93 @@
+#pragma once
+
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "Blob.h"
+#include "DepthProfile.h"
+#include "Measure3D.h"
+#include "ContourFeatures.h"
+#include "PolySimplify.h"
+#include "ShapeClassifier.h"
+#include "ShapeRecord.h"
 
 using namespace std;
 using namespace cv;
 
-class Shape {
+// T is the contour coordinate type: int for contours traced on the mask,
+// float for sub-pixel iso-contours of the difference image
+template<typename T>
+class Shape_ {
 public:
-   vector<Point> contour;
+   vector<Point_<T> > contour;
    bool isValidShape = true;
-   // Constructors
-   Shape(const vector<Point> & contour);
+   // Constructors. A workspace shared across shapes keeps the polygon
+   // approximation from allocating scratch buffers per shape. Without a
+   // classifier the default templates are used.
+   Shape_(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace = NULL,
+          const ShapeClassifier * classifier = NULL);
+   // Area, center and bounding box are taken from the blob's run statistics
+   // instead of walking the contour
+   Shape_(const vector<Point_<T> > & contour, const Blob & blob, SimplifyWorkspace * workspace = NULL,
+          const ShapeClassifier * classifier = NULL);
+   // An empty shape to reset per blob
+   Shape_() {}
+
+   // Starts over with a new contour. The buffers of the previous shape are
+   // kept, so a shape reused across blobs stops allocating once they have
+   // grown to the largest blob.
+   void reset(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace = NULL,
+              const ShapeClassifier * classifier = NULL);
+   // Grows the buffers for contours of up to points vertices up front
+   void reserve(size_t points);
 
    // Getters
    double getArea();
    double getPerimeter();
    Point2f getCenter();
    Rect getBoundingRect();
-   vector<Point> getApprox();
+   const vector<Point_<T> > & getApprox();
    string getType();
+   // Solid the height profile looks like, "NULL" without a profile
+   string getType3D();
+   // Area, perimeter, moments, bbox and convexity from one pass
+   const ContourFeatures & getFeatures();
+   // Invariants the classifier works on
+   const ShapeDescriptor & getDescriptor();
 
-   vector<Point> approximatePolyDP(double epsilon);
+   void setDepthProfile(const DepthProfile & profile);
+   void setMetrics(const ShapeMetrics & metrics);
+   // Zero until set
+   const ShapeMetrics & getMetrics() const { return metrics; }
+   // Output record of the shape, in the units of ShapeRecord
+   ShapeRecord getRecord();
+   const vector<Point_<T> > & approximatePolyDP(double epsilon);
    void draw(cv::Mat& image);
 
 private:
+   void start(const vector<Point_<T> > & contour, SimplifyWorkspace * workspace,
+              const ShapeClassifier * classifier);
+   void validate();
+   void extractFeatures();
+
    double area = -1;
    double perimeter = -1;
    Point2f center = Point2f(FLT_MAX, FLT_MAX);
    Rect boundingRect;
-   vector<Point> approx;
+   vector<Point_<T> > approx;
    string type = "NULL";
+   string type3D = "NULL";
+   DepthProfile depth;
+   bool hasDepth = false;
+   ShapeMetrics metrics;
+   ContourFeatures features;
+   bool hasFeatures = false;
+   ShapeDescriptor descriptor;
+   bool hasDescriptor = false;
+   SimplifyWorkspace * workspace = NULL;
+   const ShapeClassifier * classifier = NULL;
+   vector<Point> pixels;
 
 };
+
+typedef Shape_<int> Shape;
+typedef Shape_<float> Shape2f;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include "ContourFeatures.h"
+#include "PolySimplify.h"
+
+using namespace std;
+using namespace cv;
+
+// Translation, rotation and scale invariant description of an outline. The
+// continuous terms come from the moment invariants (Hu's first two) and the
+// area to perimeter ratio, so all of them are 1 for a disc. Moments are taken
+// on the contour, the rest on its approximation, which is far less affected
+// by pixel noise.
+struct ShapeDescriptor {
+   float elongation = 0;   // minor / major axis of the inertia ellipse
+   float circularity = 0;  // 4 pi area / perimeter^2 of the approximation
+   float spread = 0;       // 1 / (2 pi hu1), drops as area moves away from the center
+   int vertices = 0;       // of the 0.02 * perimeter approximation
+   bool convex = false;    // of the approximation
+};
+
+void describeShape(const ContourFeatures& contour, const ContourFeatures& approx, int vertices,
+                   ShapeDescriptor& d);
+// Same as a Shape does it: features of the outline plus its approximation
+void describeOutline(const vector<Point2f>& outline, SimplifyWorkspace& ws, ShapeDescriptor& d);
+
+// Nearest-template classifier over shape descriptors. Templates are only used
+// to fill a quantized lookup table over descriptor space, so classifying a
+// blob is one table read whatever the number of templates or classes.
+class ShapeClassifier {
+public:
+   // Table resolution: bins per continuous term and vertex counts 3 .. 10+,
+   // times convex or not. 12^3 * 8 * 2 bytes stays inside a 32K L1.
+   static const int bins = 12;
+   static const int vertexBins = 8;
+
+   // Starts with the default templates
+   ShapeClassifier();
+
+   // Replaces the templates with the ones in a text file, one outline per
+   // line as "NAME x0 y0 x1 y1 ...", '#' starts a comment. Several lines may
+   // share a name. Keeps the current templates and returns false if the file
+   // cannot be read or has no valid outline.
+   bool load(const string& path);
+
+   void clear();
+   void addTemplate(const string& name, const vector<Point2f>& outline);
+   // Refills the table; call after adding templates
+   void build();
+
+   // "OTR" when no template is close enough
+   const string& classify(const ShapeDescriptor& d) const;
+   size_t getNumTemplates() const { return templates.size(); }
+   size_t getNumClasses() const { return names.size(); }
+
+   // Classifier with the default templates, shared by shapes that are not
+   // given one
+   static const ShapeClassifier& getDefault();
+
+private:
+   struct Template {
+      int cls;
+      ShapeDescriptor d;
+   };
+
+   vector<string> names;         // class ids, 0 is "OTR"
+   vector<Template> templates;
+   vector<unsigned char> table;  // class id per cell
+   SimplifyWorkspace workspace;
+
+   void addDefaultTemplates();
+   int classId(const string& name);
+   static int cellOf(const ShapeDescriptor& d);
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "ShapeRecord.h"
+
+using namespace std;
+using namespace cv;
+
+// One shape on the table, merged from what every camera that sees it
+// reported. All fields are 32-bit integers, like ShapeRecord, so the shapes
+// of a frame copy straight into a Java int array.
+struct FusedRecord {
+   int32_t type = 0;          // 2D type of the view that saw most of it
+   int32_t type3D = 0;        // 3D type of that view
+   int32_t x = 0, y = 0, z = 0;       // centroid in the table frame [mm]
+   int32_t sizeMajor = 0, sizeMinor = 0;   // [mm], of the best view
+   int32_t footprint = 0;     // [mm^2]
+   int32_t volume = 0;        // [mm^3]
+   int32_t cameras = 0;       // bit c for every camera c that saw it
+   int32_t views = 0;         // records merged into it
+};
+
+static const int fusedRecordInts = sizeof(FusedRecord) / sizeof(int32_t);
+
+// The merge stage after the pipelines of several cameras covering one
+// table. Every camera's output stage submits its frames; once every live
+// camera gave a frame since the last round, the round's records are moved
+// into the table frame by each camera's pose and the records of different
+// cameras that land on the same spot become one shape. The fusing runs on
+// the thread of the camera that completed the round, so it needs no thread
+// of its own.
+class ShapeFusion {
+public:
+   struct Frame {
+      uint64_t index = 0;     // rounds fused before this one
+      int32_t cameras = 0;    // bit c for every camera in the round
+      vector<FusedRecord> records;
+   };
+   typedef function<void(const Frame& frame)> Output;
+
+   // records of different cameras closer than this on the table are one
+   // shape [mm]
+   float mergeDistance = 40;
+   // a camera without a frame for this long is left out of the rounds
+   int64_t staleNs = 250000000;
+
+   // Cameras 0..n-1; the ones already there keep their poses, new ones are
+   // at the identity pose. Drops a round in progress
+   void setCameras(int n);
+   int getCameras() const { return count.load(); }
+   // CV_64FC1 3x4 or 4x4 rigid transform from camera coordinates, as in
+   // ShapeRecord::cx, cy, cz, to the table frame, whose x-y plane is the
+   // table [mm]
+   void setPose(int camera, const Mat& cameraToTable);
+   // Set before the first submit; called on a submitting thread, one round
+   // at a time and in order
+   void setOutput(const Output& output) { this->output = output; }
+
+   // From a camera's output stage, with the records of one frame; only
+   // records with a 3D centroid can be placed on the table
+   void submit(int camera, bool detecting, const vector<ShapeRecord>& records);
+
+   // From any thread
+   uint64_t getRounds() const { return rounds.load(); }
+   // Records left out for want of a 3D centroid
+   uint64_t getUnplaced() const { return unplaced.load(); }
+
+private:
+   struct Camera {
+      // camera to table, row major 3x4
+      double pose[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+      bool pending = false;     // a frame since the last round
+      bool detecting = false;
+      int64_t seen = 0;         // steady clock of its last frame [ns], 0 never
+      vector<ShapeRecord> records;
+   };
+   // a record placed on the table
+   struct View {
+      int camera;
+      Point3d position;
+      const ShapeRecord* record;
+   };
+
+   mutex lock;          // cameras
+   mutex outputLock;    // the round being fused and output
+   vector<Camera> cameras;
+   Output output;
+   // read without the locks
+   atomic<int> count { 0 };
+   atomic<uint64_t> rounds { 0 };
+   atomic<uint64_t> unplaced { 0 };
+   Frame fused;
+   vector<View> views;
+   // area weighted sums of the positions of the shapes being merged
+   vector<Point3d> sums;
+   vector<double> weights;
+
+   void fuse(int32_t members);
+};
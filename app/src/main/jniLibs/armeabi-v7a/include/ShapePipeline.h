@@ -0,0 +1,251 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <royale/DepthData.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AllocTracker.h"
+#include "CoarseDetector.h"
+#include "CrossCheck.h"
+#include "DepthPipeline.h"
+#include "MarchingSquares.h"
+#include "MpscQueue.h"
+#include "PerfCounters.h"
+#include "RunLengthMask.h"
+#include "Shape.h"
+#include "StageExecutor.h"
+#include "TablePlane.h"
+#include "TilePool.h"
+
+using namespace std;
+using namespace cv;
+
+// The detection from camera depth to shape records, without the camera and
+// without Java: frames are ingested on the caller's thread, then run through
+// the heights, segment, classify and output stages of a StageExecutor. The
+// app's listener feeds it from the camera and hands the output to Java; the
+// host tools feed it from recordings.
+class ShapePipeline {
+public:
+   // Pixel type of the depth planes, fixed at compile time: float meters, or
+   // int16 millimeters when built with DEPTH_FIXED_POINT
+#ifdef DEPTH_FIXED_POINT
+   typedef DepthPipeline<int16_t> Planes;
+#else
+   typedef DepthPipeline<float> Planes;
+#endif
+
+   // What the app shows while no frame is detecting
+   enum Status { ClickBackground, DetectingBackground };
+
+   // A change the UI thread asks for. The UI only posts these; the heights
+   // stage applies them between frames, so every field they touch is owned
+   // by the stages and never locked.
+   struct Command {
+      enum Type {
+         SetMode,            // value: 1 camera, 2 test
+         DetectBackground,
+         SetPlaneMode,       // value: on
+         SetPyramidLevels,   // value: levels
+         SetTemplates,       // classifier
+         SetCrossCheck       // value: on
+      };
+      Type type = SetMode;
+      int value = 0;
+      shared_ptr<const ShapeClassifier> classifier;
+   };
+
+   // One camera frame on its way through the stages, from the depth the
+   // camera reported to the shapes sent out. Each stage writes its own
+   // fields, so the stages can work on different frames at the same time.
+   struct Frame {
+      uint64_t index = 0;      // ingest: frames offered before this one
+      int64_t timestamp = 0;   // ingest: camera time [us]
+      Mat depth;               // ingest: depth, 0 where the camera gave none
+      int mode = 1;            // heights: settings the frame is processed with
+      Status status = ClickBackground;
+      bool steady = false;     // heights: no command nor capture for steadyFrames
+      shared_ptr<const ShapeClassifier> classifier;
+      Mat diff;                // heights: undistorted height above the table
+      Mat table;               // heights: table depth [m], for metric measurements
+      Mat planeTable;          // heights: the frame's own table depth in plane mode
+      bool detecting = false;  // heights: diff, and everything after it, is valid
+      BitMask mask;            // heights: filtered and thresholded diff
+      vector<Blob> blobs;      // segment
+      vector<DepthProfile> profiles;
+      vector<ShapeMetrics> metrics;
+      vector<ShapeRecord> records;   // classify
+      Mat drawing;
+      // heights: run against the reference path as well; every stage adds
+      // to divergence until one diverges
+      bool checking = false;
+      CrossCheck::Divergence divergence;
+      vector<vector<Point> > checkContours;   // segment: reference contours
+   };
+
+   // Called by the output stage for every frame, in camera order. image is
+   // what the camera mode shows, the shapes or the status, and empty in the
+   // test mode. records are only valid while frame.detecting.
+   typedef function<void(const Frame& frame, const Mat& image)> Output;
+
+   // height above the background that counts as an object [m]
+   static const float detectionThreshold;
+   // frames the background capture averages
+   static const int backgroundFrames = 20;
+   // frames after a command or a background capture until the pipeline is
+   // taken to be steady, every buffer sized for the scene
+   static const int steadyFrames = 30;
+   // blobs the per-blob buffers are sized for up front; a frame with more
+   // still works, but allocates
+   static const int reservedBlobs = 64;
+
+   ShapePipeline();
+   ~ShapePipeline() { shutdown(); }
+
+   // CV_64FC1 3x3 and 1x5 (k1 k2 p1 p2 k3); without them there is no
+   // undistortion and no metric measurement. Call before initialize.
+   void setLens(const Mat& cameraMatrix, const Mat& distortion);
+   // Set before initialize, called on the output stage's thread
+   void setOutput(const Output& output) { this->output = output; }
+   // Keeps the stage threads, their kernels and their planes on these cpus,
+   // with a tile pool of their own, for one pipeline per camera; empty for
+   // anywhere and the shared pool. Set before initialize.
+   void setCpus(const vector<int>& cpus) { this->cpus = cpus; }
+
+   // Frames of the given size. threaded: a thread per stage; otherwise
+   // ingest runs every stage inline, one frame at a time.
+   void initialize(Size size, bool threaded = true);
+   void shutdown();
+   Size getSize() const { return size; }
+
+   // From one producer thread. False when the frame is dropped because every
+   // slot is still in flight; with wait it spins until a slot frees instead,
+   // for recordings, which have no frame rate to keep up with.
+   bool ingest(const royale::DepthData& data, bool wait = false);
+   // Returns once every ingested frame went through the output stage
+   void flush();
+
+   const StageExecutor& getExecutor() const { return executor; }
+   void resetStats(){
+      executor.resetStats();
+      crossCheck.resetStats();
+#ifdef SHAPE_PERF_COUNTERS
+      perf.reset();
+#endif
+#ifdef SHAPE_ALLOC_TRACKING
+      AllocTracker::shared().reset();
+#endif
+   }
+   // Stage times, the cross-check counts once a frame was checked, and the
+   // hardware counters and allocations when built with SHAPE_PERF_COUNTERS
+   // and SHAPE_ALLOC_TRACKING
+   string getStats() const;
+   // The hardware counters per zone as CSV; false when the counters are
+   // not built in or the file cannot be written
+   bool writePerfCsv(const string& path) const;
+   const CrossCheck& getCrossCheck() const { return crossCheck; }
+
+   // The setters below only post commands, from any thread; they take
+   // effect with the next frame
+   bool post(const Command& command);
+   void setMode(int mode);
+   void setPlaneMode(bool on);
+   // 0 turns the pyramid mode off, 1 and 2 detect at half and quarter size
+   void setPyramidLevels(int levels);
+   // The heights stage restarts the capture with its next frame
+   void detectBackground();
+   // Templates are loaded on the caller's thread and swapped in between
+   // frames
+   bool loadTemplates(const string& path);
+   // Debug mode: every frame also runs through the OpenCV reference path,
+   // and the first stage where the two differ is logged with its pixel
+   void setCrossCheck(bool on);
+   // Test mode: an allocation in a steady frame aborts with its stack.
+   // False when not built with SHAPE_ALLOC_TRACKING.
+   bool setAllocationCheck(bool on);
+
+private:
+   Size size;
+   Mat cameraMatrix, distortionCoefficients;
+   Output output;
+   vector<int> cpus;
+   unique_ptr<TilePool> ownPool;
+   vector<int> ownPoolCpus;
+
+   // posted from any thread, drained by the heights stage
+   MpscQueue<Command> commands;
+
+   // Frames run through ingest (the producer's thread), then the heights,
+   // segment, classify and output stages, each on its own thread
+   StageExecutor executor;
+   vector<Frame> frames;
+   uint64_t offered = 0;
+   uint64_t ingested = 0;
+   atomic<uint64_t> finished { 0 };
+   // frames since the last command or capture, by the heights stage; ingest
+   // takes the steadiness of the latest frame
+   int settledFrames = 0;
+   atomic<bool> steady { false };
+
+   // heights stage: settings, depth, background and height planes
+   int mode = 1;   // 1 camera, 2 test
+   Status status = ClickBackground;
+   shared_ptr<const ShapeClassifier> classifier;
+   bool detecting = false;
+   bool detected = false;
+   Planes pipeline;
+   bool capturing = false;
+   // table depth in the undistorted image, for metric measurements
+   Mat backgrUndist;
+   BackProjection backProjection;
+   // plane mode: the table is fitted in every frame instead of captured
+   bool planeMode = false;
+   bool planeFound = false;
+   Plane plane;
+   PlaneFitter planeFitter;
+   Mat undistortMapX, undistortMapY, zUndist, zRemapped, planeHeights;
+   // pyramid mode: objects are found on the diff downsampled 2^pyramidLevels
+   // times and only their regions are processed at full resolution
+   int pyramidLevels = 0;
+   Mat coarse;
+   CoarseDetector coarseDetector;
+   vector<Rect> regions;
+   // cross-check mode: the depth before fillInvalid and the heights before
+   // smoothing, copied for the reference path
+   bool crossChecking = false;
+   Mat checkDepth, checkHeights;
+
+   // segment stage
+   RunLengthMask runs;
+   RunLabeler labeler;
+   Mat checkMask;
+
+   // classify stage
+   MarchingSquares isoContours;
+   vector<Point2f> contour;
+   Shape2f shape;
+   SimplifyWorkspace simplifyWorkspace;
+
+   // output stage; drawing shows the status while nothing is detected
+   Mat drawing;
+   Status drawnStatus = ClickBackground;
+
+   // read by the stages, counted by the output stage
+   CrossCheck crossCheck;
+#ifdef SHAPE_PERF_COUNTERS
+   // ingest, diff and filter (heights), segment, classify and output
+   PerfCounters perf;
+#endif
+
+   void heightsStage(Frame& frame);
+   bool applyCommands();
+   void filterHeights(BitMask& mask);
+   void segmentStage(Frame& frame);
+   void classifyStage(Frame& frame);
+   void outputStage(Frame& frame);
+   void drawStatus(Status s);
+};
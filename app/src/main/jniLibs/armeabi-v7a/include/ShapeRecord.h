@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// One detected shape in the per-frame output. All fields are 32-bit integers
+// in fixed units, so the records of a frame copy straight into a Java int
+// array (or a file or socket) without conversion.
+struct ShapeRecord {
+   int32_t type = 0;          // 2D type, packed by packType
+   int32_t type3D = 0;        // 3D type, packed the same way, 0 if unknown
+   int32_t x = 0, y = 0;      // center [px]
+   int32_t left = 0, top = 0, width = 0, height = 0;   // bounding box [px]
+   int32_t cx = 0, cy = 0, cz = 0;   // 3D centroid [mm]
+   int32_t sizeMajor = 0;     // metric width [mm]
+   int32_t sizeMinor = 0;     // metric height [mm]
+   int32_t footprint = 0;     // [mm^2], 100 per cm^2
+   int32_t volume = 0;        // [mm^3], 1000 per cm^3
+   int32_t area = 0;          // of the outline [px^2]
+   int32_t vertices = 0;      // corners of the approximated polygon
+};
+
+static const int shapeRecordInts = sizeof(ShapeRecord) / sizeof(int32_t);
+
+// Up to four characters of a type name, first character in the low byte
+inline int32_t packType(const string& name){
+   uint32_t v = 0;
+   for(size_t i = 0; i < name.size() && i < 4; i++){
+      v |= (uint32_t)(unsigned char)name[i] << (8 * i);
+   }
+   return (int32_t)v;
+}
+
+inline string unpackType(int32_t packed){
+   string name;
+   for(int i = 0; i < 4; i++){
+      char c = (char)(((uint32_t)packed >> (8 * i)) & 0xff);
+      if(c == 0) break;
+      name += c;
+   }
+   return name;
+}
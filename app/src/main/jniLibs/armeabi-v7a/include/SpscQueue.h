@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Bounded lock-free queue between one producer and one consumer thread. The
+// producer only writes tail and the consumer only writes head, each padded
+// to its own cache line, so neither side ever waits on the other.
+template<typename T>
+class SpscQueue {
+public:
+   // capacity is rounded up to a power of two
+   explicit SpscQueue(size_t capacity = 16){
+      size_t n = 1;
+      while(n < capacity) n <<= 1;
+      slots.resize(n);
+      mask = n - 1;
+      head.value.store(0, memory_order_relaxed);
+      tail.value.store(0, memory_order_relaxed);
+   }
+
+   // Producer only; false when full
+   bool push(const T& v){
+      size_t t = tail.value.load(memory_order_relaxed);
+      if(t - head.value.load(memory_order_acquire) > mask) return false;
+      slots[t & mask] = v;
+      tail.value.store(t + 1, memory_order_release);
+      return true;
+   }
+
+   // Consumer only; false when empty
+   bool pop(T& v){
+      size_t h = head.value.load(memory_order_relaxed);
+      if(h == tail.value.load(memory_order_acquire)) return false;
+      v = slots[h & mask];
+      head.value.store(h + 1, memory_order_release);
+      return true;
+   }
+
+   // Either side, may be stale by the time it returns
+   size_t size() const{
+      return tail.value.load(memory_order_acquire) - head.value.load(memory_order_acquire);
+   }
+   size_t capacity() const { return mask + 1; }
+
+private:
+   struct Index {
+      atomic<size_t> value;
+      char padding[64 - sizeof(atomic<size_t>)];
+   };
+
+   vector<T> slots;
+   size_t mask;
+   Index head;   // next slot to pop
+   Index tail;   // next slot to push
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SpscQueue.h"
+
+using namespace std;
+
+// Runs a fixed chain of stages over a pool of frame slots. The producer
+// (the camera callback) fills a free slot and submits it; every stage then
+// has its own worker thread, connected to the next by a bounded lock-free
+// queue of slot indices, and the last one returns the slot to the free
+// queue. With N stages, up to N frames are processed at once, one per stage,
+// so throughput follows the slowest stage instead of the sum of all of them,
+// and a frame waits at most slots - 1 frames in the queues.
+class StageExecutor {
+public:
+   typedef function<void(int slot)> Stage;
+
+   struct StageStats {
+      string name;
+      uint64_t frames = 0;
+      double busyMs = 0;       // total time spent running frames
+      double occupancy = 0;    // busy share of the time since the stats reset
+      size_t queued = 0;       // frames waiting for the stage
+   };
+
+   ~StageExecutor() { stop(); }
+
+   // Stages run in the order they are added; add them before start
+   void addStage(const string& name, const Stage& run);
+   // Runs first on every worker thread, before its first frame; set before
+   // start, e.g. to pin the workers
+   void setWorkerInit(const function<void()>& init) { workerInit = init; }
+   // threaded: one worker per stage; otherwise submit runs every stage inline
+   // on the producer's thread, one frame at a time
+   void start(int slots, bool threaded = true);
+   // Joins the workers; frames still in flight are discarded
+   void stop();
+   bool isRunning() const { return running.load(); }
+   bool isThreaded() const { return threaded; }
+
+   // Producer side, from one thread: a free slot, or -1 when every slot is
+   // in flight and the frame has to be dropped
+   int acquire();
+   void submit(int slot);
+
+   void getStats(vector<StageStats>& stats) const;
+   // Frames that found no free slot, and the mean submit to release latency
+   uint64_t getDropped() const { return dropped.load(); }
+   double getMeanLatencyMs() const;
+   // One line per stage, the busiest one marked
+   string report() const;
+   void resetStats();
+
+private:
+   struct Worker {
+      string name;
+      Stage run;
+      SpscQueue<int> in;
+      thread worker;
+      atomic<uint64_t> frames;
+      atomic<uint64_t> busyNs;
+      Worker(const string& name, const Stage& run, size_t capacity)
+         : name(name), run(run), in(capacity), frames(0), busyNs(0) {}
+   };
+
+   vector<unique_ptr<Worker> > stages;
+   function<void()> workerInit;
+   unique_ptr<SpscQueue<int> > freeSlots;
+   vector<int64_t> submitTime;   // per slot [ns]
+   atomic<bool> running { false };
+   bool threaded = true;
+   atomic<uint64_t> dropped { 0 };
+   atomic<uint64_t> released { 0 };
+   atomic<uint64_t> latencyNs { 0 };
+   atomic<int64_t> statsStart { 0 };
+
+   void runStage(size_t i, int slot);
+   void workerLoop(size_t i);
+   void release(int slot);
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "Measure3D.h"
+
+using namespace std;
+using namespace cv;
+
+// Plane n . p + d = 0 in camera coordinates, |n| = 1, oriented so the camera
+// side is positive: the value at a point is its height above the plane.
+struct Plane {
+   float nx = 0, ny = 0, nz = -1, d = 0;
+
+   float distance(float x, float y, float z) const { return nx * x + ny * y + nz * z + d; }
+};
+
+// Finds the dominant support plane in an undistorted depth image (CV_32FC1,
+// meters, 0 where invalid) as a replacement for the captured background.
+// Points are subsampled on a grid; the grid phase moves every update, so
+// successive updates see different pixels.
+class PlaneFitter {
+public:
+   // points closer than this count as inliers [m]
+   float tolerance = 0.01f;
+   // every step-th pixel in both directions is sampled
+   int step = 4;
+
+   // Full RANSAC on the subsample with early termination, then a least
+   // squares refit on the inliers. False if no plane holds enough points.
+   bool fit(const Mat& depth, const BackProjection& rays, Plane& plane);
+   // Least squares refit on the points near the current plane, blended into
+   // it to follow slow drift. False when the plane lost its support (camera
+   // bumped), in which case fit() should run again.
+   bool update(const Mat& depth, const BackProjection& rays, Plane& plane);
+
+   // Height above the plane of every pixel, 0 where depth is invalid
+   static void heightAbove(const Mat& depth, const BackProjection& rays, const Plane& plane, Mat& height);
+   // Depth of the plane along every pixel's ray
+   static void planeDepth(const BackProjection& rays, const Plane& plane, Mat& depth);
+
+private:
+   // subsampled points, one array per coordinate for the vector scoring
+   vector<float> xs, ys, zs;
+   int phase = 0;
+   RNG rng;
+
+   void sample(const Mat& depth, const BackProjection& rays);
+   int countInliers(const Plane& plane, int best) const;
+   bool refine(Plane& plane) const;
+};
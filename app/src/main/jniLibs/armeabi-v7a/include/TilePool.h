@@ -0,0 +1,135 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AllocTracker.h"
+
+using namespace std;
+using namespace cv;
+
+// Persistent worker threads for data-parallel per-pixel kernels. A job of n
+// tasks is split into one contiguous block per thread, the caller included;
+// each thread runs its own block front to back, so neighbouring tiles stay on
+// one core, and steals from the others' blocks once its own is empty. The
+// workers sleep between jobs and are never created per frame. Several
+// threads, e.g. the stages of the StageExecutor, may run jobs at once.
+// Tasks and tile bodies are any callables, taken by reference for the
+// duration of the call, so a kernel call allocates nothing.
+class TilePool {
+public:
+   // Total threads including the caller, 0 for one per core. The workers
+   // keep to cpus when given.
+   explicit TilePool(int numThreads = 0, const vector<int>& cpus = vector<int>());
+   ~TilePool();
+
+   // The pool the per-frame kernels share. OpenCV's own threads are turned
+   // off when it starts, so OpenCV calls inside a tile stay on their thread
+   // instead of competing with the pool for the cores. A thread bound to a
+   // pool of its own gets that one instead.
+   static TilePool& shared();
+   // Binds the calling thread to pool, NULL for the shared one again; for
+   // pipelines that keep their kernels on their own cores. Returns the pool
+   // it was bound to.
+   static TilePool* bindThread(TilePool* pool);
+   // Threads of the shared pool, 0 for one per core; only before its first
+   // use. 1 runs every kernel on its caller, for callers that are already
+   // one per core themselves. Builds with SHAPE_PERF_COUNTERS always use 1.
+   static void setSharedThreads(int numThreads);
+
+   int getNumThreads() const { return (int)workers.size() + 1; }
+
+   // Runs task(0..n-1) and returns when all are done; the caller works too.
+   // Runs inline when there is a single thread or every job slot is taken.
+   template<class Task> void run(int n, const Task& task){
+      run(n, &callTask<Task>, (void*)&task);
+   }
+   // body(tile) over the tiles of size, in raster order
+   template<class Body> void forTiles(Size size, Size tile, const Body& body){
+      TileGrid grid(size, tile);
+      run(grid.count, [&grid, &body](int i) { body(grid.tile(i)); });
+   }
+
+   // Tile for kernels touching bytesPerPixel bytes per pixel, over all their
+   // planes: whole rows, as many as fit half the L1 data cache, at least
+   // minTileRows. Rows too wide for that are cut into widths of multiples of
+   // 64 pixels, so two tiles never share a BitMask word.
+   static Size tileSize(Size size, int bytesPerPixel);
+
+private:
+   typedef void (*Call)(void* context, int task);
+
+   template<class Task> static void callTask(void* context, int task){
+      (*(const Task*)context)(task);
+   }
+
+   // The tiles of a size, numbered in raster order
+   struct TileGrid {
+      TileGrid(Size size, Size tile);
+      Rect tile(int i) const;
+      Size size, step;
+      int nx = 0, count = 0;
+   };
+
+   // One thread's block of a job; next may run past end
+   struct Block {
+      atomic<int> next;
+      int end;
+      char padding[64 - sizeof(atomic<int>) - sizeof(int)];
+   };
+
+   struct Job {
+      Call call = NULL;
+      void* context = NULL;
+      int n = 0;
+      bool busy = false;    // slot taken by a caller
+      bool open = false;    // tasks may be left to claim
+      int users = 0;        // workers inside
+      atomic<int> done { 0 };
+      unique_ptr<Block[]> blocks;
+#ifdef SHAPE_ALLOC_TRACKING
+      // the caller's strict zone, and what the workers allocated for it
+      const char* allocZone = NULL;
+      atomic<uint64_t> allocations { 0 };
+      atomic<uint64_t> allocBytes { 0 };
+#endif
+   };
+
+   static const int maxJobs = 4;
+   static const int l1Bytes = 32 * 1024;
+   static const int minTileRows = 4;
+
+   vector<thread> workers;
+   Job jobs[maxJobs];
+   mutex lock;
+   condition_variable wake;      // a job was posted, or stop
+   condition_variable finished;  // a worker left a job
+   bool stopping = false;
+   vector<int> cpus;
+
+   void run(int n, Call call, void* context);
+   void workerLoop(int index);
+   // Claims and runs tasks of job, its own block first, until none is left
+   void work(Job& job, int index);
+};
+
+// Binds the calling thread to pool for the enclosing scope, for threads the
+// pipeline does not own, like the camera's
+class TilePoolBinding {
+public:
+   explicit TilePoolBinding(TilePool* pool) : outer(TilePool::bindThread(pool)) {}
+   ~TilePoolBinding() { TilePool::bindThread(outer); }
+
+private:
+   TilePool* outer;
+};
+
+// body(tile) over size on the shared pool, with tiles of
+// TilePool::tileSize(size, bytesPerPixel)
+template<class Body> void parallel_for_tiles(Size size, int bytesPerPixel, const Body& body){
+   TilePool::shared().forTiles(size, TilePool::tileSize(size, bytesPerPixel), body);
+}
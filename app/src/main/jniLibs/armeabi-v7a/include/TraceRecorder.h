@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Timeline of the frame pipeline: scoped zones on every thread, written as a
+// Chrome JSON trace that chrome://tracing and ui.perfetto.dev open. Each
+// thread records into its own ring of the latest events, with no lock and no
+// allocation once the ring exists; the oldest events are overwritten. Off by
+// default, and a zone then costs one relaxed load, so the zones stay in
+// release builds behind setEnabled.
+class TraceRecorder {
+public:
+   // events each thread keeps
+   static const int ringEvents = 8192;
+
+   static TraceRecorder& shared();
+
+   void setEnabled(bool on) { enabled.store(on, memory_order_relaxed); }
+   bool isEnabled() const { return enabled.load(memory_order_relaxed); }
+
+   // Steady clock [ns], the one of Java's System.nanoTime on Android
+   static int64_t now();
+   // name: a string that outlives the recorder, a literal or from intern.
+   // frame: the frame the zone worked on, -1 for none
+   void record(const char* name, int64_t beginNs, int64_t endNs, int64_t frame = -1);
+   // A stable copy of a name that is not a literal, e.g. from Java
+   const char* intern(const string& name);
+   // Shown for the calling thread instead of its system name; no ring is
+   // created for it before the thread records
+   void nameThread(const string& name);
+
+   // Drops the events recorded so far and the rings of finished threads
+   void clear();
+   // The events of every ring, oldest first per thread
+   bool writeJson(const string& path);
+
+private:
+   struct Event {
+      atomic<const char*> name;
+      atomic<int64_t> begin, end;
+      atomic<int64_t> frame;
+   };
+
+   // Written by its thread only; read by writeJson while it is written,
+   // which drops the events overwritten during the read
+   struct Ring {
+      vector<Event> events;
+      atomic<uint64_t> head { 0 };      // events ever recorded
+      atomic<uint64_t> cleared { 0 };   // head at the last clear
+      atomic<bool> alive { true };
+      long tid = 0;
+      string name;                      // under the recorder's lock
+      Ring() : events(ringEvents) {}
+   };
+
+   atomic<bool> enabled { false };
+   mutex lock;
+   vector<shared_ptr<Ring> > rings;
+   set<string> names;
+
+   TraceRecorder() {}
+   Ring& threadRing();
+};
+
+// Records the enclosing scope when the recorder is enabled at its start
+class TraceZone {
+public:
+   explicit TraceZone(const char* name, int64_t frame = -1)
+      : name(TraceRecorder::shared().isEnabled() ? name : NULL), frame(frame){
+      if(this->name) begin = TraceRecorder::now();
+   }
+   ~TraceZone(){
+      if(name) TraceRecorder::shared().record(name, begin, TraceRecorder::now(), frame);
+   }
+
+private:
+   const char* name;
+   int64_t frame;
+   int64_t begin = 0;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name, frame) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name, frame)
@@ -0,0 +1,97 @@
+// Polygon approximation cost: cv::approxPolyDP against the workspace based
+// Douglas-Peucker and Visvalingam-Whyatt simplifiers. Contour lengths follow
+// a log-uniform spread over what a table-top scene produces at the sensor
+// resolution, from small specks to objects filling most of the view.
+//
+//    bench_approx [contours] [iterations]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "PolySimplify.h"
+
+using namespace std;
+using namespace cv;
+
+// Noisy outline of a circle or a regular polygon with about n points
+static vector<Point2f> makeContour(RNG& rng, int n){
+   int corners = rng.uniform(0, 2) ? rng.uniform(3, 7) : 0;
+   float radius = n / (float)(2 * CV_PI);
+   Point2f c(radius + 10, radius + 10);
+   vector<Point2f> pts(n);
+   for(int i = 0; i < n; i++){
+      double t = 2 * CV_PI * i / n;
+      double r = radius;
+      if(corners){
+         // distance to the edge of a regular polygon in direction t
+         double sector = 2 * CV_PI / corners;
+         double u = fmod(t, sector) - sector / 2;
+         r = radius * cos(sector / 2) / cos(u);
+      }
+      r += rng.gaussian(0.3);
+      pts[i] = c + Point2f((float)(r * cos(t)), (float)(r * sin(t)));
+   }
+   return pts;
+}
+
+static double perimeterOf(const vector<Point2f>& pts){
+   return arcLength(pts, true);
+}
+
+int main(int argc, char** argv){
+   int count = argc > 1 ? atoi(argv[1]) : 2000;
+   int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+   RNG rng(23);
+   vector<vector<Point2f> > contours(count);
+   vector<double> epsilons(count);
+   size_t points = 0;
+   for(int i = 0; i < count; i++){
+      int n = (int)exp(rng.uniform(log(20.0), log(600.0)));
+      contours[i] = makeContour(rng, n);
+      epsilons[i] = 0.02 * perimeterOf(contours[i]);
+      points += n;
+   }
+
+   printf("%d contours, %.1f points on average\n", count, (double)points / count);
+   printf("%-22s %12s %10s\n", "method", "ns/contour", "vertices");
+
+   size_t vertices = 0;
+   vector<Point2f> approx;
+   auto start = chrono::steady_clock::now();
+   for(int it = 0; it < iterations; it++){
+      vertices = 0;
+      for(int i = 0; i < count; i++){
+         approxPolyDP(contours[i], approx, epsilons[i], true);
+         vertices += approx.size();
+      }
+   }
+   double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+   printf("%-22s %12.1f %10.2f\n", "cv::approxPolyDP", ns / iterations / count, (double)vertices / count);
+
+   SimplifyWorkspace ws;
+   start = chrono::steady_clock::now();
+   for(int it = 0; it < iterations; it++){
+      vertices = 0;
+      for(int i = 0; i < count; i++){
+         simplifyDouglasPeucker(contours[i], epsilons[i], true, ws, ws.indices);
+         vertices += ws.indices.size();
+      }
+   }
+   ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+   printf("%-22s %12.1f %10.2f\n", "simplifyDouglasPeucker", ns / iterations / count, (double)vertices / count);
+
+   // area threshold giving about the same vertex count as the epsilon above
+   start = chrono::steady_clock::now();
+   for(int it = 0; it < iterations; it++){
+      vertices = 0;
+      for(int i = 0; i < count; i++){
+         simplifyVisvalingam(contours[i], epsilons[i] * epsilons[i], true, ws, ws.indices);
+         vertices += ws.indices.size();
+      }
+   }
+   ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+   printf("%-22s %12.1f %10.2f\n", "simplifyVisvalingam", ns / iterations / count, (double)vertices / count);
+   return 0;
+}
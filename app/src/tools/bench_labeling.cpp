@@ -0,0 +1,63 @@
+// Scaling benchmark of ParallelLabeler from 1 to N threads at the sensor
+// resolution and at synthetic 1MP and 4MP masks.
+//
+//    bench_labeling [maxThreads] [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "ConnectedComponents.h"
+
+using namespace std;
+using namespace cv;
+
+// Table-top like mask: a few large blobs plus speckle noise
+static Mat makeMask(Size size, unsigned seed){
+   RNG rng(seed);
+   Mat mask = Mat::zeros(size, CV_8UC1);
+   int blobs = 8;
+   int maxRadius = min(size.width, size.height) / 8;
+   for(int i = 0; i < blobs; i++){
+      Point c(rng.uniform(0, size.width), rng.uniform(0, size.height));
+      circle(mask, c, rng.uniform(maxRadius / 4, maxRadius), Scalar(255), -1);
+   }
+   int speckles = size.area() / 500;
+   for(int i = 0; i < speckles; i++){
+      mask.at<uchar>(rng.uniform(0, size.height), rng.uniform(0, size.width)) = 255;
+   }
+   return mask;
+}
+
+int main(int argc, char** argv){
+   int maxThreads = argc > 1 ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+   int iterations = argc > 2 ? atoi(argv[2]) : 50;
+   maxThreads = max(1, maxThreads);
+
+   struct Case { const char* name; Size size; };
+   Case cases[] = {
+      { "sensor 224x171", Size(224, 171) },
+      { "1MP 1024x1024", Size(1024, 1024) },
+      { "4MP 2048x2048", Size(2048, 2048) },
+   };
+
+   printf("%-16s %7s %10s %8s %7s\n", "resolution", "threads", "ms/frame", "speedup", "blobs");
+   for(const Case& c : cases){
+      Mat mask = makeMask(c.size, 17);
+      double base = 0;
+      for(int t = 1; t <= maxThreads; t++){
+         ParallelLabeler labeler(t);
+         vector<Blob> blobs;
+         labeler.label(mask, blobs);   // warm up, sizes the label plane
+
+         auto start = chrono::steady_clock::now();
+         for(int i = 0; i < iterations; i++){
+            labeler.label(mask, blobs);
+         }
+         double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+         if(t == 1) base = ms;
+         printf("%-16s %7d %10.3f %8.2f %7zu\n", c.name, t, ms, base / ms, blobs.size());
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,66 @@
+// Throughput and latency of StageExecutor, serial against pipelined, for
+// chains of 1 to N stages that each busy-wait a fixed time per frame.
+//
+//    bench_pipeline [maxStages] [stage ms] [frames]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "StageExecutor.h"
+
+using namespace std;
+
+static void busyWait(double ms){
+   auto end = chrono::steady_clock::now() + chrono::microseconds((long long)(ms * 1000));
+   while(chrono::steady_clock::now() < end){}
+}
+
+// Frames per second when the producer submits as fast as slots free up
+static double run(StageExecutor& executor, int frames){
+   auto start = chrono::steady_clock::now();
+   for(int submitted = 0; submitted < frames;){
+      int slot = executor.acquire();
+      if(slot < 0){
+         this_thread::yield();
+         continue;
+      }
+      executor.submit(slot);
+      submitted++;
+   }
+   // wait for the last frames to come back
+   while(true){
+      vector<StageExecutor::StageStats> stats;
+      executor.getStats(stats);
+      if(stats.back().frames >= (uint64_t)frames) break;
+      this_thread::yield();
+   }
+   double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+   return frames / s;
+}
+
+int main(int argc, char** argv){
+   int maxStages = argc > 1 ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+   double stageMs = argc > 2 ? atof(argv[2]) : 2;
+   int frames = argc > 3 ? atoi(argv[3]) : 200;
+   maxStages = max(1, maxStages);
+
+   printf("%6s %12s %12s %8s %12s\n", "stages", "serial fps", "piped fps", "speedup", "latency ms");
+   string report;
+   for(int n = 1; n <= maxStages; n++){
+      StageExecutor executor;
+      for(int i = 0; i < n; i++){
+         executor.addStage("stage" + to_string(i), [stageMs](int) { busyWait(stageMs); });
+      }
+      executor.start(n + 1, false);
+      double serial = run(executor, frames);
+      executor.start(n + 1, true);
+      double piped = run(executor, frames);
+      double latency = executor.getMeanLatencyMs();
+      report = executor.report();
+      executor.stop();
+      printf("%6d %12.1f %12.1f %8.2f %12.2f\n", n, serial, piped, piped / serial, latency);
+   }
+   printf("\n%s", report.c_str());
+   return 0;
+}
@@ -0,0 +1,160 @@
+// Accuracy and speed of the int16 millimeter pipeline against the float
+// meter one on synthetic table scenes: noisy background capture, then frames
+// with a box, a cylinder and a dome on the table.
+//
+//    compare_fixed_point [frames] [noise mm]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "DepthPipeline.h"
+#include "Measure3D.h"
+#include "RunLengthMask.h"
+
+using namespace std;
+using namespace cv;
+
+static const Size sensor(224, 171);
+static const float detectionThreshold = 0.005f;
+
+// Depth of a slightly tilted table with three objects on it, noise added and
+// a few pixels dropped as invalid (0)
+static void makeFrame(bool objects, float noise, RNG& rng, Mat& z){
+   z.create(sensor, CV_32FC1);
+   for(int v = 0; v < sensor.height; v++){
+      float* row = z.ptr<float>(v);
+      for(int u = 0; u < sensor.width; u++){
+         float h = 0;
+         if(objects){
+            if(u >= 40 && u < 90 && v >= 50 && v < 100) h = 0.04f;
+            float dc = (float)hypot(u - 140.0, v - 60.0);
+            if(dc < 20) h = 0.07f;
+            float ds = (float)hypot(u - 150.0, v - 125.0);
+            if(ds < 25) h = max(h, 0.03f * (float)sqrt(1 - ds * ds / 625));
+         }
+         row[u] = 0.8f + 0.0004f * v - h + (float)rng.gaussian(noise);
+         if(rng.uniform(0, 200) == 0) row[u] = 0;
+      }
+   }
+}
+
+template<typename T>
+static void feed(DepthPipeline<T>& p, const Mat& z, bool background){
+   typedef DepthPipeline<T> P;
+   if(background) p.clearDepth();
+   else p.fillWithBackground();
+   for(int y = 0; y < z.rows; y++){
+      const float* s = z.ptr<float>(y);
+      typename P::Depth* d = p.depthRow(y);
+      for(int x = 0; x < z.cols; x++){
+         if(s[x] > 0) d[x] = P::Pixel::depthFromMeters(s[x]);
+      }
+   }
+}
+
+// The stages the listener runs on every detected frame, timed
+template<typename T>
+static double process(DepthPipeline<T>& p, BitMask& mask){
+   auto start = chrono::steady_clock::now();
+   p.difference();
+   p.boxFilter();
+   p.threshold(detectionThreshold, mask);
+   mask.open(mask, 1);
+   return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+struct Objects {
+   RunLengthMask runs;
+   RunLabeler labeler;
+   vector<Blob> blobs;
+   vector<DepthProfile> profiles;
+   vector<ShapeMetrics> metrics;
+
+   void find(const BitMask& mask, const Mat& diff, BackProjection& rays, const Mat& table){
+      runs.encode(mask);
+      labeler.label(runs, blobs, diff, profiles);
+      rays.measure(runs, labeler.getRunLabels(), (int)blobs.size(), diff, table, metrics);
+   }
+};
+
+int main(int argc, char** argv){
+   int frames = argc > 1 ? atoi(argv[1]) : 100;
+   float noise = (argc > 2 ? (float)atof(argv[2]) : 2) * 0.001f;
+
+   DepthPipelineF pf;
+   DepthPipelineMM pi;
+   pf.create(sensor);
+   pi.create(sensor);
+   RNG rng(7);
+   Mat z;
+   for(int i = 0; i < 20; i++){
+      makeFrame(false, noise, rng, z);
+      feed(pf, z, true);
+      feed(pi, z, true);
+      pf.addBackground();
+      pi.addBackground();
+   }
+   pf.endBackground();
+   pi.endBackground();
+
+   Mat cameraMatrix = (Mat1d(3, 3) << 210, 0, 112, 0, 210, 85, 0, 0, 1);
+   BackProjection rays;
+   rays.create(cameraMatrix, sensor);
+
+   BitMask maskF, maskI;
+   Objects objF, objI;
+   double msF = 0, msI = 0;
+   double sumErr = 0, maxErr = 0;
+   size_t pixels = 0, maskDiff = 0, maskCount = 0;
+   int countMismatch = 0, blobsCompared = 0;
+   double maxHeightErr = 0, maxVolumeErr = 0, maxFootprintErr = 0;
+   for(int f = 0; f < frames; f++){
+      makeFrame(true, noise, rng, z);
+      feed(pf, z, false);
+      feed(pi, z, false);
+      msF += process(pf, maskF);
+      msI += process(pi, maskI);
+
+      for(int y = 0; y < sensor.height; y++){
+         const float* a = pf.diff.ptr<float>(y);
+         const int16_t* b = pi.diff.ptr<int16_t>(y);
+         for(int x = 0; x < sensor.width; x++){
+            double e = fabs(b[x] - a[x] * 1000.0);
+            sumErr += e;
+            maxErr = max(maxErr, e);
+            maskDiff += maskF.get(y, x) != maskI.get(y, x);
+         }
+      }
+      pixels += sensor.area();
+      maskCount += maskF.count();
+
+      objF.find(maskF, pf.diff, rays, pf.background);
+      objI.find(maskI, pi.diff, rays, pf.background);
+      if(objF.blobs.size() != objI.blobs.size()){
+         countMismatch++;
+         continue;
+      }
+      for(size_t b = 0; b < objF.blobs.size(); b++){
+         const ShapeMetrics& mf = objF.metrics[b];
+         const ShapeMetrics& mi = objI.metrics[b];
+         if(mf.volume < 1) continue;
+         maxHeightErr = max(maxHeightErr, (double)fabs(objF.profiles[b].getMeanHeight() -
+                                                       objI.profiles[b].getMeanHeight()) * 1000);
+         maxVolumeErr = max(maxVolumeErr, (double)fabs(mi.volume - mf.volume) / mf.volume);
+         maxFootprintErr = max(maxFootprintErr, (double)fabs(mi.footprint - mf.footprint) / mf.footprint);
+         blobsCompared++;
+      }
+   }
+
+   printf("frames %d, noise %.1f mm\n", frames, noise * 1000);
+   printf("filtered height   mean |err| %.3f mm, max %.3f mm\n", sumErr / pixels, maxErr);
+   printf("mask              %zu of %zu foreground pixels differ (%.3f%%)\n", maskDiff, maskCount,
+          maskCount ? 100.0 * maskDiff / maskCount : 0.0);
+   printf("blob counts       differ in %d frames\n", countMismatch);
+   printf("blobs (%d)        max mean height err %.3f mm, footprint %.3f%%, volume %.3f%%\n",
+          blobsCompared, maxHeightErr, 100 * maxFootprintErr, 100 * maxVolumeErr);
+   printf("ms/frame          float %.3f, int16 %.3f, speedup %.2f\n", msF / frames, msI / frames,
+          msI > 0 ? msF / msI : 0.0);
+   return 0;
+}
@@ -0,0 +1,92 @@
+// Stand-in for the camera process in front of shape_daemon: replays a
+// recording into the daemon's frame socket or into shared memory, at the
+// recorded pace or at a given rate. Timestamps keep counting up over loops.
+//
+//    depth_producer <file.rec> <--socket path | --shm name> [--rate fps] [--loop]
+
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "DepthExchange.h"
+#include "DepthRecording.h"
+
+using namespace std;
+using namespace cv;
+
+static atomic<bool> stopping { false };
+
+static void stop(int){
+   stopping = true;
+}
+
+static int usage(){
+   printf("usage: depth_producer <file.rec> <--socket path | --shm name> [--rate fps] [--loop]\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   string path, socket, shm;
+   double rate = 0;
+   bool loop = false;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--loop") loop = true;
+      else if(arg == "--socket" && value) socket = argv[++i];
+      else if(arg == "--shm" && value) shm = argv[++i];
+      else if(arg == "--rate" && value) rate = atof(argv[++i]);
+      else if(arg.compare(0, 2, "--") == 0 || !path.empty()) return usage();
+      else path = arg;
+   }
+   if(path.empty() || socket.empty() == shm.empty()) return usage();
+
+   RecordingReader reader;
+   if(!reader.open(path)){
+      printf("cannot read %s\n", path.c_str());
+      return 1;
+   }
+   DepthStreamWriter stream;
+   DepthShmWriter shared;
+   if(!socket.empty() && !stream.connect(socket, reader.getSize(), reader.getCameraMatrix(), reader.getDistortion())){
+      printf("cannot connect to %s\n", socket.c_str());
+      return 1;
+   }
+   if(!shm.empty() && !shared.create(shm, reader.getSize(), reader.getCameraMatrix(), reader.getDistortion())){
+      printf("cannot create the shared memory %s\n", shm.c_str());
+      return 1;
+   }
+
+   // stop between frames, so the shared memory is unlinked on the way out
+   signal(SIGINT, stop);
+   signal(SIGTERM, stop);
+   signal(SIGPIPE, SIG_IGN);
+
+   royale::DepthData data;
+   auto start = chrono::steady_clock::now();
+   int64_t first = -1, offset = 0, last = 0;
+   int frames = 0;
+   do{
+      reader.rewind();
+      while(!stopping && reader.read(data)){
+         if(first < 0) first = data.timeStamp.count();
+         int64_t us = data.timeStamp.count() - first + offset;
+         if(rate > 0) us = (int64_t)(frames * 1e6 / rate);
+         this_thread::sleep_until(start + chrono::microseconds(us));
+         data.timeStamp = chrono::microseconds(first + us);
+         last = us;
+         if(!socket.empty() && !stream.write(data)){
+            printf("%s closed after %d frames\n", socket.c_str(), frames);
+            return 1;
+         }
+         if(!shm.empty()) shared.write(data);
+         frames++;
+      }
+      // the next pass starts a frame period after this one
+      offset = last + (frames > 1 ? last / (frames - 1) : 0);
+   } while(loop && frames > 0 && !stopping);
+   printf("%d frames sent\n", frames);
+   return 0;
+}
@@ -0,0 +1,94 @@
+// Prints a DetectionTable as shape_batch writes it: a line per frame, with
+// or without shapes, and a line per shape under it, then counts of the
+// frames and shapes. Exits with 1 when the table is cut short or damaged.
+//
+//    dump_detections [--summary] <detections.sdt>
+//
+//    --summary   only the counts, per recording and in total
+
+#include <cstdio>
+#include "DetectionTable.h"
+
+using namespace std;
+
+// Frames and shapes of a recording
+struct Counts {
+   uint64_t frames = 0;
+   uint64_t detecting = 0;
+   uint64_t empty = 0;   // detecting without shapes
+   uint64_t shapes = 0;
+};
+
+static void printCounts(const char* what, const Counts& c){
+   printf("%s: %llu frames, %llu detecting, %llu of them without shapes, %llu shapes\n", what,
+          (unsigned long long)c.frames, (unsigned long long)c.detecting, (unsigned long long)c.empty,
+          (unsigned long long)c.shapes);
+}
+
+static int usage(){
+   printf("usage: dump_detections [--summary] <detections.sdt>\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   bool summary = false;
+   string path;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      if(arg == "--summary") summary = true;
+      else if(arg.compare(0, 2, "--") == 0 || !path.empty()) return usage();
+      else path = arg;
+   }
+   if(path.empty()) return usage();
+
+   DetectionTableReader table;
+   if(!table.open(path)){
+      printf("%s is not a detection table\n", path.c_str());
+      return 2;
+   }
+   const vector<string>& recordings = table.getRecordings();
+   if(!summary){
+      for(size_t r = 0; r < recordings.size(); r++) printf("recording %zu: %s\n", r, recordings[r].c_str());
+   }
+
+   vector<Counts> counts(recordings.size());
+   Counts total;
+   vector<DetectionFrame> frames;
+   vector<DetectionRow> rows;
+   while(table.read(frames, rows)){
+      size_t row = 0;
+      for(size_t i = 0; i < frames.size(); i++){
+         const DetectionFrame& f = frames[i];
+         Counts& c = counts[f.recording];
+         c.frames++;
+         c.detecting += f.detecting != 0;
+         c.empty += f.detecting && f.shapes == 0;
+         c.shapes += f.shapes;
+         if(!summary){
+            printf("%d %d %lld us: %s, %d shapes\n", f.recording, f.frame, (long long)f.timestamp,
+                   f.detecting ? "detecting" : "capturing", f.shapes);
+         }
+         for(int k = 0; k < f.shapes; k++, row++){
+            if(summary) continue;
+            const ShapeRecord& s = rows[row].shape;
+            string type3D = unpackType(s.type3D);
+            printf("   %s/%s at (%d,%d) px, %dx%d px box, (%d,%d,%d) mm, %dx%d mm, area %d px, %d vertices\n",
+                   unpackType(s.type).c_str(), type3D.empty() ? "-" : type3D.c_str(), s.x, s.y, s.width, s.height,
+                   s.cx, s.cy, s.cz, s.sizeMajor, s.sizeMinor, s.area, s.vertices);
+         }
+      }
+   }
+   for(size_t r = 0; r < counts.size(); r++){
+      total.frames += counts[r].frames;
+      total.detecting += counts[r].detecting;
+      total.empty += counts[r].empty;
+      total.shapes += counts[r].shapes;
+      if(summary) printCounts(recordings[r].c_str(), counts[r]);
+   }
+   printCounts("total", total);
+   if(table.isDamaged()){
+      printf("%s is damaged after the frames above\n", path.c_str());
+      return 1;
+   }
+   return 0;
+}
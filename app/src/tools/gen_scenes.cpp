@@ -0,0 +1,89 @@
+// Synthetic table-top recordings with ground truth, and the render speed.
+// Every recording is one session on one table: background frames of the
+// empty table first, then random objects that change every few frames.
+// Frames render in parallel, one per thread, and are written in order.
+//
+//    gen_scenes <out.rec | -> [frames] [threads] [seed] [noise mm]
+//
+// With - nothing is written and only the render speed is reported.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "DepthRecording.h"
+#include "SceneGenerator.h"
+#include "TilePool.h"
+
+using namespace std;
+using namespace cv;
+
+// frames of the empty table, as many as the listener captures
+static const int backgroundFrames = 20;
+// frames the same objects stay on the table
+static const int holdFrames = 10;
+// frames rendered per parallel batch
+static const int batch = 64;
+
+int main(int argc, char** argv){
+   if(argc < 2){
+      printf("usage: gen_scenes <out.rec | -> [frames] [threads] [seed] [noise mm]\n");
+      return 1;
+   }
+   string path = argv[1];
+   int frames = argc > 2 ? atoi(argv[2]) : 1000;
+   int threads = argc > 3 ? atoi(argv[3]) : 0;
+   uint64_t seed = argc > 4 ? strtoull(argv[4], NULL, 10) : 1;
+   SceneParams params;
+   if(argc > 5) params.noise = (float)atof(argv[5]) * 0.001f;
+
+   SceneGenerator generator(params);
+   TilePool pool(threads);
+   RecordingWriter writer;
+   bool writing = path != "-";
+   if(writing && !writer.open(path, params.size, generator.getCameraMatrix(), generator.getDistortion(), true)){
+      printf("cannot write %s\n", path.c_str());
+      return 1;
+   }
+
+   RNG rng(seed);
+   Scene table;
+   generator.randomScene(rng, table);
+   table.objects.clear();
+   vector<Scene> scenes(batch);
+   vector<royale::DepthData> data(batch);
+   vector<Mat> labels(batch);
+   Scene current = table;
+   double renderS = 0;
+   int objects = 0;
+   for(int first = 0; first < frames; first += batch){
+      int n = min(batch, frames - first);
+      for(int i = 0; i < n; i++){
+         int f = first + i;
+         if(f >= backgroundFrames && (f - backgroundFrames) % holdFrames == 0){
+            generator.randomObjects(rng, current);
+            objects += (int)current.objects.size();
+         }
+         scenes[i] = f < backgroundFrames ? table : current;
+         // 45 fps, like the camera's fastest use case
+         data[i].timeStamp = chrono::microseconds((int64_t)f * 1000000 / 45);
+      }
+      auto start = chrono::steady_clock::now();
+      pool.run(n, [&](int i){
+         generator.render(scenes[i], seed * 1000003 + first + i, data[i], &labels[i]);
+      });
+      renderS += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      for(int i = 0; i < n && writing; i++){
+         if(!writer.write(data[i], &labels[i], &scenes[i].objects)){
+            printf("write failed at frame %d\n", first + i);
+            return 1;
+         }
+      }
+   }
+   writer.close();
+
+   printf("%d frames %dx%d, %d objects, %d threads: %.1f frames/s rendered\n", frames, params.size.width,
+          params.size.height, objects, pool.getNumThreads(), frames / max(renderS, 1e-9));
+   if(writing) printf("wrote %s\n", path.c_str());
+   return 0;
+}
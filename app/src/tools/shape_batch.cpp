@@ -0,0 +1,268 @@
+// Offline detection over many recordings at full speed, for re-analyzing
+// recorded sessions after a change to the detection: timestamps are
+// ignored and the recordings are cut into chunks of frames that workers,
+// one per core, each with a ShapePipeline of its own running every stage
+// inline, take in turn. Every frame and its shapes are written to a
+// DetectionTable, in recording and frame order whatever the order the
+// chunks finish in; dump_detections prints it.
+//
+//    shape_batch [options] <recording.rec> ...
+//
+//    --out file        detection table (detections.sdt)
+//    --jobs n          workers (one per core)
+//    --chunk frames    frames per chunk (1000), 0 for whole recordings
+//    --plane           table plane mode instead of the background capture
+//    --pyramid n       pyramid levels (0)
+//    --templates file  shape templates
+//
+// Every recording starts with frames of the empty table. A chunk further in
+// first runs those frames for its own background capture and then steps to
+// its first frame, so it finds the same shapes as a pass over the whole
+// recording. In plane mode it runs as many frames before its first instead:
+// the plane blends in every frame, so it then only comes close to the
+// plane of a whole pass, and measurements may differ in the last digits.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include "DepthRecording.h"
+#include "DetectionTable.h"
+#include "ShapePipeline.h"
+#include "TilePool.h"
+
+using namespace std;
+using namespace cv;
+
+struct Options {
+   string out = "detections.sdt";
+   int jobs = 0;
+   int chunk = 1000;
+   bool plane = false;
+   int pyramid = 0;
+   string templates;
+};
+
+// Frames [first, first + count) of a recording
+struct Chunk {
+   int recording = 0;
+   int first = 0, count = 0;
+};
+
+// A chunk's frames and shapes, handed from its worker to the writer
+struct ChunkResult {
+   bool done = false;
+   bool failed = false;
+   vector<DetectionFrame> frames;
+   vector<DetectionRow> rows;
+};
+
+class Batch {
+public:
+   Batch(const Options& options, const vector<string>& recordings)
+      : options(options), recordings(recordings){
+   }
+
+   // Cuts every recording into chunks; false when one cannot be read
+   bool plan(){
+      int chunkFrames = options.chunk;
+      // a chunk must start past the background frames it runs again
+      if(chunkFrames > 0) chunkFrames = max(chunkFrames, ShapePipeline::backgroundFrames);
+      for(size_t r = 0; r < recordings.size(); r++){
+         RecordingReader reader;
+         if(!reader.open(recordings[r])){
+            printf("cannot read %s\n", recordings[r].c_str());
+            return false;
+         }
+         int frames = reader.countFrames();
+         int step = chunkFrames > 0 ? chunkFrames : max(frames, 1);
+         for(int first = 0; first < frames; first += step){
+            Chunk chunk;
+            chunk.recording = (int)r;
+            chunk.first = first;
+            chunk.count = min(step, frames - first);
+            chunks.push_back(chunk);
+         }
+         totalFrames += frames;
+      }
+      results.resize(chunks.size());
+      return true;
+   }
+
+   // Runs the workers and writes the table as the chunks come in; false
+   // when a chunk or the table failed
+   bool run(DetectionTableWriter& table){
+      int jobs = options.jobs > 0 ? options.jobs : max(1, (int)thread::hardware_concurrency());
+      jobs = max(1, min(jobs, (int)chunks.size()));
+      // the workers are one per core already; tiles on a shared pool would
+      // only make them wait for each other
+      TilePool::setSharedThreads(1);
+      busy.assign(jobs, 0);
+      vector<thread> workers;
+      for(int i = 0; i < jobs; i++) workers.push_back(thread(&Batch::workerLoop, this, i));
+
+      bool ok = true;
+      for(size_t c = 0; c < chunks.size(); c++){
+         vector<DetectionFrame> frames;
+         vector<DetectionRow> rows;
+         {
+            unique_lock<mutex> guard(lock);
+            chunkDone.wait(guard, [&]{ return results[c].done; });
+            frames.swap(results[c].frames);
+            rows.swap(results[c].rows);
+            if(results[c].failed) ok = false;
+         }
+         if(!table.write(frames, rows)) ok = false;
+      }
+      for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+      return ok;
+   }
+
+   int getChunks() const { return (int)chunks.size(); }
+   long getFrames() const { return totalFrames; }
+   // Seconds each worker spent on its chunks
+   const vector<double>& getBusy() const { return busy; }
+
+private:
+   Options options;
+   vector<string> recordings;
+   vector<Chunk> chunks;
+   long totalFrames = 0;
+   atomic<size_t> next { 0 };
+   mutex lock;
+   condition_variable chunkDone;
+   vector<ChunkResult> results;
+   vector<double> busy;
+
+   void workerLoop(int worker){
+      ShapePipeline pipeline;
+      vector<DetectionFrame> frames;
+      vector<DetectionRow> rows;
+      // frames run ahead of the chunk, whose output is not the chunk's
+      uint64_t lead = 0;
+      Chunk chunk;
+      pipeline.setOutput([&](const ShapePipeline::Frame& frame, const Mat&){
+         if(frame.index < lead) return;
+         DetectionFrame f;
+         f.recording = chunk.recording;
+         f.frame = chunk.first + (int)(frame.index - lead);
+         f.timestamp = frame.timestamp;
+         f.detecting = frame.detecting;
+         f.shapes = frame.detecting ? (int32_t)frame.records.size() : 0;
+         frames.push_back(f);
+         DetectionRow row;
+         row.recording = f.recording;
+         row.frame = f.frame;
+         row.timestamp = f.timestamp;
+         for(int32_t i = 0; i < f.shapes; i++){
+            row.shape = frame.records[i];
+            rows.push_back(row);
+         }
+      });
+
+      auto start = chrono::steady_clock::now();
+      for(size_t c = next++; c < chunks.size(); c = next++){
+         chunk = chunks[c];
+         frames.clear();
+         rows.clear();
+         bool ok = runChunk(pipeline, chunk, lead);
+         lock_guard<mutex> guard(lock);
+         results[c].frames.swap(frames);
+         results[c].rows.swap(rows);
+         results[c].failed = !ok;
+         results[c].done = true;
+         chunkDone.notify_all();
+      }
+      busy[worker] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      pipeline.shutdown();
+   }
+
+   bool runChunk(ShapePipeline& pipeline, const Chunk& chunk, uint64_t& lead){
+      RecordingReader reader;
+      if(!reader.open(recordings[chunk.recording])){
+         printf("cannot read %s\n", recordings[chunk.recording].c_str());
+         return false;
+      }
+      pipeline.setLens(reader.getCameraMatrix(), reader.getDistortion());
+      // every stage inline on this thread
+      pipeline.initialize(reader.getSize(), false);
+      // no drawing, nobody sees it
+      pipeline.setMode(2);
+      if(options.plane) pipeline.setPlaneMode(true);
+      else pipeline.detectBackground();
+      pipeline.setPyramidLevels(options.pyramid);
+      if(!options.templates.empty() && !pipeline.loadTemplates(options.templates)){
+         printf("cannot read %s\n", options.templates.c_str());
+         return false;
+      }
+
+      royale::DepthData data;
+      int position = 0;
+      lead = 0;
+      if(chunk.first > 0){
+         lead = ShapePipeline::backgroundFrames;
+         int from = options.plane ? chunk.first - (int)lead : 0;
+         for(; position < from; position++) if(!reader.skip()) return false;
+         for(uint64_t i = 0; i < lead; i++, position++){
+            if(!reader.read(data)) return false;
+            pipeline.ingest(data, true);
+         }
+      }
+      for(; position < chunk.first; position++) if(!reader.skip()) return false;
+      for(int i = 0; i < chunk.count; i++){
+         if(!reader.read(data)) return false;
+         pipeline.ingest(data, true);
+      }
+      pipeline.flush();
+      return true;
+   }
+};
+
+static int usage(){
+   printf("usage: shape_batch [--out file] [--jobs n] [--chunk frames] [--plane] [--pyramid n] [--templates file]\n"
+          "                   <recording.rec> ...\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   Options options;
+   vector<string> recordings;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--plane") options.plane = true;
+      else if(arg == "--out" && value) options.out = argv[++i];
+      else if(arg == "--jobs" && value) options.jobs = atoi(argv[++i]);
+      else if(arg == "--chunk" && value) options.chunk = max(0, atoi(argv[++i]));
+      else if(arg == "--pyramid" && value) options.pyramid = atoi(argv[++i]);
+      else if(arg == "--templates" && value) options.templates = argv[++i];
+      else if(arg.compare(0, 2, "--") == 0) return usage();
+      else recordings.push_back(arg);
+   }
+   if(recordings.empty()) return usage();
+
+   Batch batch(options, recordings);
+   if(!batch.plan()) return 2;
+   DetectionTableWriter table;
+   if(!table.open(options.out, recordings)){
+      printf("cannot write %s\n", options.out.c_str());
+      return 2;
+   }
+   auto start = chrono::steady_clock::now();
+   bool ok = batch.run(table);
+   table.close();
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+   const vector<double>& busy = batch.getBusy();
+   printf("%zu recordings, %d chunks, %ld frames, %llu written, %llu shapes in %.2f s: %.1f frames/s on %zu workers\n",
+          recordings.size(), batch.getChunks(), batch.getFrames(), (unsigned long long)table.getFrames(),
+          (unsigned long long)table.getRows(), seconds,
+          batch.getFrames() / max(seconds, 1e-9), busy.size());
+   for(size_t i = 0; i < busy.size(); i++) printf("   worker %zu busy %.2f s\n", i, busy[i]);
+   if(!ok) printf("some chunks failed, %s is incomplete\n", options.out.c_str());
+   return ok ? 0 : 1;
+}
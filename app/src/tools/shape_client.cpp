@@ -0,0 +1,132 @@
+// Reads what shape_daemon publishes: a line per frame with its shapes, or
+// with --quiet only, every second, the frames received, the frames missed
+// and the latency from the daemon's send to the receive here. With --ring
+// it reads the shared-memory ring in place instead of the socket, sleeping
+// on its futex between frames.
+//
+//    shape_client [path] [--ring file] [--quiet] [--frames n]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "ResultRing.h"
+#include "ResultStream.h"
+#include "Shape.h"
+
+using namespace std;
+
+static int64_t nowNs(){
+   return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Prints the frames, or their counts and latencies every second
+class Report {
+public:
+   explicit Report(bool quiet) : quiet(quiet), reported(nowNs()){
+   }
+
+   void frame(uint64_t index, int64_t timestamp, const ShapeRecord* records, uint32_t count, int64_t published,
+              uint64_t missedBefore){
+      int64_t latency = nowNs() - published;
+      missed += missedBefore;
+      latencies.push_back(latency);
+      if(!quiet){
+         printf("frame %llu t=%lld us, %u shapes, %.3f ms\n", (unsigned long long)index, (long long)timestamp, count,
+                latency * 1e-6);
+         for(uint32_t i = 0; i < count; i++){
+            const ShapeRecord& r = records[i];
+            string type3D = unpackType(r.type3D);
+            printf("   %s/%s at (%d,%d) area %d\n", unpackType(r.type).c_str(), type3D.empty() ? "-" : type3D.c_str(),
+                   r.x, r.y, r.area);
+         }
+      }
+      if(quiet && nowNs() - reported >= 1000000000){
+         sort(latencies.begin(), latencies.end());
+         printf("%zu frames, %llu missed, latency median %.3f ms, max %.3f ms\n", latencies.size(),
+                (unsigned long long)missed, latencies[latencies.size() / 2] * 1e-6, latencies.back() * 1e-6);
+         fflush(stdout);
+         latencies.clear();
+         missed = 0;
+         reported = nowNs();
+      }
+   }
+
+private:
+   bool quiet;
+   int64_t reported;
+   vector<int64_t> latencies;
+   uint64_t missed = 0;
+};
+
+static int readSocket(const string& path, long frames, Report& report){
+   ResultClient client;
+   if(!client.connect(path)){
+      printf("cannot connect to %s\n", path.c_str());
+      return 1;
+   }
+   ResultHeader header;
+   vector<ShapeRecord> records;
+   uint64_t expected = 0;
+   for(long received = 0; (frames < 0 || received < frames) && client.read(header, records); received++){
+      uint64_t missed = received > 0 && header.index > expected ? header.index - expected : 0;
+      expected = header.index + 1;
+      report.frame(header.index, header.timestamp, records.empty() ? NULL : &records[0], header.count,
+                   header.published, missed);
+   }
+   return 0;
+}
+
+static int readRing(const string& path, long frames, Report& report){
+   ResultRingReader reader;
+   if(!reader.open(path)){
+      printf("cannot open the ring %s\n", path.c_str());
+      return 1;
+   }
+   // from the next frame on
+   uint64_t sequence = reader.getPublished();
+   long received = 0;
+   vector<ShapeRecord> records;
+   while(frames < 0 || received < frames){
+      ResultRingView view;
+      if(!reader.next(sequence, view)){
+         // nothing new for a second: the daemon may be gone
+         if(!reader.wait(sequence, 1000) && reader.getPublished() <= sequence) return 0;
+         continue;
+      }
+      const ResultRingSlot& slot = *view.slot;
+      uint64_t index = slot.index;
+      int64_t timestamp = slot.timestamp, published = slot.published;
+      uint32_t count = min(slot.count, (uint32_t)maxResultShapes);
+      records.assign(view.records, view.records + count);
+      // the writer came round while this was read; the next view is past it
+      // and counts it as missed
+      if(!reader.intact(view)) continue;
+      report.frame(index, timestamp, records.empty() ? NULL : &records[0], count, published,
+                   view.sequence - sequence - 1);
+      sequence = view.sequence;
+      received++;
+   }
+   return 0;
+}
+
+int main(int argc, char** argv){
+   string path = "/tmp/shape_daemon.sock";
+   string ring;
+   bool quiet = false;
+   long frames = -1;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      if(arg == "--quiet") quiet = true;
+      else if(arg == "--frames" && i + 1 < argc) frames = atol(argv[++i]);
+      else if(arg == "--ring" && i + 1 < argc) ring = argv[++i];
+      else if(arg.compare(0, 2, "--") == 0){
+         printf("usage: shape_client [path] [--ring file] [--quiet] [--frames n]\n");
+         return 2;
+      }
+      else path = arg;
+   }
+
+   Report report(quiet);
+   return ring.empty() ? readSocket(path, frames, report) : readRing(ring, frames, report);
+}
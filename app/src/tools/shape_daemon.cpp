@@ -0,0 +1,347 @@
+// Headless detection, for a ToF camera on an embedded Linux box where the
+// app and its JNI layer do not apply: the listener's ShapePipeline, fed from
+// a recording replayed at its own pace or from a producer process over a
+// Unix socket or shared memory (DepthExchange.h), publishing the shapes of
+// every frame over a Unix socket (ResultStream.h) and, if asked, into a
+// shared-memory ring (ResultRing.h).
+//
+//    shape_daemon [options] <--replay file.rec | --socket path | --shm name>
+//
+//    --results path    result socket (/tmp/shape_daemon.sock)
+//    --ring file       result ring as well, e.g. /dev/shm/shape_results
+//    --ring-mask       with the detection mask of every frame in the ring
+//    --loop            replay: start over at the end instead of exiting
+//    --rate fps        replay: this rate instead of the recorded times, 0 for
+//                      as fast as the pipeline takes frames
+//    --plane           table plane mode instead of the background capture
+//    --pyramid n       pyramid levels (0)
+//    --templates file  shape templates
+//    --stats s         stage times and latencies every s seconds (10), 0 never
+//
+// The first frames of every source are taken as the empty table, and a
+// producer that comes back, over the socket or in shared memory, restarts
+// the pipeline. Latency is from ingest to the send of the frame's message.
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include "DepthExchange.h"
+#include "DepthRecording.h"
+#include "Log.h"
+#include "ResultRing.h"
+#include "ResultStream.h"
+#include "ShapePipeline.h"
+
+using namespace std;
+using namespace cv;
+
+struct Options {
+   string replay, socket, shm;
+   string results = "/tmp/shape_daemon.sock";
+   string ring;
+   bool ringMask = false;
+   bool loop = false;
+   double rate = -1;   // < 0: the recorded times
+   bool plane = false;
+   int pyramid = 0;
+   string templates;
+   double stats = 10;
+};
+
+// Set by the signal thread; the socket source also gets a byte down the
+// stop pipe, as it may be blocked in accept or read
+static atomic<bool> stopping { false };
+static int stopPipe[2] = { -1, -1 };
+
+static int64_t nowNs(){
+   return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Ingest to publish times of the frames since the last report, from the
+// output stage
+class Latencies {
+public:
+   void add(int64_t ns, int clients, uint64_t missed){
+      lock_guard<mutex> guard(lock);
+      if(samples.size() < 100000) samples.push_back(ns);
+      this->clients = clients;
+      this->missed = missed;
+   }
+
+   string report(){
+      vector<int64_t> taken;
+      int n;
+      uint64_t lost;
+      {
+         lock_guard<mutex> guard(lock);
+         taken.swap(samples);
+         n = clients;
+         lost = missed;
+      }
+      char text[160];
+      if(taken.empty()){
+         snprintf(text, sizeof(text), "latency: no frames, %d clients\n", n);
+         return text;
+      }
+      sort(taken.begin(), taken.end());
+      double sum = 0;
+      for(size_t i = 0; i < taken.size(); i++) sum += taken[i];
+      snprintf(text, sizeof(text), "latency: %zu frames, mean %.3f ms, p99 %.3f ms, max %.3f ms; %d clients, "
+               "%llu messages missed\n", taken.size(), sum / taken.size() * 1e-6,
+               taken[taken.size() * 99 / 100] * 1e-6, taken.back() * 1e-6, n, (unsigned long long)lost);
+      return text;
+   }
+
+private:
+   mutex lock;
+   vector<int64_t> samples;
+   int clients = 0;
+   uint64_t missed = 0;
+};
+
+class Daemon {
+public:
+   explicit Daemon(const Options& options) : options(options){
+      pipeline.setOutput([this](const ShapePipeline::Frame& frame, const Mat&) { publish(frame); });
+   }
+
+   bool openResults(){
+      return server.open(options.results);
+   }
+
+   // Restarts the pipeline for a source of this size and lens
+   void start(Size size, const Mat& cameraMatrix, const Mat& distortion){
+      lock_guard<mutex> guard(pipelineLock);
+      pipeline.shutdown();
+      if(!options.ring.empty() && !ring.create(options.ring, size, options.ringMask)){
+         LOGE("Cannot create the result ring %s", options.ring.c_str());
+      }
+      pipeline.setLens(cameraMatrix, distortion);
+      pipeline.initialize(size);
+      offered = 0;
+      // no drawing, there is no screen
+      pipeline.setMode(2);
+      if(options.plane) pipeline.setPlaneMode(true);
+      else pipeline.detectBackground();
+      pipeline.setPyramidLevels(options.pyramid);
+      if(!options.templates.empty()) pipeline.loadTemplates(options.templates);
+      LOGI("Detecting on %dx%d frames.", size.width, size.height);
+   }
+
+   // From the source's thread; wait for recordings, which may be behind
+   void ingest(const royale::DepthData& data, bool wait){
+      ingestedAt[offered % ingestSlots] = nowNs();
+      offered++;
+      pipeline.ingest(data, wait);
+   }
+
+   void finish(){
+      lock_guard<mutex> guard(pipelineLock);
+      pipeline.flush();
+      pipeline.shutdown();
+   }
+
+   // Every stats interval until stopping, on its own thread
+   void reportLoop(){
+      unique_lock<mutex> guard(reportLock);
+      while(!stopping){
+         reportWake.wait_for(guard, chrono::milliseconds((int64_t)(options.stats * 1000)));
+         if(stopping) break;
+         string stats;
+         {
+            lock_guard<mutex> pipelineGuard(pipelineLock);
+            stats = pipeline.getStats();
+         }
+         printf("%s%s", stats.c_str(), latencies.report().c_str());
+         fflush(stdout);
+      }
+   }
+
+   // After setting stopping
+   void wakeReports(){
+      lock_guard<mutex> guard(reportLock);
+      reportWake.notify_all();
+   }
+
+private:
+   // more than the frames in flight
+   static const int ingestSlots = 64;
+
+   Options options;
+   ShapePipeline pipeline;
+   // start and finish rebuild the stages under the stats report
+   mutex pipelineLock;
+   ResultServer server;
+   ResultRingWriter ring;
+   uint64_t offered = 0;
+   atomic<int64_t> ingestedAt[ingestSlots];
+   Latencies latencies;
+   vector<ShapeRecord> none;
+   mutex reportLock;
+   condition_variable reportWake;
+
+   void publish(const ShapePipeline::Frame& frame){
+      ring.publish(frame.index, frame.timestamp, frame.detecting, frame.records, &frame.mask);
+      ResultHeader header;
+      header.index = frame.index;
+      header.timestamp = frame.timestamp;
+      header.ingested = ingestedAt[frame.index % ingestSlots].load();
+      header.detecting = frame.detecting;
+      server.publish(header, frame.detecting ? frame.records : none);
+      latencies.add(header.published - header.ingested, server.getClients(), server.getMissed());
+   }
+};
+
+static void replay(Daemon& daemon, const Options& options){
+   RecordingReader reader;
+   if(!reader.open(options.replay)){
+      LOGE("Cannot read %s", options.replay.c_str());
+      return;
+   }
+   daemon.start(reader.getSize(), reader.getCameraMatrix(), reader.getDistortion());
+   royale::DepthData data;
+   bool paced = options.rate != 0;
+   while(!stopping){
+      auto start = chrono::steady_clock::now();
+      int64_t first = -1;
+      for(int n = 0; !stopping && reader.read(data); n++){
+         if(first < 0) first = data.timeStamp.count();
+         if(paced){
+            int64_t us = options.rate > 0 ? (int64_t)(n * 1e6 / options.rate) : data.timeStamp.count() - first;
+            this_thread::sleep_until(start + chrono::microseconds(us));
+         }
+         daemon.ingest(data, !paced);
+      }
+      if(!options.loop) break;
+      reader.rewind();
+   }
+}
+
+static void streamSocket(Daemon& daemon, const Options& options){
+   DepthStreamReader reader;
+   reader.setInterrupt(stopPipe[0]);
+   if(!reader.listen(options.socket)){
+      LOGE("Cannot listen on %s", options.socket.c_str());
+      return;
+   }
+   royale::DepthData data;
+   while(!stopping){
+      if(!reader.accept()) continue;
+      LOGI("Producer connected.");
+      daemon.start(reader.getSize(), reader.getCameraMatrix(), reader.getDistortion());
+      while(!stopping && reader.read(data)) daemon.ingest(data, false);
+      LOGI("Producer gone.");
+   }
+}
+
+static void sharedMemory(Daemon& daemon, const Options& options){
+   DepthShmReader reader;
+   royale::DepthData data;
+   uint64_t skipped = 0;
+   while(!stopping){
+      if(!reader.open(options.shm)){
+         this_thread::sleep_for(chrono::milliseconds(100));
+         continue;
+      }
+      LOGI("Producer connected.");
+      daemon.start(reader.getSize(), reader.getCameraMatrix(), reader.getDistortion());
+      auto lastFrame = chrono::steady_clock::now();
+      while(!stopping){
+         // a frame comes every 20 ms or so; 50 us of polling adds little to it
+         if(reader.read(data)){
+            daemon.ingest(data, false);
+            lastFrame = chrono::steady_clock::now();
+            continue;
+         }
+         // a restarted producer maps a new segment under the same name
+         if(chrono::steady_clock::now() - lastFrame > chrono::milliseconds(200)){
+            if(reader.stale()) break;
+            lastFrame = chrono::steady_clock::now();
+         }
+         this_thread::sleep_for(chrono::microseconds(50));
+      }
+      skipped += reader.getSkipped();
+      reader.close();
+      if(!stopping) LOGI("Producer gone.");
+   }
+   LOGI("%llu frames skipped in shared memory.", (unsigned long long)skipped);
+}
+
+static int usage(){
+   printf("usage: shape_daemon [--results path] [--ring file] [--ring-mask] [--loop] [--rate fps] [--plane]\n"
+          "                    [--pyramid n] [--templates file] [--stats s]\n"
+          "                    <--replay file.rec | --socket path | --shm name>\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   Options options;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--loop") options.loop = true;
+      else if(arg == "--plane") options.plane = true;
+      else if(arg == "--replay" && value) options.replay = argv[++i];
+      else if(arg == "--socket" && value) options.socket = argv[++i];
+      else if(arg == "--shm" && value) options.shm = argv[++i];
+      else if(arg == "--results" && value) options.results = argv[++i];
+      else if(arg == "--ring" && value) options.ring = argv[++i];
+      else if(arg == "--ring-mask") options.ringMask = true;
+      else if(arg == "--rate" && value) options.rate = atof(argv[++i]);
+      else if(arg == "--pyramid" && value) options.pyramid = atoi(argv[++i]);
+      else if(arg == "--templates" && value) options.templates = argv[++i];
+      else if(arg == "--stats" && value) options.stats = atof(argv[++i]);
+      else return usage();
+   }
+   if(options.replay.empty() + options.socket.empty() + options.shm.empty() != 2) return usage();
+
+   // SIGINT and SIGTERM are blocked before any thread starts, so every
+   // thread inherits the mask and only the signal thread takes them
+   sigset_t signals;
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGINT);
+   sigaddset(&signals, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &signals, NULL);
+   signal(SIGPIPE, SIG_IGN);
+   if(pipe(stopPipe) != 0){
+      LOGE("Cannot create the stop pipe");
+      return 1;
+   }
+
+   Daemon daemon(options);
+   if(!daemon.openResults()){
+      LOGE("Cannot listen on %s", options.results.c_str());
+      return 1;
+   }
+   thread signalThread([&daemon, &signals]{
+      int taken = 0;
+      sigwait(&signals, &taken);
+      stopping = true;
+      char byte = 0;
+      if(write(stopPipe[1], &byte, 1) != 1) LOGE("Cannot write the stop pipe");
+      daemon.wakeReports();
+   });
+   thread reports;
+   if(options.stats > 0) reports = thread(&Daemon::reportLoop, &daemon);
+
+   if(!options.replay.empty()) replay(daemon, options);
+   else if(!options.socket.empty()) streamSocket(daemon, options);
+   else sharedMemory(daemon, options);
+   daemon.finish();
+
+   stopping = true;
+   daemon.wakeReports();
+   if(reports.joinable()) reports.join();
+   // the source ended on its own: the signal thread still waits
+   pthread_kill(signalThread.native_handle(), SIGTERM);
+   signalThread.join();
+   return 0;
+}
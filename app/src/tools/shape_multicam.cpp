@@ -0,0 +1,183 @@
+// Replays recordings as the cameras around one table, the way the app runs
+// several cameras: every recording is fed at its recorded pace by a thread
+// of its own to a threaded ShapePipeline of its own, and the shapes of all
+// of them are merged in the table frame by ShapeFusion. Prints the fused
+// shapes of every round, or with --quiet only a summary at the end.
+//
+//    shape_multicam [options] <camera0.rec> <camera1.rec> ...
+//
+//    --poses file   camera to table transforms, a line of 12 numbers per
+//                   camera: the 3x4 matrix row by row [mm]; identity when
+//                   not given, # starts a comment
+//    --cpus         every pipeline on its own group of cpus
+//    --plane        table plane mode instead of the background capture
+//    --merge mm     distance on the table within which shapes merge (40)
+//    --quiet        only the summary
+//
+// A pipeline that falls behind holds up its recording instead of dropping
+// frames, so every frame of every recording is fused.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "CpuTopology.h"
+#include "DepthRecording.h"
+#include "ShapeFusion.h"
+#include "ShapePipeline.h"
+
+using namespace std;
+using namespace cv;
+
+struct Options {
+   string poses;
+   bool cpus = false;
+   bool plane = false;
+   float merge = 40;
+   bool quiet = false;
+};
+
+// One camera to table transform per line
+static bool readPoses(const string& path, vector<Mat>& poses){
+   ifstream file(path.c_str());
+   if(!file) return false;
+   string line;
+   while(getline(file, line)){
+      line = line.substr(0, line.find('#'));
+      istringstream values(line);
+      Mat1d pose(3, 4);
+      int n = 0;
+      for(double v; n < 12 && values >> v; n++) pose(n / 4, n % 4) = v;
+      if(n == 0) continue;
+      if(n < 12) return false;
+      poses.push_back(pose);
+   }
+   return true;
+}
+
+// Feeds one recording to its pipeline; false when it cannot be read
+static bool replay(RecordingReader& reader, ShapePipeline& pipeline, chrono::steady_clock::time_point start,
+                   long& frames){
+   royale::DepthData data;
+   int64_t first = -1;
+   while(reader.read(data)){
+      if(first < 0) first = data.timeStamp.count();
+      this_thread::sleep_until(start + chrono::microseconds(data.timeStamp.count() - first));
+      pipeline.ingest(data, true);
+      frames++;
+   }
+   pipeline.flush();
+   return frames > 0;
+}
+
+static int usage(){
+   printf("usage: shape_multicam [--poses file] [--cpus] [--plane] [--merge mm] [--quiet] <camera0.rec> ...\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   Options options;
+   vector<string> recordings;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--cpus") options.cpus = true;
+      else if(arg == "--plane") options.plane = true;
+      else if(arg == "--quiet") options.quiet = true;
+      else if(arg == "--poses" && value) options.poses = argv[++i];
+      else if(arg == "--merge" && value) options.merge = (float)atof(argv[++i]);
+      else if(arg.compare(0, 2, "--") == 0) return usage();
+      else recordings.push_back(arg);
+   }
+   int n = (int)recordings.size();
+   if(n == 0 || n > 32) return usage();
+
+   vector<Mat> poses;
+   if(!options.poses.empty() && !readPoses(options.poses, poses)){
+      printf("cannot read the poses in %s\n", options.poses.c_str());
+      return 2;
+   }
+   if(!poses.empty() && (int)poses.size() < n){
+      printf("%s has %zu poses for %d cameras\n", options.poses.c_str(), poses.size(), n);
+      return 2;
+   }
+
+   ShapeFusion fusion;
+   fusion.mergeDistance = options.merge;
+   fusion.setCameras(n);
+   for(size_t c = 0; c < poses.size() && (int)c < n; c++) fusion.setPose((int)c, poses[c]);
+   // shapes by the number of views merged into them
+   vector<uint64_t> byViews(n + 1, 0);
+   fusion.setOutput([&](const ShapeFusion::Frame& frame){
+      for(size_t i = 0; i < frame.records.size(); i++) byViews[min(frame.records[i].views, n)]++;
+      if(options.quiet) return;
+      printf("round %llu cameras %x, %zu shapes\n", (unsigned long long)frame.index, frame.cameras,
+             frame.records.size());
+      for(size_t i = 0; i < frame.records.size(); i++){
+         const FusedRecord& r = frame.records[i];
+         string type3D = unpackType(r.type3D);
+         printf("   %s/%s at (%d,%d,%d) mm, %dx%d mm, %d views, cameras %x\n", unpackType(r.type).c_str(),
+                type3D.empty() ? "-" : type3D.c_str(), r.x, r.y, r.z, r.sizeMajor, r.sizeMinor, r.views, r.cameras);
+      }
+   });
+
+   vector<RecordingReader> readers(n);
+   for(int c = 0; c < n; c++){
+      if(!readers[c].open(recordings[c])){
+         printf("cannot read %s\n", recordings[c].c_str());
+         return 2;
+      }
+   }
+   vector<vector<int> > groups = cpuGroups(options.cpus ? n : 1);
+   vector<unique_ptr<ShapePipeline> > pipelines;
+   for(int c = 0; c < n; c++){
+      ShapePipeline* pipeline = new ShapePipeline();
+      pipelines.push_back(unique_ptr<ShapePipeline>(pipeline));
+      pipeline->setOutput([&fusion, c](const ShapePipeline::Frame& frame, const Mat&){
+         fusion.submit(c, frame.detecting, frame.records);
+      });
+      pipeline->setLens(readers[c].getCameraMatrix(), readers[c].getDistortion());
+      if(options.cpus) pipeline->setCpus(groups[c % groups.size()]);
+      pipeline->initialize(readers[c].getSize());
+      // no drawing, nobody sees it
+      pipeline->setMode(2);
+      if(options.plane) pipeline->setPlaneMode(true);
+      else pipeline->detectBackground();
+   }
+   if(options.cpus){
+      for(int c = 0; c < n; c++){
+         const vector<int>& cpus = groups[c % groups.size()];
+         printf("camera %d on cpus", c);
+         for(size_t i = 0; i < cpus.size(); i++) printf(" %d", cpus[i]);
+         printf("\n");
+      }
+   }
+
+   auto start = chrono::steady_clock::now();
+   vector<long> frames(n, 0);
+   vector<char> ok(n, 0);
+   vector<thread> cameras;
+   for(int c = 0; c < n; c++){
+      cameras.push_back(thread([&, c]{
+         if(options.cpus) pinThread(groups[c % groups.size()]);
+         ok[c] = replay(readers[c], *pipelines[c], start, frames[c]);
+      }));
+   }
+   for(int c = 0; c < n; c++) cameras[c].join();
+   for(int c = 0; c < n; c++) pipelines[c]->shutdown();
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+   uint64_t shapes = 0;
+   for(int v = 0; v <= n; v++) shapes += byViews[v];
+   printf("%d cameras, %llu rounds in %.2f s, %llu fused shapes, %llu without a 3D position\n", n,
+          (unsigned long long)fusion.getRounds(), seconds, (unsigned long long)shapes,
+          (unsigned long long)fusion.getUnplaced());
+   for(int v = 1; v <= n; v++){
+      printf("   from %d view%s: %llu\n", v, v > 1 ? "s" : "", (unsigned long long)byViews[v]);
+   }
+   for(int c = 0; c < n; c++) printf("   camera %d: %ld frames of %s\n", c, frames[c], recordings[c].c_str());
+   for(int c = 0; c < n; c++) if(!ok[c]) return 1;
+   return 0;
+}
@@ -0,0 +1,428 @@
+// Accuracy and speed regressions of the detection. Every corpus is replayed
+// through ShapePipeline, one frame at a time, and the shapes of every frame
+// are compared with the golden shapes stored for it: same type and 3D type,
+// center within a few pixels, area within a share, the same number of
+// vertices. The mean time per frame of every stage is compared with a
+// baseline of the same machine. Exits with 1 on any difference beyond the
+// tolerances, so it can gate changes to the kernels and to Shape.
+//
+//    shape_regress [options] <recording.rec | synthetic:frames:seed> ...
+//
+//    --golden dir      golden shapes, <dir>/<corpus>.golden (default golden)
+//    --update          write the golden shapes and the timing baseline
+//    --timings file    timing baseline; no timing check without it
+//    --slowdown share  allowed slowdown of a stage and of the total (0.15)
+//    --repeat n        timed passes, the fastest counts (3)
+//    --center px       center tolerance (1.5)
+//    --area share      area tolerance (0.05)
+//    --vertices n      vertex count tolerance (0)
+//    --plane           table plane mode instead of the background capture
+//    --pyramid n       pyramid levels (0)
+//    --trace file      Chrome JSON trace of the stages, of the last frames
+//    --alloc-check     abort when a steady frame allocates; needs
+//                      SHAPE_ALLOC_TRACKING, which prints the allocations
+//                      per stage in any case
+//
+// A corpus starts with frames of the empty table, as gen_scenes writes them;
+// the first backgroundFrames of them become the background. synthetic:N:S
+// renders N frames of seed S like gen_scenes does, without a file.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "DepthRecording.h"
+#include "SceneGenerator.h"
+#include "AllocTracker.h"
+#include "ShapePipeline.h"
+#include "TraceRecorder.h"
+
+using namespace std;
+using namespace cv;
+
+struct Options {
+   string golden = "golden";
+   bool update = false;
+   string timings;
+   double slowdown = 0.15;
+   int repeat = 3;
+   double center = 1.5;
+   double area = 0.05;
+   int vertices = 0;
+   bool plane = false;
+   int pyramid = 0;
+   string trace;
+   bool allocCheck = false;
+};
+
+// Stage times below this differ by noise only [ms]
+static const double timingFloorMs = 0.05;
+// Differences printed per corpus
+static const int maxReported = 10;
+
+// Frames of a recording, or rendered on the fly
+class Corpus {
+public:
+   bool open(const string& spec){
+      name = spec;
+      size_t slash = name.find_last_of('/');
+      if(slash != string::npos) name = name.substr(slash + 1);
+      if(spec.compare(0, 10, "synthetic:") == 0){
+         for(size_t i = 0; i < name.size(); i++) if(name[i] == ':') name[i] = '-';
+         frames = 0;
+         seed = 1;
+         if(sscanf(spec.c_str() + 10, "%d:%llu", &frames, (unsigned long long*)&seed) < 1 || frames <= 0) return false;
+         generator.reset(new SceneGenerator());
+         rewind();
+         return true;
+      }
+      return reader.open(spec);
+   }
+
+   const string& getName() const { return name; }
+   Size getSize() const { return generator ? generator->getParams().size : reader.getSize(); }
+   const Mat& getCameraMatrix() const { return generator ? generator->getCameraMatrix() : reader.getCameraMatrix(); }
+   const Mat& getDistortion() const { return generator ? generator->getDistortion() : reader.getDistortion(); }
+
+   void rewind(){
+      if(!generator){
+         reader.rewind();
+         return;
+      }
+      next = 0;
+      rng = RNG(seed);
+      generator->randomScene(rng, table);
+      table.objects.clear();
+      current = table;
+   }
+
+   // Same scene sequence and seeds as gen_scenes
+   bool read(royale::DepthData& data){
+      if(!generator) return reader.read(data);
+      if(next >= frames) return false;
+      if(next >= backgroundFrames && (next - backgroundFrames) % holdFrames == 0){
+         generator->randomObjects(rng, current);
+      }
+      data.timeStamp = chrono::microseconds((int64_t)next * 1000000 / 45);
+      generator->render(next < backgroundFrames ? table : current, seed * 1000003 + next, data);
+      next++;
+      return true;
+   }
+
+private:
+   static const int backgroundFrames = 20;
+   static const int holdFrames = 10;
+
+   string name;
+   RecordingReader reader;
+   unique_ptr<SceneGenerator> generator;
+   int frames = 0, next = 0;
+   uint64_t seed = 1;
+   RNG rng;
+   Scene table, current;
+};
+
+// Shapes of the detecting frames, by frame index
+typedef map<uint64_t, vector<ShapeRecord> > Shapes;
+
+// Stage name and mean time per frame [ms], in pipeline order
+typedef vector<pair<string, double> > Timings;
+
+static bool writeGolden(const string& path, const string& name, const Shapes& shapes){
+   ofstream file(path.c_str());
+   if(!file.is_open()) return false;
+   file << "# shape_regress golden shapes of " << name << "\n";
+   file << "# frame count, then type type3D x y area vertices per shape\n";
+   for(Shapes::const_iterator it = shapes.begin(); it != shapes.end(); ++it){
+      file << it->first << " " << it->second.size() << "\n";
+      for(size_t i = 0; i < it->second.size(); i++){
+         const ShapeRecord& r = it->second[i];
+         string type3D = unpackType(r.type3D);
+         file << "   " << unpackType(r.type) << " " << (type3D.empty() ? "-" : type3D) << " " << r.x << " "
+              << r.y << " " << r.area << " " << r.vertices << "\n";
+      }
+   }
+   return file.good();
+}
+
+static bool readGolden(const string& path, Shapes& shapes){
+   ifstream file(path.c_str());
+   if(!file.is_open()) return false;
+   shapes.clear();
+   string line;
+   vector<ShapeRecord>* frame = NULL;
+   map<uint64_t, size_t> counts;
+   while(getline(file, line)){
+      if(line.empty() || line[0] == '#') continue;
+      istringstream in(line);
+      if(line[0] != ' '){
+         uint64_t index;
+         size_t count;
+         if(!(in >> index >> count)) return false;
+         frame = &shapes[index];
+         counts[index] = count;
+         continue;
+      }
+      string type, type3D;
+      ShapeRecord r;
+      if(!frame || !(in >> type >> type3D >> r.x >> r.y >> r.area >> r.vertices)) return false;
+      r.type = packType(type);
+      r.type3D = type3D == "-" ? 0 : packType(type3D);
+      frame->push_back(r);
+   }
+   // a truncated file
+   for(Shapes::const_iterator it = shapes.begin(); it != shapes.end(); ++it){
+      if(it->second.size() != counts[it->first]) return false;
+   }
+   return true;
+}
+
+static string describe(const ShapeRecord& r){
+   char text[96];
+   string type3D = unpackType(r.type3D);
+   snprintf(text, sizeof(text), "%s/%s at (%d,%d) area %d, %d vertices", unpackType(r.type).c_str(),
+            type3D.empty() ? "-" : type3D.c_str(), r.x, r.y, r.area, r.vertices);
+   return text;
+}
+
+// Pairs every golden shape with the nearest shape of the frame; the
+// differences of one frame, empty when it matches
+static vector<string> compareFrame(const vector<ShapeRecord>& golden, const vector<ShapeRecord>& found,
+                                   const Options& options){
+   vector<string> differences;
+   vector<bool> used(found.size(), false);
+   for(size_t i = 0; i < golden.size(); i++){
+      const ShapeRecord& g = golden[i];
+      int best = -1;
+      double bestDistance = options.center;
+      for(size_t j = 0; j < found.size(); j++){
+         double d = hypot((double)(found[j].x - g.x), (double)(found[j].y - g.y));
+         if(!used[j] && d <= bestDistance){
+            best = (int)j;
+            bestDistance = d;
+         }
+      }
+      if(best < 0){
+         differences.push_back("missing " + describe(g));
+         continue;
+      }
+      used[best] = true;
+      const ShapeRecord& f = found[best];
+      if(f.type != g.type || f.type3D != g.type3D || abs(f.area - g.area) > options.area * g.area ||
+         abs(f.vertices - g.vertices) > options.vertices){
+         differences.push_back(describe(g) + " is now " + describe(f));
+      }
+   }
+   for(size_t j = 0; j < found.size(); j++){
+      if(!used[j]) differences.push_back("extra " + describe(found[j]));
+   }
+   return differences;
+}
+
+// One pass over the corpus; shapes of the detecting frames and the mean
+// time per frame of every stage, ingest being the rest of the total
+static bool replay(Corpus& corpus, const Options& options, Shapes& shapes, Timings& timings){
+   ShapePipeline pipeline;
+   pipeline.setLens(corpus.getCameraMatrix(), corpus.getDistortion());
+   shapes.clear();
+   pipeline.setOutput([&](const ShapePipeline::Frame& frame, const Mat&){
+      ALLOC_UNCHECKED();
+      if(frame.detecting) shapes[frame.index] = frame.records;
+   });
+   // one frame at a time on this thread, so the stage times add up
+   pipeline.initialize(corpus.getSize(), false);
+   if(options.plane) pipeline.setPlaneMode(true);
+   else pipeline.detectBackground();
+   pipeline.setPyramidLevels(options.pyramid);
+   if(options.allocCheck) pipeline.setAllocationCheck(true);
+
+   corpus.rewind();
+   royale::DepthData data;
+   int frames = 0;
+   double totalMs = 0;
+   while(corpus.read(data)){
+      auto start = chrono::steady_clock::now();
+      pipeline.ingest(data, true);
+      totalMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      frames++;
+   }
+   pipeline.flush();
+   if(frames == 0) return false;
+
+   vector<StageExecutor::StageStats> stats;
+   pipeline.getExecutor().getStats(stats);
+   timings.clear();
+   double stagesMs = 0;
+   for(size_t i = 0; i < stats.size(); i++) stagesMs += stats[i].busyMs;
+   timings.push_back(make_pair(string("ingest"), max(0.0, totalMs - stagesMs) / frames));
+   for(size_t i = 0; i < stats.size(); i++) timings.push_back(make_pair(stats[i].name, stats[i].busyMs / frames));
+   timings.push_back(make_pair(string("total"), totalMs / frames));
+   pipeline.shutdown();
+   return true;
+}
+
+static bool readTimings(const string& path, map<string, double>& timings){
+   ifstream file(path.c_str());
+   if(!file.is_open()) return false;
+   string line;
+   while(getline(file, line)){
+      if(line.empty() || line[0] == '#') continue;
+      istringstream in(line);
+      string name;
+      double ms;
+      if(in >> name >> ms) timings[name] += ms;
+   }
+   return true;
+}
+
+static int usage(){
+   printf("usage: shape_regress [--golden dir] [--update] [--timings file] [--slowdown share] [--repeat n]\n"
+          "                     [--center px] [--area share] [--vertices n] [--plane] [--pyramid n] [--trace file]\n"
+          "                     [--alloc-check]\n"
+          "                     <recording.rec | synthetic:frames:seed> ...\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   Options options;
+   vector<string> corpora;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--update") options.update = true;
+      else if(arg == "--plane") options.plane = true;
+      else if(arg == "--alloc-check") options.allocCheck = true;
+      else if(arg == "--golden" && value) options.golden = argv[++i];
+      else if(arg == "--timings" && value) options.timings = argv[++i];
+      else if(arg == "--slowdown" && value) options.slowdown = atof(argv[++i]);
+      else if(arg == "--repeat" && value) options.repeat = max(1, atoi(argv[++i]));
+      else if(arg == "--center" && value) options.center = atof(argv[++i]);
+      else if(arg == "--area" && value) options.area = atof(argv[++i]);
+      else if(arg == "--vertices" && value) options.vertices = atoi(argv[++i]);
+      else if(arg == "--pyramid" && value) options.pyramid = atoi(argv[++i]);
+      else if(arg == "--trace" && value) options.trace = argv[++i];
+      else if(arg.compare(0, 2, "--") == 0) return usage();
+      else corpora.push_back(arg);
+   }
+   if(corpora.empty()) return usage();
+   TraceRecorder::shared().setEnabled(!options.trace.empty());
+#ifndef SHAPE_ALLOC_TRACKING
+   if(options.allocCheck){
+      printf("--alloc-check needs a build with SHAPE_ALLOC_TRACKING\n");
+      return 2;
+   }
+#endif
+
+   bool failed = false;
+   // fastest pass of every corpus, summed over the corpora
+   Timings total;
+   for(size_t c = 0; c < corpora.size(); c++){
+      Corpus corpus;
+      if(!corpus.open(corpora[c])){
+         printf("cannot read %s\n", corpora[c].c_str());
+         return 2;
+      }
+      Shapes shapes;
+      Timings best;
+      for(int pass = 0; pass < options.repeat; pass++){
+         Shapes passShapes;
+         Timings timings;
+         if(!replay(corpus, options, passShapes, timings)){
+            printf("%s has no frames\n", corpus.getName().c_str());
+            return 2;
+         }
+         if(pass == 0){
+            shapes.swap(passShapes);
+            best = timings;
+         }
+         for(size_t i = 0; i < timings.size(); i++) best[i].second = min(best[i].second, timings[i].second);
+      }
+      if(total.empty()) total = best;
+      else for(size_t i = 0; i < best.size(); i++) total[i].second += best[i].second;
+
+      size_t found = 0;
+      for(Shapes::const_iterator it = shapes.begin(); it != shapes.end(); ++it) found += it->second.size();
+      string path = options.golden + "/" + corpus.getName() + ".golden";
+      if(options.update){
+         if(!writeGolden(path, corpus.getName(), shapes)){
+            printf("cannot write %s\n", path.c_str());
+            return 2;
+         }
+         printf("%s: %zu detecting frames, %zu shapes written to %s\n", corpus.getName().c_str(), shapes.size(),
+                found, path.c_str());
+         continue;
+      }
+
+      Shapes golden;
+      if(!readGolden(path, golden)){
+         printf("cannot read %s\n", path.c_str());
+         return 2;
+      }
+      int differentFrames = 0, reported = 0;
+      vector<ShapeRecord> none;
+      // every frame detecting in either run
+      Shapes all = golden;
+      all.insert(shapes.begin(), shapes.end());
+      for(Shapes::const_iterator it = all.begin(); it != all.end(); ++it){
+         Shapes::const_iterator g = golden.find(it->first), f = shapes.find(it->first);
+         vector<string> differences;
+         if(g == golden.end()) differences.push_back("detecting, golden frame is not");
+         else if(f == shapes.end()) differences.push_back("not detecting, golden frame is");
+         else differences = compareFrame(g->second, f->second, options);
+         if(differences.empty()) continue;
+         differentFrames++;
+         for(size_t i = 0; i < differences.size() && reported < maxReported; i++, reported++){
+            printf("%s frame %llu: %s\n", corpus.getName().c_str(), (unsigned long long)it->first,
+                   differences[i].c_str());
+         }
+      }
+      printf("%s: %zu detecting frames, %zu shapes, %d frames differ\n", corpus.getName().c_str(),
+             shapes.size(), found, differentFrames);
+      if(differentFrames > 0) failed = true;
+   }
+
+   printf("\n%-10s %10s %10s %8s\n", "stage", "ms/frame", "baseline", "change");
+   if(options.update && !options.timings.empty()){
+      ofstream file(options.timings.c_str());
+      file << "# shape_regress stage timings [ms/frame], fastest of " << options.repeat << " passes\n";
+      for(size_t i = 0; i < total.size(); i++) file << total[i].first << " " << total[i].second << "\n";
+      if(!file.good()){
+         printf("cannot write %s\n", options.timings.c_str());
+         return 2;
+      }
+   }
+   map<string, double> baseline;
+   bool checkTimings = !options.update && !options.timings.empty();
+   if(checkTimings && !readTimings(options.timings, baseline)){
+      printf("cannot read %s\n", options.timings.c_str());
+      return 2;
+   }
+   for(size_t i = 0; i < total.size(); i++){
+      const string& name = total[i].first;
+      double ms = total[i].second;
+      if(!baseline.count(name)){
+         printf("%-10s %10.3f\n", name.c_str(), ms);
+         continue;
+      }
+      double base = baseline[name];
+      bool slower = ms > base * (1 + options.slowdown) && ms - base > timingFloorMs;
+      printf("%-10s %10.3f %10.3f %+7.1f%%%s\n", name.c_str(), ms, base, base > 0 ? 100 * (ms / base - 1) : 0.0,
+             slower ? "  SLOWER" : "");
+      if(slower) failed = true;
+   }
+   if(!total.empty()) printf("%.1f frames/s\n", 1000 / max(total.back().second, 1e-9));
+#ifdef SHAPE_ALLOC_TRACKING
+   printf("\n%s", AllocTracker::shared().report().c_str());
+#endif
+   if(!options.trace.empty() && !TraceRecorder::shared().writeJson(options.trace)){
+      printf("cannot write %s\n", options.trace.c_str());
+      return 2;
+   }
+
+   printf("%s\n", options.update ? "updated" : failed ? "FAILED" : "passed");
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,280 @@
+// Stress test of the control path: while frames stream through a threaded
+// ShapePipeline, several threads post mode, plane mode, pyramid, background
+// and template changes as fast as they can. The output stage checks that
+// every frame arrives once and in order, and that the settings it was
+// processed with are consistent with what it carries. Afterwards the same
+// final settings are posted and a clean pipeline given them from the start
+// must find the same shapes, so no command was lost or half applied. Exits
+// with 1 on any failure.
+//
+//    shape_stress [--threads n] [--frames n] [--seed n]
+//
+//    --threads n   threads posting commands (4)
+//    --frames n    frames streamed while they do (2000)
+//    --seed n      scene seed (1)
+//
+// On a single core the stages run inline on the producer; the commands
+// still race the producer from their own threads.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include "SceneGenerator.h"
+#include "ShapePipeline.h"
+
+using namespace std;
+using namespace cv;
+
+// frames of the empty table, then frames with objects, cycled
+static const int backgroundFrames = ShapePipeline::backgroundFrames;
+static const int objectFrames = 40;
+static const int holdFrames = 10;
+// failures printed
+static const int maxReported = 10;
+
+// What the output stage sees
+class Checker {
+public:
+   explicit Checker(Size size) : size(size){
+   }
+
+   void frame(const ShapePipeline::Frame& frame, const Mat& image){
+      if(frame.index != expected) fail(frame.index, "arrived out of order, expected " + to_string(expected));
+      expected = frame.index + 1;
+      frames++;
+      if(frame.mode != 1 && frame.mode != 2) fail(frame.index, "mode " + to_string(frame.mode));
+      if(frame.mode == 1 && (image.empty() || image.size() != size)) fail(frame.index, "mode 1 without an image");
+      if(frame.mode == 2 && !image.empty()) fail(frame.index, "an image in mode 2");
+      if(frame.status != ShapePipeline::ClickBackground && frame.status != ShapePipeline::DetectingBackground){
+         fail(frame.index, "status " + to_string((int)frame.status));
+      }
+      if(frame.mode == 1) modeCamera++;
+      if(!frame.detecting) return;
+      detecting++;
+      if(frame.mask.rows != size.height || frame.mask.cols != size.width) fail(frame.index, "detecting without a mask");
+      for(size_t i = 0; i < frame.records.size(); i++){
+         const ShapeRecord& r = frame.records[i];
+         if(r.type == 0 || r.left < 0 || r.top < 0 || r.left + r.width > size.width ||
+            r.top + r.height > size.height){
+            fail(frame.index, "shape " + to_string(i) + " out of the frame or without a type");
+         }
+      }
+   }
+
+   void fail(uint64_t index, const string& what){
+      if(failures++ < maxReported) printf("frame %llu: %s\n", (unsigned long long)index, what.c_str());
+   }
+
+   Size size;
+   uint64_t expected = 0;
+   uint64_t frames = 0, detecting = 0, modeCamera = 0;
+   atomic<int> failures { 0 };
+};
+
+// Frames ingested, in order, from one set of rendered frames
+static void stream(ShapePipeline& pipeline, const vector<royale::DepthData>& rendered, int first, int count){
+   for(int i = 0; i < count; i++) pipeline.ingest(rendered[(first + i) % rendered.size()], true);
+}
+
+static bool postUntilTaken(ShapePipeline& pipeline, const ShapePipeline::Command& command){
+   for(int tries = 0; tries < 1000; tries++){
+      if(pipeline.post(command)) return true;
+      this_thread::sleep_for(chrono::milliseconds(1));
+   }
+   return false;
+}
+
+// The settings both pipelines end with, then the empty table and the objects
+static bool finalPass(ShapePipeline& pipeline, const vector<royale::DepthData>& rendered, const string& templates,
+                      vector<vector<ShapeRecord> >& shapes, int& detectingFrames){
+   ShapePipeline::Command command;
+   command.type = ShapePipeline::Command::SetPlaneMode;
+   command.value = 0;
+   bool ok = postUntilTaken(pipeline, command);
+   command.type = ShapePipeline::Command::SetPyramidLevels;
+   ok = ok && postUntilTaken(pipeline, command);
+   command.type = ShapePipeline::Command::SetCrossCheck;
+   ok = ok && postUntilTaken(pipeline, command);
+   command.type = ShapePipeline::Command::SetMode;
+   command.value = 2;
+   ok = ok && postUntilTaken(pipeline, command);
+   shared_ptr<ShapeClassifier> classifier = make_shared<ShapeClassifier>();
+   command.type = ShapePipeline::Command::SetTemplates;
+   command.classifier = classifier;
+   ok = ok && classifier->load(templates) && postUntilTaken(pipeline, command);
+   command = ShapePipeline::Command();
+   command.type = ShapePipeline::Command::DetectBackground;
+   ok = ok && postUntilTaken(pipeline, command);
+   shapes.clear();
+   detectingFrames = 0;
+   stream(pipeline, rendered, 0, (int)rendered.size());
+   pipeline.flush();
+   return ok;
+}
+
+static int usage(){
+   printf("usage: shape_stress [--threads n] [--frames n] [--seed n]\n");
+   return 2;
+}
+
+int main(int argc, char** argv){
+   int threads = 4;
+   int frames = 2000;
+   uint64_t seed = 1;
+   for(int i = 1; i < argc; i++){
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "--threads" && value) threads = max(1, atoi(argv[++i]));
+      else if(arg == "--frames" && value) frames = max(1, atoi(argv[++i]));
+      else if(arg == "--seed" && value) seed = strtoull(argv[++i], NULL, 10);
+      else return usage();
+   }
+
+   // a session as gen_scenes renders it, rendered once and cycled
+   SceneGenerator generator;
+   vector<royale::DepthData> rendered(backgroundFrames + objectFrames);
+   RNG rng(seed);
+   Scene table, current;
+   generator.randomScene(rng, table);
+   table.objects.clear();
+   current = table;
+   for(int i = 0; i < (int)rendered.size(); i++){
+      if(i >= backgroundFrames && (i - backgroundFrames) % holdFrames == 0) generator.randomObjects(rng, current);
+      rendered[i].timeStamp = chrono::microseconds((int64_t)i * 1000000 / 45);
+      generator.render(i < backgroundFrames ? table : current, seed * 1000003 + i, rendered[i]);
+   }
+   Size size = generator.getParams().size;
+
+   // templates for the template commands, here and in the final pass
+   char templates[] = "/tmp/shape_stress_XXXXXX";
+   int fd = mkstemp(templates);
+   if(fd < 0){
+      printf("cannot write a templates file\n");
+      return 2;
+   }
+   close(fd);
+   {
+      ofstream file(templates);
+      file << "TRI 0 0 1 0 0.5 0.866\nSQR 0 0 1 0 1 1 0 1\nRCT 0 0 2 0 2 1 0 1\n";
+   }
+
+   Checker checker(size);
+   vector<vector<ShapeRecord> > stressedShapes, referenceShapes;
+   int stressedDetecting = 0, referenceDetecting = 0;
+   bool collecting = false;
+   ShapePipeline pipeline;
+   pipeline.setLens(generator.getCameraMatrix(), generator.getDistortion());
+   pipeline.setOutput([&](const ShapePipeline::Frame& frame, const Mat& image){
+      checker.frame(frame, image);
+      if(!collecting) return;
+      if(frame.mode != 2) checker.fail(frame.index, "final pass in mode " + to_string(frame.mode));
+      if(!frame.detecting) return;
+      stressedShapes.push_back(frame.records);
+      stressedDetecting++;
+   });
+   pipeline.initialize(size);
+   pipeline.detectBackground();
+
+   // every thread picks a command at random until the frames are through
+   atomic<bool> running { true };
+   atomic<uint64_t> posted { 0 }, dropped { 0 };
+   vector<thread> posters;
+   for(int t = 0; t < threads; t++){
+      posters.push_back(thread([&, t]{
+         RNG random(seed * 7919 + t);
+         while(running.load()){
+            ShapePipeline::Command command;
+            int pick = random.uniform(0, 100);
+            if(pick < 30){
+               command.type = ShapePipeline::Command::SetMode;
+               command.value = random.uniform(1, 3);
+            }
+            else if(pick < 50){
+               command.type = ShapePipeline::Command::SetPlaneMode;
+               command.value = random.uniform(0, 2);
+            }
+            else if(pick < 70){
+               command.type = ShapePipeline::Command::SetPyramidLevels;
+               command.value = random.uniform(0, 3);
+            }
+            // rare enough for captures to finish and frames to detect
+            else if(pick < 71) command.type = ShapePipeline::Command::DetectBackground;
+            else if(pick < 80){
+               // through the public setter, which loads on this thread
+               if(pipeline.loadTemplates(templates)) posted++;
+               else dropped++;
+               continue;
+            }
+            else{
+               command.type = ShapePipeline::Command::SetCrossCheck;
+               command.value = random.uniform(0, 2);
+            }
+            if(pipeline.post(command)) posted++;
+            else dropped++;
+            // bursts, with pauses of a few frames' worth of commands
+            if(random.uniform(0, 8) == 0) this_thread::sleep_for(chrono::microseconds(200));
+         }
+      }));
+   }
+   auto start = chrono::steady_clock::now();
+   stream(pipeline, rendered, 0, frames);
+   running = false;
+   for(size_t t = 0; t < posters.size(); t++) posters[t].join();
+   pipeline.flush();
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+   printf("%llu frames in %.2f s, %llu detecting, %llu in mode 1; %llu commands posted, %llu dropped on a full queue\n",
+          (unsigned long long)checker.frames, seconds, (unsigned long long)checker.detecting,
+          (unsigned long long)checker.modeCamera, (unsigned long long)posted.load(),
+          (unsigned long long)dropped.load());
+   if(checker.frames != (uint64_t)frames) checker.fail(checker.expected, "frames lost: " + to_string(checker.frames));
+   // the next frame applies what the posters left in the queue, which may
+   // be full, so the final settings find room and come last
+   stream(pipeline, rendered, 0, 1);
+   pipeline.flush();
+
+   collecting = true;
+   if(!finalPass(pipeline, rendered, templates, stressedShapes, stressedDetecting)){
+      checker.fail(checker.expected, "final settings not taken");
+   }
+   collecting = false;
+   pipeline.shutdown();
+
+   ShapePipeline reference;
+   reference.setLens(generator.getCameraMatrix(), generator.getDistortion());
+   reference.setOutput([&](const ShapePipeline::Frame& frame, const Mat&){
+      if(!frame.detecting) return;
+      referenceShapes.push_back(frame.records);
+      referenceDetecting++;
+   });
+   reference.initialize(size);
+   finalPass(reference, rendered, templates, referenceShapes, referenceDetecting);
+   reference.shutdown();
+   unlink(templates);
+
+   bool same = stressedShapes.size() == referenceShapes.size();
+   for(size_t f = 0; same && f < stressedShapes.size(); f++){
+      const vector<ShapeRecord>& a = stressedShapes[f];
+      const vector<ShapeRecord>& b = referenceShapes[f];
+      same = a.size() == b.size();
+      for(size_t i = 0; same && i < a.size(); i++){
+         same = a[i].type == b[i].type && a[i].x == b[i].x && a[i].y == b[i].y && a[i].area == b[i].area;
+      }
+   }
+   if(!same || stressedDetecting == 0){
+      checker.fail(checker.expected, "final pass: " + to_string(stressedDetecting) + " detecting frames, " +
+                   to_string(referenceDetecting) + " in the clean pipeline, shapes differ");
+   }
+   printf("final pass: %d detecting frames, same shapes as a clean pipeline: %s\n", stressedDetecting,
+          same ? "yes" : "no");
+   if(checker.failures > 0){
+      printf("FAILED, %d failures\n", checker.failures.load());
+      return 1;
+   }
+   printf("OK\n");
+   return 0;
+}